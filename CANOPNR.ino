@@ -22,46 +22,139 @@
 
 
 #include <SoftwareSerial.h>
-#include <PString.h>
 #include <CANOPNR_MCP2515.h>
+#include <CANOPNR_Telemetry.h>
+#include <CANOPNR_Timebase.h>
+#include <CANOPNR_Batch.h>
+#include <CANOPNR_Slip.h>
+#include <CANOPNR_VehicleSignals.h>
+#include <CANOPNR_AT.h>
+#include <CANOPNR_GPRS.h>
+#include <CANOPNR_SDRing.h>
+#include <CANOPNR_Capture.h>
 #include <MCP2515_defs.h>
 #include <SPI.h>
 #include <SD.h>
 #include <stdio.h>
 
 #define GPSRATE 4800
-#define BUFFSIZ 90 // plenty big
+#define GPS_WAIT_MS 1500 // longest a record waits for the next $GPRMC; the receiver sends one a second
+#define GPS_CHAR_US (10000000UL / GPSRATE) // one character at GPSRATE, start and stop bits included
+#define GPS_RMC_LATENCY_US 150000UL // receiver's delay from the UTC second to the '$' of its RMC; measure once against PPS
+// #define GPS_PPS_PIN 3 // receiver's 1PPS output, on an interrupt pin; without it RMC arrivals set the clock
+#define PPS_TIMEOUT_US 3000000UL // no edge for this long: sync from RMC arrivals instead
+#define HSCAN_CS_PIN 10 // HS-CAN MCP2515 chip select
+#define SD_CS_PIN 9 // SD card chip select on the CAN-BUS shield
+#define CAN_INT_PIN 2 // HS-CAN MCP2515 INT, drains RX buffers into the driver's ring
+#define AUTOBAUD_DWELL_MS 250 // listening time per HS-CAN rate, see HSCAN_BAUDS
+#define AUTOBAUD_RETRY_MS 10000UL // no rate found (bus quiet): listen again this often
+// #define MSCAN_CS_PIN 6 // second MCP2515 on the MS-CAN pair (OBD pins 3 and 11), logged in capture mode only
+#define MSCAN_INT_PIN 3 // its INT; shares pin 3 with GPS_PPS_PIN, so only one of them
+#define MSCAN_BAUD CAN_BAUD_125K
+#define BATCH_RECORDS 6 // loop() cycles per upload; fewer if the buffer fills first
+#define SLIP_WINDOW_MS 1000 // wheel speeds taken after the accelerator frame, before the record closes
+#define SLIP_REF_WHEELS 0 // wheels (bits of 0x513 words) giving the vehicle speed, 0 for the median
+#define OBD_FRESH_SLACK 1000 // ms a PID's value may be older than two of its periods and still be uploaded
+#define BATCH_BUFSIZ 384 // at least TELEMETRY_BATCH_RECORD_MAX, at most SD_RING_PAYLOAD_MAX
+#define UPLOAD_WAIT_MS 5000 // longest a record waits for the batch buffer while an upload holds it
+#define GPRS_APN "web.gci"
+#define GPRS_POWER_PIN A0 // SIM900 power key; move the shield's D9 jumper here, D9 is SD_CS_PIN
+#define STORE_FILE "STORE.BIN" // batches waiting for the uplink, see CANOPNR_SDRing.h
+#define STORE_BLOCKS 1025 // 1024 batches, about 5 hours of driving
+// #define CAPTURE_MODE // log every frame on the bus to CAPTURE_FILE instead of uploading telemetry
+#define CAPTURE_FILE "CAPTURE.BIN" // see CANOPNR_Capture.h, host/capture_dump.cpp converts it
+#define CAPTURE_BLOCKS 65536UL // 32 MB, about 20 minutes at 2000 frames/s
+#define CAPTURE_IDLE_MS 1000 // bus quiet this long: put the partial sector on the card
 
 Sd2Card card;
 SdVolume volume;
 SdFile root;
 SdFile file;
+static_assert(GPRS_POWER_PIN != SD_CS_PIN, "the modem's power key would select the SD card");
+// the globals come to about 3.5 KB (batch, OBD scheduler, slip monitor, CAN
+// rings, modem and SD buffers), about 2.3 KB in CAPTURE_MODE (the capture
+// sectors and the SD cache); either way the sketch needs a Mega 2560's 8 KB
+#if defined(RAMEND) && defined(RAMSTART) && (RAMEND - RAMSTART + 1) < 4096
+#error "CANOPNR needs an ATmega2560 (Arduino Mega); its globals do not fit in an Uno's 2 KB of SRAM"
+#endif
+#ifndef CAPTURE_MODE
 int CONTROLLER_ID = -1; // Defaults to -1
 char conn_str[45] = "AT+CIPSTART=\"TCP\",\"";  //starting empty slot is idx 19
 char buffer[128];  //Data will be temporarily stored to this buffer before being written to the file
-char stringBuffer[700];
-char tempbuff[128];
-PString dataString(stringBuffer, sizeof(stringBuffer)); //string to be sent
-PString tempbuffS(tempbuff, sizeof(tempbuff));
+NMEAPARSER nmea; // fed from pollGPS(), holds the latest fix (see CANOPNR_GPS.h)
+unsigned long rmcCount = 0; // $GPRMC sentences parsed
+unsigned long sentenceMicros; // micros() at which the '$' of the sentence being parsed came in
+TIMEBASE timebase; // micros() to UTC, synced from every valid RMC (see CANOPNR_Timebase.h)
+#if defined(GPS_PPS_PIN) && defined(MSCAN_CS_PIN) && GPS_PPS_PIN == MSCAN_INT_PIN
+#error "GPS_PPS_PIN and MSCAN_INT_PIN are the same pin"
+#endif
+#ifdef GPS_PPS_PIN
+volatile unsigned long ppsMicros; // stamped by ppsISR()
+volatile byte ppsCount = 0;
+byte ppsUsed = 0; // ppsCount of the edge last synced to
+#endif
+TELEMETRY record; // one sample (see CANOPNR_Telemetry.h)
+unsigned long recordMicros; // micros() at record.timestamp, slip events are timed against it
+SLIPMONITOR slip; // every 0x513 frame goes through it (see CANOPNR_Slip.h)
+TELEMETRYBATCH batch; // delta coded records waiting for upload (see CANOPNR_Batch.h)
+uint8_t batchBuf[BATCH_BUFSIZ]; // the batch fills it and goes out from it; one buffer, SRAM is short
+boolean uploadPending = false; // batchBuf is with the modem, no record goes into it
+uint16_t uploadLen;
+boolean batchFull = false; // the last record did not fit, upload early
+boolean uploadStored = false; // the upload is the oldest entry of store
+SDRing store; // batches kept on the card while the uplink is down
+boolean storeReady = false;
+#else
+CaptureLog capture; // two 512-byte sector buffers; nothing of the telemetry above is built
+unsigned long lastFrame = 0;
+#endif
 byte sleepmode = 0x01;
 byte normalmode = 0x00;
 byte listenmode = 0x03;
 
+#ifndef CAPTURE_MODE
 SoftwareSerial canbus =  SoftwareSerial(4, 5); // for GPS
 SoftwareSerial cell(7, 8);
-MCP2515 HSCAN;
-
-char buffidx;
+GPRSLink gprs(cell, GPRS_POWER_PIN); // keeps the TCP session open between uploads
+#endif
+MCP2515 HSCAN(HSCAN_CS_PIN);
+#ifdef MSCAN_CS_PIN
+MCP2515 MSCAN(MSCAN_CS_PIN); // listen-only, never acknowledges or transmits on MS-CAN
+#endif
+CANChannels buses; // HS-CAN is channel 0, MS-CAN channel 1; read oldest frame first
+#ifndef CAPTURE_MODE
+// only these IDs reach the MCU; everything else is dropped by the MCP2515 filters.
+// The first two get RXB0 and its rollover into RXB1, so the busiest IDs go first.
+const unsigned long HSCAN_IDS[] = {ABSCAN, BRAKE_PRESSURE, ACCELERATOR, PID_REPLY};
+#endif
+// rates HS-CAN is tried at, in listen-only mode, most common first
+const int HSCAN_BAUDS[] = {CAN_BAUD_500K, CAN_BAUD_250K, CAN_BAUD_125K, CAN_BAUD_1000K, CAN_BAUD_100K, CAN_BAUD_83K3, CAN_BAUD_50K};
+int hsBaud = 0; // HSCAN_BAUDS entry HS-CAN runs at, 0 while still listening for it
+unsigned long hsRetry; // millis() of the last detection
+#ifndef CAPTURE_MODE
+// uploaded in TELEMETRY_OBD_PIDS order: RPM, speed, coolant, fuel, run time, intake, MAF, O2
+#define OBD_COUNT TELEMETRY_OBD_COUNT
+// ms between requests for each of them; fast-changing signals get the bus time
+const uint16_t OBD_PERIODS[OBD_COUNT] = {100, 200, 10000, 10000, 1000, 5000, 200, 500};
+OBDSCHEDULER obdSched; // polled from drainCAN(), only PIDs the ECU supports (see CANOPNR_OBD.h)
+unsigned long obdMicros[OBD_COUNT]; // micros() the ISR read each PID's latest reply
+#endif
 
 int sleeper = 0;
-int power_to = 0;
-int close_to = 0;
 byte mode;
 
 void setup() {                    // need to change this
   Serial.begin(19200);
-  if (card.init(SPI_HALF_SPEED,9) && volume.init(&card) &&
+  // neither MCP2515 may listen in while the SD card is set up
+  pinMode(HSCAN_CS_PIN, OUTPUT);
+  digitalWrite(HSCAN_CS_PIN, HIGH);
+#ifdef MSCAN_CS_PIN
+  pinMode(MSCAN_CS_PIN, OUTPUT);
+  digitalWrite(MSCAN_CS_PIN, HIGH);
+#endif
+  if (card.init(SPI_HALF_SPEED,SD_CS_PIN) && volume.init(&card) &&
       root.openRoot(&volume) && file.open(root, "config.txt", O_READ)) {
+#ifndef CAPTURE_MODE
     uint8_t i;	
     i=0;
     while (1) {
@@ -93,12 +186,20 @@ void setup() {                    // need to change this
     conn_str[i] = '\0';
     //	  Serial.println(CONTROLLER_ID);
     //	  Serial.println(conn_str);
+#endif
   }    
 
+#ifndef CAPTURE_MODE
+  storeReady = openStore();
   cell.begin(19200);
   canbus.begin(GPSRATE);
-
-  //GPRSPower();
+  nmeaBegin(&nmea);
+  timebaseBegin(&timebase);
+#ifdef GPS_PPS_PIN
+  pinMode(GPS_PPS_PIN, INPUT);
+  attachInterrupt(digitalPinToInterrupt(GPS_PPS_PIN), ppsISR, RISING);
+#endif
+#endif
 
   // Begin the SPI module
   SPI.setClockDivider(SPI_CLOCK_DIV2);
@@ -106,88 +207,73 @@ void setup() {                    // need to change this
   SPI.setBitOrder(MSBFIRST);
   SPI.begin();     
 
-  disableHSCAN();
-
-  int baudRate = 0;
-  if(HSCAN.initCAN(CAN_BAUD_500K)){
-    delay(50);
-    if(!HSCAN.setCANNormalMode()) { 
-      Serial.print("CAN E");
-    }
+  startHSCAN();
+  buses.add(&HSCAN);
+#ifdef MSCAN_CS_PIN
+  if(MSCAN.initCAN(MSCAN_BAUD) && MSCAN.setCANReceiveonlyMode()){
+    MSCAN.enableRxInterrupt(MSCAN_INT_PIN);
+    buses.add(&MSCAN);
+  }
+  else {
+    Serial.print("MS E");
+  }
+#endif
+#ifdef CAPTURE_MODE
+  if(!openCapture()){
+    Serial.print("CAP E");
+  }
+#else
+  slipBegin(&slip, SLIP_THRESHOLD, SLIP_REF_WHEELS);
+  obdSchedBegin(&obdSched); // asks the ECU for its supported PIDs first
+  for(int i = 0; i < OBD_COUNT; i++){
+    obdSchedAdd(&obdSched, TELEMETRY_OBD_PIDS[i], OBD_PERIODS[i]);
   }
-  init_GPRS(); 
+  record.controllerId = CONTROLLER_ID;
+  record.sequence = 0;
+  telemetryBatchBegin(&batch, batchBuf, BATCH_BUFSIZ);
+  gprs.setServer(conn_str);
+  gprs.begin(GPRS_APN); // carried on by gprs.service() from loop()
+#endif
 
 }
 
 
 void loop() {
-loop_start:
-  int timeo4 = 0, timeo3 = 0, timeo2 = 0, timeo1 = 0;
-  enableHSCAN();
-  dataString.begin();
-  tempbuffS.begin();
-
-  CANMSG message;
-  message.adrsValue = 0x001;
-start_check:
-  cell.println(conn_str); //Open a connection to server
-  if(cell_wait_for_bytes(12,100) == 0)//what happens if timeouts occur, do we try again?
-  {  
-    if(power_to > 1){//timed out 2 times, assuming GPRS is off
-      power_to = 0; 
-      init_GPRS(); //initialize GPRS
-      goto loop_start; //reloop
-    }
-    Serial.println("T1");
-    cell.println("AT+CIPSHUT"); //Close the GPRS Connection    
-    delay(100);
-    power_to++;
-    goto loop_start;
-  }
-  else
-  {
-    power_to = 0; //clear power timeout, message was received
-    while(cell.available()!=0)
-    {
-      tempbuffS.print((unsigned char)cell.read());
-    }
-    if(strstr(tempbuffS,"ERROR") != NULL || strstr(tempbuffS,"FAIL") != NULL){//if ERROR exists in tempbuffS
-      Serial.println("E1");
-      timeo1 += 1; //timeout counter for error 1
-      tempbuffS.begin(); //clear tempbuffS
-      cell.println("AT+CIPSHUT"); //Close the GPRS Connection
-      if(cell_wait_for_bytes(4,100) == 0){ 
-        init_GPRS();//didnt need to reinit_GPRS even when errored, just relooped
-        Serial.println("ET1");
-      }
-      if(timeo1 > 4){
-        init_GPRS(); 
-        timeo1 = 0;
-      }
-      Serial.print("1:");
-      Serial.println(timeo1);
-      goto start_check;
-    }
-    else{
-      tempbuffS.begin();
+  if(hsBaud == 0 && millis() - hsRetry >= AUTOBAUD_RETRY_MS){
+    startHSCAN();
+  }
+#ifdef CAPTURE_MODE
+  captureFrames(); // no telemetry and no modem while capturing
+#else
+  unsigned long waitStart, lastFix;
+
+  uplink();
+  record.timestamp = millis();
+  recordMicros = micros();
+  record.present = 0;
+  // one record per fix: wait for the next RMC, but not forever if the receiver is silent
+  lastFix = rmcCount;
+  waitStart = millis();
+  while(rmcCount == lastFix && millis() - waitStart < GPS_WAIT_MS){
+    pollGPS();
+    drainCAN();
+    uplink();
+  }
+  if(rmcCount != lastFix){
+    record.gps = nmea.fix;
+    if(record.gps.valid){
+      bitSet(record.present, TELEMETRY_HAS_GPS);
     }
-  } 
-  dataString.print(CONTROLLER_ID);
-  while(strncmp(tempbuffS, "$GPRMC",6) != 0){ //while GPRS does not find GPRMC and a location, it will loop in here
-    //strncmp != 0 if not found
-    //strchr = NULL if not found
-    readline(); //grabs GPS DATA stores to gpsbuffer
-  }
-  dataString.print(tempbuffS);
-  dataString.print("|"); 
-  //  dataString.print("0");
+  }
 sleep_check:
-  if(HSCAN.getMSG(&message,100,ACCELERATOR)){ //the the code is stuck in the while loop inside ACCELERATOR
-    dataString.print(message.data[4],DEC); //prints the message
-    //    Serial.print("Current CANSTAT: ");
-    //    Serial.println(HSCAN.readReg(CANSTAT),HEX);
-  } 
-  else{
+  // frames keep going to the slip monitor while the accelerator is awaited
+  waitStart = millis();
+  while(!bitRead(record.present, TELEMETRY_HAS_ACCEL) && millis() - waitStart < 800){
+    pollGPS();
+    drainCAN();
+    uplink(); // the modem moves along in between, never for long
+  }
+  if(!bitRead(record.present, TELEMETRY_HAS_ACCEL)){
     sleeper++;
     //    Serial.print("Sleep: ");
     //    Serial.println(sleeper);
@@ -200,360 +286,370 @@ sleep_check:
       //       Serial.println(HSCAN.readReg(CANSTAT), HEX);
       //if asleep, need to stay in here
       //Serial.println("SP");
-      cell.println("AT+CIPSHUT"); //shutdown any connections
-      delay(400);
-      GPRSPower(); //turn off GPRS
+      gprs.powerDown(); //shutdown any connections, then turn off GPRS
+      while(!gprs.idle()){
+        gprs.service();
+      }
       while(HSCAN.isAwake() == false){ //while sleeping
         delay(2500);  //check if awake every 2.5 seconds
         //         Serial.println("StillSleeping");
       }
       //       Serial.println("Awake");
-      while(HSCAN.setCANNormalMode() == false){
+      while(hsBaud != 0 && HSCAN.setCANNormalMode() == false){
         ;
         delay(1000);
         //once it wakes up, it will be in listenmode only, this ensures it goes back to normal mode
       }
+      if(hsBaud == 0){
+        startHSCAN(); //woken by a bus whose rate is still unknown
+      }
       //       Serial.print(HSCAN.readReg(CANSTAT), DEC);
       //       Serial.println("<--Awake: 0");
-      GPRSPower(); //power on GPRS
-      init_GPRS(); //initialize GPRS after turning it on from sleep
+      gprs.begin(GPRS_APN); //power on and initialize GPRS after sleep
+      obdSchedDiscover(&obdSched, millis()); //the ECU may have changed while the bus slept
       sleeper = 0; //reset sleeper time out
-      goto loop_start; //go back to loop start
+      return; //go back to loop start
     }
     goto sleep_check; //sleeper is not > 2, but no accelerator pedal message was received
   }
   sleeper = 0; //data was received, reset sleeper timeout
-  dataString.print("|");    //seperate data
-  for(int i = 0; i <= 18; i++){
-    message.adrsValue = 0x001; //resets address to get a different wheel speed
-    if(HSCAN.getMSG(&message, 100, ABSCAN) && i%2 == 0)//checks if its an even number
-    {
-      dumpMessage(&message);
-      dataString.print("*"); //star seperated wheel speed from brake_pressure
-      if(HSCAN.getMSG(&message, 100, BRAKE_PRESSURE)){//if wheel speed is found, need to find corresponding brake_pressure with it
-          dataString.print(message.data[4],DEC);//print out brake pressure in 
-      }
-      //else if(!HSCAN.BRAKE_PRESSURE){
-      //goto loop_start;// means wheel speed was found but not brake pressure 
-      //  }
-    }
-    //else if(!HSCAN.ABSCAN(&message,100)){
-    //  goto loop_start; //clear messages, go back to the beginning
-    //}
-    if(i<18 && i%2 == 0){
-      dataString.print("*");
+  waitStart = millis();
+  while(millis() - waitStart < SLIP_WINDOW_MS){
+    pollGPS();
+    drainCAN();
+    uplink();
+  }
+  drainCAN();
+  // the latest reply to each PID, polled at its own rate; raw A,B go out, the server scales them
+  for(int i = 0; i < OBD_COUNT; i++){
+    if(obdSchedFresh(&obdSched, i, millis(), OBD_FRESH_SLACK)){
+      record.obd[i][0] = obdSched.pids[i].data[0];
+      record.obd[i][1] = (obdSched.pids[i].length > 1) ? obdSched.pids[i].data[1] : 0;
+      record.obdTime[i] = (long)(obdMicros[i] - recordMicros) / 1000;
+      bitSet(record.present, TELEMETRY_HAS_OBD(i));
     }
   }
-  //  dataString.print("00#00#00#00#00#00#00#00+00#00#00#00#00#00#00#00+00#00#00#00#00#00#00#00+00#00#00#00#00#00#00#00+00#00#00#00#00#0#00#00+00#00#00#00#00#00#00#00+00#00#00#00#00#00#00#00+00#00#00#00#00#00#00#00+00#00#00#00#00#00#00#00+00#00#00#00#00#00#00#00");
-  dataString.print("|");
-  if(HSCAN.queryOBD(ENGINE_RPM,buffer) == 1){
-    dataString.print(buffer);    
+  // UTC of the record time; slip events and OBD replies are timed from it in micros()
+  if(timebaseValid(&timebase, micros())){
+    timebaseToUtc(&timebase, recordMicros, &record.utc);
+    record.clockRate = timebasePpm(&timebase);
+    bitSet(record.present, TELEMETRY_HAS_UTC);
+    if(timebase.source == TIMEBASE_PPS){
+      bitSet(record.present, TELEMETRY_UTC_PPS);
+    }
   }
-  dataString.print("|"); //RPM
+  slipTakeSummary(&slip, &record.slip);
+  record.eventCount = slipTakeEvents(&slip, record.events, TELEMETRY_SLIP_EVENTS, recordMicros);
 
-  if(HSCAN.queryOBD(VEHICLE_SPEED,buffer) == 1){
-    dataString.print(buffer); //prints an INT to the buffer     
-  }  
-  dataString.print("|");
-  if(HSCAN.queryOBD(ENGINE_COOLANT_TEMP,buffer) == 1){
-    dataString.print(buffer);    
-  }
-  dataString.print("|");//Throttle
-  if(HSCAN.queryOBD(FUEL_LEVEL, buffer) == 1){
-    dataString.print(buffer);
-  }
-  dataString.print("|");    
-  if(HSCAN.queryOBD(RUN_TIME, buffer) == 1){
-    dataString.print(buffer); 
-  }
-  dataString.print("|"); 
-  if(HSCAN.queryOBD(INTAKE_TEMP, buffer) == 1){
-    dataString.print(buffer); 
-  }
-  dataString.print("|"); 
-  if(HSCAN.queryOBD(MAF_SENSOR, buffer) == 1){
-    dataString.print(buffer);
+  record.csq = gprs.signalQuality(); //Strength from the last AT+CSQ, 99 if unknown
+  if(record.csq != 99){
+    bitSet(record.present, TELEMETRY_HAS_CSQ);
   }
-  dataString.print("|"); 
-  if(HSCAN.queryOBD(O2_VOLTAGE, buffer) == 1){
-    dataString.print(buffer); 
+  if(!addRecord()){
+    Serial.println("T3"); // the upload kept the buffer, this record is lost
   }
+  record.sequence++;
+  uplink();
+#endif
+}
 
-  disableHSCAN();
-  dataString.print("|"); //Strength
-  cell.println("AT+CSQ");
-  if(cell_wait_for_bytes(12,75) == 0){
-    dataString.print("NA");
-  }
-  else{
-    tempbuffS.begin();
-    while(cell.available()!=0){
-      tempbuffS.print((unsigned char)cell.read());
+#ifndef CAPTURE_MODE
+/*
+ * Moves the modem along and hands it a finished batch. Called between the
+ * sampling steps of loop(); it never waits, so CAN and GPS reads go on
+ * while the modem connects or sends. A finished batch goes out straight
+ * from batchBuf, and the next one starts there once it is delivered (see
+ * addRecord()). While the uplink is down, batches go to the store on the SD
+ * card instead; it is drained oldest first through the empty batchBuf once
+ * uploads get through again.
+ */
+void uplink() {
+  boolean wasPending = uploadPending;
+
+  gprs.service();
+  if(uploadPending){
+    switch(gprs.sendState()){
+    case GPRS_SEND_DONE:
+      uploadPending = false;
+      if(uploadStored){
+        store.pop();
+      }
+      telemetryBatchBegin(&batch, batchBuf, BATCH_BUFSIZ); // the next batch starts in the freed buffer
+      break;
+    case GPRS_SEND_FAILED:
+      Serial.println("T2");
+      if(!uploadStored && storeReady && store.append(batchBuf, uploadLen)){
+        uploadPending = false; // on the card now, it goes out again from there
+        telemetryBatchBegin(&batch, batchBuf, BATCH_BUFSIZ);
+      }
+      else{
+        gprs.send(batchBuf, uploadLen); // retried until it is delivered
+      }
+      break;
     }
   }
-  cell.flush();
-  //need to figure out a way to remove +CSQ ___ from the string and add to dataString
-  char* sigptr = strchr(tempbuffS, '+CSQ '); //returns a pointer to 'c' in tempbuffS 
-  sigptr += 1; //returns the signal strength, next 4 characters in this array
-  char sigstrength[5];
-  sigstrength[0] = *sigptr;
-  sigstrength[1] = *(sigptr+1);
-  sigstrength[2] = *(sigptr+2);
-  sigstrength[3] = *(sigptr+3);
-  sigstrength[4] = NULL;
-  dataString.print(sigstrength);//signal strength
-
-    tempbuffS.begin();
-
-  delay(400);
-send_check:
-  cell.println("AT+CIPSEND"); //Start data through TCP connection
-  if(cell_wait_for_bytes(5,100) == 0)
-  {  
-    Serial.println("T2");//timeout on CIPSend
-    cell.println("AT+CIPSHUT");
-    delay(100);
-    goto loop_start;
-  }
-  else
-  {
-    while(cell.available()!=0)
-    {
-      tempbuffS.print((unsigned char)cell.read());
+  if(!uploadPending && batch.count > 0 && (batchFull || batch.count >= BATCH_RECORDS)){
+    if(!storeReady || store.count() == 0){
+      uploadLen = batch.len;
+      gprs.send(batchBuf, uploadLen); // the batch stays in batchBuf until it is delivered
+      uploadPending = true;
+      uploadStored = false;
+      batchFull = false;
     }
-    if(strstr(tempbuffS,"ERROR") != NULL || strstr(tempbuffS,"FAIL") != NULL){//if ERROR exists in tempbuffS
-      tempbuffS.begin(); //clear tempbuffS
-      Serial.println("E2");
-      timeo2 += 1;
-      if(timeo2 > 4){
-        cell.println("AT+CIPSHUT"); //Close the GPRS Connection
-        delay(100);
-        init_GPRS(); //reinitialize GPRS
-        goto loop_start; //reloop
-      }
-      Serial.print("2:");
-      Serial.println(timeo2);
-      goto send_check;
+    else if(store.append(batchBuf, batch.len)){
+      telemetryBatchBegin(&batch, batchBuf, BATCH_BUFSIZ); // one sector write, the buffer is free again
+      batchFull = false;
     }
-    else{
-      tempbuffS.begin();
+  }
+  // stored batches go out only through an empty batchBuf, so no record is
+  // overwritten, and not in the call that freed it, so a waiting record gets it first
+  if(!wasPending && !uploadPending && batch.count == 0 && storeReady && store.count() > 0){
+    uploadLen = store.peek(batchBuf, BATCH_BUFSIZ);
+    if(uploadLen > 0){
+      gprs.send(batchBuf, uploadLen);
+      uploadPending = true;
+      uploadStored = true;
     }
   }
+}
 
-  //Serial.println(dataString);
-
-  delay(15);
-  cell.print(dataString);
-  delay(100);
-  cell.print("\r\n"); 
-  delay(100);
-  cell.print("\r\n"); 
-  delay(100);
-end_check:
-
-  cell.write(0x1A); // ARDUINO 1.0 doesn't support "BYTE" -- cell.print(0x1A,BYTE);//not getting this character   
-  
-  if(cell_wait_for_bytes(20,255) == 0)
-  {  
-    Serial.println("T3");
-    cell.println("AT+CIPSHUT");
-    if(cell_wait_for_bytes(4,100) == 0){
-      init_GPRS();
-    } //Close the GPRS Connection    
-    goto loop_start;
-  }
-  else
-  {
-    while(cell.available()!=0)
-    {
-      tempbuffS.print((unsigned char)cell.read());
-    }
-    if(strstr(tempbuffS,"ERROR") != NULL || strstr(tempbuffS,"FAIL") != NULL){//if ERROR exists in tempbuffS
-      tempbuffS.begin(); //clear tempbuffS
-      Serial.println("E3");
-      timeo3 += 1;
-      if(timeo3 > 4){
-        cell.println("AT+CIPSHUT"); //Close the GPRS Connection
-        delay(100);
-        init_GPRS(); 
-        goto loop_start;
+/*
+ * Puts record into the batch. There is one batch buffer and uploads go out
+ * from it, so batching stalls while one is in flight: the record waits, with
+ * CAN and GPS still read, until the upload is delivered or has gone to the
+ * store, at most UPLOAD_WAIT_MS. A full batch is handed on first. False if
+ * the buffer never came free.
+ */
+boolean addRecord() {
+  unsigned long waitStart = millis();
+
+  while(true){
+    if(!uploadPending){
+      if(telemetryBatchAdd(&batch, &record)){
+        return true;
       }
-      Serial.print("3:");
-      Serial.println(timeo3);
-      goto end_check;
-    }
-  }
-close_check:
-  cell.println("AT+CIPCLOSE=0"); //Close the GPRS Connection
-  if(cell_wait_for_bytes(7,100) == 0)
-  {  
-    close_to++;
-    if(close_to >= 3){ //attempted to close the connection 3 times, unsuccessful    
-      init_GPRS(); //automatically goes to loop start right after
+      batchFull = true; // uplink() sends or stores it, then the record fits
     }
-    else{
-      goto close_check;
+    if(millis() - waitStart >= UPLOAD_WAIT_MS){
+      return false;
     }
-  }       
+    pollGPS();
+    drainCAN();
+    uplink();
+  }
 }
 
-void readline(void) {
-  char c;
+/*
+ * Finds the store file, or makes it contiguous on first use, and hands its
+ * blocks to the ring; after that no FAT or directory entry is touched.
+ */
+boolean openStore() {
+  SdFile storeFile;
+  uint32_t bgnBlock, endBlock;
 
-  buffidx = 0; // start at begninning
-  while (1) {
-    c=canbus.read();
-    if (c == -1)
-      continue;
-    if (c == '\n')
-      continue;
-    if ((buffidx == BUFFSIZ-1) || (c == '\r')) {
-      tempbuff[buffidx] = 0;
-      return;
-    }
-    tempbuff[buffidx++]= c;
+  if(!storeFile.open(root, STORE_FILE, O_READ) &&
+     !storeFile.createContiguous(&root, STORE_FILE, STORE_BLOCKS * 512UL)){
+    return false;
   }
+  if(!storeFile.contiguousRange(&bgnBlock, &endBlock)){
+    storeFile.close();
+    return false;
+  }
+  storeFile.close();
+  return store.begin(&card, bgnBlock, endBlock - bgnBlock + 1);
 }
 
-char cell_wait_for_bytes(char no_of_bytes, int timeout) //timeout amount is *100 MS
-{
-  while(cell.available() < no_of_bytes)
-  {
-    delay(100);
-    timeout-=1;
-    if(timeout == 0)
-    {
-      return 0;
-    }
+#else
+/*
+ * Same as openStore() for the capture file. Every capture starts at the
+ * beginning of the file; the session number tells it from the one before.
+ */
+boolean openCapture() {
+  SdFile captureFile;
+  uint32_t bgnBlock, endBlock;
+
+  if(!captureFile.open(root, CAPTURE_FILE, O_READ) &&
+     !captureFile.createContiguous(&root, CAPTURE_FILE, CAPTURE_BLOCKS * 512UL)){
+    return false;
+  }
+  if(!captureFile.contiguousRange(&bgnBlock, &endBlock)){
+    captureFile.close();
+    return false;
   }
-  return 1;
+  captureFile.close();
+  return capture.begin(&card, bgnBlock, endBlock - bgnBlock + 1);
 }
-void init_GPRS(){
-setup_start:
-  Serial.println();
-  tempbuffS.begin();
-
-  cell.println("AT");
-  if(cell_wait_for_bytes(2,100) == 0)
-  {   //wait one second for a response
-    Serial.println("P was off");
-    GPRSPower();
-    goto setup_start;
-  }
-  else{
-    Serial.println("P OK");
-  }
-
-  cell.flush();
-
-  cell.println("AT+CIPSHUT");
-  delay(150);
-
-  cell.println("AT+CIPMUX=0"); //We only want a single IP Connection at a time.
-  if(cell_wait_for_bytes(4,100) == 0)
-  {  
-    Serial.println("T4");
-    goto setup_start;
-  }
-  else
-  {
-    while(cell.available()!=0)
-    {
-      tempbuffS.print((unsigned char)cell.read());
-    }
-    if(strstr(tempbuffS,"ERROR") != NULL){ //means it found ERROR in the string
-      Serial.println("E4");
-      cell.println("AT+CIPSHUT");
-      delay(100);
-      goto setup_start;
+
+/*
+ * One pass of capture mode: a frame from the receive ring into the log, or
+ * a full sector to the card when the ring is empty. The SD transfer holds
+ * off the CAN interrupt, so it must not be started while frames wait.
+ */
+void captureFrames() {
+  CANMSG msg;
+  byte bus;
+
+  if(buses.receive(&msg, &bus)){
+    capture.add(&msg, msg.timestamp, bus);
+    lastFrame = millis();
+  }
+  else if(capture.pending()){
+    capture.service();
+  }
+  else if(millis() - lastFrame >= CAPTURE_IDLE_MS){
+    capture.flush();
+    lastFrame = millis();
+  }
+}
+#endif
+
+#ifndef CAPTURE_MODE
+/*
+ * Hands every frame waiting in the receive ring to its consumer: wheel
+ * speeds to the slip monitor with the time the ISR read them, brake and
+ * accelerator into the record, OBD replies to the PID scheduler. Then
+ * sends the scheduler's next request, if one is due. Called wherever
+ * loop() waits, so the ring does not fill and no frame is dropped while
+ * an OBD reply is awaited. Frames from MS-CAN are read to keep its ring
+ * from filling, but only capture mode logs them.
+ */
+void drainCAN() {
+  CANMSG msg;
+  uint16_t wheels[SLIP_WHEELS];
+  byte len, pid;
+  int8_t index;
+  byte bus;
+
+  while(buses.receive(&msg, &bus)){
+    if(bus != 0){
+      continue;
     }
-    else{
-      tempbuffS.begin();
+    if(SIG_WHEEL_SPEED3::match(&msg)){
+      wheels[0] = SIG_WHEEL_SPEED0::value(msg.data);
+      wheels[1] = SIG_WHEEL_SPEED1::value(msg.data);
+      wheels[2] = SIG_WHEEL_SPEED2::value(msg.data);
+      wheels[3] = SIG_WHEEL_SPEED3::value(msg.data);
+      slipAddWheels(&slip, wheels, msg.timestamp);
     }
-  }        
-
-  cell.println("AT+CIPMODE=0"); //was AT+CIPMODE=1 for one connection. Selecting "Normal Mode" and NOT "Transparent Mode" as the TCP/IP Application Mode
-  if(cell_wait_for_bytes(4,100) == 0)
-  {  
-    Serial.println("T5");
-    goto setup_start;
-  }
-  else
-  {
-    while(cell.available()!=0)
-    {
-      tempbuffS.print((unsigned char)cell.read());
+    else if(SIG_BRAKE_PRESSURE::match(&msg)){
+      record.brake = SIG_BRAKE_PRESSURE::value(msg.data);
+      bitSet(record.present, TELEMETRY_HAS_BRAKE);
+      slipSetBrake(&slip, record.brake);
     }
-    if(strstr(tempbuffS,"ERROR") != NULL){ //means it found ERROR in the string
-      Serial.println("E5");
-      cell.println("AT+CIPSHUT");
-      delay(100);      
-      goto setup_start;
+    else if(SIG_ACCELERATOR_PEDAL::match(&msg)){
+      record.accelerator = SIG_ACCELERATOR_PEDAL::value(msg.data);
+      bitSet(record.present, TELEMETRY_HAS_ACCEL);
     }
-    else{
-      tempbuffS.begin();
+    else if((len = MCP2515::getOBDReply(&msg)) > 0){
+      index = obdSchedReply(&obdSched, msg.data[2], &msg.data[3], len, millis());
+      if(index >= 0){
+        obdMicros[index] = msg.timestamp;
+      }
     }
   }
-
-  cell.println("AT+CGDCONT=1,\"IP\",\"web.gci\""); //Defining the Packet Data
-  if(cell_wait_for_bytes(4,100) == 0)
-  {  
-    Serial.println("T6");
-    goto setup_start;
+  if(hsBaud != 0 && obdSchedNext(&obdSched, millis(), &pid) && !HSCAN.requestOBD(pid)){
+    obdSchedUnsent(&obdSched); // TX queue full: asked again next call, not counted as a miss
   }
-  else
-  {
-    while(cell.available()!=0)
-    {
-      tempbuffS.print((unsigned char)cell.read());
-    }
-    if(strstr(tempbuffS,"ERROR") != NULL){ //means it found ERROR in the string
-      Serial.println("E6");
-      cell.println("AT+CIPSHUT");
-      delay(100);      
-      goto setup_start;
+  buses.serviceTX(); // requests that found every TX buffer busy go out now, if there are any
+}
+
+/*
+ * Feeds every character the GPS sent since the last call to the NMEA
+ * parser; never waits for more. SoftwareSerial holds 64 characters, about
+ * 130 ms at 4800 baud. A sentence that loses one fails its checksum and
+ * is skipped, the fix stays at the previous one. The characters queued
+ * behind a '$' came in one GPS_CHAR_US apart after it, which times the
+ * sentence to within a character however late it is read.
+ */
+void pollGPS() {
+  int waiting = canbus.available();
+  unsigned long now = micros();
+  char c;
+
+  while(waiting > 0){
+    c = canbus.read();
+    waiting--;
+    if(c == '$'){
+      sentenceMicros = now - (waiting + 1) * GPS_CHAR_US;
     }
-    else{
-      tempbuffS.begin();
+    if(nmeaFeed(&nmea, c) == NMEA_RMC){
+      rmcCount++;
+      if(nmea.fix.valid){
+        syncTime();
+      }
     }
-
   }
+}
 
-
-  cell.println("AT+CSTT=\"WEB.GCI\""); //Start Task and set Access Point Name (and username and password if any)
-  if(cell_wait_for_bytes(4,100) == 0)
-  {  
-    Serial.println("T7");
-    goto setup_start;
+/*
+ * Syncs the timebase to the RMC just parsed: to the PPS edge that began
+ * its second when there is one, else to the sentence's arrival less the
+ * receiver's latency.
+ */
+void syncTime() {
+  UTCTIME utc;
+
+  timebaseFixTime(&nmea.fix, &utc);
+#ifdef GPS_PPS_PIN
+  unsigned long pps;
+  byte count;
+
+  noInterrupts();
+  pps = ppsMicros;
+  count = ppsCount;
+  interrupts();
+  if(count != ppsUsed && utc.micros == 0 && sentenceMicros - pps < 1000000UL){
+    ppsUsed = count;
+    timebaseSync(&timebase, pps, &utc, TIMEBASE_PPS);
+    return;
   }
-  else
-  {
-    while(cell.available()!=0)
-    {
-      tempbuffS.print((unsigned char)cell.read());
-    }
-    if(strstr(tempbuffS,"ERROR") != NULL){ //means it found ERROR in the string
-      Serial.println("E7");
-      cell.println("AT+CIPSHUT");
-      delay(100);    
-      goto setup_start;
-    }
-    else{
-      tempbuffS.begin();
-    }
+  if(count != 0 && micros() - pps < PPS_TIMEOUT_US){
+    return; // one edge missed; the RMC's latency error would only pull the clock off
   }
-  cell.println("AT+CIPSHUT");
-  delay(100);
+#endif
+  timebaseSync(&timebase, sentenceMicros - GPS_RMC_LATENCY_US, &utc, TIMEBASE_RMC);
+}
 
+#ifdef GPS_PPS_PIN
+/*
+ * Stamps the receiver's pulse at the start of each UTC second.
+ */
+void ppsISR() {
+  ppsMicros = micros();
+  ppsCount++;
 }
+#endif
+#endif
 
-void dumpMessage(CANMSG* message) {
-  for(int i = 0; i <= message->dataLength - 1 ; i++) {
-    dataString.print(message->data[i], HEX);
-    if(i < message->dataLength - 1){
-      dataString.print("#");
-    }
+/*
+ * Brings HS-CAN up at the vehicle's rate: listens at each of HSCAN_BAUDS
+ * until one gives clean frames, and only then sets the filters and goes
+ * to normal mode, so the node never acknowledges or transmits at a wrong
+ * rate. On a quiet bus the controller is left listening, OBD requests
+ * wait, and loop() tries again every AUTOBAUD_RETRY_MS. At most
+ * AUTOBAUD_DWELL_MS per rate.
+ */
+boolean startHSCAN() {
+  hsRetry = millis();
+  if(!HSCAN.initCAN(HSCAN_BAUDS[0])){
+    Serial.print("CAN E");
+    return false;
+  }
+  HSCAN.disableRxInterrupt(CAN_INT_PIN); // detectBaud() reads the buffers itself
+  hsBaud = HSCAN.detectBaud(HSCAN_BAUDS, sizeof(HSCAN_BAUDS)/sizeof(HSCAN_BAUDS[0]), AUTOBAUD_DWELL_MS);
+  if(hsBaud == 0){
+    return false;
+  }
+#ifndef CAPTURE_MODE
+  if(!HSCAN.setAcceptanceFilters(HSCAN_IDS, sizeof(HSCAN_IDS)/sizeof(HSCAN_IDS[0]))) {
+    Serial.print("CAN F");
   }
+#endif
+  if(!HSCAN.setCANNormalMode()) { 
+    Serial.print("CAN E");
+  }
+  HSCAN.enableRxInterrupt(CAN_INT_PIN); //getMSG/queryOBD now read from the ring
+  return true;
 }
 
 /**
@@ -561,39 +657,20 @@ void dumpMessage(CANMSG* message) {
  */
 void init_SPI_CS(void)
 {
-  pinMode(9,OUTPUT);
-  digitalWrite(9, HIGH);
+  pinMode(SD_CS_PIN,OUTPUT);
+  digitalWrite(SD_CS_PIN, HIGH);
 }  
 /**
  * Initialize the status LED
  */
-/**
- * Enable the HSCAN by setting is pin low
- */
-void enableHSCAN() {
-  digitalWrite(10, LOW); 
-}
-/**
- * Disable CAN device by setting its
- * pins high
- */
-void disableHSCAN() {
-  digitalWrite(10, HIGH); 
-}
-void GPRSPower(){
-  pinMode(9, OUTPUT); 
-  digitalWrite(9,LOW);
-  delay(1000);
-  digitalWrite(9,HIGH);
-  delay(2500);
-  digitalWrite(9,LOW);
-  delay(3500);
-}
 
 
 
-// pin 10: slave select
+// pin 6: MS-CAN slave select, when MSCAN_CS_PIN is set
+// pin 9: SD card slave select
+// pin 10: HS-CAN slave select
 // pin 11: master out slave in
 // pin 12: master in slave out
 // pin 13: serial clock
-
+// pin A0: SIM900 power key
+
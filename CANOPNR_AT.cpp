@@ -0,0 +1,228 @@
+/*
+   This file is included as part of the CANOPNR distribution.
+   You are free to use this project as you see fit, provided credit is given to all
+   contributors (original and subsequent).
+
+   Copyright 2012  Jose Denrie Enriquez, Alex Bautista, Paloma Field, Sun-il Kim
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+  ------------------------------------------------------------------------------------------------------------
+
+  Non-blocking AT command engine, see CANOPNR_AT.h.
+*/
+
+#include <string.h>
+#include "CANOPNR_AT.h"
+
+//state
+#define AT_IDLE 0
+#define AT_WAIT_RESULT 1
+#define AT_WAIT_PROMPT 2
+#define AT_WRITING 3
+
+ATEngine::ATEngine(Stream &p) : port(p)
+{
+  state = AT_IDLE;
+  written = 0;
+  started = 0;
+  lineLen = 0;
+  onDone = 0;
+  onLine = 0;
+  ctx = 0;
+  sent = 0;
+  timeouts = 0;
+}
+
+void ATEngine::setHandlers(ATDONE done, ATLINE lineHandler, void *context)
+{
+  onDone = done;
+  onLine = lineHandler;
+  ctx = context;
+}
+
+boolean ATEngine::queue(const ATCOMMAND &c)
+{
+  return commands.push(c);
+}
+
+boolean ATEngine::queue(const char *text, const char *want, unsigned long timeout, byte tag)
+{
+  ATCOMMAND c;
+
+  memset(&c, 0, sizeof(c));
+  c.text = text;
+  c.want = want;
+  c.timeout = timeout;
+  c.tag = tag;
+  return commands.push(c);
+}
+
+void ATEngine::flush()
+{
+  ATCOMMAND c;
+
+  while(commands.pop(&c))
+    ;
+}
+
+boolean ATEngine::idle()
+{
+  return state == AT_IDLE && commands.available() == 0;
+}
+
+byte ATEngine::current()
+{
+  return (state == AT_IDLE) ? 0 : cmd.tag;
+}
+
+/*
+ * Collects modem output into line. Returns true once a non-empty line is
+ * complete; while a prompt is awaited the "> " counts as a line since no
+ * newline follows it. Lines longer than the buffer are cut short.
+ */
+boolean ATEngine::readLine()
+{
+  int c;
+
+  while(port.available() > 0)
+  {
+    c = port.read();
+    if(c == '\r')
+      continue;
+    if(c == '\n')
+    {
+      if(lineLen == 0)
+        continue;
+      line[lineLen] = '\0';
+      lineLen = 0;
+      return true;
+    }
+    if(lineLen == 0 && c == ' ') //left over from "> "
+      continue;
+    if(state == AT_WAIT_PROMPT && lineLen == 0 && c == '>')
+    {
+      line[0] = '>';
+      line[1] = '\0';
+      return true;
+    }
+    if(lineLen < AT_LINE_SIZE - 1)
+      line[lineLen++] = c;
+  }
+  return false;
+}
+
+void ATEngine::handleLine()
+{
+  const char *want = (cmd.want != 0) ? cmd.want : "OK";
+
+  if(state == AT_WAIT_PROMPT && line[0] == '>')
+  {
+    state = AT_WRITING;
+    written = 0;
+    return;
+  }
+  if(state == AT_WAIT_RESULT)
+  {
+    if(strncmp(line, want, strlen(want)) == 0 ||
+       (cmd.alt != 0 && strncmp(line, cmd.alt, strlen(cmd.alt)) == 0))
+    {
+      finish(AT_MATCH);
+      return;
+    }
+  }
+  //The modem answers nothing while it takes data, so only unsolicited
+  //lines can turn up then
+  if(state == AT_WAIT_RESULT || state == AT_WAIT_PROMPT)
+  {
+    if(strstr(line, "ERROR") != NULL || strstr(line, "FAIL") != NULL)
+    {
+      finish(AT_FAILED);
+      return;
+    }
+  }
+  if(onLine != 0)
+    onLine(ctx, line);
+}
+
+void ATEngine::start()
+{
+  const char *p;
+
+  for(p = cmd.text; *p != '\0'; p++)
+  {
+    if(*p != '%')
+      port.print(*p);
+    else if(cmd.param != 0)
+      port.print(cmd.param);
+    else
+      port.print((unsigned int)cmd.num);
+  }
+  port.println();
+  sent++;
+  state = (cmd.data != 0) ? AT_WAIT_PROMPT : AT_WAIT_RESULT;
+  started = millis();
+}
+
+//Ends the command in progress; the handler may queue or flush right away
+void ATEngine::finish(byte result)
+{
+  state = AT_IDLE;
+  if(result == AT_TIMEOUT)
+  {
+    timeouts++;
+    line[0] = '\0';
+  }
+  if(onDone != 0)
+    onDone(ctx, cmd.tag, result, line);
+}
+
+void ATEngine::service()
+{
+  uint16_t n;
+
+  while(readLine())
+    handleLine();
+
+  if(state == AT_WAIT_PROMPT && millis() - started >= AT_PROMPT_TIMEOUT)
+    finish(AT_TIMEOUT);
+  else if(state == AT_WAIT_RESULT && millis() - started >= cmd.timeout)
+    finish(AT_TIMEOUT);
+
+  if(state == AT_IDLE && commands.pop(&cmd))
+    start();
+
+  if(state == AT_WRITING)
+  {
+    n = cmd.num - written;
+    if(n > AT_WRITE_SLICE)
+      n = AT_WRITE_SLICE;
+    port.write(cmd.data + written, n);
+    written += n;
+    if(written == cmd.num)
+    {
+      state = AT_WAIT_RESULT;
+      started = millis();
+    }
+  }
+}
+
+unsigned long ATEngine::getCommandCount()
+{
+  return sent;
+}
+
+unsigned long ATEngine::getTimeoutCount()
+{
+  return timeouts;
+}
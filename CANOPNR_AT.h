@@ -0,0 +1,110 @@
+/*
+   This file is included as part of the CANOPNR distribution.
+   You are free to use this project as you see fit, provided credit is given to all
+   contributors (original and subsequent).
+
+   Copyright 2012  Jose Denrie Enriquez, Alex Bautista, Paloma Field, Sun-il Kim
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+  ------------------------------------------------------------------------------------------------------------
+
+  Event-driven AT command engine for a modem on a serial port.
+
+  Commands are queued with the start of the line that ends them and a
+  timeout, and go out one at a time. service() reads whatever the modem has
+  sent, cuts it into lines and moves the command in progress along; it never
+  waits, so it can be called between every other piece of work in loop().
+
+    - The final line of a command is one starting with want (or alt), or one
+      containing ERROR or FAIL. It is passed to the done handler with the
+      command's tag and AT_MATCH / AT_FAILED, or AT_TIMEOUT when nothing
+      ended the command in time.
+    - Every other line (intermediate results such as "+CSQ: 17,0", echoes,
+      unsolicited CLOSED) goes to the line handler.
+    - A command with data waits for the "> " prompt, then writes the data
+      AT_WRITE_SLICE bytes per service() call before waiting for want.
+
+  Command text may hold one '%', replaced by param or, when param is 0, by
+  num in decimal: {"AT+CIPSEND=%", 0, len, data, "DATA ACCEPT", ...}. The
+  strings and data are not copied and must stay valid until the command
+  is done.
+*/
+
+#ifndef CANOPNR_AT_h
+#define CANOPNR_AT_h
+
+#include "Arduino.h"
+#include "CANOPNR_RingBuffer.h"
+
+#define AT_QUEUE_SIZE 8         //holds AT_QUEUE_SIZE - 1 commands
+#define AT_LINE_SIZE 48
+#define AT_WRITE_SLICE 64       //data bytes per service(), ~33 ms at 19200 baud
+#define AT_PROMPT_TIMEOUT 2000
+
+//Results passed to the done handler
+#define AT_TIMEOUT 0
+#define AT_MATCH 1
+#define AT_FAILED 2
+
+typedef struct
+{
+  const char *text;       //'%' is replaced by param, or by num if param is 0
+  const char *param;
+  uint16_t num;
+  const uint8_t *data;    //num bytes written after the "> " prompt, or 0
+  const char *want;       //start of the final line, 0 for "OK"
+  const char *alt;        //second accepted final line, or 0
+  unsigned long timeout;  //ms from the command (or its data) going out
+  byte tag;               //handed back to the done handler
+} ATCOMMAND;
+
+typedef void (*ATDONE)(void *ctx, byte tag, byte result, const char *line);
+typedef void (*ATLINE)(void *ctx, const char *line);
+
+class ATEngine
+{
+  public:
+    ATEngine(Stream &port);
+    void setHandlers(ATDONE done, ATLINE line, void *ctx);
+    boolean queue(const ATCOMMAND &cmd);   //false if the queue is full
+    boolean queue(const char *text, const char *want, unsigned long timeout, byte tag);
+    void flush();                          //drops queued commands, not the one in progress
+    void service();
+    boolean idle();                        //nothing queued or in progress
+    byte current();                        //tag of the command in progress, 0 if none
+
+    unsigned long getCommandCount();
+    unsigned long getTimeoutCount();
+
+  private:
+    Stream &port;
+    RingBuffer<ATCOMMAND, AT_QUEUE_SIZE> commands;
+    ATCOMMAND cmd;
+    byte state;
+    uint16_t written;
+    unsigned long started;
+    char line[AT_LINE_SIZE];
+    byte lineLen;
+    ATDONE onDone;
+    ATLINE onLine;
+    void *ctx;
+    unsigned long sent;
+    unsigned long timeouts;
+    boolean readLine();
+    void handleLine();
+    void start();
+    void finish(byte result);
+};
+
+#endif
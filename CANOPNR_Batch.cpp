@@ -0,0 +1,268 @@
+/*
+   This file is included as part of the CANOPNR distribution.
+   You are free to use this project as you see fit, provided credit is given to all
+   contributors (original and subsequent).
+
+   Copyright 2012  Jose Denrie Enriquez, Alex Bautista, Paloma Field, Sun-il Kim
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+  ------------------------------------------------------------------------------------------------------------
+
+  Delta/zigzag/varint batch coding, see CANOPNR_Batch.h.
+
+  codeRecord() walks the fields once for both directions, so the encoder and
+  decoder cannot disagree on field order. It is instantiated for a const
+  record when encoding (fields are only read) and a writable one when
+  decoding, so the encoder needs no scratch copy of the record.
+*/
+
+#include <string.h>
+#include "CANOPNR_Batch.h"
+
+typedef struct
+{
+  uint8_t *out;          //encoding
+  const uint8_t *in;     //decoding
+  uint16_t pos;
+  uint16_t size;
+  uint16_t zeros;        //zero deltas waiting to be written, or still to be returned
+  bool error;            //out of space, or malformed input
+}  BATCHCODER;
+
+static void putByte(BATCHCODER *c, uint8_t val)
+{
+  if(c->pos >= c->size)
+  {
+    c->error = true;
+    return;
+  }
+  c->out[c->pos++] = val;
+}
+
+static void putVarint(BATCHCODER *c, uint32_t val)
+{
+  while(val >= 0x80)
+  {
+    putByte(c, (val & 0x7F) | 0x80);
+    val >>= 7;
+  }
+  putByte(c, val);
+}
+
+static uint32_t getVarint(BATCHCODER *c)
+{
+  uint32_t val = 0;
+  uint8_t shift = 0, b;
+
+  do
+  {
+    if(c->pos >= c->size || shift > 28)
+    {
+      c->error = true;
+      return 0;
+    }
+    b = c->in[c->pos++];
+    val |= (uint32_t)(b & 0x7F) << shift;
+    shift += 7;
+  } while(b & 0x80);
+  return val;
+}
+
+static void flushZeros(BATCHCODER *c)
+{
+  if(c->zeros == 0)
+    return;
+  putByte(c, 0);
+  putVarint(c, c->zeros - 1);
+  c->zeros = 0;
+}
+
+//Encoding: writes cur - prev and returns cur. Decoding: returns prev plus
+//the next delta. The delta wraps at the field's width, so a byte going from
+//0xFF to 0x01 costs +2, not -254; the caller truncates the result back.
+static uint32_t codeValue(BATCHCODER *c, uint32_t cur, uint32_t prev, uint8_t bits)
+{
+  int32_t delta;
+  uint32_t zz;
+
+  if(c->out != 0)
+  {
+    delta = (int32_t)((cur - prev) << (32 - bits)) >> (32 - bits);
+    if(delta == 0)
+    {
+      c->zeros++;
+      return cur;
+    }
+    flushZeros(c);
+    putVarint(c, ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31));
+    return cur;
+  }
+
+  if(c->zeros > 0)
+  {
+    c->zeros--;
+    return prev;
+  }
+  zz = getVarint(c);
+  if(zz == 0)
+  {
+    c->zeros = getVarint(c);
+    return prev;
+  }
+  delta = (int32_t)((zz >> 1) ^ (0 - (zz & 1)));
+  return prev + (uint32_t)delta;
+}
+
+template <typename T> static inline void store(T &field, uint32_t val) { field = (T)val; }
+template <typename T> static inline void store(const T &field, uint32_t val) { (void)field; (void)val; }
+
+#define CODE(field, prevField) \
+  store(field, codeValue(c, (uint32_t)(field), (uint32_t)(prevField), 8 * sizeof(field)))
+
+template <typename REC>
+static void codeRecord(BATCHCODER *c, REC *cur, const TELEMETRY *prev)
+{
+  static const SLIPEVENT noEvent = {0, 0, 0, 0, 0, 0};
+  const SLIPEVENT *ref;
+  uint8_t i;
+
+  CODE(cur->controllerId, prev->controllerId);
+  CODE(cur->sequence, prev->sequence);
+  CODE(cur->timestamp, prev->timestamp);
+  CODE(cur->present, prev->present);
+  CODE(cur->utc.seconds, prev->utc.seconds);
+  CODE(cur->utc.micros, prev->utc.micros);
+  CODE(cur->clockRate, prev->clockRate);
+  CODE(cur->gps.timeMs, prev->gps.timeMs);
+  CODE(cur->gps.days, prev->gps.days);
+  CODE(cur->gps.lat, prev->gps.lat);
+  CODE(cur->gps.lon, prev->gps.lon);
+  CODE(cur->gps.speed, prev->gps.speed);
+  CODE(cur->gps.course, prev->gps.course);
+  CODE(cur->accelerator, prev->accelerator);
+  CODE(cur->csq, prev->csq);
+  for(i = 0; i < TELEMETRY_OBD_COUNT; i++)
+  {
+    CODE(cur->obd[i][0], prev->obd[i][0]);
+    CODE(cur->obd[i][1], prev->obd[i][1]);
+  }
+  for(i = 0; i < TELEMETRY_OBD_COUNT; i++)
+    CODE(cur->obdTime[i], prev->obdTime[i]);
+  CODE(cur->slip.frames, prev->slip.frames);
+  CODE(cur->slip.speed, prev->slip.speed);
+  for(i = 0; i < SLIP_WHEELS; i++)
+    CODE(cur->slip.mean[i], prev->slip.mean[i]);
+  for(i = 0; i < SLIP_WHEELS; i++)
+    CODE(cur->slip.peak[i], prev->slip.peak[i]);
+  CODE(cur->brake, prev->brake);
+  CODE(cur->eventCount, prev->eventCount);
+  if(cur->eventCount > TELEMETRY_SLIP_EVENTS)
+  {
+    c->error = true;
+    return;
+  }
+
+  //An event is coded against the one before it; the first follows the
+  //last event of the previous record
+  ref = (prev->eventCount > 0) ? &prev->events[prev->eventCount - 1] : &noEvent;
+  for(i = 0; i < cur->eventCount; i++)
+  {
+    CODE(cur->events[i].start, ref->start);
+    CODE(cur->events[i].duration, ref->duration);
+    CODE(cur->events[i].wheel, ref->wheel);
+    CODE(cur->events[i].peak, ref->peak);
+    CODE(cur->events[i].speed, ref->speed);
+    CODE(cur->events[i].brake, ref->brake);
+    ref = &cur->events[i];
+  }
+  store(cur->gps.valid, (cur->present >> TELEMETRY_HAS_GPS) & 1);
+}
+
+static void writeHeader(TELEMETRYBATCH *batch)
+{
+  batch->buf[0] = TELEMETRY_BATCH_MAGIC;
+  batch->buf[1] = TELEMETRY_BATCH_VERSION;
+  batch->buf[2] = batch->count;
+  batch->buf[3] = batch->len;
+  batch->buf[4] = batch->len >> 8;
+}
+
+void telemetryBatchBegin(TELEMETRYBATCH *batch, uint8_t *buf, uint16_t size)
+{
+  batch->buf = buf;
+  batch->size = size;
+  batch->len = TELEMETRY_BATCH_HEADER_SIZE;
+  batch->count = 0;
+  memset(&batch->prev, 0, sizeof(TELEMETRY));
+  if(size >= TELEMETRY_BATCH_HEADER_SIZE)
+    writeHeader(batch);
+}
+
+bool telemetryBatchAdd(TELEMETRYBATCH *batch, const TELEMETRY *rec)
+{
+  BATCHCODER c;
+
+  if(batch->count == 0xFF || batch->size < TELEMETRY_BATCH_HEADER_SIZE)
+    return false;
+
+  memset(&c, 0, sizeof(c));
+  c.out = batch->buf;
+  c.pos = batch->len;
+  c.size = batch->size;
+  codeRecord(&c, rec, &batch->prev);
+  flushZeros(&c);
+  if(c.error)
+    return false;
+
+  batch->len = c.pos;
+  batch->count++;
+  batch->prev = *rec;
+  writeHeader(batch);
+  return true;
+}
+
+uint16_t telemetryBatchDecode(const uint8_t *buf, uint16_t len, TELEMETRY *recs, uint8_t maxRecs, uint8_t *count)
+{
+  BATCHCODER c;
+  TELEMETRY zero;
+  const TELEMETRY *prev = &zero;
+  uint16_t total;
+  uint8_t n, i;
+
+  if(len < TELEMETRY_BATCH_HEADER_SIZE || buf[0] != TELEMETRY_BATCH_MAGIC || buf[1] != TELEMETRY_BATCH_VERSION)
+    return 0;
+  n = buf[2];
+  total = buf[3] | ((uint16_t)buf[4] << 8);
+  if(total < TELEMETRY_BATCH_HEADER_SIZE || total > len || n > maxRecs)
+    return 0;
+
+  memset(&zero, 0, sizeof(zero));
+  memset(&c, 0, sizeof(c));
+  c.in = buf;
+  c.pos = TELEMETRY_BATCH_HEADER_SIZE;
+  c.size = total;
+  for(i = 0; i < n; i++)
+  {
+    memset(&recs[i], 0, sizeof(TELEMETRY));
+    codeRecord(&c, &recs[i], prev);
+    //Every record ends with its zero run flushed
+    if(c.error || c.zeros != 0)
+      return 0;
+    prev = &recs[i];
+  }
+  if(c.pos != total)
+    return 0;
+  *count = n;
+  return total;
+}
@@ -0,0 +1,75 @@
+/*
+   This file is included as part of the CANOPNR distribution.
+   You are free to use this project as you see fit, provided credit is given to all
+   contributors (original and subsequent).
+
+   Copyright 2012  Jose Denrie Enriquez, Alex Bautista, Paloma Field, Sun-il Kim
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+  ------------------------------------------------------------------------------------------------------------
+
+  Batches of telemetry records (CANOPNR_Telemetry.h), delta compressed so
+  several loop() cycles share one upload.
+
+  Every field of a record is sent as the difference from the same field of
+  the previous record, zigzag mapped (0, -1, 1, -2 -> 0, 1, 2, 3) and written
+  as a little-endian base-128 varint. Deltas wrap at the field's width. A
+  slip event is differenced against the event before it. Fields that did
+  not change cost one byte per run: a 0 token is followed by a varint
+  holding the run length minus one.
+
+    off  size  field
+      0     1  TELEMETRY_BATCH_MAGIC
+      1     1  TELEMETRY_BATCH_VERSION
+      2     1  record count
+      3     2  batch length in bytes, header included
+      5     -  records; the first is differenced against all-zero fields
+
+  Records are encoded as they are added, so the node keeps only the batch
+  buffer and the previous record, never N records.
+*/
+
+#ifndef CANOPNR_Batch_h
+#define CANOPNR_Batch_h
+
+#include <stdint.h>
+#include "CANOPNR_Telemetry.h"
+
+#define TELEMETRY_BATCH_MAGIC 0xC8
+#define TELEMETRY_BATCH_VERSION 3
+#define TELEMETRY_BATCH_HEADER_SIZE 5
+
+//A single record never needs more than this, so a buffer of at least this
+//size always takes one record
+#define TELEMETRY_BATCH_RECORD_MAX 256
+
+typedef struct
+{
+  uint8_t *buf;
+  uint16_t size;
+  uint16_t len;
+  uint8_t count;
+  TELEMETRY prev;      //last record added
+}  TELEMETRYBATCH;
+
+void telemetryBatchBegin(TELEMETRYBATCH *batch, uint8_t *buf, uint16_t size);
+
+//False if the record does not fit; the batch is left as it was
+bool telemetryBatchAdd(TELEMETRYBATCH *batch, const TELEMETRY *rec);
+
+//Decodes up to maxRecs records into recs. Returns the bytes consumed, or 0
+//if buf does not start with a complete, well-formed batch.
+uint16_t telemetryBatchDecode(const uint8_t *buf, uint16_t len, TELEMETRY *recs, uint8_t maxRecs, uint8_t *count);
+
+#endif
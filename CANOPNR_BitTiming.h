@@ -0,0 +1,139 @@
+/*
+   This file is included as part of the CANOPNR distribution.
+   You are free to use this project as you see fit, provided credit is given to all
+   contributors (original and subsequent).
+
+   Copyright 2012  Jose Denrie Enriquez, Alex Bautista, Paloma Field, Sun-il Kim
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+  ------------------------------------------------------------------------------------------------------------
+
+  MCP2515 bit timing, worked out by the compiler from the crystal and the
+  bitrate instead of kept as a table of magic CNF values.
+
+  A bit is SyncSeg (1 TQ) + PropSeg + PS1 + PS2 time quanta, with
+  TQ = 2 * BRP / Fosc. The controller allows BRP 1-64, PropSeg and PS1
+  1-8 and PS2 2-8, PropSeg + PS1 >= PS2 and SJW 1-4 below PS2, so a bit
+  is 5 to 25 quanta. The bus samples at the end of PS1.
+
+  For every quanta count the solver takes the nearest prescaler and the
+  PS2 nearest the wanted sample point, and keeps the count whose bitrate
+  is closest; among equally close ones, the one nearest the sample point,
+  then the one with more quanta. Sample points are in tenths of a percent.
+  A rate the crystal cannot make within CAN_TIMING_TOLERANCE_PPM gives 0:
+  1 Mbit/s from 8 MHz would need 4 quanta a bit.
+
+      canBitTiming(16000000UL, 500000UL)    CNF1 << 16 | CNF2 << 8 | CNF3
+
+  MCP2515::setCANBaud() programs the result for MCP2515_OSC_HZ.
+  host/bench_bittiming checks every CAN_BAUD_ rate against several
+  crystals.
+*/
+
+#ifndef CANOPNR_BitTiming_h
+#define CANOPNR_BitTiming_h
+
+#include "CANOPNR_MCP2515.h"
+
+//Farthest a programmed bitrate may be from the one asked for; CAN allows
+//a few thousand ppm between two nodes, most of it for their crystals
+#define CAN_TIMING_TOLERANCE_PPM 1000
+
+//Bits per second of a CAN_BAUD_ constant, 0 if there is none
+constexpr unsigned long canBaudRate(int baudConst)
+{
+  return (baudConst == CAN_BAUD_10K) ? 10000UL :
+         (baudConst == CAN_BAUD_50K) ? 50000UL :
+         (baudConst == CAN_BAUD_100K) ? 100000UL :
+         (baudConst == CAN_BAUD_125K) ? 125000UL :
+         (baudConst == CAN_BAUD_250K) ? 250000UL :
+         (baudConst == CAN_BAUD_500K) ? 500000UL :
+         (baudConst == CAN_BAUD_1000K) ? 1000000UL :
+         (baudConst == CAN_BAUD_83K3) ? 83333UL : 0;
+}
+
+//CiA 301: 87.5% up to 800 kbit/s, 75% above
+constexpr unsigned int canSamplePoint(unsigned long rate) { return (rate > 800000UL) ? 750 : 875; }
+
+constexpr unsigned long canClamp(unsigned long v, unsigned long lo, unsigned long hi)
+{
+  return (v < lo) ? lo : (v > hi) ? hi : v;
+}
+
+constexpr unsigned long canAbsDiff(unsigned long a, unsigned long b) { return (a > b) ? a - b : b - a; }
+
+//Nearest prescaler for n quanta a bit
+constexpr unsigned long canBrp(unsigned long osc, unsigned long rate, byte n)
+{
+  return canClamp((osc + rate * n) / (2 * rate * n), 1, 64);
+}
+
+//PS2 nearest the sample point, leaving PropSeg + PS1 in 2-16 and >= PS2
+constexpr byte canPs2(byte n, unsigned int sp)
+{
+  return canClamp(canClamp((n * (1000UL - sp) + 500) / 1000, 2, ((n - 1) / 2 < 8) ? (n - 1) / 2 : 8),
+                  (n > 17) ? n - 17 : 2, 8);
+}
+
+//How far osc / (2 * brp * n) is from rate, in ppm
+constexpr unsigned long canRatePpm(unsigned long osc, unsigned long rate, unsigned long brp, byte n)
+{
+  return (unsigned long)((unsigned long long)canAbsDiff(osc, 2 * rate * brp * n) * 1000000ULL / osc);
+}
+
+constexpr unsigned long canSamplePointError(byte n, unsigned int sp)
+{
+  return canAbsDiff(1000UL * (n - canPs2(n, sp)) / n, sp);
+}
+
+//Bitrate error first, then sample point, then more quanta
+constexpr unsigned long long canTimingCost(unsigned long osc, unsigned long rate, unsigned int sp, byte n)
+{
+  return ((unsigned long long)canRatePpm(osc, rate, canBrp(osc, rate, n), n) * 1024 + canSamplePointError(n, sp)) * 32
+         + (25 - n);
+}
+
+constexpr byte canBestQuanta(unsigned long osc, unsigned long rate, unsigned int sp, byte n = 5, byte best = 5)
+{
+  return (n > 25) ? best :
+         canBestQuanta(osc, rate, sp, n + 1, (canTimingCost(osc, rate, sp, n) < canTimingCost(osc, rate, sp, best)) ? n : best);
+}
+
+//PropSeg + PS1 split evenly, PS1 taking the odd quantum; SJW as wide as PS2 allows;
+//BTLMODE set so PS2 comes from CNF3
+constexpr unsigned long canTimingRegs(unsigned long brp, byte n, byte ps2)
+{
+  return ((unsigned long)((((ps2 > 5) ? 4 : ps2 - 1) - 1) << 6 | (brp - 1)) << 16)
+         | ((unsigned long)(0x80 | ((n - 1 - ps2 - (n - 1 - ps2) / 2 - 1) << 3) | ((n - 1 - ps2) / 2 - 1)) << 8)
+         | (unsigned long)(ps2 - 1);
+}
+
+constexpr unsigned long canBitTimingFor(unsigned long osc, unsigned long rate, unsigned int sp, byte n)
+{
+  return (canRatePpm(osc, rate, canBrp(osc, rate, n), n) > CAN_TIMING_TOLERANCE_PPM) ? 0 :
+         canTimingRegs(canBrp(osc, rate, n), n, canPs2(n, sp));
+}
+
+//CNF1 << 16 | CNF2 << 8 | CNF3, or 0 if the crystal cannot make the rate
+constexpr unsigned long canBitTiming(unsigned long osc, unsigned long rate, unsigned int sp)
+{
+  return (rate == 0) ? 0 : canBitTimingFor(osc, rate, sp, canBestQuanta(osc, rate, sp));
+}
+
+constexpr unsigned long canBitTiming(unsigned long osc, unsigned long rate)
+{
+  return canBitTiming(osc, rate, canSamplePoint(rate));
+}
+
+#endif
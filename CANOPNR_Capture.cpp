@@ -0,0 +1,284 @@
+/*
+   This file is included as part of the CANOPNR distribution.
+   You are free to use this project as you see fit, provided credit is given to all
+   contributors (original and subsequent).
+
+   Copyright 2012  Jose Denrie Enriquez, Alex Bautista, Paloma Field, Sun-il Kim
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+  ------------------------------------------------------------------------------------------------------------
+
+  Raw CAN frame capture to the SD card, see CANOPNR_Capture.h.
+*/
+
+#include <string.h>
+#include "CANOPNR_Capture.h"
+
+#define FLAG_EXT 0x10
+#define FLAG_RTR 0x20
+
+//The channel goes in the top three bits of the identifier field, which a
+//standard (11-bit) or extended (29-bit) ID leaves free
+#define CHANNEL_SHIFT_STD 13
+#define CHANNEL_SHIFT_EXT 29
+
+static void putLE(uint8_t *p, uint32_t v, byte n)
+{
+  while(n-- > 0)
+  {
+    *p++ = v;
+    v >>= 8;
+  }
+}
+
+static uint32_t getLE(const uint8_t *p, byte n)
+{
+  uint32_t v = 0;
+
+  while(n-- > 0)
+    v = (v << 8) | p[n];
+  return v;
+}
+
+CaptureLog::CaptureLog()
+{
+  card = 0;
+  blocks = 0;
+  session = 0;
+  closed = 0;
+  written = 0;
+  fill = 0;
+  waiting = false;
+  active = false;
+  used = 0;
+  last = 0;
+  frames = 0;
+  drops = 0;
+  errors = 0;
+}
+
+/*
+ * Starts a multi-block write over the range. The session number moves on
+ * from the one in the first block, so sectors left from an older capture
+ * are not read as part of this one.
+ */
+boolean CaptureLog::begin(Sd2Card *sd, uint32_t firstBlock, uint32_t blockCount)
+{
+  uint32_t old = 0;
+
+  card = sd;
+  blocks = blockCount;
+  closed = 0;
+  written = 0;
+  fill = 0;
+  waiting = false;
+  used = 0;
+  if(card->readBlock(firstBlock, buf[0]) && getLE(buf[0], 2) == CAPTURE_MAGIC)
+    old = getLE(buf[0] + 4, 4);
+  session = old + 1;
+  active = card->writeStart(firstBlock, blockCount);
+  if(!active)
+    errors++;
+  return active;
+}
+
+void CaptureLog::closeSector()
+{
+  uint8_t *s = buf[fill];
+
+  putLE(s, CAPTURE_MAGIC, 2);
+  putLE(s + 2, used, 2);
+  putLE(s + 4, session, 4);
+  putLE(s + 8, closed, 4);
+  memset(s + used, 0, CAPTURE_SECTOR_SIZE - used);
+  closed++;
+  waiting = true;
+  fill ^= 1;
+  used = 0;
+}
+
+boolean CaptureLog::add(const CANMSG *msg, unsigned long stamp, byte channel)
+{
+  uint8_t *p;
+  uint32_t delta, id;
+  byte dlc = (msg->dataLength > 8) ? 8 : msg->dataLength;
+  byte dn, idn, len;
+
+  if(!active || closed >= blocks)
+  {
+    drops++;
+    return false;
+  }
+  //Frames from two controllers can be stamped a hair out of order
+  delta = (used == 0 || (long)(stamp - last) < 0) ? 0 : stamp - last;
+  dn = (delta < 0x100UL) ? 1 : (delta < 0x10000UL) ? 2 : (delta < 0x1000000UL) ? 3 : 4;
+  idn = msg->isExtendedAdrs ? 4 : 2;
+  len = 1 + dn + idn + (msg->rtr ? 0 : dlc);
+  if(used + len > CAPTURE_SECTOR_SIZE)
+  {
+    if(waiting)
+    {
+      drops++; //service() has not caught up
+      return false;
+    }
+    closeSector();
+    if(closed >= blocks)
+    {
+      drops++;
+      return false;
+    }
+    delta = 0;
+    dn = 1;
+    len = 1 + dn + idn + (msg->rtr ? 0 : dlc);
+  }
+  if(used == 0)
+  {
+    putLE(buf[fill] + 12, stamp, 4);
+    used = CAPTURE_HEADER_SIZE;
+    last = stamp;
+  }
+
+  p = buf[fill] + used;
+  *p++ = dlc | (msg->isExtendedAdrs ? FLAG_EXT : 0) | (msg->rtr ? FLAG_RTR : 0) | ((dn - 1) << 6);
+  putLE(p, delta, dn);
+  p += dn;
+  if(msg->isExtendedAdrs)
+    id = msg->extendedAdrsValue | ((uint32_t)(channel & (CAPTURE_CHANNELS - 1)) << CHANNEL_SHIFT_EXT);
+  else
+    id = msg->adrsValue | ((uint32_t)(channel & (CAPTURE_CHANNELS - 1)) << CHANNEL_SHIFT_STD);
+  putLE(p, id, idn);
+  p += idn;
+  if(!msg->rtr)
+    memcpy(p, msg->data, dlc);
+  used += len;
+  if(delta > 0)
+    last = stamp;
+  frames++;
+  return true;
+}
+
+boolean CaptureLog::pending()
+{
+  return waiting;
+}
+
+boolean CaptureLog::service()
+{
+  if(!waiting)
+    return true;
+  waiting = false;
+  if(!active)
+    return false;
+  if(!card->writeData(buf[fill ^ 1]))
+  {
+    errors++;
+    active = false;
+    return false;
+  }
+  written++;
+  if(written == blocks)
+  {
+    card->writeStop();
+    active = false;
+  }
+  return true;
+}
+
+void CaptureLog::flush()
+{
+  if(used > 0 && !waiting)
+    closeSector();
+}
+
+void CaptureLog::end()
+{
+  service();
+  flush();
+  service();
+  if(active)
+    card->writeStop();
+  active = false;
+}
+
+boolean CaptureLog::full()
+{
+  return closed >= blocks;
+}
+
+unsigned long CaptureLog::getFrameCount()
+{
+  return frames;
+}
+
+unsigned long CaptureLog::getDropCount()
+{
+  return drops;
+}
+
+unsigned long CaptureLog::getSectorCount()
+{
+  return written;
+}
+
+unsigned long CaptureLog::getErrorCount()
+{
+  return errors;
+}
+
+boolean captureReadFrame(const uint8_t *sector, uint16_t *pos, CANMSG *msg, uint32_t *delta, byte *channel)
+{
+  uint16_t used = getLE(sector + 2, 2);
+  uint16_t p = *pos;
+  uint32_t id;
+  byte head, dn, idn, dlc;
+
+  if(p < CAPTURE_HEADER_SIZE)
+    p = CAPTURE_HEADER_SIZE;
+  if(used > CAPTURE_SECTOR_SIZE || p >= used)
+    return false;
+  head = sector[p];
+  dlc = head & 0x0F;
+  dn = (head >> 6) + 1;
+  idn = (head & FLAG_EXT) ? 4 : 2;
+  if(dlc > 8 || p + 1 + dn + idn + ((head & FLAG_RTR) ? 0 : dlc) > used)
+    return false;
+  p++;
+  memset(msg, 0, sizeof(*msg));
+  *delta = getLE(sector + p, dn);
+  p += dn;
+  msg->isExtendedAdrs = (head & FLAG_EXT) != 0;
+  id = getLE(sector + p, idn);
+  if(msg->isExtendedAdrs)
+  {
+    msg->extendedAdrsValue = id & ((1UL << CHANNEL_SHIFT_EXT) - 1);
+    if(channel != 0)
+      *channel = id >> CHANNEL_SHIFT_EXT;
+  }
+  else
+  {
+    msg->adrsValue = id & ((1U << CHANNEL_SHIFT_STD) - 1);
+    if(channel != 0)
+      *channel = id >> CHANNEL_SHIFT_STD;
+  }
+  p += idn;
+  msg->rtr = (head & FLAG_RTR) != 0;
+  msg->dataLength = dlc;
+  if(!msg->rtr)
+  {
+    memcpy(msg->data, sector + p, dlc);
+    p += dlc;
+  }
+  *pos = p;
+  return true;
+}
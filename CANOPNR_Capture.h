@@ -0,0 +1,112 @@
+/*
+   This file is included as part of the CANOPNR distribution.
+   You are free to use this project as you see fit, provided credit is given to all
+   contributors (original and subsequent).
+
+   Copyright 2012  Jose Denrie Enriquez, Alex Bautista, Paloma Field, Sun-il Kim
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+  ------------------------------------------------------------------------------------------------------------
+
+  Raw CAN frame capture to the SD card, every frame with its time.
+
+  Frames are packed into 512-byte sectors in RAM and streamed to a range of
+  blocks (a contiguous file, see SdFile::createContiguous()) with one
+  multi-block write, so there is no FAT update and no per-sector command
+  overhead. There are two sector buffers: while a full one waits for
+  service(), frames go into the other. The SD card and the MCP2515 share the
+  SPI bus, and an SD transfer masks the CAN interrupt for about a
+  millisecond, so call service() when the receive ring is empty; frames
+  arriving meanwhile wait in the MCP2515's two RX buffers.
+
+  Sector layout, little-endian:
+
+    off  size  field
+      0     2  CAPTURE_MAGIC
+      2     2  bytes used, header included
+      4     4  session, one more than the session found in the first block
+      8     4  sector number within the session
+     12     4  micros() of the first frame in the sector
+     16     -  frames
+
+  Frame:
+
+      1  DLC (bits 0-3), extended ID (bit 4), RTR (bit 5),
+         size of the time delta minus one (bits 6-7)
+    1-4  microseconds since the previous frame (0 for a sector's first)
+    2/4  standard / extended identifier, channel in the top three bits
+    0-8  data, none for a remote frame
+
+  The channel is the CANChannels number of the bus the frame came from,
+  0 with a single controller. A frame stamped before the one logged ahead
+  of it (two controllers read a few microseconds apart) gets a delta of 0.
+
+  A frame never spans two sectors, so each sector decodes on its own and a
+  power loss costs at most the two sectors still in RAM. A reader stops at
+  the first sector with another session or an unexpected sector number.
+*/
+
+#ifndef CANOPNR_Capture_h
+#define CANOPNR_Capture_h
+
+#include "CANOPNR_MCP2515.h"
+#include <SD.h>
+
+#define CAPTURE_MAGIC 0x4C43      //"CL"
+#define CAPTURE_SECTOR_SIZE 512
+#define CAPTURE_HEADER_SIZE 16
+#define CAPTURE_FRAME_MAX 17      //1 + 4 + 4 + 8
+#define CAPTURE_CHANNELS 8        //channel numbers that fit the identifier field
+
+class CaptureLog
+{
+  public:
+    CaptureLog();
+    boolean begin(Sd2Card *card, uint32_t firstBlock, uint32_t blockCount);
+    boolean add(const CANMSG *msg, unsigned long stamp, byte channel = 0); //false if the frame was dropped
+    boolean pending();                //a full sector waits for service()
+    boolean service();                //writes one waiting sector; false on an SD error
+    void flush();                     //closes the partial sector so service() writes it
+    void end();                       //writes everything buffered and ends the write
+    boolean full();                   //the block range is used up
+
+    unsigned long getFrameCount();
+    unsigned long getDropCount();     //no buffer free, range full or SD error
+    unsigned long getSectorCount();
+    unsigned long getErrorCount();
+
+  private:
+    Sd2Card *card;
+    uint32_t blocks;
+    uint32_t session;
+    uint32_t closed;      //sectors handed to service(), written or waiting
+    uint32_t written;
+    uint8_t buf[2][CAPTURE_SECTOR_SIZE];
+    byte fill;            //buffer taking frames
+    boolean waiting;      //buf[fill ^ 1] is full and not yet written
+    boolean active;       //multi-block write in progress
+    uint16_t used;        //bytes in buf[fill], 0 when no sector is open
+    unsigned long last;   //stamp of the previous frame
+    unsigned long frames;
+    unsigned long drops;
+    unsigned long errors;
+    void closeSector();
+};
+
+//Reads the frame at *pos of a sector and advances *pos. delta is the
+//microseconds since the previous frame, channel (if not 0) the bus it came
+//from. False at the end of the sector.
+boolean captureReadFrame(const uint8_t *sector, uint16_t *pos, CANMSG *msg, uint32_t *delta, byte *channel = 0);
+
+#endif
@@ -0,0 +1,461 @@
+/*
+   This file is included as part of the CANOPNR distribution.
+   You are free to use this project as you see fit, provided credit is given to all
+   contributors (original and subsequent).
+
+   Copyright 2012  Jose Denrie Enriquez, Alex Bautista, Paloma Field, Sun-il Kim
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+  ------------------------------------------------------------------------------------------------------------
+
+  Persistent SIM900 TCP session on the AT command engine, see CANOPNR_GPRS.h.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "CANOPNR_GPRS.h"
+
+#define GPRS_PROBE_TRIES 2
+#define GPRS_SETUP_TRIES 3
+
+//phase, in the order the link comes up
+#define LINK_OFF 0
+#define LINK_POWER 1        //power key pulse
+#define LINK_PROBE 2        //waiting for an answer to AT
+#define LINK_SETUP 3        //setup commands queued
+#define LINK_SHUTDOWN 4     //CIPSHUT before powering down
+#define LINK_READY 5        //IP INITIAL, APN set
+#define LINK_CONNECTING 6
+#define LINK_ONLINE 7
+#define LINK_SENDING 8
+
+//command tags, 0 means none in ATEngine::current()
+#define TAG_PROBE 1
+#define TAG_ECHO 2
+#define TAG_SHUT 3
+#define TAG_MUX 4
+#define TAG_MODE 5
+#define TAG_QSEND 6
+#define TAG_CONTEXT 7
+#define TAG_APN 8
+#define TAG_CONNECT 9
+#define TAG_SEND 10
+#define TAG_CSQ 11
+#define TAG_OFF 12
+
+//power key: low, high (pressed), low while the modem boots
+static const unsigned int powerSteps[3] = {1000, 2500, 3500};
+
+GPRSLink::GPRSLink(Stream &port, byte powerPin) : at(port)
+{
+  pin = powerPin;
+  server = 0;
+  apn = 0;
+  phase = LINK_OFF;
+  step = 0;
+  stepAt = 0;
+  online = false;
+  deactivated = false;
+  offAfter = false;
+  connectFailures = 0;
+  data = 0;
+  len = 0;
+  offset = 0;
+  attempts = 0;
+  state = GPRS_SEND_IDLE;
+  rssi = 99;
+  csqAt = 0;
+  connects = 0;
+  drops = 0;
+  resets = 0;
+  chunks = 0;
+  powers = 0;
+  at.setHandlers(done, unsolicited, this);
+}
+
+void GPRSLink::setServer(const char *cipstart)
+{
+  server = cipstart;
+}
+
+/*
+ * Starts bringing the modem to the IP INITIAL state with the APN set. If it
+ * does not answer AT the power key is pulsed and it is tried again, as long
+ * as it takes; ready() tells when the setup is through.
+ */
+void GPRSLink::begin(const char *apnName)
+{
+  if(phase == LINK_POWER)
+    digitalWrite(pin, LOW); //let go of the power key
+  apn = apnName;
+  online = false;
+  deactivated = false;
+  offAfter = false;
+  connectFailures = 0;
+  step = 0;
+  probe();
+}
+
+void GPRSLink::probe()
+{
+  at.flush();
+  phase = LINK_PROBE;
+  at.queue("AT", 0, GPRS_COMMAND_TIMEOUT, TAG_PROBE);
+}
+
+void GPRSLink::setup()
+{
+  ATCOMMAND c;
+
+  at.flush();
+  phase = LINK_SETUP;
+  at.queue("ATE0", 0, GPRS_COMMAND_TIMEOUT, TAG_ECHO); //no echo: every line read is a reply
+  at.queue("AT+CIPSHUT", "SHUT OK", GPRS_COMMAND_TIMEOUT, TAG_SHUT);
+  at.queue("AT+CIPMUX=0", 0, GPRS_COMMAND_TIMEOUT, TAG_MUX);       //single connection
+  at.queue("AT+CIPMODE=0", 0, GPRS_COMMAND_TIMEOUT, TAG_MODE);     //normal, not transparent mode
+  at.queue("AT+CIPQSEND=1", 0, GPRS_COMMAND_TIMEOUT, TAG_QSEND);   //DATA ACCEPT instead of SEND OK
+  memset(&c, 0, sizeof(c));
+  c.text = "AT+CGDCONT=1,\"IP\",\"%\"";
+  c.param = apn;
+  c.timeout = GPRS_COMMAND_TIMEOUT;
+  c.tag = TAG_CONTEXT;
+  at.queue(c);
+  c.text = "AT+CSTT=\"%\"";
+  c.tag = TAG_APN;
+  at.queue(c);
+}
+
+void GPRSLink::pressPower()
+{
+  at.flush();
+  powers++;
+  phase = LINK_POWER;
+  step = 0;
+  stepAt = millis();
+  pinMode(pin, OUTPUT);
+  digitalWrite(pin, LOW);
+}
+
+void GPRSLink::powerDown()
+{
+  at.flush();
+  lost();
+  if(state == GPRS_SEND_BUSY)
+    state = GPRS_SEND_FAILED;
+  offAfter = true;
+  phase = LINK_SHUTDOWN;
+  at.queue("AT+CIPSHUT", "SHUT OK", GPRS_COMMAND_TIMEOUT, TAG_OFF);
+}
+
+void GPRSLink::lost()
+{
+  if(online)
+    drops++;
+  online = false;
+  if(phase == LINK_ONLINE)
+    phase = LINK_READY;
+}
+
+void GPRSLink::connect()
+{
+  ATCOMMAND c;
+
+  if(server == 0)
+  {
+    state = GPRS_SEND_FAILED;
+    return;
+  }
+  if(connectFailures >= GPRS_RESET_AFTER)
+  {
+    resets++;
+    connectFailures = 0;
+    step = 0;
+    probe();
+    return;
+  }
+  phase = LINK_CONNECTING;
+  if(deactivated)
+  {
+    at.queue("AT+CIPSHUT", "SHUT OK", GPRS_COMMAND_TIMEOUT, TAG_SHUT);
+    deactivated = false;
+  }
+  memset(&c, 0, sizeof(c));
+  c.text = server;
+  c.want = "CONNECT OK";
+  c.alt = "ALREADY CONNECT";
+  c.timeout = GPRS_CONNECT_TIMEOUT;
+  c.tag = TAG_CONNECT;
+  at.queue(c);
+}
+
+void GPRSLink::sendChunk()
+{
+  ATCOMMAND c;
+
+  memset(&c, 0, sizeof(c));
+  c.text = "AT+CIPSEND=%";
+  c.num = (len - offset > GPRS_MAX_SEND) ? GPRS_MAX_SEND : len - offset;
+  c.data = data + offset;
+  c.want = "DATA ACCEPT";
+  c.alt = "SEND OK";
+  c.timeout = GPRS_SEND_TIMEOUT;
+  c.tag = TAG_SEND;
+  phase = LINK_SENDING;
+  at.queue(c);
+}
+
+//The payload starts over on the next session; the server may see its
+//leading part twice
+void GPRSLink::sendFailed()
+{
+  offset = 0;
+  attempts++;
+  if(attempts >= GPRS_SEND_ATTEMPTS)
+    state = GPRS_SEND_FAILED;
+}
+
+void GPRSLink::done(void *ctx, byte tag, byte result, const char *)
+{
+  ((GPRSLink *)ctx)->commandDone(tag, result);
+}
+
+void GPRSLink::unsolicited(void *ctx, const char *line)
+{
+  ((GPRSLink *)ctx)->handleLine(line);
+}
+
+/*
+ * Results that belong to an earlier phase (a reply still in flight when
+ * begin() or powerDown() started over) are ignored.
+ */
+void GPRSLink::commandDone(byte tag, byte result)
+{
+  uint16_t n;
+
+  switch(tag)
+  {
+    case TAG_PROBE:
+      if(phase != LINK_PROBE)
+        return;
+      if(result == AT_MATCH)
+      {
+        step = 0;
+        setup();
+      }
+      else if(++step < GPRS_PROBE_TRIES)
+        at.queue("AT", 0, GPRS_COMMAND_TIMEOUT, TAG_PROBE);
+      else
+        pressPower(); //powered off
+      return;
+
+    case TAG_MUX:
+    case TAG_MODE:
+    case TAG_QSEND:
+    case TAG_CONTEXT:
+    case TAG_APN:
+      if(phase != LINK_SETUP)
+        return;
+      if(result != AT_MATCH)
+      {
+        if(++step < GPRS_SETUP_TRIES)
+          setup();
+        else
+          pressPower(); //keeps rejecting the setup
+      }
+      else if(tag == TAG_APN)
+      {
+        phase = LINK_READY;
+        step = 0;
+      }
+      return;
+
+    case TAG_CONNECT:
+      if(phase != LINK_CONNECTING)
+        return;
+      if(result == AT_MATCH)
+      {
+        phase = LINK_ONLINE;
+        online = true;
+        connectFailures = 0;
+        connects++;
+        return;
+      }
+      //CONNECT FAIL or no answer: the IP state is unknown, start it over
+      phase = LINK_READY;
+      connectFailures++;
+      at.queue("AT+CIPSHUT", "SHUT OK", GPRS_COMMAND_TIMEOUT, TAG_SHUT);
+      sendFailed();
+      return;
+
+    case TAG_SEND:
+      if(phase != LINK_SENDING)
+        return;
+      phase = online ? LINK_ONLINE : LINK_READY;
+      if(result == AT_MATCH)
+      {
+        n = (len - offset > GPRS_MAX_SEND) ? GPRS_MAX_SEND : len - offset;
+        chunks++;
+        offset += n;
+        if(offset == len)
+        {
+          state = GPRS_SEND_DONE;
+          return;
+        }
+        if(online)
+          return;
+      }
+      else
+        lost();
+      sendFailed();
+      return;
+
+    case TAG_CSQ:
+      if(result != AT_MATCH)
+        rssi = 99;
+      return;
+
+    case TAG_OFF:
+      if(phase != LINK_SHUTDOWN)
+        return;
+      if(result == AT_TIMEOUT)
+        phase = LINK_OFF; //no answer, already off
+      else
+        pressPower();
+      return;
+  }
+}
+
+//The modem reports a lost session on its own, in between command replies
+void GPRSLink::handleLine(const char *line)
+{
+  if(strncmp(line, "CLOSED", 6) == 0)
+    lost();
+  else if(strncmp(line, "+PDP: DEACT", 11) == 0)
+  {
+    lost();
+    deactivated = true;
+  }
+  else if(strncmp(line, "+CSQ: ", 6) == 0) //"+CSQ: <rssi>,<ber>"
+    rssi = atoi(line + 6);
+}
+
+void GPRSLink::service()
+{
+  at.service();
+
+  if(phase == LINK_POWER)
+  {
+    if(millis() - stepAt < powerSteps[step])
+      return;
+    stepAt = millis();
+    step++;
+    if(step == 1)
+      digitalWrite(pin, HIGH);
+    else if(step == 2)
+      digitalWrite(pin, LOW);
+    else if(offAfter)
+    {
+      offAfter = false;
+      phase = LINK_OFF;
+    }
+    else
+    {
+      step = 0;
+      probe();
+    }
+    return;
+  }
+
+  if(!at.idle())
+    return;
+  if(state == GPRS_SEND_BUSY)
+  {
+    if(phase == LINK_READY)
+      connect();
+    else if(phase == LINK_ONLINE)
+      sendChunk();
+  }
+  else if(phase >= LINK_READY && millis() - csqAt >= GPRS_CSQ_INTERVAL)
+  {
+    csqAt = millis();
+    at.queue("AT+CSQ", 0, GPRS_COMMAND_TIMEOUT, TAG_CSQ);
+  }
+}
+
+boolean GPRSLink::send(const uint8_t *payload, uint16_t length)
+{
+  if(state == GPRS_SEND_BUSY)
+    return false;
+  data = payload;
+  len = length;
+  offset = 0;
+  attempts = 0;
+  state = GPRS_SEND_BUSY;
+  return true;
+}
+
+byte GPRSLink::sendState()
+{
+  return state;
+}
+
+boolean GPRSLink::connected()
+{
+  return online;
+}
+
+boolean GPRSLink::ready()
+{
+  return phase >= LINK_READY;
+}
+
+boolean GPRSLink::idle()
+{
+  return at.idle() && phase != LINK_POWER;
+}
+
+byte GPRSLink::signalQuality()
+{
+  return rssi;
+}
+
+unsigned long GPRSLink::getConnectCount()
+{
+  return connects;
+}
+
+unsigned long GPRSLink::getDropCount()
+{
+  return drops;
+}
+
+unsigned long GPRSLink::getResetCount()
+{
+  return resets;
+}
+
+unsigned long GPRSLink::getChunkCount()
+{
+  return chunks;
+}
+
+unsigned long GPRSLink::getPowerCount()
+{
+  return powers;
+}
+
+unsigned long GPRSLink::getCommandCount()
+{
+  return at.getCommandCount();
+}
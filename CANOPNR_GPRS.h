@@ -0,0 +1,126 @@
+/*
+   This file is included as part of the CANOPNR distribution.
+   You are free to use this project as you see fit, provided credit is given to all
+   contributors (original and subsequent).
+
+   Copyright 2012  Jose Denrie Enriquez, Alex Bautista, Paloma Field, Sun-il Kim
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+  ------------------------------------------------------------------------------------------------------------
+
+  SIM900 GPRS uplink that keeps one TCP session open across loop() cycles.
+
+  Nothing here waits: send() and begin() only start work, and service(),
+  called from loop() between CAN and GPS reads, moves it along on the AT
+  command engine (CANOPNR_AT.h). Each call takes a few milliseconds at most,
+  so frames keep being collected while the modem connects or sends.
+
+  send() opens the connection only when there is none, then writes the
+  payload with AT+CIPSEND in chunks of up to GPRS_MAX_SEND bytes. Quick send
+  mode (AT+CIPQSEND=1) is enabled, so each chunk is acknowledged with
+  "DATA ACCEPT" once the modem has it instead of "SEND OK" after the server's
+  TCP ack, and consecutive chunks and sends go out back to back. sendState()
+  reports the outcome; the payload must be left alone until it is DONE or
+  FAILED.
+
+  The session is only dropped on a real failure: an ERROR or FAIL reply, a
+  timeout, or an unsolicited CLOSED / +PDP: DEACT line. The next send()
+  reconnects; after GPRS_RESET_AFTER failed connects in a row the modem is
+  set up again from scratch. If it does not answer AT, the power key on
+  powerPin is pulsed to switch it on.
+
+  Works on any Stream (SoftwareSerial on the board, host/SIM900Sim.h on a PC).
+*/
+
+#ifndef CANOPNR_GPRS_h
+#define CANOPNR_GPRS_h
+
+#include "Arduino.h"
+#include "CANOPNR_AT.h"
+
+#define GPRS_MAX_SEND 512         //bytes per AT+CIPSEND, the SIM900 takes up to 1460
+#define GPRS_RESET_AFTER 3        //failed connects in a row before the setup runs again
+#define GPRS_SEND_ATTEMPTS 2      //sessions tried per send() before it is FAILED
+
+#define GPRS_COMMAND_TIMEOUT 1000
+#define GPRS_CONNECT_TIMEOUT 10000
+#define GPRS_SEND_TIMEOUT 10000
+#define GPRS_CSQ_INTERVAL 10000   //ms between AT+CSQ while the link is idle
+
+//sendState()
+#define GPRS_SEND_IDLE 0
+#define GPRS_SEND_BUSY 1
+#define GPRS_SEND_DONE 2
+#define GPRS_SEND_FAILED 3
+
+class GPRSLink
+{
+  public:
+    GPRSLink(Stream &port, byte powerPin);
+    void setServer(const char *cipstart);  //the whole AT+CIPSTART=... command
+    void begin(const char *apn);            //starts the modem setup
+    void service();                         //call from loop(), never waits
+    boolean send(const uint8_t *data, uint16_t len); //false while a send is in flight
+    byte sendState();
+    boolean connected();
+    boolean ready();                        //set up and not powering or resetting
+    void powerDown();                       //CIPSHUT, then the power key
+    boolean idle();                         //no command or power key pulse in progress
+    byte signalQuality();                   //last +CSQ rssi, 99 if unknown
+
+    unsigned long getConnectCount();
+    unsigned long getDropCount();
+    unsigned long getResetCount();
+    unsigned long getChunkCount();
+    unsigned long getPowerCount();
+    unsigned long getCommandCount();
+
+  private:
+    ATEngine at;
+    byte pin;
+    const char *server;
+    const char *apn;
+    byte phase;
+    byte step;            //power key pulse step, or probe/setup try
+    unsigned long stepAt;
+    boolean online;       //TCP session believed open
+    boolean deactivated;  //PDP context lost, CIPSHUT needed before CIPSTART
+    boolean offAfter;     //power down once CIPSHUT is through
+    byte connectFailures;
+    const uint8_t *data;
+    uint16_t len;
+    uint16_t offset;
+    byte attempts;
+    byte state;
+    byte rssi;
+    unsigned long csqAt;
+    unsigned long connects;
+    unsigned long drops;
+    unsigned long resets;
+    unsigned long chunks;
+    unsigned long powers;
+    static void done(void *ctx, byte tag, byte result, const char *line);
+    static void unsolicited(void *ctx, const char *line);
+    void commandDone(byte tag, byte result);
+    void handleLine(const char *line);
+    void probe();
+    void setup();
+    void pressPower();
+    void connect();
+    void sendChunk();
+    void sendFailed();
+    void lost();
+};
+
+#endif
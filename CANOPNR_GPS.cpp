@@ -0,0 +1,302 @@
+/*
+   This file is included as part of the CANOPNR distribution.
+   You are free to use this project as you see fit, provided credit is given to all
+   contributors (original and subsequent).
+
+   Copyright 2012  Jose Denrie Enriquez, Alex Bautista, Paloma Field, Sun-il Kim
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+  ------------------------------------------------------------------------------------------------------------
+
+  NMEA parsing, see CANOPNR_GPS.h.
+
+  $GPRMC,hhmmss.sss,A,ddmm.mmmm,N,dddmm.mmmm,W,knots,course,ddmmyy,,,A*hh
+  $GPGGA,hhmmss.sss,ddmm.mmmm,N,dddmm.mmmm,W,quality,sats,hdop,alt,M,geoid,M,,*hh
+*/
+
+#include <string.h>
+#include "CANOPNR_GPS.h"
+
+//NMEAPARSER.state
+#define NMEA_IDLE 0           //waiting for '$'
+#define NMEA_BODY 1
+#define NMEA_CHECK_HI 2       //first checksum digit after '*'
+#define NMEA_CHECK_LO 3
+
+//Fields after the address, up to the '*': RMC has 11 before NMEA 2.3, GGA always 14.
+//A lost comma changes the count even where it leaves the XOR checksum intact.
+#define RMC_MIN_FIELDS 11
+#define GGA_FIELDS 14
+
+static uint8_t hexValue(char c)
+{
+  if(c >= '0' && c <= '9')
+    return c - '0';
+  if(c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  if(c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  return 0xFF;
+}
+
+//Reads up to 'count' digits; stops at the first non-digit
+static uint32_t readDigits(const char **p, uint8_t count)
+{
+  uint32_t val = 0;
+
+  while(count > 0 && **p >= '0' && **p <= '9')
+  {
+    val = val * 10 + (**p - '0');
+    (*p)++;
+    count--;
+  }
+  return val;
+}
+
+//"123.45" with 'places' fractional digits kept: 12345 for places = 2
+static uint32_t readFixed(const char *p, uint8_t places)
+{
+  uint32_t val = readDigits(&p, 9);
+  uint8_t i;
+
+  if(*p == '.')
+    p++;
+  for(i = 0; i < places; i++)
+  {
+    val *= 10;
+    if(*p >= '0' && *p <= '9')
+      val += *p++ - '0';
+  }
+  return val;
+}
+
+//"ddmm.mmmm" or "dddmm.mmmm" to microdegrees; the hemisphere comes in the next field
+static int32_t readCoordinate(const char *p, uint8_t degDigits)
+{
+  uint32_t deg, microMin;
+
+  deg = readDigits(&p, degDigits);
+  microMin = readFixed(p, 6);   //minutes * 1e6
+  return deg * 1000000L + microMin / 60;
+}
+
+//"hhmmss.sss" to ms since midnight
+static uint32_t readTime(const char *p)
+{
+  uint32_t hms;
+
+  hms = readDigits(&p, 2) * 3600UL;
+  hms += readDigits(&p, 2) * 60UL;
+  hms += readDigits(&p, 2);
+  return hms * 1000UL + ((*p == '.') ? readFixed(p, 3) : 0);
+}
+
+//Days from 2000-01-01 to dd/mm/yy (20yy)
+static uint16_t daysSince2000(uint8_t d, uint8_t m, uint8_t y)
+{
+  static const uint16_t before[12] = {0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334};
+  uint16_t days;
+
+  if(m < 1 || m > 12 || d < 1)
+    return 0;
+  days = y * 365 + (y + 3) / 4 + before[m - 1] + d - 1;
+  if(m > 2 && (y % 4) == 0)
+    days++;
+  return days;
+}
+
+//"ddmmyy", 0 unless all six digits are there
+static uint16_t readDate(const char *p)
+{
+  uint8_t n, d, m, y;
+
+  for(n = 0; n < 6 && p[n] >= '0' && p[n] <= '9'; n++)
+    ;
+  if(n != 6)
+    return 0;
+  d = readDigits(&p, 2);
+  m = readDigits(&p, 2);
+  y = readDigits(&p, 2);
+  return daysSince2000(d, m, y);
+}
+
+//An empty field, or 'before' digits and then '.' or the end. Lost digits move the point.
+static bool pointAt(const char *t, uint8_t len, uint8_t before)
+{
+  uint8_t i;
+
+  if(len == 0)
+    return true;
+  if(len < before || (len > before && t[before] != '.'))
+    return false;
+  for(i = 0; i < before; i++)
+    if(t[i] < '0' || t[i] > '9')
+      return false;
+  return true;
+}
+
+//Field p->field of the sentence is complete in p->text
+static void takeField(NMEAPARSER *p)
+{
+  GPSFIX *f = &p->next;
+  const char *t = p->text;
+  uint8_t first;
+
+  p->text[p->len] = '\0';
+  //Time, latitude and longitude have a fixed number of digits before the point
+  first = (p->type == NMEA_RMC) ? 3 : 2;
+  if(p->field > 0 && ((p->field == 1 && !pointAt(t, p->len, 6)) ||
+                      (p->field == first && !pointAt(t, p->len, 4)) ||
+                      (p->field == first + 2 && !pointAt(t, p->len, 5))))
+  {
+    p->errors++;
+    p->state = NMEA_IDLE;
+    return;
+  }
+  if(p->field == 0)
+  {
+    //Address: two talker characters, then the sentence type
+    if(p->len == 5 && strcmp(t + 2, "RMC") == 0)
+      p->type = NMEA_RMC;
+    else if(p->len == 5 && strcmp(t + 2, "GGA") == 0)
+      p->type = NMEA_GGA;
+    else
+      p->state = NMEA_IDLE;   //not one we use, skip to the next '$'
+    return;
+  }
+
+  if(p->type == NMEA_RMC)
+  {
+    switch(p->field)
+    {
+      case 1: f->timeMs = readTime(t); break;
+      case 2: f->valid = (t[0] == 'A'); break;
+      case 3: f->lat = readCoordinate(t, 2); break;
+      case 4: if(t[0] == 'S') f->lat = -f->lat; break;
+      case 5: f->lon = readCoordinate(t, 3); break;
+      case 6: if(t[0] == 'W') f->lon = -f->lon; break;
+      case 7: f->speed = readFixed(t, 2); break;
+      case 8: f->course = readFixed(t, 2); break;
+      case 9: f->days = readDate(t); break;
+    }
+  }
+  else
+  {
+    switch(p->field)
+    {
+      case 1: f->timeMs = readTime(t); break;
+      case 2: f->lat = readCoordinate(t, 2); break;
+      case 3: if(t[0] == 'S') f->lat = -f->lat; break;
+      case 4: f->lon = readCoordinate(t, 3); break;
+      case 5: if(t[0] == 'W') f->lon = -f->lon; break;
+      case 6:
+        f->quality = readDigits(&t, 2);
+        f->valid = (f->quality > 0);
+        break;
+      case 7: f->satellites = readDigits(&t, 2); break;
+      case 8: f->hdop = readFixed(t, 2); break;
+      case 9:
+        f->altitude = (t[0] == '-') ? -(int32_t)readFixed(t + 1, 2) : (int32_t)readFixed(t, 2);
+        break;
+    }
+  }
+}
+
+void nmeaBegin(NMEAPARSER *p)
+{
+  memset(p, 0, sizeof(NMEAPARSER));
+  p->state = NMEA_IDLE;
+}
+
+uint8_t nmeaFeed(NMEAPARSER *p, char c)
+{
+  uint8_t v;
+
+  if(c == '$')
+  {
+    //A new sentence, even in the middle of one that lost its end
+    if(p->state != NMEA_IDLE && p->type != NMEA_NONE)
+      p->errors++;
+    p->state = NMEA_BODY;
+    p->type = NMEA_NONE;
+    p->field = 0;
+    p->len = 0;
+    p->sum = 0;
+    p->next = p->fix;
+    return NMEA_NONE;
+  }
+
+  switch(p->state)
+  {
+    case NMEA_BODY:
+      if(c == '\r' || c == '\n')
+      {
+        //No checksum: nothing tells a damaged sentence from a good one
+        if(p->type != NMEA_NONE)
+          p->errors++;
+        p->state = NMEA_IDLE;
+      }
+      else if(c == ',' || c == '*')
+      {
+        if(c == ',')
+          p->sum ^= c;
+        takeField(p);
+        p->field++;
+        p->len = 0;
+        if(c == '*' && p->state == NMEA_BODY)
+          p->state = NMEA_CHECK_HI;
+      }
+      else if(p->len < NMEA_FIELD_MAX)
+      {
+        p->sum ^= c;
+        p->text[p->len++] = c;
+      }
+      else
+      {
+        if(p->type != NMEA_NONE)
+          p->errors++;
+        p->state = NMEA_IDLE;
+      }
+      break;
+
+    case NMEA_CHECK_HI:
+    case NMEA_CHECK_LO:
+      v = hexValue(c);
+      if(v > 15)
+      {
+        p->errors++;
+        p->state = NMEA_IDLE;
+        break;
+      }
+      if(p->state == NMEA_CHECK_HI)
+      {
+        p->check = v << 4;
+        p->state = NMEA_CHECK_LO;
+        break;
+      }
+      p->state = NMEA_IDLE;
+      //p->field is one past the last field, the address included
+      if((p->check | v) != p->sum ||
+         (p->type == NMEA_RMC && p->field - 1 < RMC_MIN_FIELDS) ||
+         (p->type == NMEA_GGA && p->field - 1 != GGA_FIELDS))
+      {
+        p->errors++;
+        break;
+      }
+      p->fix = p->next;
+      p->sentences++;
+      return p->type;
+  }
+  return NMEA_NONE;
+}
@@ -0,0 +1,86 @@
+/*
+   This file is included as part of the CANOPNR distribution.
+   You are free to use this project as you see fit, provided credit is given to all
+   contributors (original and subsequent).
+
+   Copyright 2012  Jose Denrie Enriquez, Alex Bautista, Paloma Field, Sun-il Kim
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+  ------------------------------------------------------------------------------------------------------------
+
+  GPS fix as integers, parsed from the NMEA stream one byte at a time
+  without float or sscanf. Free of Arduino includes so the same code
+  decodes on a host.
+
+  The parser keeps only the field being read (at most NMEA_FIELD_MAX
+  characters), never a whole sentence. A sentence updates the fix only if
+  its checksum matches, it has the right number of fields and time and
+  position have their digits before the decimal point. Sentences without
+  a checksum, or with a byte lost on the way, are dropped and counted.
+  The XOR checksum cannot see two equal bytes lost from one sentence; the
+  other checks catch that when the bytes are commas or leading digits. Fields from $xxRMC (time, status,
+  position, speed, course, date) and $xxGGA (time, position, quality,
+  satellites, HDOP, altitude) go into one GPSFIX, so the latest values of
+  both are always at hand. Any talker ID is accepted: GP, GN, GL, ...
+*/
+
+#ifndef CANOPNR_GPS_h
+#define CANOPNR_GPS_h
+
+#include <stdint.h>
+
+#define NMEA_FIELD_MAX 15     //longest field kept, "dddmm.mmmmmmm"
+
+//nmeaFeed() results
+#define NMEA_NONE 0           //sentence not finished, or not used
+#define NMEA_RMC 1
+#define NMEA_GGA 2
+
+typedef struct
+{
+  bool valid;           //RMC status 'A', or GGA quality above 0
+  uint32_t timeMs;      //UTC milliseconds since midnight
+  uint16_t days;        //UTC days since 2000-01-01 (RMC)
+  int32_t lat;          //microdegrees, north positive
+  int32_t lon;          //microdegrees, east positive
+  uint16_t speed;       //0.01 knots (RMC)
+  uint16_t course;      //0.01 degrees true (RMC)
+  uint8_t quality;      //GGA fix quality, 0 = no fix
+  uint8_t satellites;   //GGA satellites in use
+  uint16_t hdop;        //GGA, 0.01
+  int32_t altitude;     //GGA, cm above mean sea level
+}  GPSFIX;
+
+typedef struct
+{
+  GPSFIX fix;           //latest fix, from checksummed sentences only
+  GPSFIX next;          //fix with the fields of the sentence being read
+  uint8_t state;
+  uint8_t type;         //NMEA_RMC, NMEA_GGA or NMEA_NONE for the sentence being read
+  uint8_t field;        //index of the field being read, 0 is the address
+  uint8_t len;
+  char text[NMEA_FIELD_MAX + 1];
+  uint8_t sum;          //XOR of the characters after '$'
+  uint8_t check;        //checksum as sent
+  uint32_t sentences;   //RMC and GGA sentences taken into fix
+  uint32_t errors;      //sentences dropped: checksum wrong or missing, field too long
+}  NMEAPARSER;
+
+void nmeaBegin(NMEAPARSER *p);
+
+//Takes the next character from the receiver. Returns NMEA_RMC or NMEA_GGA
+//when such a sentence has just been checked and copied into p->fix.
+uint8_t nmeaFeed(NMEAPARSER *p, char c);
+
+#endif
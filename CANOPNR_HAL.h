@@ -0,0 +1,160 @@
+/*
+   This file is included as part of the CANOPNR distribution.
+   You are free to use this project as you see fit, provided credit is given to all
+   contributors (original and subsequent).
+
+   Copyright 2012  Jose Denrie Enriquez, Alex Bautista, Paloma Field, Sun-il Kim
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+  ------------------------------------------------------------------------------------------------------------
+
+  Platform binding for the MCP2515 driver: the SPI transport (one object per
+  chip select), the millisecond clock and interrupt control. The binding is
+  picked at compile time, so there is no virtual call anywhere on the SPI path.
+
+  Arduino (default)     Arduino SPI library and core. Everything is inline and
+                        compiles to the same code as calling SPI directly. The
+                        host simulator build uses this binding too, through the
+                        Arduino.h/SPI.h stand-ins in host/.
+  CANOPNR_SPIDEV        Linux spidev. The chip-select "pin" is a GPIO line on
+                        CANOPNR_SPIDEV_GPIOCHIP that select() and deselect()
+                        drive; the bytes go through /dev/spidevB.D with the
+                        controller's own chip select off. No interrupt line:
+                        the driver polls. See host/MCP2515Spidev.cpp.
+*/
+
+#ifndef CANOPNR_HAL_h
+#define CANOPNR_HAL_h
+
+#define MCP2515_SPI_CLOCK 10000000 //MCP2515 maximum SCK
+
+#if defined(CANOPNR_SPIDEV)
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//spidev node the MCP2515s share, /dev/spidevB.D
+#ifndef CANOPNR_SPIDEV_BUS
+#define CANOPNR_SPIDEV_BUS 0
+#endif
+#ifndef CANOPNR_SPIDEV_DEVICE
+#define CANOPNR_SPIDEV_DEVICE 0
+#endif
+
+//GPIO chip carrying each MCP2515's CS line
+#ifndef CANOPNR_SPIDEV_GPIOCHIP
+#define CANOPNR_SPIDEV_GPIOCHIP "/dev/gpiochip0"
+#endif
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define bitRead(value, bit) (((value) >> (bit)) & 0x01)
+
+class MCP2515SPI
+{
+  public:
+    MCP2515SPI(byte csPin) : cs(csPin), fd(-1), csFd(-1) {}
+    void begin();
+    void select() { setCS(0); }
+    void deselect() { setCS(1); }
+    byte transfer(byte val);
+    void usingInterrupt(int irq) { (void)irq; }
+  private:
+    void setCS(byte level);
+    byte cs;      //GPIO line offset
+    int fd;       //spidev
+    int csFd;     //line handle for cs
+};
+
+unsigned long halMillis();
+unsigned long halMicros();
+void halDelay(unsigned long ms);
+
+//Single-threaded polling: there is no ISR to keep out
+inline void halDisableInterrupts() {}
+inline void halEnableInterrupts() {}
+inline int halPinToInterrupt(byte pin) { (void)pin; return -1; }
+inline void halAttachInterrupt(byte pin, void (*isr)()) { (void)pin; (void)isr; }
+inline void halDetachInterrupt(byte pin) { (void)pin; }
+
+#else
+
+#include "Arduino.h"
+#include "SPI.h"
+
+class MCP2515SPI
+{
+  public:
+    MCP2515SPI(byte csPin) : cs(csPin) {}
+
+    void begin()
+    {
+      pinMode(cs,OUTPUT);
+      digitalWrite(cs,HIGH);
+      SPI.begin();
+    }
+
+    void select()
+    {
+#ifdef SPI_HAS_TRANSACTION
+      //Masks the CAN interrupts (see usingInterrupt) so an ISR cannot
+      //start a transfer in the middle of this one
+      SPI.beginTransaction(SPISettings(MCP2515_SPI_CLOCK, MSBFIRST, SPI_MODE0));
+#endif
+      digitalWrite(cs,LOW);
+    }
+
+    void deselect()
+    {
+      digitalWrite(cs,HIGH);
+#ifdef SPI_HAS_TRANSACTION
+      SPI.endTransaction();
+#endif
+    }
+
+    byte transfer(byte val) { return SPI.transfer(val); }
+
+    void usingInterrupt(int irq)
+    {
+#ifdef SPI_HAS_TRANSACTION
+      SPI.usingInterrupt(irq);
+#else
+      (void)irq;
+#endif
+    }
+
+  private:
+    byte cs;
+};
+
+inline unsigned long halMillis() { return millis(); }
+inline unsigned long halMicros() { return micros(); }
+inline void halDelay(unsigned long ms) { delay(ms); }
+inline void halDisableInterrupts() { noInterrupts(); }
+inline void halEnableInterrupts() { interrupts(); }
+inline int halPinToInterrupt(byte pin) { return digitalPinToInterrupt(pin); }
+//INT is active low and stays low until every enabled flag is cleared
+inline void halAttachInterrupt(byte pin, void (*isr)())
+{
+  pinMode(pin,INPUT);
+  attachInterrupt(digitalPinToInterrupt(pin), isr, FALLING);
+}
+inline void halDetachInterrupt(byte pin) { detachInterrupt(digitalPinToInterrupt(pin)); }
+
+#endif
+
+#endif
@@ -26,7 +26,7 @@
   11       MOSI
   12       MISO
   13       SCK
-  10       CS 
+  10       CS (default; any pin can be passed to the constructor)
 
 
   //////////////////////////////////////////////////////////////////////////////////////////////
@@ -39,18 +39,15 @@
      4. boolean MCP2515::SNIFF_ALL(CANMSG *msg)
      5. boolean MCP2515::CANSNIFF(CANMSG *msg, unsigned short address, unsigned long timeout)
      6. boolean MCP2515::receiveCANMessage(CANMSG *msg, unsigned long timeout)
-     7. long MCP2515::queryOBD(unsigned char pid, char *buffer)
+     7. byte MCP2515::queryOBD(unsigned char pid, OBDVALUE *values, byte max)
   -Modified 1 existing method:
      1. boolean MCP2515::setCANNormalMode()
   //////////////////////////////////////////////////////////////////////////////////////////////
 */
 
 
-#include "Arduino.h"
-#include "SPI.h"
 #include "CANOPNR_MCP2515.h"
-
-#define SLAVESELECT 10
+#include "CANOPNR_BitTiming.h"
 
 //MCP2515 Registers
 #define RXF0SIDH 0x00
@@ -113,28 +110,37 @@
 	#define RX1IF 1
 	#define RX0IF 0
 #define EFLG 0x2D
+	#define RX1OVR 7
+	#define RX0OVR 6
 #define TXB0CTRL 0x30
 	#define TXREQ 3
+	#define TXP1 1
+	#define TXP0 0
 #define TXB0SIDH 0x31
 #define TXB0SIDL 0x32
 	#define EXIDE 3
 #define TXB0EID8 0x33
 #define TXB0EID0 0x34
 #define TXB0DLC 0x35
-  #define TXRTR 7
 #define TXB0D0 0x36 
+#define TXB1CTRL 0x40
+#define TXB2CTRL 0x50
 
 #define RXB0CTRL 0x60
 	#define RXM1 6
 	#define RXM0 5
 	#define RXRTR 3
+	#define BUKT 2
 	// Bits 2:0 FILHIT2:0
 #define RXB0SIDH 0x61
 #define RXB0SIDL 0x62
+	#define SRR 4
 #define RXB0EID8 0x63
 #define RXB0EID0 0x64
 #define RXB0DLC 0x65
+	#define RTR 6
 #define RXB0D0 0x66 
+#define RXB1CTRL 0x70
 
 //MCP2515 Command Bytes
 #define RESET 0xC0
@@ -147,65 +153,141 @@
 #define RX_STATUS 0xB0
 #define BIT_MODIFY 0x05
 
+//READ_STATUS bit positions for TX buffer n
+#define READ_STATUS_TXREQ(n) (2 + ((n) << 1))
+#define READ_STATUS_TXIF(n) (3 + ((n) << 1))
+
+MCP2515 *MCP2515::rxOwners[CAN_MAX_INTERRUPTS] = {0, 0};
+
+MCP2515::MCP2515(byte csPin)
+  : spi(csPin), spiTransactions(0), rxb1First(false), rxInterruptMode(false), txQueued(0), txCompleted(0)
+{
+  rxOverflows[0] = rxOverflows[1] = 0;
+  txPriority[0] = txPriority[1] = txPriority[2] = 0;
+}
+
+inline void MCP2515::spiSelect()
+{
+  spiTransactions++;
+  spi.select();
+}
+
+inline void MCP2515::spiDeselect()
+{
+  spi.deselect();
+}
+
 boolean MCP2515::initCAN(int baudConst)
 {
   byte mode;
   
-  SPI.begin();
+  spi.begin();
   
-  digitalWrite(SLAVESELECT,LOW);
-  SPI.transfer(RESET); //Reset cmd
-  digitalWrite(SLAVESELECT,HIGH);
+  spiSelect();
+  spi.transfer(RESET); //Reset cmd
+  spiDeselect();
   //Read mode and make sure it is config
-  delay(100);
+  halDelay(100);
   mode = readReg(CANSTAT) >> 5;
   if(mode != 0b100) 
     return false;
+
+  txPriority[0] = txPriority[1] = txPriority[2] = 0;
+
+  //Let a frame that finds RXB0 full roll over into RXB1
+  writeRegBit(RXB0CTRL,BUKT,1);
+  //Every frame until setAcceptanceFilters()
+  setRxFiltering(false);
 	
   return(setCANBaud(baudConst));
 
 }
 
+//CNF1 << 16 | CNF2 << 8 | CNF3 for each CAN_BAUD_ constant, 0 where the crystal cannot make it.
+//Indexed by the constant; the assert keeps the entries below in the constants' order.
+static_assert(CAN_BAUD_10K == 1 && CAN_BAUD_50K == 2 && CAN_BAUD_100K == 3 && CAN_BAUD_125K == 4 &&
+              CAN_BAUD_250K == 5 && CAN_BAUD_500K == 6 && CAN_BAUD_1000K == 7 && CAN_BAUD_83K3 == 8 &&
+              CAN_BAUD_COUNT == 9, "canBaudTimings[] no longer matches the CAN_BAUD_ constants");
+static constexpr unsigned long canBaudTimings[CAN_BAUD_COUNT] = {
+  0,
+  canBitTiming(MCP2515_OSC_HZ, canBaudRate(CAN_BAUD_10K)),
+  canBitTiming(MCP2515_OSC_HZ, canBaudRate(CAN_BAUD_50K)),
+  canBitTiming(MCP2515_OSC_HZ, canBaudRate(CAN_BAUD_100K)),
+  canBitTiming(MCP2515_OSC_HZ, canBaudRate(CAN_BAUD_125K)),
+  canBitTiming(MCP2515_OSC_HZ, canBaudRate(CAN_BAUD_250K)),
+  canBitTiming(MCP2515_OSC_HZ, canBaudRate(CAN_BAUD_500K)),
+  canBitTiming(MCP2515_OSC_HZ, canBaudRate(CAN_BAUD_1000K)),
+  canBitTiming(MCP2515_OSC_HZ, canBaudRate(CAN_BAUD_83K3))
+};
+static_assert(canBaudTimings[CAN_BAUD_500K] != 0 && canBaudTimings[CAN_BAUD_125K] != 0,
+              "MCP2515_OSC_HZ cannot make the HS-CAN and MS-CAN bitrates");
+
 boolean MCP2515::setCANBaud(int baudConst)
 {
-  byte brp;
-  
-  //BRP<5:0> = 00h, so divisor (0+1)*2 for 125ns per quantum at 16MHz for 500K   
-  //SJW<1:0> = 00h, Sync jump width = 1
-  switch(baudConst)
+  unsigned long timing;
+  byte regs[3];
+
+  if(baudConst <= 0 || baudConst >= CAN_BAUD_COUNT)
+    return false;
+  timing = canBaudTimings[baudConst];
+  if(timing == 0)
+    return false;
+
+  //CNF3, CNF2 and CNF1 are consecutive, so one burst sets the whole bit time
+  regs[0] = timing;
+  regs[1] = timing >> 8;
+  regs[2] = timing >> 16;
+  writeRegs(CNF3, regs, 3);
+  return true;
+}
+
+//Tries each rate in listen-only mode, where the controller neither
+//acknowledges frames nor sends error frames, so a wrong rate is never
+//put on the bus. With the filters off (RXM = 11) a frame with errors is
+//stored as well, so RXnIF alone says nothing about the rate: MERRF, set on
+//every bit, stuff, form or CRC error, discards the frames counted so far,
+//and a rate is taken only once CAN_AUTOBAUD_FRAMES frames arrive with no
+//MERRF between them. CAN_AUTOBAUD_ERRORS errors rule a rate out early,
+//frames or not. Takes at most count * dwell ms, and leaves the controller in
+//listen-only mode at the rate found, for the caller to pick filters and
+//mode. The RX interrupt must be off: frames are read here, not drained.
+int MCP2515::detectBaud(const int *bauds, byte count, unsigned long dwell)
+{
+  byte i, flags, frames, errors;
+  unsigned long start;
+
+  for(i = 0; i < count; i++)
   {
-    case CAN_BAUD_500K: brp = 0; break;
-    case CAN_BAUD_250K: brp = 1; break;
-    case CAN_BAUD_125K: brp = 3; break;
-    case CAN_BAUD_100K: brp = 4; break;
-    default: return false;
+    if(!setCANConfigMode() || !setCANBaud(bauds[i]))
+      continue;
+    writeReg(CANINTF,0);
+    writeReg(EFLG,0);
+    if(!setCANReceiveonlyMode())
+      continue;
+
+    frames = errors = 0;
+    start = halMillis();
+    while(halMillis() - start < dwell && frames < CAN_AUTOBAUD_FRAMES && errors < CAN_AUTOBAUD_ERRORS)
+    {
+      flags = readReg(CANINTF) & ((1 << MERRF) | (1 << RX1IF) | (1 << RX0IF));
+      if(flags == 0)
+        continue;
+      //Clearing RXnIF frees the buffer for the next frame
+      modifyReg(CANINTF, flags, 0);
+      if(bitRead(flags,MERRF))
+      {
+        //The buffers may hold the errored frame, or an earlier one that was
+        //errored too with its MERRF seen only now
+        errors++;
+        frames = 0;
+      }
+      else
+        frames += bitRead(flags,RX0IF) + bitRead(flags,RX1IF);
+    }
+    if(frames >= CAN_AUTOBAUD_FRAMES)
+      return bauds[i];
   }
-  digitalWrite(SLAVESELECT,LOW);
-  SPI.transfer(WRITE); 
-  SPI.transfer(CNF1);
-  SPI.transfer(brp & 0b00111111);
-  digitalWrite(SLAVESELECT,HIGH);  
-  
-  //PRSEG<2:0> = 0x01, 2 time quantum for prop
-  //PHSEG<2:0> = 0x06, 7 time constants to PS1 sample
-  //SAM = 0, just 1 sampling
-  //BTLMODE = 1, PS2 determined by CNF3
-  digitalWrite(SLAVESELECT,LOW);
-  SPI.transfer(WRITE); 
-  SPI.transfer(CNF2);
-  SPI.transfer(0b10110001);
-  digitalWrite(SLAVESELECT,HIGH); 
-  
-  //PHSEG2<2:0> = 5 for 6 time constants after sample
-  digitalWrite(SLAVESELECT,LOW);
-  SPI.transfer(WRITE); 
-  SPI.transfer(CNF3);
-  SPI.transfer(0x05);
-  digitalWrite(SLAVESELECT,HIGH); 
-  
-  //SyncSeg + PropSeg + PS1 + PS2 = 1 + 2 + 7 + 6 = 16
-  
-  return true;
+  return 0;
 }
 
 
@@ -252,7 +334,8 @@ boolean MCP2515::setCANNormalMode()
   byte mode;
   writeReg(CANINTF,0b00000000);
   writeReg(CANCTRL,0b00000111);
-  writeReg(CANINTE,0b00000000); //sets interrupt to awake on activity
+  //keep RX interrupts if the ISR is draining the buffers
+  writeReg(CANINTE,(rxInterruptMode ? ((1 << RX1IE) | (1 << RX0IE)) : 0b00000000));
   //Read mode and make sure it is normal
   mode = readReg(CANSTAT) >> 5;
   if(mode != 0)
@@ -286,63 +369,230 @@ boolean MCP2515::setCANReceiveonlyMode()
 }
 
 
+boolean MCP2515::setCANConfigMode()
+{
+  //REQOP2<2:0> = 100 for configuration mode
+  //CLKEN = 1, disable output clock
+  //CLKPRE = 0b11, clk/8
+  
+  writeReg(CANCTRL,0b10000111);
+  //The controller finishes the frame on the bus before switching
+  return waitForMode(0b100);
+}
+
+boolean MCP2515::waitForMode(byte mode)
+{
+  unsigned long endTime = halMillis() + 10;
+
+  do
+  {
+    if((readReg(CANSTAT) >> 5) == mode)
+      return true;
+  } while(halMillis() < endTime);
+  return false;
+}
+
+
+/*
+  Acceptance filtering
+  RXB0 has mask RXM0 and filters RXF0-RXF1, RXB1 has mask RXM1 and filters
+  RXF2-RXF5. A mask bit of 1 means the bit must match the filter. IDs are
+  11-bit standard IDs, or 29-bit IDs OR'd with CAN_EXTENDED_ID; an extended
+  frame's 29-bit ID is (adrsValue << 18) | extendedAdrsValue. For standard
+  filters the EID bytes of the mask are left 0, otherwise the controller
+  would compare them against the first two data bytes.
+*/
+static void encodeFilterId(unsigned long id, boolean isMask, byte *regs)
+{
+  unsigned short sid;
+  unsigned long eid;
+
+  if(id & CAN_EXTENDED_ID)
+  {
+    sid = (id >> 18) & 0x7FF;
+    eid = id & 0x3FFFF;
+    regs[0] = sid >> 3;
+    regs[1] = ((sid & 0x07) << 5) | ((eid >> 16) & 0x03);
+    if(!isMask)
+      regs[1] |= (1 << EXIDE);
+    regs[2] = eid >> 8;
+    regs[3] = eid;
+  }
+  else
+  {
+    sid = id & 0x7FF;
+    regs[0] = sid >> 3;
+    regs[1] = (sid & 0x07) << 5;
+    regs[2] = 0;
+    regs[3] = 0;
+  }
+}
+
+boolean MCP2515::setFilter(byte n, unsigned long id)
+{
+  //RXF0-RXF2 at 0x00, RXF3-RXF5 at 0x10
+  static const byte filterRegs[6] = {RXF0SIDH, RXF1SIDH, RXF2SIDH, RXF3SIDH, RXF4SIDH, RXF5SIDH};
+  byte regs[4];
+
+  if(n > 5)
+    return false;
+  encodeFilterId(id, false, regs);
+  writeRegs(filterRegs[n], regs, 4);
+  return true;
+}
+
+boolean MCP2515::setMask(byte n, unsigned long mask)
+{
+  byte regs[4];
+
+  if(n > 1)
+    return false;
+  encodeFilterId(mask, true, regs);
+  writeRegs((n == 0) ? RXM0SIDH : RXM1SIDH, regs, 4);
+  return true;
+}
+
+unsigned long MCP2515::computeMask(const unsigned long *ids, byte count)
+{
+  unsigned long diff = 0;
+  unsigned long width;
+  byte i;
+
+  if(count == 0)
+    return 0;
+  width = (ids[0] & CAN_EXTENDED_ID) ? 0x1FFFFFFFUL : 0x7FFUL;
+  //Keep only the bits on which every ID agrees
+  for(i = 1; i < count; i++)
+    diff |= (ids[i] ^ ids[0]);
+  return (~diff & width) | (ids[0] & CAN_EXTENDED_ID);
+}
+
+void MCP2515::programRxBuffer(byte rxb, const unsigned long *ids, byte count, unsigned long kind, byte skip, byte take)
+{
+  byte firstFilter = (rxb == 0) ? 0 : 2;
+  byte numFilters = (rxb == 0) ? 2 : 4;
+  unsigned long first = 0, diff = 0, mask;
+  byte i, seen = 0, used = 0;
+
+  //Pass over the IDs of one kind, taking 'take' of them after skipping 'skip'
+  for(i = 0; i < count && used < take; i++)
+  {
+    if((ids[i] & CAN_EXTENDED_ID) != kind)
+      continue;
+    if(seen++ < skip)
+      continue;
+    if(used == 0)
+      first = ids[i];
+    diff |= (ids[i] ^ first);
+    if(take <= numFilters)
+      setFilter(firstFilter + used, ids[i]);
+    used++;
+  }
+
+  mask = (kind ? 0x1FFFFFFFUL : 0x7FFUL);
+  if(take <= numFilters)
+  {
+    //Exact match; unused filters repeat the first ID
+    for(i = used; i < numFilters; i++)
+      setFilter(firstFilter + i, first);
+  }
+  else
+  {
+    //More IDs than filters: one filter with the tightest common mask
+    mask &= ~diff;
+    for(i = 0; i < numFilters; i++)
+      setFilter(firstFilter + i, first);
+  }
+  setMask(rxb, mask | kind);
+}
+
+boolean MCP2515::setAcceptanceFilters(const unsigned long *ids, byte count)
+{
+  byte mode, i, numExt = 0, numStd;
+  unsigned long kind0;
+
+  if(count == 0)
+    return clearAcceptanceFilters();
+
+  for(i = 0; i < count; i++)
+    if(ids[i] & CAN_EXTENDED_ID)
+      numExt++;
+  numStd = count - numExt;
+
+  mode = readReg(CANSTAT) >> 5;
+  if(!setCANConfigMode())
+    return false;
+  setRxFiltering(true);
+
+  if(numExt == 0 || numStd == 0)
+  {
+    //One kind: first two IDs exact on RXB0, the rest on RXB1. With two or
+    //fewer IDs RXB1 mirrors RXB0 so it lets nothing else through.
+    kind0 = (numExt != 0) ? CAN_EXTENDED_ID : 0;
+    programRxBuffer(0, ids, count, kind0, 0, (count < 2) ? count : 2);
+    if(count > 2)
+      programRxBuffer(1, ids, count, kind0, 2, count - 2);
+    else
+      programRxBuffer(1, ids, count, kind0, 0, count);
+  }
+  else
+  {
+    //Standard and extended IDs cannot share a mask: the smaller group gets
+    //RXB0's two filters, the larger one RXB1's four
+    kind0 = (numExt < numStd) ? CAN_EXTENDED_ID : 0;
+    programRxBuffer(0, ids, count, kind0, 0, kind0 ? numExt : numStd);
+    programRxBuffer(1, ids, count, kind0 ^ CAN_EXTENDED_ID, 0, kind0 ? numStd : numExt);
+  }
+
+  writeReg(CANCTRL,(mode << 5) | 0b00000111);
+  return waitForMode(mode);
+}
+
+boolean MCP2515::clearAcceptanceFilters()
+{
+  byte mode;
+
+  mode = readReg(CANSTAT) >> 5;
+  if(!setCANConfigMode())
+    return false;
+
+  setMask(0, 0);
+  setMask(1, 0);
+  setRxFiltering(false);
+
+  writeReg(CANCTRL,(mode << 5) | 0b00000111);
+  return waitForMode(mode);
+}
+
+//RXM<1:0> = 11 in RXBnCTRL turns the filters off. Zero masks alone are
+//not enough: a filter with EXIDE clear only ever passes standard frames,
+//so extended IDs would still be dropped.
+void MCP2515::setRxFiltering(boolean on)
+{
+  modifyReg(RXB0CTRL, 0x60, on ? 0x00 : 0x60);
+  modifyReg(RXB1CTRL, 0x60, on ? 0x00 : 0x60);
+}
+
+
 boolean MCP2515::getMSG(CANMSG *msg, unsigned long timeout, unsigned long message_addr){
 	unsigned long startTime, endTime;
-    boolean gotMessage;
-    byte val;
-    int i;
+    boolean gotMessage = false;
 	int y = 0; //timeout
 	while(msg->adrsValue != message_addr){
-		startTime = millis();
+		startTime = halMillis();
 		endTime = startTime + timeout;
 		gotMessage = false;
-		while(millis() < endTime)
+		while(halMillis() < endTime)
 		{
-		  val = readReg(CANINTF);
 		  //If we have a message available, read it
-		  if(bitRead(val,RX0IF) == 1)
+		  if(readMessage(msg))
 		  {
 			gotMessage = true;
 			break;
 		  }
 		}
     
-		if(gotMessage)
-		{
-			  val = readReg(RXB0CTRL);
-			  msg->rtr = ((bitRead(val,3) == 1) ? true : false);
-
-			  //Address received from
-			  msg->adrsValue = 0;
-			  val = readReg(RXB0SIDH);
-			  msg->adrsValue |= (val << 3);
-			  val = readReg(RXB0SIDL); 
-			  msg->adrsValue |= (val >> 5);
-			  msg->isExtendedAdrs = ((bitRead(val,EXIDE) == 1) ? true : false);
-			  msg->extendedAdrsValue = 0;
-			  if(msg->isExtendedAdrs)
-			  {
-				msg->extendedAdrsValue = (val & 0x03) << 16;
-				val = readReg(RXB0EID8);
-				msg->extendedAdrsValue |= (val << 8);
-				val = readReg(RXB0EID0);
-				msg->extendedAdrsValue |= val;
-			  }
-      
-			  //Read data bytes
-			  val = readReg(RXB0DLC);
-			  msg->dataLength = (val & 0xf); 
-			  digitalWrite(SLAVESELECT,LOW);
-			  SPI.transfer(READ); 
-			  SPI.transfer(RXB0D0);
-			  for(i = 0; i < msg->dataLength; i++)
-				msg->data[i] = SPI.transfer(0);
-			  digitalWrite(SLAVESELECT,HIGH);
-      
-			  //And clear read interrupt
-			  writeRegBit(CANINTF,RX0IF,0);
-		}
-		else{//only if no message at all is received
+		if(!gotMessage){//only if no message at all is received
 			if(y > 7){ //timeout ->this is the reason why everything is turning off
 				gotMessage = false;
 				break;
@@ -357,104 +607,26 @@ boolean MCP2515::getMSG(CANMSG *msg, unsigned long timeout, unsigned long messag
 
 
 boolean MCP2515::SNIFF_ALL(CANMSG *msg){//Sniff all messages found in the CAN
-	byte val;
-	int i;
-	val = readReg(CANINTF);
-	if(bitRead(val, RX0IF) == 1){
-		val = readReg(RXB0CTRL);
-		msg->rtr = ((bitRead(val,3) == 1) ? true : false);
-
-		//Address received from
-		msg->adrsValue = 0;
-		val = readReg(RXB0SIDH);
-		msg->adrsValue |= (val << 3);
-		val = readReg(RXB0SIDL); 
-		msg->adrsValue |= (val >> 5);
-		msg->isExtendedAdrs = ((bitRead(val,EXIDE) == 1) ? true : false);
-		msg->extendedAdrsValue = 0;
-		if(msg->isExtendedAdrs)
-		{
-		msg->extendedAdrsValue = (val & 0x03) << 16;
-		val = readReg(RXB0EID8);
-		msg->extendedAdrsValue |= (val << 8);
-		val = readReg(RXB0EID0);
-		msg->extendedAdrsValue |= val;
-		}
-      
-		//Read data bytes
-		val = readReg(RXB0DLC);
-		msg->dataLength = (val & 0xf); 
-		digitalWrite(SLAVESELECT,LOW);
-		SPI.transfer(READ); 
-		SPI.transfer(RXB0D0);
-		for(i = 0; i < msg->dataLength; i++)
-		msg->data[i] = SPI.transfer(0);
-		digitalWrite(SLAVESELECT,HIGH);
-      
-		//And clear read interrupt
-		writeRegBit(CANINTF,RX0IF,0);
-		return true;
-	}
-	return false;
+	return readMessage(msg);
 }
 
 
 boolean MCP2515::CANSNIFF(CANMSG *msg, unsigned short address, unsigned long timeout){ //Sniff specific messages for further testing
    unsigned long startTime, endTime;
-    boolean gotMessage;
-    byte val;
-    int i;
-	int y = 0; //timeout
+    boolean gotMessage = false;
 	while(msg->adrsValue != address){
-		startTime = millis();
+		startTime = halMillis();
 		endTime = startTime + timeout;
 		gotMessage = false;
-		while(millis() < endTime)
+		while(halMillis() < endTime)
 		{
-		  val = readReg(CANINTF);
 		  //If we have a message available, read it
-		  if(bitRead(val,RX0IF) == 1)
+		  if(readMessage(msg))
 		  {
 			gotMessage = true;
 			break;
 		  }
 		}
-    
-		if(gotMessage)
-		{
-			  val = readReg(RXB0CTRL);
-			  msg->rtr = ((bitRead(val,3) == 1) ? true : false);
-
-			  //Address received from
-			  msg->adrsValue = 0;
-			  val = readReg(RXB0SIDH);
-			  msg->adrsValue |= (val << 3);
-			  val = readReg(RXB0SIDL); 
-			  msg->adrsValue |= (val >> 5);
-			  msg->isExtendedAdrs = ((bitRead(val,EXIDE) == 1) ? true : false);
-			  msg->extendedAdrsValue = 0;
-			  if(msg->isExtendedAdrs)
-			  {
-				msg->extendedAdrsValue = (val & 0x03) << 16;
-				val = readReg(RXB0EID8);
-				msg->extendedAdrsValue |= (val << 8);
-				val = readReg(RXB0EID0);
-				msg->extendedAdrsValue |= val;
-			  }
-      
-			  //Read data bytes
-			  val = readReg(RXB0DLC);
-			  msg->dataLength = (val & 0xf); 
-			  digitalWrite(SLAVESELECT,LOW);
-			  SPI.transfer(READ); 
-			  SPI.transfer(RXB0D0);
-			  for(i = 0; i < msg->dataLength; i++)
-				msg->data[i] = SPI.transfer(0);
-			  digitalWrite(SLAVESELECT,HIGH);
-      
-			  //And clear read interrupt
-			  writeRegBit(CANINTF,RX0IF,0);
-		}
 	}
 	return gotMessage;
 }
@@ -464,124 +636,241 @@ boolean MCP2515::receiveCANMessage(CANMSG *msg, unsigned long timeout)
 {
     unsigned long startTime, endTime;
     boolean gotMessage;
-    byte val;
-    int i;
 
-    startTime = millis();
+    startTime = halMillis();
     endTime = startTime + timeout;
     gotMessage = false;
-    while(millis() < endTime)
+    while(halMillis() < endTime)
     {
-      val = readReg(CANINTF);
       //If we have a message available, read it
-      if(bitRead(val,RX0IF) == 1)
+      if(readMessage(msg))
       {
         gotMessage = true;
         break;
       }
     }
     
-    if(gotMessage)
+    return gotMessage;
+}
+
+boolean MCP2515::collectMSGs(CANSLOT *slots, byte count, unsigned long timeout)
+{
+  unsigned long endTime;
+  CANMSG msg;
+  byte i, missing;
+
+  //Every slot starts empty; frames for any subscribed ID fill their slot
+  //as they arrive instead of being thrown away while waiting for another
+  for(i = 0; i < count; i++)
+    slots[i].present = false;
+  missing = count;
+
+  endTime = halMillis() + timeout;
+  while(missing > 0 && halMillis() < endTime)
+  {
+    if(!readMessage(&msg))
+      continue;
+    if(msg.isExtendedAdrs)
+      continue;
+    for(i = 0; i < count; i++)
     {
-      val = readReg(RXB0CTRL);
-      msg->rtr = ((bitRead(val,3) == 1) ? true : false);
-
-      //Address received from
-      msg->adrsValue = 0;
-      val = readReg(RXB0SIDH);
-      msg->adrsValue |= (val << 3);
-      val = readReg(RXB0SIDL); 
-      msg->adrsValue |= (val >> 5);
-      msg->isExtendedAdrs = ((bitRead(val,EXIDE) == 1) ? true : false);
-      msg->extendedAdrsValue = 0;
-      if(msg->isExtendedAdrs)
+      if(slots[i].adrsValue != msg.adrsValue)
+        continue;
+      if(!slots[i].present)
       {
-        msg->extendedAdrsValue = (val & 0x03) << 16;
-        val = readReg(RXB0EID8);
-        msg->extendedAdrsValue |= (val << 8);
-        val = readReg(RXB0EID0);
-        msg->extendedAdrsValue |= val;
+        slots[i].present = true;
+        missing--;
       }
-      
-      //Read data bytes
-      val = readReg(RXB0DLC);
-      msg->dataLength = (val & 0xf); 
-      digitalWrite(SLAVESELECT,LOW);
-      SPI.transfer(READ); 
-      SPI.transfer(RXB0D0);
-      for(i = 0; i < msg->dataLength; i++)
-        msg->data[i] = SPI.transfer(0);
-      digitalWrite(SLAVESELECT,HIGH);
-      
-      //And clear read interrupt
-      writeRegBit(CANINTF,RX0IF,0);
+      slots[i].msg = msg; //keep the latest value
+      slots[i].timestamp = halMillis();
+      slots[i].count++;
+      break;
     }
-    
-    return gotMessage;
+  }
+  return (missing == 0);
 }
 
 boolean MCP2515::transmitCANMessage(CANMSG msg, unsigned long timeout)
 {
   unsigned long startTime, endTime;
   boolean sentMessage;
-  unsigned short val;
-  int i;
+  byte status, n;
  
-  startTime = millis();
+  startTime = halMillis();
   endTime = startTime + timeout;
   sentMessage = false;
 
-  val = msg.adrsValue >> 3;
-  writeReg(TXB0SIDH,val);
-  val = msg.adrsValue << 5;
-  if(msg.isExtendedAdrs)
-    val |= 1 << EXIDE;
-  writeReg(TXB0SIDL,val);
-  if(msg.isExtendedAdrs)
+  //Wait for any of the three TX buffers to free up
+  do
   {
-    val = msg.extendedAdrsValue >> 8;
-    writeReg(TXB0EID8,val);
-    val = msg.extendedAdrsValue;
-    writeReg(TXB0EID0,val);
-  }
-  
-  val = msg.dataLength & 0x0f;
-  if(msg.rtr)
-    bitWrite(val,TXRTR,1);
-  writeReg(TXB0DLC,val);
-  
-  //Message bytes
-  digitalWrite(SLAVESELECT,LOW);
-  SPI.transfer(WRITE); 
-  SPI.transfer(TXB0D0);
-  for(i = 0; i < msg.dataLength; i++)
-    SPI.transfer(msg.data[i]);
-  digitalWrite(SLAVESELECT,HIGH);
+    n = findFreeTxBuffer(readStatus());
+  } while(n > 2 && halMillis() < endTime);
+  if(n > 2)
+    return false;
 
-  //Transmit the message
-  writeRegBit(TXB0CTRL,TXREQ,1);
+  loadTxBuffer(n, &msg, 0);
 
-  sentMessage = false;
-  while(millis() < endTime)
+  //TXREQ clears when the frame has gone out (TXnIF set) or was aborted
+  while(halMillis() < endTime)
   {
-    val = readReg(CANINTF);
-    if(bitRead(val,TX0IF) == 1)
+    status = readStatus();
+    if(bitRead(status,READ_STATUS_TXREQ(n)) == 0)
     {
-      sentMessage = true;
+      sentMessage = (bitRead(status,READ_STATUS_TXIF(n)) == 1);
       break;
     }
   }
 
   //Abort the send if failed
-  writeRegBit(TXB0CTRL,TXREQ,0);
+  if(!sentMessage)
+    writeRegBit(TXB0CTRL + (n << 4),TXREQ,0);
   
   //And clear write interrupt
-  writeRegBit(CANINTF,TX0IF,0);
+  writeRegBit(CANINTF,TX0IF + n,0);
 
   return sentMessage;
 
 }
 
+boolean MCP2515::queueCANMessage(const CANMSG *msg, byte priority)
+{
+  byte n;
+
+  //Straight into a free buffer unless older frames are still waiting
+  if(txQueued == 0)
+  {
+    n = findFreeTxBuffer(readStatus());
+    if(n <= 2)
+    {
+      loadTxBuffer(n, msg, priority);
+      return true;
+    }
+  }
+  if(txQueued == CAN_TX_QUEUE_SIZE)
+    return false;
+
+  //Behind every frame of the same or higher priority, ahead of the rest
+  for(n = txQueued; n > 0 && txQueue[n - 1].priority < priority; n--)
+    txQueue[n] = txQueue[n - 1];
+  txQueue[n].msg = *msg;
+  txQueue[n].priority = priority;
+  txQueued++;
+  return true;
+}
+
+byte MCP2515::serviceTX()
+{
+  byte status, done, n, loaded, i;
+
+  status = readStatus();
+
+  //Acknowledge finished frames so their TXnIF does not linger
+  done = 0;
+  for(n = 0; n < 3; n++)
+  {
+    if(bitRead(status,READ_STATUS_TXIF(n)) == 1)
+    {
+      done |= (1 << (TX0IF + n));
+      txCompleted++;
+    }
+  }
+  if(done != 0)
+    modifyReg(CANINTF, done, 0);
+
+  //Refill every idle buffer from the front of the software queue
+  loaded = 0;
+  for(n = 0; n < 3 && loaded < txQueued; n++)
+  {
+    if(bitRead(status,READ_STATUS_TXREQ(n)) == 1)
+      continue;
+    loadTxBuffer(n, &txQueue[loaded].msg, txQueue[loaded].priority);
+    loaded++;
+  }
+  if(loaded > 0)
+  {
+    txQueued -= loaded;
+    for(i = 0; i < txQueued; i++)
+      txQueue[i] = txQueue[i + loaded];
+  }
+  return txQueued;
+}
+
+byte MCP2515::txPending()
+{
+  return txQueued;
+}
+
+unsigned long MCP2515::getTxCompletedCount()
+{
+  return txCompleted;
+}
+
+byte MCP2515::readStatus()
+{
+  byte val;
+
+  spiSelect();
+  spi.transfer(READ_STATUS);
+  val = spi.transfer(0);
+  spiDeselect();
+
+  return val;
+}
+
+byte MCP2515::findFreeTxBuffer(byte status)
+{
+  byte n;
+
+  for(n = 0; n < 3; n++)
+    if(bitRead(status,READ_STATUS_TXREQ(n)) == 0)
+      return n;
+  return 0xFF;
+}
+
+void MCP2515::loadTxBuffer(byte n, const CANMSG *msg, byte priority)
+{
+  byte dlc;
+  int i;
+
+  //TXP<1:0>; the controller sends the highest-priority loaded buffer first
+  priority &= 0x03;
+  if(txPriority[n] != priority)
+  {
+    modifyReg(TXB0CTRL + (n << 4), (1 << TXP1) | (1 << TXP0), priority);
+    txPriority[n] = priority;
+  }
+
+  dlc = msg->dataLength & 0x0f;
+  if(dlc > 8)
+    dlc = 8;
+
+  //LOAD_TX_BUFFER starts at TXBnSIDH, one transaction for header and data
+  spiSelect();
+  spi.transfer(LOAD_TX_BUFFER | (n << 1));
+  spi.transfer(msg->adrsValue >> 3);
+  if(msg->isExtendedAdrs)
+  {
+    spi.transfer((msg->adrsValue << 5) | (1 << EXIDE) | ((msg->extendedAdrsValue >> 16) & 0x03));
+    spi.transfer(msg->extendedAdrsValue >> 8);
+    spi.transfer(msg->extendedAdrsValue);
+  }
+  else
+  {
+    spi.transfer(msg->adrsValue << 5);
+    spi.transfer(0);
+    spi.transfer(0);
+  }
+  spi.transfer(msg->rtr ? (dlc | (1 << RTR)) : dlc);
+  for(i = 0; i < dlc; i++)
+    spi.transfer(msg->data[i]);
+  spiDeselect();
+
+  //Request to send
+  spiSelect();
+  spi.transfer(RTS | (1 << n));
+  spiDeselect();
+}
+
 byte MCP2515::getCANTxErrCnt()
 {
   return(readReg(TEC));
@@ -594,61 +883,322 @@ byte MCP2515::getCANRxErrCnt()
 
 void MCP2515::writeReg(byte regno, byte val)
 {
-  digitalWrite(SLAVESELECT,LOW);
-  SPI.transfer(WRITE); 
-  SPI.transfer(regno);
-  SPI.transfer(val);
-  digitalWrite(SLAVESELECT,HIGH);  
+  spiSelect();
+  spi.transfer(WRITE); 
+  spi.transfer(regno);
+  spi.transfer(val);
+  spiDeselect();  
+}
+
+void MCP2515::writeRegs(byte regno, const byte *vals, byte count)
+{
+  byte i;
+
+  //WRITE auto-increments the address, so consecutive registers take one transaction
+  spiSelect();
+  spi.transfer(WRITE); 
+  spi.transfer(regno);
+  for(i = 0; i < count; i++)
+    spi.transfer(vals[i]);
+  spiDeselect();
 }
 
 void MCP2515::writeRegBit(byte regno, byte bitno, byte val)
 {
-  digitalWrite(SLAVESELECT,LOW);
-  SPI.transfer(BIT_MODIFY); 
-  SPI.transfer(regno);
-  SPI.transfer(1 << bitno);
-  if(val != 0)
-    SPI.transfer(0xff);
+  modifyReg(regno, 1 << bitno, (val != 0) ? 0xff : 0x00);
+}
+
+void MCP2515::modifyReg(byte regno, byte mask, byte val)
+{
+  spiSelect();
+  spi.transfer(BIT_MODIFY); 
+  spi.transfer(regno);
+  spi.transfer(mask);
+  spi.transfer(val);
+  spiDeselect();
+}
+
+void MCP2515::readRxBuffer(byte rxb, CANMSG *msg)
+{
+  byte sidh, sidl, eid8, eid0, dlc;
+  int i;
+
+  //One transaction: READ_RX_BUFFER starts at RXBnSIDH and streams
+  //SIDH, SIDL, EID8, EID0, DLC, D0..D7. Raising CS clears RXnIF.
+  msg->timestamp = halMicros();
+  spiSelect();
+  spi.transfer(READ_RX_BUFFER | (rxb << 2));
+  sidh = spi.transfer(0);
+  sidl = spi.transfer(0);
+  eid8 = spi.transfer(0);
+  eid0 = spi.transfer(0);
+  dlc = spi.transfer(0);
+  msg->dataLength = (dlc & 0xf);
+  if(msg->dataLength > 8)
+    msg->dataLength = 8;
+  for(i = 0; i < msg->dataLength; i++)
+    msg->data[i] = spi.transfer(0);
+  spiDeselect();
+
+  //Address received from
+  msg->adrsValue = (sidh << 3) | (sidl >> 5);
+  msg->isExtendedAdrs = ((bitRead(sidl,EXIDE) == 1) ? true : false);
+  msg->extendedAdrsValue = 0;
+  if(msg->isExtendedAdrs)
+  {
+    msg->extendedAdrsValue = ((unsigned long)(sidl & 0x03) << 16) | ((unsigned long)eid8 << 8) | eid0;
+    msg->rtr = ((bitRead(dlc,RTR) == 1) ? true : false);
+  }
   else
-    SPI.transfer(0x00);
-  digitalWrite(SLAVESELECT,HIGH);
+    msg->rtr = ((bitRead(sidl,SRR) == 1) ? true : false);
+}
+
+byte MCP2515::readRxStatus()
+{
+  byte val;
+
+  spiSelect();
+  spi.transfer(RX_STATUS);
+  val = spi.transfer(0);
+  spiDeselect();
+
+  return val;
+}
+
+boolean MCP2515::readMessage(CANMSG *msg)
+{
+  //The ISR owns the controller's RX buffers in interrupt mode
+  if(rxInterruptMode)
+    return rxRing.pop(msg);
+  return pollMessage(msg);
+}
+
+boolean MCP2515::pollMessage(CANMSG *msg)
+{
+  byte status;
+
+  //RX_STATUS bit 6: RXB0 full, bit 7: RXB1 full
+  status = readRxStatus() & 0xC0;
+  if(status == 0)
+    return false;
+
+  //A frame can only be lost while RXB1 is full: RXB0 rolls over into it,
+  //and IDs accepted by RXF2-RXF5 land there directly
+  if(status & 0x80)
+    checkRxOverflow();
+
+  if(status == 0xC0)
+  {
+    //Both full: with rollover RXB0 holds the older frame unless RXB0 has
+    //been refilled since RXB1 was loaded
+    if(rxb1First)
+    {
+      readRxBuffer(1, msg);
+      rxb1First = false;
+    }
+    else
+    {
+      readRxBuffer(0, msg);
+      rxb1First = true;
+    }
+  }
+  else if(status == 0x40)
+  {
+    readRxBuffer(0, msg);
+    rxb1First = false;
+  }
+  else
+  {
+    readRxBuffer(1, msg);
+    rxb1First = false;
+  }
+  return true;
+}
+
+byte MCP2515::checkRxOverflow()
+{
+  byte val;
+
+  val = readReg(EFLG) & ((1 << RX1OVR) | (1 << RX0OVR));
+  if(bitRead(val,RX0OVR) == 1)
+  {
+    rxOverflows[0]++;
+    writeRegBit(EFLG,RX0OVR,0);
+  }
+  if(bitRead(val,RX1OVR) == 1)
+  {
+    rxOverflows[1]++;
+    writeRegBit(EFLG,RX1OVR,0);
+  }
+  return val;
+}
+
+unsigned long MCP2515::getRxOverflowCount(byte rxb)
+{
+  unsigned long val;
+
+  if(rxb > 1)
+    return 0;
+  halDisableInterrupts();
+  val = rxOverflows[rxb];
+  halEnableInterrupts();
+  return val;
+}
+
+boolean MCP2515::enableRxInterrupt(byte intPin)
+{
+  static void (*const trampolines[CAN_MAX_INTERRUPTS])() = {rxISR0, rxISR1};
+  int irq = halPinToInterrupt(intPin);
+
+  if(irq < 0 || irq >= CAN_MAX_INTERRUPTS)
+    return false;
+  if(rxOwners[irq] != 0 && rxOwners[irq] != this)
+    return false;
+
+  spi.usingInterrupt(irq);
+  rxOwners[irq] = this;
+  rxInterruptMode = true;
+  writeRegBit(CANINTE,RX0IE,1);
+  writeRegBit(CANINTE,RX1IE,1);
+  halAttachInterrupt(intPin, trampolines[irq]);
+  //Frames that arrived before the handler was attached would hold INT
+  //low with no further falling edge, so drain them now
+  halDisableInterrupts();
+  rxISR();
+  halEnableInterrupts();
+  return true;
+}
+
+void MCP2515::disableRxInterrupt(byte intPin)
+{
+  int irq = halPinToInterrupt(intPin);
+
+  if(irq >= 0 && irq < CAN_MAX_INTERRUPTS && rxOwners[irq] == this)
+  {
+    halDetachInterrupt(intPin);
+    rxOwners[irq] = 0;
+  }
+  writeRegBit(CANINTE,RX0IE,0);
+  writeRegBit(CANINTE,RX1IE,0);
+  rxInterruptMode = false;
+}
+
+//attachInterrupt() takes a plain function, so each INTn line gets one
+//that forwards to the controller attached to it
+void MCP2515::rxISR0()
+{
+  if(rxOwners[0] != 0)
+    rxOwners[0]->rxISR();
+}
+
+void MCP2515::rxISR1()
+{
+  if(rxOwners[1] != 0)
+    rxOwners[1]->rxISR();
+}
+
+void MCP2515::rxISR()
+{
+  CANMSG msg;
+
+  //INT only falls again once every enabled flag has been cleared,
+  //so empty both buffers before returning
+  while(pollMessage(&msg))
+    rxRing.push(msg);
+}
+
+byte MCP2515::available()
+{
+  if(rxInterruptMode)
+    return rxRing.available();
+  return ((readRxStatus() & 0xC0) != 0) ? 1 : 0;
+}
+
+unsigned long MCP2515::getRxDropCount()
+{
+  unsigned long val;
+
+  halDisableInterrupts();
+  val = rxRing.getOverflowCount();
+  halEnableInterrupts();
+  return val;
+}
+
+unsigned long MCP2515::getSPITransactionCount()
+{
+  unsigned long val;
+
+  halDisableInterrupts();
+  val = spiTransactions;
+  halEnableInterrupts();
+  return val;
+}
+
+void MCP2515::resetSPITransactionCount()
+{
+  halDisableInterrupts();
+  spiTransactions = 0;
+  halEnableInterrupts();
 }
 
 byte MCP2515::readReg(byte regno)
 {
   byte val;
   
-  digitalWrite(SLAVESELECT,LOW);
-  SPI.transfer(READ); 
-  SPI.transfer(regno);
-  val = SPI.transfer(0);
-  digitalWrite(SLAVESELECT,HIGH);
+  spiSelect();
+  spi.transfer(READ); 
+  spi.transfer(regno);
+  val = spi.transfer(0);
+  spiDeselect();
   
   return val;  
 }  
 
 
-long MCP2515::queryOBD(unsigned char pid, char *buffer)
+static void buildOBDRequest(CANMSG *msg, unsigned char pid)
+{
+  msg->adrsValue = OBD_REQUEST;
+  msg->isExtendedAdrs = false;
+  msg->extendedAdrsValue = 0;
+  msg->rtr = false;
+  msg->dataLength = 8;
+  msg->data[0] = 0x02;
+  msg->data[1] = 0x01;
+  msg->data[2] = pid;
+  msg->data[3] = 0;
+  msg->data[4] = 0;
+  msg->data[5] = 0;
+  msg->data[6] = 0;
+  msg->data[7] = 0;
+}
+
+boolean MCP2515::requestOBD(unsigned char pid)
+{
+  CANMSG msg;
+
+  buildOBDRequest(&msg, pid);
+  return queueCANMessage(&msg, 3);
+}
+
+byte MCP2515::getOBDReply(const CANMSG *msg)
+{
+  if(msg->isExtendedAdrs || msg->rtr || msg->dataLength < 3)
+    return 0;
+  if(msg->adrsValue < PID_REPLY || msg->adrsValue > PID_REPLY_LAST)
+    return 0;
+  //Single frame: data[0] = bytes that follow, data[1] = 0x40 + mode
+  if(msg->data[1] != 0x41 || msg->data[0] < 3 || msg->data[0] > 7)
+    return 0;
+  return msg->data[0] - 2;
+}
+
+byte MCP2515::queryOBD(unsigned char pid, OBDVALUE *values, byte max)
 {
   CANMSG msg;
-  //long val;
-  float engine_data;
   boolean rxSuccess;
   int noMatch;
 
-  msg.adrsValue = 0x7Df;
-  msg.isExtendedAdrs = false;
-  msg.extendedAdrsValue = 0;
-  msg.rtr = false;
-  msg.dataLength = 8;
-  msg.data[0] = 0x02;
-  msg.data[1] = 0x01;
-  msg.data[2] = pid;
-  msg.data[3] = 0;
-  msg.data[4] = 0;
-  msg.data[5] = 0;
-  msg.data[6] = 0;
-  msg.data[7] = 0;
+  buildOBDRequest(&msg, pid);
   
   if(!transmitCANMessage(msg,300))
     return 0;
@@ -672,76 +1222,169 @@ long MCP2515::queryOBD(unsigned char pid, char *buffer)
 
     return 0;
   }
-  //if(msg.data[0] == 3)  // runt time code?
-  //  val = msg.data[3];
-  //else
-  //  val = 256 * msg.data[3] + msg.data[4];
 
   ///inefficent double double error check lol
 
-  if((msg.adrsValue == PID_REPLY) && (msg.data[2] == pid)) 
+  if(getOBDReply(&msg) > 0 && msg.data[2] == pid)
   {
-	  switch(msg.data[2])
-	  {   /* Details from http://en.wikipedia.org/wiki/OBD-II_PIDs */
-							
-			case ENGINE_COOLANT_TEMP: 	// 	A-40			  [degree C]
-				engine_data =  msg.data[3] - 40;
-				sprintf(buffer,"%d",(int) engine_data);
-				break;
+	  return obdDecode(pid, &msg.data[3], getOBDReply(&msg), values, max);
+  }
+    
+  return 0;
+}
 
-			case ENGINE_RPM:
-				engine_data = ((msg.data[3]*256) + msg.data[4])/4;
-				sprintf(buffer, "%d", (int)engine_data);
-				break;
 
-			case FUEL_LEVEL:
-				engine_data = ((100*msg.data[3])/255);
-				sprintf(buffer,"%d",(int) engine_data);
-				break;
-							
-			case VEHICLE_SPEED: 		// A				  [km]
-				engine_data =  msg.data[3];
-				sprintf(buffer,"%d",(int) engine_data);
-				break;
+byte MCP2515::queryOBDBatch(OBDREPLY *replies, byte count, unsigned long timeout)
+{
+  CANMSG msg;
+  unsigned long start, now;
+  unsigned long slotSent[OBD_PIPELINE_DEPTH]; //when each in-flight request was queued
+  byte slotIndex[OBD_PIPELINE_DEPTH];         //its entry in replies, SLOT_FREE if none
+  byte sent = 0, answered = 0, outstanding = 0, i, s, len;
+  const byte SLOT_FREE = 0xFF;
+
+  for(i = 0; i < count; i++)
+    replies[i].valid = false;
+  for(s = 0; s < OBD_PIPELINE_DEPTH; s++)
+    slotIndex[s] = SLOT_FREE;
+
+  //Elapsed time, not an end time, so a millis() wrap doesn't end the batch early
+  start = halMillis();
+  while(answered < count && (now = halMillis()) - start < timeout)
+  {
+    //Keep up to OBD_PIPELINE_DEPTH requests in flight; replies are matched
+    //by PID, so their order does not matter
+    if(sent < count && outstanding < OBD_PIPELINE_DEPTH)
+    {
+      buildOBDRequest(&msg, replies[sent].pid);
+      if(queueCANMessage(&msg, 3))
+      {
+        for(s = 0; slotIndex[s] != SLOT_FREE; s++)
+          ;
+        slotIndex[s] = sent;
+        slotSent[s] = now;
+        sent++;
+        outstanding++;
+        continue;
+      }
+    }
+    if(txQueued > 0)
+      serviceTX();
 
-			case RUN_TIME:
-				engine_data = ((msg.data[3]*256)+msg.data[4]);
-				sprintf(buffer,"%d", (int) engine_data);
-				break;
+    //A PID the ECU ignores must not hold its pipeline slot forever, but
+    //giving up on it leaves the other requests in flight
+    for(s = 0; s < OBD_PIPELINE_DEPTH; s++)
+    {
+      if(slotIndex[s] != SLOT_FREE && (now - slotSent[s]) > OBD_REPLY_TIMEOUT)
+      {
+        slotIndex[s] = SLOT_FREE;
+        outstanding--;
+      }
+    }
+    if(sent == count && outstanding == 0)
+      break;
 
-			case INTAKE_TEMP:
-				engine_data = (msg.data[3]-40);
-				sprintf(buffer, "%d",(int) engine_data);
-				break;
+    if(!readMessage(&msg))
+      continue;
+    len = getOBDReply(&msg);
+    if(len == 0)
+      continue;
 
-			case MAF_SENSOR:   			// ((256*A)+B) / 100  [g/s]
-				engine_data =  ((msg.data[3]*256) + msg.data[4])/100;
-				sprintf(buffer,"%d",(int) engine_data);
-				break;
+    for(i = 0; i < sent; i++)
+    {
+      if(replies[i].valid || replies[i].pid != msg.data[2])
+        continue;
+      if(len > 4)
+        len = 4;
+      replies[i].valid = true;
+      replies[i].replyId = msg.adrsValue;
+      replies[i].length = len;
+      memcpy(replies[i].data, &msg.data[3], len);
+      answered++;
+      for(s = 0; s < OBD_PIPELINE_DEPTH; s++)
+      {
+        if(slotIndex[s] == i)
+        {
+          slotIndex[s] = SLOT_FREE;
+          outstanding--;
+        }
+      }
+      break;
+    }
+  }
+  return answered;
+}
 
-			case O2_VOLTAGE:    		// A * 0.005   (B-128) * 100/128 (if B==0xFF, sensor is not used in trim calc)
-				engine_data = msg.data[3]*0.005;
-				sprintf(buffer,"%d",(int) engine_data);
-				break;
 
-/*			case THROTTLE:				// Throttle Position
-				engine_data = ((((msg.data[3]*100)/255)-15)/.7);//Subaru vehicles idle at 15%, max at 85%
-				if(engine_data < 0){
-					engine_data = 0;
-				}
-				sprintf(buffer,"%d",(int) engine_data);
-				break;
-*/					
-			case REAL_THROTTLE:
-				engine_data = (msg.data[3]*100)/255;
-				sprintf(buffer,"%d",(int) engine_data);
-				break;
-		}
+CANChannels::CANChannels()
+{
+  byte i;
 
-	  return 1;// need 0?
+  n = 0;
+  for(i = 0; i < CAN_MAX_CHANNELS; i++)
+  {
+    channels[i] = 0;
+    headValid[i] = false;
+    frames[i] = 0;
   }
-    
-  return 0;
+}
+
+int8_t CANChannels::add(MCP2515 *can)
+{
+  if(n >= CAN_MAX_CHANNELS)
+    return -1;
+  channels[n] = can;
+  headValid[n] = false;
+  frames[n] = 0;
+  return n++;
+}
+
+boolean CANChannels::receive(CANMSG *msg, byte *channel)
+{
+  byte i, oldest = 0xFF;
+
+  //Stamps come from one clock, so the smallest difference from any of
+  //them is the oldest, across a micros() wrap too
+  for(i = 0; i < n; i++)
+  {
+    if(!headValid[i])
+      headValid[i] = channels[i]->SNIFF_ALL(&head[i]);
+    if(headValid[i] && (oldest == 0xFF || (long)(head[i].timestamp - head[oldest].timestamp) < 0))
+      oldest = i;
+  }
+  if(oldest == 0xFF)
+    return false;
+
+  *msg = head[oldest];
+  *channel = oldest;
+  headValid[oldest] = false;
+  frames[oldest]++;
+  return true;
+}
+
+void CANChannels::serviceTX()
+{
+  byte i;
+
+  //An idle channel costs nothing: serviceTX() always reads the status
+  for(i = 0; i < n; i++)
+    if(channels[i]->txPending() > 0)
+      channels[i]->serviceTX();
+}
+
+byte CANChannels::count()
+{
+  return n;
+}
+
+MCP2515 *CANChannels::get(byte channel)
+{
+  return (channel < n) ? channels[channel] : 0;
+}
+
+unsigned long CANChannels::getFrameCount(byte channel)
+{
+  return (channel < n) ? frames[channel] : 0;
 }
 
 
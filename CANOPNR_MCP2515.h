@@ -40,7 +40,9 @@
 #ifndef MCP2515_h
 #define MCP2515_h
 
-#include "Arduino.h." // for Arduino 1.0 , otherwise do #include "WProgram.h"
+#include "CANOPNR_HAL.h" // Arduino.h and SPI.h, or the spidev binding
+#include "CANOPNR_RingBuffer.h"
+#include "CANOPNR_OBD.h"
 
 typedef struct
 {
@@ -50,41 +52,178 @@ typedef struct
   boolean rtr;
   byte dataLength;
   byte data[8];
+  unsigned long timestamp;   //micros() when read from the controller, in the RX interrupt if enabled
 }  CANMSG;
 
+//Latest-value slot for one subscribed ID, filled by MCP2515::collectMSGs()
+typedef struct
+{
+  unsigned short adrsValue;  //ID to collect, set by the caller
+  boolean present;           //a frame arrived during the last collection
+  unsigned long timestamp;   //millis() when msg was stored
+  unsigned int count;        //frames stored since the caller last zeroed it
+  CANMSG msg;                //latest frame for adrsValue
+}  CANSLOT;
+
+//One mode 01 PID for MCP2515::queryOBDBatch()
+typedef struct
+{
+  byte pid;                  //PID to request, set by the caller
+  boolean valid;             //a reply for pid arrived
+  unsigned short replyId;    //responding ECU, 0x7E8-0x7EF
+  byte length;               //data bytes in the reply (A, B, C, D)
+  byte data[4];
+}  OBDREPLY;
+
+//Frame waiting for a free TX buffer, see MCP2515::queueCANMessage()
+typedef struct
+{
+  CANMSG msg;
+  byte priority;             //TXP<1:0>, 3 is sent first
+}  TXENTRY;
+
+//Default chip select (the Uno's SS pin) and how many INTn lines can carry CAN interrupts
+#ifndef SLAVESELECT
+#define SLAVESELECT 10
+#endif
+#define CAN_MAX_INTERRUPTS 2
+
+//MCP2515 crystal, 16 MHz on the CAN-BUS shield. Bit timing is worked out
+//from it at compile time (CANOPNR_BitTiming.h)
+#ifndef MCP2515_OSC_HZ
+#define MCP2515_OSC_HZ 16000000UL
+#endif
+
+//detectBaud() locks on a rate after this many frames with no error between
+//them; this many errors rule a rate out before its dwell time is up
+#define CAN_AUTOBAUD_FRAMES 2
+#define CAN_AUTOBAUD_ERRORS 3
+
+//Frames queueCANMessage() holds while all three TX buffers are busy
+#ifndef CAN_TX_QUEUE_SIZE
+#define CAN_TX_QUEUE_SIZE 4
+#endif
+
+//Frames buffered between the RX interrupt and the application (one slot is kept free)
+#ifndef CAN_RX_RING_SIZE
+#define CAN_RX_RING_SIZE 8
+#endif
+
+//One MCP2515 on its own chip select. Several instances can share the SPI bus.
 class MCP2515
 {
   public:
-    static boolean initCAN(int baudConst);
-	static boolean setCANNormalMode();
-	static boolean setCANReceiveonlyMode();
-	static boolean setWakeMode();
-	static boolean setSleepMode();
-	static boolean isAwake();
-	static boolean receiveCANMessage(CANMSG *msg, unsigned long timeout);
-	static boolean transmitCANMessage(CANMSG msg, unsigned long timeout);
-	static boolean getMSG(CANMSG *msg, unsigned long timeout, unsigned long message_addr);
-	static boolean CANSNIFF(CANMSG *msg, unsigned short address, unsigned long timeout);
-	static boolean SNIFF_ALL(CANMSG *msg);
+    MCP2515(byte csPin = SLAVESELECT);
+    boolean initCAN(int baudConst);
+    int detectBaud(const int *bauds, byte count, unsigned long dwell); //CAN_BAUD_ constant heard, or 0
+	boolean setCANNormalMode();
+	boolean setCANReceiveonlyMode();
+	boolean setCANConfigMode();
+	boolean setWakeMode();
+	boolean setSleepMode();
+	boolean isAwake();
+	boolean receiveCANMessage(CANMSG *msg, unsigned long timeout);
+	boolean transmitCANMessage(CANMSG msg, unsigned long timeout);
+	boolean queueCANMessage(const CANMSG *msg, byte priority);
+	byte serviceTX();
+	byte txPending(); //frames queued for serviceTX()
+	unsigned long getTxCompletedCount();
+	boolean getMSG(CANMSG *msg, unsigned long timeout, unsigned long message_addr);
+	boolean CANSNIFF(CANMSG *msg, unsigned short address, unsigned long timeout);
+	boolean collectMSGs(CANSLOT *slots, byte count, unsigned long timeout);
+	boolean SNIFF_ALL(CANMSG *msg);
+	boolean setAcceptanceFilters(const unsigned long *ids, byte count); //list high-rate IDs first: they get RXB0 and rollover
+	boolean clearAcceptanceFilters();
+	static unsigned long computeMask(const unsigned long *ids, byte count);
+	boolean setFilter(byte n, unsigned long id);     //config mode only
+	boolean setMask(byte n, unsigned long mask);     //config mode only
+	boolean enableRxInterrupt(byte intPin);
+	void disableRxInterrupt(byte intPin);
+	byte available();
+	unsigned long getRxDropCount();
 
 	/*
-	static boolean BRAKE_PRESSURE(CANMSG *msg, unsigned long timeout);
-	static boolean ABSCAN(CANMSG *msg, unsigned long timeout);
-	static boolean ACCELERATOR(CANMSG *msg, unsigned long timeout);
+	boolean BRAKE_PRESSURE(CANMSG *msg, unsigned long timeout);
+	boolean ABSCAN(CANMSG *msg, unsigned long timeout);
+	boolean ACCELERATOR(CANMSG *msg, unsigned long timeout);
 	*/
 
-	static byte getCANTxErrCnt();
-	static byte getCANRxErrCnt();
-	static long queryOBD(unsigned char code, char* buffer);
-	static byte readReg(byte regno);
+	byte getCANTxErrCnt();
+	byte getCANRxErrCnt();
+	byte queryOBD(unsigned char pid, OBDVALUE *values, byte max); //decoded values, 0 if no reply
+	byte queryOBDBatch(OBDREPLY *replies, byte count, unsigned long timeout);
+	boolean requestOBD(unsigned char pid); //queues a mode 01 request, the reply comes through SNIFF_ALL
+	static byte getOBDReply(const CANMSG *msg); //bytes A, B, ... at data[3] of a mode 01 reply, else 0
+	byte readReg(byte regno);
+	byte checkRxOverflow();
+	unsigned long getRxOverflowCount(byte rxb);
+	unsigned long getSPITransactionCount();
+	void resetSPITransactionCount();
 	
 	private:
-	static boolean setCANBaud(int baudConst);
-	static void writeReg(byte regno, byte val);
-	static void writeRegBit(byte regno, byte bitno, byte val);
+	MCP2515SPI spi;
+	unsigned long spiTransactions; //chip-select assertions since reset
+	void spiSelect();
+	void spiDeselect();
+	unsigned long rxOverflows[2]; //EFLG RX0OVR/RX1OVR events seen
+	boolean rxb1First; //RXB1 holds the older frame when both are full
+	RingBuffer<CANMSG, CAN_RX_RING_SIZE> rxRing; //filled by rxISR()
+	boolean rxInterruptMode;
+	void rxISR();
+	static MCP2515 *rxOwners[CAN_MAX_INTERRUPTS]; //instance behind each attached INTn
+	static void rxISR0();
+	static void rxISR1();
+	boolean pollMessage(CANMSG *msg);
+	void readRxBuffer(byte rxb, CANMSG *msg);
+	byte readRxStatus();
+	boolean readMessage(CANMSG *msg);
+	boolean setCANBaud(int baudConst);
+	void writeReg(byte regno, byte val);
+	void writeRegs(byte regno, const byte *vals, byte count);
+	boolean waitForMode(byte mode);
+	void programRxBuffer(byte rxb, const unsigned long *ids, byte count, unsigned long kind, byte skip, byte take);
+	void setRxFiltering(boolean on); //off: every standard and extended frame
+	void writeRegBit(byte regno, byte bitno, byte val);
+	void modifyReg(byte regno, byte mask, byte val);
+	byte readStatus();
+	byte findFreeTxBuffer(byte status);
+	void loadTxBuffer(byte n, const CANMSG *msg, byte priority);
+	TXENTRY txQueue[CAN_TX_QUEUE_SIZE]; //highest priority first, drained by serviceTX()
+	byte txQueued;
+	byte txPriority[3]; //TXP last written to each TX buffer
+	unsigned long txCompleted;
 //	static byte readReg(byte regno);
 };
 
+//Controllers CANChannels reads in turn
+#ifndef CAN_MAX_CHANNELS
+#define CAN_MAX_CHANNELS 2
+#endif
+
+//Several MCP2515s, each on its own bus with its own baud rate, filters and
+//receive ring, read and written from one place. receive() hands out the
+//oldest frame waiting on any channel, by the time the controller was read,
+//so a busy bus cannot hold back a quiet one and frames come out in bus
+//order. One frame per channel is kept as a lookahead.
+class CANChannels
+{
+  public:
+    CANChannels();
+    int8_t add(MCP2515 *can);                      //channel number, or -1 if all are taken
+    boolean receive(CANMSG *msg, byte *channel);   //oldest frame on any channel
+    void serviceTX();                              //MCP2515::serviceTX() on channels with frames queued
+    byte count();
+    MCP2515 *get(byte channel);
+    unsigned long getFrameCount(byte channel);     //frames receive() returned from the channel
+
+  private:
+    MCP2515 *channels[CAN_MAX_CHANNELS];
+    CANMSG head[CAN_MAX_CHANNELS];                 //next frame of each channel
+    boolean headValid[CAN_MAX_CHANNELS];
+    unsigned long frames[CAN_MAX_CHANNELS];
+    byte n;
+};
+
 //Data rate selection constants
 #define CAN_BAUD_10K 1
 #define CAN_BAUD_50K 2
@@ -92,6 +231,12 @@ class MCP2515
 #define CAN_BAUD_125K 4
 #define CAN_BAUD_250K 5
 #define CAN_BAUD_500K 6
+#define CAN_BAUD_1000K 7
+#define CAN_BAUD_83K3 8
+#define CAN_BAUD_COUNT 9 //one past the last
+
+//OR into an acceptance filter ID or mask to mark it as a 29-bit extended ID
+#define CAN_EXTENDED_ID 0x80000000UL
 
 #define ABSCAN 0x513
 #define ACCELERATOR 0x410
@@ -110,6 +255,14 @@ class MCP2515
 #define RUN_TIME		0x1F
 #define INTAKE_TEMP		0x0F
 
+#define OBD_REQUEST		0x7DF
 #define PID_REPLY		0x7E8
+#define PID_REPLY_LAST		0x7EF
+
+//Requests queryOBDBatch keeps in flight, and how long it waits on a silent ECU
+#ifndef OBD_PIPELINE_DEPTH
+#define OBD_PIPELINE_DEPTH 4
+#endif
+#define OBD_REPLY_TIMEOUT 100
 
 #endif
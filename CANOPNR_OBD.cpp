@@ -0,0 +1,398 @@
+/*
+   This file is included as part of the CANOPNR distribution.
+   You are free to use this project as you see fit, provided credit is given to all
+   contributors (original and subsequent).
+
+   Copyright 2012  Jose Denrie Enriquez, Alex Bautista, Paloma Field, Sun-il Kim
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+  ------------------------------------------------------------------------------------------------------------
+
+  Mode 01 PID decoder, see CANOPNR_OBD.h.
+*/
+
+#include <string.h>
+#include "CANOPNR_OBD.h"
+
+#ifdef __AVR__
+#include <avr/pgmspace.h>
+#else
+#define PROGMEM
+#define memcpy_P memcpy
+#define pgm_read_byte(p) (*(const uint8_t *)(p))
+#endif
+
+#define L OBD_LAYOUT
+
+//Field shapes shared by many PIDs
+#define BITS(pid, bytes)      {pid, L(0, bytes, 0), OBD_UNIT_BITS, 0, 1, 1, 0}
+#define RAW(pid, first, bytes, unit) {pid, L(first, bytes, 0), unit, 0, 1, 1, 0}
+#define PERCENT(pid, first)   {pid, L(first, 1, 0), OBD_UNIT_PERCENT, 1, 1000, 255, 0}     //A*100/255
+#define TRIM(pid, first)      {pid, L(first, 1, 0), OBD_UNIT_PERCENT, 2, 625, 8, -10000}   //A*100/128 - 100
+#define TEMP(pid)             {pid, L(0, 1, 0), OBD_UNIT_CELSIUS, 0, 1, 1, -40}           //A - 40
+#define TORQUE(pid)           {pid, L(0, 1, 0), OBD_UNIT_PERCENT, 0, 1, 1, -125}          //A - 125
+#define RATIO(pid)            {pid, L(0, 2, 0), OBD_UNIT_NONE, 5, 3125, 1024, 0}          //(256A+B)*2/65536
+#define O2_NARROW(pid)        {pid, L(0, 1, 0), OBD_UNIT_VOLT, 3, 5, 1, 0}, TRIM(pid, 1)  //A/200 V, B trim
+#define O2_WIDE_V(pid)        RATIO(pid), {pid, L(2, 2, 0), OBD_UNIT_VOLT, 4, 625, 512, 0}          //(256C+D)*8/65536 V
+#define O2_WIDE_I(pid)        RATIO(pid), {pid, L(2, 2, 0), OBD_UNIT_MILLIAMP, 3, 125, 32, -128000} //(256C+D)/256 - 128 mA
+#define CATALYST(pid)         {pid, L(0, 2, 0), OBD_UNIT_CELSIUS, 1, 1, 1, -400}          //(256A+B)/10 - 40
+
+//Sorted by PID. raw * num must fit 32 bits signed: 4-byte fields use num 1.
+static const OBDFIELD OBD_FIELDS[] PROGMEM =
+{
+  BITS(0x00, 4),                       //PIDs supported 01-20
+  BITS(0x01, 4),                       //monitor status since DTCs cleared
+  BITS(0x02, 2),                       //DTC that caused the freeze frame
+  BITS(0x03, 2),                       //fuel system status
+  PERCENT(0x04, 0),                    //calculated engine load
+  TEMP(0x05),                          //coolant
+  TRIM(0x06, 0), TRIM(0x07, 0), TRIM(0x08, 0), TRIM(0x09, 0), //short/long term fuel trim, banks 1 and 2
+  {0x0A, L(0, 1, 0), OBD_UNIT_KPA, 0, 3, 1, 0},               //fuel pressure, 3A
+  RAW(0x0B, 0, 1, OBD_UNIT_KPA),       //intake manifold absolute pressure
+  {0x0C, L(0, 2, 0), OBD_UNIT_RPM, 2, 25, 1, 0},              //(256A+B)/4
+  RAW(0x0D, 0, 1, OBD_UNIT_KMH),
+  {0x0E, L(0, 1, 0), OBD_UNIT_DEGREE, 1, 5, 1, -640},         //timing advance, A/2 - 64
+  TEMP(0x0F),                          //intake air
+  {0x10, L(0, 2, 0), OBD_UNIT_GRAMS_PER_S, 2, 1, 1, 0},       //MAF, (256A+B)/100
+  PERCENT(0x11, 0),                    //throttle position
+  BITS(0x12, 1),                       //commanded secondary air status
+  BITS(0x13, 1),                       //O2 sensors present, 2 banks
+  O2_NARROW(0x14), O2_NARROW(0x15), O2_NARROW(0x16), O2_NARROW(0x17),
+  O2_NARROW(0x18), O2_NARROW(0x19), O2_NARROW(0x1A), O2_NARROW(0x1B),
+  RAW(0x1C, 0, 1, OBD_UNIT_NONE),      //OBD standard
+  BITS(0x1D, 1),                       //O2 sensors present, 4 banks
+  BITS(0x1E, 1),                       //auxiliary input status
+  RAW(0x1F, 0, 2, OBD_UNIT_SECOND),    //run time since engine start
+  BITS(0x20, 4),                       //PIDs supported 21-40
+  RAW(0x21, 0, 2, OBD_UNIT_KM),        //distance with MIL on
+  {0x22, L(0, 2, 0), OBD_UNIT_KPA, 3, 79, 1, 0},              //fuel rail pressure, 0.079(256A+B)
+  {0x23, L(0, 2, 0), OBD_UNIT_KPA, 0, 10, 1, 0},              //fuel rail gauge pressure
+  O2_WIDE_V(0x24), O2_WIDE_V(0x25), O2_WIDE_V(0x26), O2_WIDE_V(0x27),
+  O2_WIDE_V(0x28), O2_WIDE_V(0x29), O2_WIDE_V(0x2A), O2_WIDE_V(0x2B),
+  PERCENT(0x2C, 0),                    //commanded EGR
+  TRIM(0x2D, 0),                       //EGR error
+  PERCENT(0x2E, 0),                    //commanded evaporative purge
+  PERCENT(0x2F, 0),                    //fuel tank level
+  RAW(0x30, 0, 1, OBD_UNIT_NONE),      //warm-ups since codes cleared
+  RAW(0x31, 0, 2, OBD_UNIT_KM),        //distance since codes cleared
+  {0x32, L(0, 2, 1), OBD_UNIT_PA, 2, 25, 1, 0},               //evap vapor pressure, signed (256A+B)/4
+  RAW(0x33, 0, 1, OBD_UNIT_KPA),       //barometric pressure
+  O2_WIDE_I(0x34), O2_WIDE_I(0x35), O2_WIDE_I(0x36), O2_WIDE_I(0x37),
+  O2_WIDE_I(0x38), O2_WIDE_I(0x39), O2_WIDE_I(0x3A), O2_WIDE_I(0x3B),
+  CATALYST(0x3C), CATALYST(0x3D), CATALYST(0x3E), CATALYST(0x3F),
+  BITS(0x40, 4),                       //PIDs supported 41-60
+  BITS(0x41, 4),                       //monitor status this drive cycle
+  {0x42, L(0, 2, 0), OBD_UNIT_VOLT, 3, 1, 1, 0},              //control module voltage, (256A+B)/1000
+  {0x43, L(0, 2, 0), OBD_UNIT_PERCENT, 1, 1000, 255, 0},      //absolute load, (256A+B)*100/255
+  RATIO(0x44),                         //commanded air-fuel equivalence ratio
+  PERCENT(0x45, 0),                    //relative throttle position
+  TEMP(0x46),                          //ambient air
+  PERCENT(0x47, 0), PERCENT(0x48, 0), PERCENT(0x49, 0),       //absolute throttle B, C, accelerator D
+  PERCENT(0x4A, 0), PERCENT(0x4B, 0), PERCENT(0x4C, 0),       //accelerator E, F, commanded throttle
+  RAW(0x4D, 0, 2, OBD_UNIT_MINUTE),    //time run with MIL on
+  RAW(0x4E, 0, 2, OBD_UNIT_MINUTE),    //time since codes cleared
+  RAW(0x4F, 0, 1, OBD_UNIT_NONE),      //maximum equivalence ratio,
+  RAW(0x4F, 1, 1, OBD_UNIT_VOLT),      //O2 sensor voltage,
+  RAW(0x4F, 2, 1, OBD_UNIT_MILLIAMP),  //O2 sensor current,
+  {0x4F, L(3, 1, 0), OBD_UNIT_KPA, 0, 10, 1, 0},              //and intake pressure
+  {0x50, L(0, 1, 0), OBD_UNIT_GRAMS_PER_S, 0, 10, 1, 0},      //maximum MAF
+  RAW(0x51, 0, 1, OBD_UNIT_NONE),      //fuel type
+  PERCENT(0x52, 0),                    //ethanol
+  {0x53, L(0, 2, 0), OBD_UNIT_KPA, 3, 5, 1, 0},               //absolute evap vapor pressure, (256A+B)/200
+  {0x54, L(0, 2, 0), OBD_UNIT_PA, 0, 1, 1, -32767},           //evap vapor pressure, (256A+B) - 32767
+  TRIM(0x55, 0), TRIM(0x55, 1), TRIM(0x56, 0), TRIM(0x56, 1), //secondary O2 trims, banks 1/3 and 2/4
+  TRIM(0x57, 0), TRIM(0x57, 1), TRIM(0x58, 0), TRIM(0x58, 1),
+  {0x59, L(0, 2, 0), OBD_UNIT_KPA, 0, 10, 1, 0},              //fuel rail absolute pressure
+  PERCENT(0x5A, 0),                    //relative accelerator position
+  PERCENT(0x5B, 0),                    //hybrid battery remaining life
+  TEMP(0x5C),                          //engine oil
+  {0x5D, L(0, 2, 0), OBD_UNIT_DEGREE, 3, 125, 16, -210000},   //injection timing, (256A+B)/128 - 210
+  {0x5E, L(0, 2, 0), OBD_UNIT_LITRE_PER_H, 2, 5, 1, 0},       //fuel rate, (256A+B)/20
+  RAW(0x5F, 0, 1, OBD_UNIT_NONE),      //emission requirements
+  BITS(0x60, 4),                       //PIDs supported 61-80
+  TORQUE(0x61),                        //driver's demand torque
+  TORQUE(0x62),                        //actual torque
+  RAW(0x63, 0, 2, OBD_UNIT_NM),        //reference torque
+  BITS(0x80, 4),                       //PIDs supported 81-A0
+  BITS(0xA0, 4),                       //PIDs supported A1-C0
+  {0xA6, L(0, 4, 0), OBD_UNIT_KM, 1, 1, 1, 0},                //odometer, ABCD/10
+  BITS(0xC0, 4)                        //PIDs supported C1-E0
+};
+
+#define OBD_FIELD_COUNT (sizeof(OBD_FIELDS) / sizeof(OBD_FIELDS[0]))
+
+//Index of the first row of pid, or OBD_FIELD_COUNT
+static uint8_t findPid(uint8_t pid)
+{
+  uint8_t lo = 0, hi = OBD_FIELD_COUNT, mid;
+
+  while(lo < hi)
+  {
+    mid = (lo + hi) / 2;
+    if(pgm_read_byte(&OBD_FIELDS[mid].pid) < pid)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if(lo < OBD_FIELD_COUNT && pgm_read_byte(&OBD_FIELDS[lo].pid) == pid)
+    return lo;
+  return OBD_FIELD_COUNT;
+}
+
+static int32_t decodeField(const OBDFIELD *f, const uint8_t *data)
+{
+  uint8_t first = OBD_LAYOUT_FIRST(f->layout), bytes = OBD_LAYOUT_BYTES(f->layout), i;
+  uint32_t raw = 0;
+  int32_t v;
+
+  for(i = 0; i < bytes; i++)
+    raw = (raw << 8) | data[first + i];
+  if(OBD_LAYOUT_SIGNED(f->layout) && bytes < 4 && (raw >> (8 * bytes - 1)))
+    raw |= ~(uint32_t)0 << (8 * bytes);
+  else if(bytes == 4 && f->unit != OBD_UNIT_BITS && raw > INT32_MAX)
+    raw = INT32_MAX;
+  v = (int32_t)raw;
+
+  if(f->num != 1 || f->den != 1)
+  {
+    v *= f->num;
+    //Round half away from zero
+    if(v >= 0)
+      v = (v + f->den / 2) / f->den;
+    else
+      v = -((-v + f->den / 2) / f->den);
+  }
+  return v + f->offset;
+}
+
+uint8_t obdDecode(uint8_t pid, const uint8_t *data, uint8_t length, OBDVALUE *values, uint8_t max)
+{
+  uint8_t i, n = 0;
+  OBDFIELD f;
+
+  for(i = findPid(pid); i < OBD_FIELD_COUNT && n < max; i++)
+  {
+    memcpy_P(&f, &OBD_FIELDS[i], sizeof(OBDFIELD));
+    if(f.pid != pid)
+      break;
+    if(OBD_LAYOUT_FIRST(f.layout) + OBD_LAYOUT_BYTES(f.layout) > length)
+      return 0;
+    values[n].value = decodeField(&f, data);
+    values[n].unit = f.unit;
+    values[n].decimals = f.decimals;
+    n++;
+  }
+  return n;
+}
+
+uint8_t obdFieldCount(uint8_t pid)
+{
+  uint8_t i, n = 0;
+
+  for(i = findPid(pid); i < OBD_FIELD_COUNT && pgm_read_byte(&OBD_FIELDS[i].pid) == pid; i++)
+    n++;
+  return n;
+}
+
+uint8_t obdReplyLength(uint8_t pid)
+{
+  uint8_t i, layout, end, length = 0;
+
+  for(i = findPid(pid); i < OBD_FIELD_COUNT && pgm_read_byte(&OBD_FIELDS[i].pid) == pid; i++)
+  {
+    layout = pgm_read_byte(&OBD_FIELDS[i].layout);
+    end = OBD_LAYOUT_FIRST(layout) + OBD_LAYOUT_BYTES(layout);
+    if(end > length)
+      length = end;
+  }
+  return length;
+}
+
+bool obdSupported(const OBDSCHEDULER *s, uint8_t pid)
+{
+  return (s->supported[pid >> 3] >> (7 - (pid & 7))) & 1;
+}
+
+static void setSupported(OBDSCHEDULER *s, uint8_t pid, bool on)
+{
+  if(on)
+    s->supported[pid >> 3] |= 0x80 >> (pid & 7);
+  else
+    s->supported[pid >> 3] &= ~(0x80 >> (pid & 7));
+}
+
+void obdSchedBegin(OBDSCHEDULER *s)
+{
+  memset(s, 0, sizeof(OBDSCHEDULER));
+  s->inFlight = OBD_SCHED_IDLE;
+}
+
+int8_t obdSchedAdd(OBDSCHEDULER *s, uint8_t pid, uint16_t period)
+{
+  OBDSCHEDPID *t;
+
+  if(s->count >= OBD_SCHED_PIDS)
+    return -1;
+  t = &s->pids[s->count];
+  memset(t, 0, sizeof(OBDSCHEDPID));
+  t->pid = pid;
+  t->period = period;
+  return s->count++;
+}
+
+void obdSchedDiscover(OBDSCHEDULER *s, uint32_t now)
+{
+  memset(s->supported, 0, sizeof(s->supported));
+  s->ready = false;
+  s->discover = 0x00;
+  s->inFlight = OBD_SCHED_IDLE;
+  s->retryAt = now;
+}
+
+//Every supported PID is due at once; the most overdue goes first, so they
+//spread out by themselves
+static void finishDiscovery(OBDSCHEDULER *s, uint32_t now)
+{
+  uint8_t i;
+
+  s->ready = true;
+  for(i = 0; i < s->count; i++)
+  {
+    s->pids[i].due = now;
+    s->pids[i].misses = 0;
+  }
+}
+
+static void timeoutInFlight(OBDSCHEDULER *s, uint32_t now)
+{
+  OBDSCHEDPID *t;
+
+  s->timeouts++;
+  if(s->inFlight == OBD_SCHED_DISCOVERY)
+  {
+    //No ECU behind 0x00 yet (ignition off?): try again later. A later
+    //bitmap the ECU announced but does not send ends discovery.
+    if(s->discover == 0x00)
+      s->retryAt = now + OBD_SCHED_RETRY;
+    else
+      finishDiscovery(s, now);
+  }
+  else
+  {
+    t = &s->pids[s->inFlight];
+    t->due = now + t->period;
+    if(++t->misses >= OBD_SCHED_MISSES)
+      setSupported(s, t->pid, false);
+  }
+  s->inFlight = OBD_SCHED_IDLE;
+}
+
+bool obdSchedNext(OBDSCHEDULER *s, uint32_t now, uint8_t *pid)
+{
+  uint8_t i, best = OBD_SCHED_IDLE;
+  int32_t late, bestLate = 0;
+
+  if(s->inFlight != OBD_SCHED_IDLE)
+  {
+    if(now - s->sentAt < OBD_SCHED_TIMEOUT)
+      return false;
+    timeoutInFlight(s, now);
+  }
+
+  if(!s->ready)
+  {
+    if(s->discover == 0x00 && (int32_t)(now - s->retryAt) < 0)
+      return false;
+    s->inFlight = OBD_SCHED_DISCOVERY;
+    s->inFlightPid = s->discover;
+  }
+  else
+  {
+    for(i = 0; i < s->count; i++)
+    {
+      if(!obdSupported(s, s->pids[i].pid))
+        continue;
+      late = (int32_t)(now - s->pids[i].due);
+      if(late >= 0 && (best == OBD_SCHED_IDLE || late > bestLate))
+      {
+        best = i;
+        bestLate = late;
+      }
+    }
+    if(best == OBD_SCHED_IDLE)
+      return false;
+    s->inFlight = best;
+    s->inFlightPid = s->pids[best].pid;
+  }
+  s->sentAt = now;
+  s->requests++;
+  *pid = s->inFlightPid;
+  return true;
+}
+
+void obdSchedUnsent(OBDSCHEDULER *s)
+{
+  //The PID's due time and the discovery state are untouched, so it is
+  //still the most overdue
+  if(s->inFlight == OBD_SCHED_IDLE)
+    return;
+  s->inFlight = OBD_SCHED_IDLE;
+  s->requests--;
+}
+
+int8_t obdSchedReply(OBDSCHEDULER *s, uint8_t pid, const uint8_t *data, uint8_t length, uint32_t now)
+{
+  OBDSCHEDPID *t;
+  uint8_t i, base;
+  int8_t index;
+
+  if(s->inFlight == OBD_SCHED_IDLE || pid != s->inFlightPid)
+    return -1;
+
+  if(s->inFlight == OBD_SCHED_DISCOVERY)
+  {
+    if(length < 4)
+      return -1;
+    //Bit 7 of A is PID base + 1, bit 0 of D is base + 0x20
+    base = pid;
+    setSupported(s, base, true);
+    for(i = 0; i < 32 && base + 1 + i <= 0xFF; i++)
+      setSupported(s, base + 1 + i, (data[i >> 3] >> (7 - (i & 7))) & 1);
+    s->inFlight = OBD_SCHED_IDLE;
+    if(base < 0xE0 && obdSupported(s, base + 0x20))
+      s->discover = base + 0x20;
+    else
+      finishDiscovery(s, now);
+    return -1;
+  }
+
+  index = s->inFlight;
+  t = &s->pids[index];
+  if(length > sizeof(t->data))
+    length = sizeof(t->data);
+  memcpy(t->data, data, length);
+  t->length = length;
+  t->updated = now;
+  t->misses = 0;
+  t->due = s->sentAt + t->period;
+  s->inFlight = OBD_SCHED_IDLE;
+  return index;
+}
+
+bool obdSchedFresh(const OBDSCHEDULER *s, uint8_t i, uint32_t now, uint32_t slack)
+{
+  const OBDSCHEDPID *t = &s->pids[i];
+
+  return t->length > 0 && obdSupported(s, t->pid) && now - t->updated <= 2UL * t->period + slack;
+}
@@ -0,0 +1,181 @@
+/*
+   This file is included as part of the CANOPNR distribution.
+   You are free to use this project as you see fit, provided credit is given to all
+   contributors (original and subsequent).
+
+   Copyright 2012  Jose Denrie Enriquez, Alex Bautista, Paloma Field, Sun-il Kim
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+  ------------------------------------------------------------------------------------------------------------
+
+  Mode 01 PID decoding in integer arithmetic, replacing the float and
+  sprintf() work MCP2515::formatOBD() did per value.
+
+  Each PID is one or more fields in a table (OBD_FIELDS, in CANOPNR_OBD.cpp,
+  kept in flash on the AVR). A field takes 1, 2 or 4 of the reply bytes A-D
+  as an unsigned or two's complement integer and scales it:
+
+    value = raw * num / den + offset        (rounded to nearest)
+
+  giving a fixed-point OBDVALUE in units of 10^-decimals. num, den and
+  decimals are chosen per field so the result matches the SAE J1979
+  formulas (as listed at http://en.wikipedia.org/wiki/OBD-II_PIDs) to
+  within half the last decimal; most fields are exact. For example RPM,
+  (256A+B)/4, is raw * 25 with 2 decimals, and O2 sensor voltage, A/200 V,
+  is raw * 5 with 3 decimals, where the old code truncated it to 0 or 1 V.
+
+  Covered: PIDs 0x00-0x63 and 0xA6 (odometer), plus the "PIDs supported"
+  bitmaps 0x80, 0xA0 and 0xC0. Bit-encoded PIDs (monitor status, fuel
+  system status, sensors present, fuel type, ...) are returned raw with
+  unit OBD_UNIT_BITS: the reply bytes big-endian, read as (uint32_t)value.
+  Other 4-byte values saturate at INT32_MAX (the odometer at 214748364.7 km).
+  Fields of PIDs above 0x63 that need more than the four bytes an OBDREPLY
+  holds are not decoded.
+
+  OBDSCHEDULER polls a set of PIDs, each at its own period, one request at
+  a time. It first asks the ECU which PIDs it supports (0x00, then 0x20,
+  0x40, ... while the previous reply says the next bitmap exists) and
+  never requests a PID the ECU did not list, so unsupported PIDs cost no
+  reply timeouts. A PID that is listed but goes unanswered
+  OBD_SCHED_MISSES times in a row is dropped as well, until the next
+  discovery. The caller sends what obdSchedNext() asks for, or hands it
+  back with obdSchedUnsent() when it cannot, and gives the replies to
+  obdSchedReply(); nothing here blocks or touches the bus.
+
+  Integer only and free of Arduino includes, like CANOPNR_Telemetry.
+*/
+
+#ifndef CANOPNR_OBD_h
+#define CANOPNR_OBD_h
+
+#include <stdint.h>
+
+#define OBD_MAX_FIELDS 4     //most values one PID decodes to (0x4F)
+
+//OBDVALUE.unit
+#define OBD_UNIT_NONE 0      //count, ratio or enumerated value
+#define OBD_UNIT_BITS 1      //raw bit-encoded bytes
+#define OBD_UNIT_PERCENT 2
+#define OBD_UNIT_CELSIUS 3
+#define OBD_UNIT_KPA 4
+#define OBD_UNIT_PA 5
+#define OBD_UNIT_RPM 6
+#define OBD_UNIT_KMH 7
+#define OBD_UNIT_DEGREE 8
+#define OBD_UNIT_GRAMS_PER_S 9
+#define OBD_UNIT_VOLT 10
+#define OBD_UNIT_MILLIAMP 11
+#define OBD_UNIT_SECOND 12
+#define OBD_UNIT_MINUTE 13
+#define OBD_UNIT_KM 14
+#define OBD_UNIT_NM 15
+#define OBD_UNIT_LITRE_PER_H 16
+
+//OBDFIELD.layout: first reply byte (0 = A), length in bytes, signedness
+#define OBD_LAYOUT(first, bytes, isSigned) ((first) | (((bytes) - 1) << 2) | ((isSigned) ? 0x10 : 0))
+#define OBD_LAYOUT_FIRST(layout) ((layout) & 0x03)
+#define OBD_LAYOUT_BYTES(layout) ((((layout) >> 2) & 0x03) + 1)
+#define OBD_LAYOUT_SIGNED(layout) (((layout) & 0x10) != 0)
+
+#define OBD_SCHED_PIDS 12        //PIDs one scheduler polls
+#define OBD_SCHED_MISSES 3       //unanswered requests in a row before a PID is dropped
+#define OBD_SCHED_TIMEOUT 100    //ms to wait for a reply
+#define OBD_SCHED_RETRY 5000     //ms between discovery attempts while no ECU answers 0x00
+#define OBD_SCHED_IDLE 0xFF      //OBDSCHEDULER.inFlight: no request outstanding
+#define OBD_SCHED_DISCOVERY 0xFE //OBDSCHEDULER.inFlight: a supported-PIDs request
+
+//One decoded value: value * 10^-decimals, in unit
+typedef struct
+{
+  int32_t value;
+  uint8_t unit;         //OBD_UNIT_*
+  uint8_t decimals;
+}  OBDVALUE;
+
+//One table row; a PID's rows are adjacent and the table is sorted by PID
+typedef struct
+{
+  uint8_t pid;
+  uint8_t layout;       //OBD_LAYOUT()
+  uint8_t unit;
+  uint8_t decimals;
+  int16_t num;
+  uint16_t den;
+  int32_t offset;       //in units of 10^-decimals
+}  OBDFIELD;
+
+//One polled PID
+typedef struct
+{
+  uint8_t pid;
+  uint8_t misses;       //requests in a row without a reply
+  uint8_t length;       //reply bytes in data, 0 until the first reply
+  uint8_t data[4];      //A-D of the latest reply
+  uint16_t period;      //ms between requests
+  uint32_t due;         //ms time of the next request
+  uint32_t updated;     //ms time of the latest reply
+}  OBDSCHEDPID;
+
+typedef struct
+{
+  uint8_t supported[32]; //bit 7 - pid % 8 of byte pid / 8, in the order the 0x00 reply uses
+  bool ready;           //discovery finished
+  uint8_t discover;     //next supported-PIDs request while !ready
+  uint8_t inFlight;     //index into pids, or OBD_SCHED_IDLE / OBD_SCHED_DISCOVERY
+  uint8_t inFlightPid;
+  uint32_t sentAt;
+  uint32_t retryAt;     //next 0x00 attempt while no ECU answers
+  uint8_t count;
+  OBDSCHEDPID pids[OBD_SCHED_PIDS];
+  uint32_t requests;    //requests handed out by obdSchedNext()
+  uint32_t timeouts;    //of those, unanswered
+}  OBDSCHEDULER;
+
+//Decodes the reply bytes A, B, ... (length of them) of mode 01 PID pid.
+//Returns the number of values written, at most max; 0 if the PID is not
+//in the table or the reply is shorter than its fields need.
+uint8_t obdDecode(uint8_t pid, const uint8_t *data, uint8_t length, OBDVALUE *values, uint8_t max);
+
+//Fields PID pid decodes to, 0 if it is not in the table
+uint8_t obdFieldCount(uint8_t pid);
+
+//Reply bytes PID pid needs, 0 if it is not in the table
+uint8_t obdReplyLength(uint8_t pid);
+
+void obdSchedBegin(OBDSCHEDULER *s);
+
+//Polls pid every period ms once discovery has found it supported.
+//Returns its index in s->pids, or -1 if the scheduler is full.
+int8_t obdSchedAdd(OBDSCHEDULER *s, uint8_t pid, uint16_t period);
+
+//Forgets what the ECU supports and asks again, e.g. after the bus slept
+void obdSchedDiscover(OBDSCHEDULER *s, uint32_t now);
+
+//The PID to request now, if any: true with *pid set. The request counts as
+//sent at now; its reply is expected within OBD_SCHED_TIMEOUT.
+bool obdSchedNext(OBDSCHEDULER *s, uint32_t now, uint8_t *pid);
+//The request obdSchedNext() just handed out could not be sent (TX queue
+//full): it is not in flight and counts as no miss; the next call asks again
+void obdSchedUnsent(OBDSCHEDULER *s);
+
+//A mode 01 reply: its PID, then length bytes A, B, .... Returns the index
+//of the PID it updated, or -1 (discovery, or not a reply being waited for).
+int8_t obdSchedReply(OBDSCHEDULER *s, uint8_t pid, const uint8_t *data, uint8_t length, uint32_t now);
+
+bool obdSupported(const OBDSCHEDULER *s, uint8_t pid);
+
+//Polled PID i was answered within two periods plus slack ms
+bool obdSchedFresh(const OBDSCHEDULER *s, uint8_t i, uint32_t now, uint32_t slack);
+
+#endif
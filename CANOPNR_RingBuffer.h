@@ -0,0 +1,107 @@
+/*
+   This file is included as part of the CANOPNR distribution.
+   You are free to use this project as you see fit, provided credit is given to all
+   contributors (original and subsequent).
+
+   Copyright 2012  Jose Denrie Enriquez, Alex Bautista, Paloma Field, Sun-il Kim
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+  ------------------------------------------------------------------------------------------------------------
+
+  Fixed-size single-producer/single-consumer ring.
+
+  One side (an ISR on the Arduino, any thread on a PC) calls push(), the other
+  calls pop(). Neither side ever blocks or disables interrupts: the producer
+  only writes head, the consumer only writes tail, and each publishes its index
+  after the slot it guards has been written or read. One slot is kept empty to
+  tell full from empty, so a RingBuffer<T, 8> holds 7 items.
+
+  Header-only and free of Arduino includes so it builds unchanged on a host.
+*/
+
+#ifndef CANOPNR_RingBuffer_h
+#define CANOPNR_RingBuffer_h
+
+#if defined(__AVR__)
+// 8-bit loads and stores are atomic on AVR; the barrier keeps the compiler
+// from moving the slot access across the index update.
+typedef volatile unsigned char ring_index_t;
+typedef volatile unsigned long ring_counter_t;
+static inline unsigned char ringLoad(const ring_index_t &idx) { unsigned char val = idx; __asm__ __volatile__("" ::: "memory"); return val; }
+static inline void ringStore(ring_index_t &idx, unsigned char val) { __asm__ __volatile__("" ::: "memory"); idx = val; }
+#else
+#include <atomic>
+typedef std::atomic<unsigned char> ring_index_t;
+typedef std::atomic<unsigned long> ring_counter_t;
+static inline unsigned char ringLoad(const ring_index_t &idx) { return idx.load(std::memory_order_acquire); }
+static inline void ringStore(ring_index_t &idx, unsigned char val) { idx.store(val, std::memory_order_release); }
+#endif
+
+template <typename T, unsigned char SIZE>
+class RingBuffer
+{
+  public:
+    RingBuffer() : head(0), tail(0), overflows(0) {}
+
+    //Producer side. Returns false and counts an overflow when full.
+    bool push(const T &item)
+    {
+      unsigned char h = ringLoad(head);
+      unsigned char next = h + 1;
+      if(next == SIZE)
+        next = 0;
+      if(next == ringLoad(tail))
+      {
+        overflows++;
+        return false;
+      }
+      items[h] = item;
+      ringStore(head, next);
+      return true;
+    }
+
+    //Consumer side. Returns false when empty.
+    bool pop(T *item)
+    {
+      unsigned char t = ringLoad(tail);
+      if(t == ringLoad(head))
+        return false;
+      *item = items[t];
+      t++;
+      if(t == SIZE)
+        t = 0;
+      ringStore(tail, t);
+      return true;
+    }
+
+    unsigned char available() const
+    {
+      unsigned char h = ringLoad(head);
+      unsigned char t = ringLoad(tail);
+      return (h >= t) ? (h - t) : (SIZE - t + h);
+    }
+
+    unsigned char capacity() const { return SIZE - 1; }
+
+    //Written by the producer only; on AVR read it with interrupts disabled.
+    unsigned long getOverflowCount() const { return overflows; }
+
+  private:
+    T items[SIZE];
+    ring_index_t head;
+    ring_index_t tail;
+    ring_counter_t overflows;
+};
+
+#endif
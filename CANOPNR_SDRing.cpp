@@ -0,0 +1,295 @@
+/*
+   This file is included as part of the CANOPNR distribution.
+   You are free to use this project as you see fit, provided credit is given to all
+   contributors (original and subsequent).
+
+   Copyright 2012  Jose Denrie Enriquez, Alex Bautista, Paloma Field, Sun-il Kim
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+  ------------------------------------------------------------------------------------------------------------
+
+  SD card store-and-forward ring, see CANOPNR_SDRing.h.
+*/
+
+#include <string.h>
+#include "CANOPNR_SDRing.h"
+
+#define OFF_MAGIC 0
+#define OFF_ID 4
+#define OFF_SEQ 8       //slot count in the header block
+#define OFF_TAIL 12
+#define OFF_LEN 16
+#define OFF_CRC 18
+
+static void put16(uint8_t *p, uint16_t v)
+{
+  p[0] = v;
+  p[1] = v >> 8;
+}
+
+static void put32(uint8_t *p, uint32_t v)
+{
+  put16(p, v);
+  put16(p + 2, v >> 16);
+}
+
+static uint16_t get16(const uint8_t *p)
+{
+  return p[0] | ((uint16_t)p[1] << 8);
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+  return get16(p) | ((uint32_t)get16(p + 2) << 16);
+}
+
+//CRC-16/CCITT, polynomial 0x1021 MSB first
+static uint16_t crc16(uint16_t crc, const uint8_t *p, uint16_t n)
+{
+  byte bit;
+
+  while(n-- > 0)
+  {
+    crc ^= (uint16_t)*p++ << 8;
+    for(bit = 0; bit < 8; bit++)
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+  }
+  return crc;
+}
+
+//CRC over the fixed fields and len payload bytes
+static uint16_t blockCrc(const uint8_t *buf, uint16_t len)
+{
+  return crc16(crc16(0xFFFF, buf, OFF_CRC), buf + SD_RING_HEADER_SIZE, len);
+}
+
+SDRing::SDRing()
+{
+  card = 0;
+  first = 0;
+  slots = 0;
+  id = 0;
+  nextSeq = 0;
+  tailSeq = 0;
+  appends = 0;
+  overwrites = 0;
+  errors = 0;
+}
+
+//Sequence numbers map to slots directly, so the newest entry also tells
+//where the next one goes
+uint32_t SDRing::blockOf(uint32_t seq)
+{
+  return first + 1 + seq % slots;
+}
+
+boolean SDRing::write(uint32_t block, uint8_t *buf)
+{
+  if(card->writeBlock(block, buf))
+    return true;
+  errors++;
+  return false;
+}
+
+//Writes the entry for nextSeq from the cache buffer holding the payload
+boolean SDRing::put(uint8_t *buf, uint16_t len, uint32_t tail)
+{
+  put32(buf + OFF_MAGIC, SD_RING_ENTRY_MAGIC);
+  put32(buf + OFF_ID, id);
+  put32(buf + OFF_SEQ, nextSeq);
+  put32(buf + OFF_TAIL, tail);
+  put16(buf + OFF_LEN, len);
+  put16(buf + OFF_CRC, blockCrc(buf, len));
+  if(!write(blockOf(nextSeq), buf))
+    return false;
+  nextSeq++;
+  return true;
+}
+
+boolean SDRing::format()
+{
+  uint8_t *buf = SdVolume::cacheClear();
+
+  memset(buf, 0, 512);
+  id += micros() | 1; //differs from the ring these blocks held before
+  put32(buf + OFF_MAGIC, SD_RING_MAGIC);
+  put32(buf + OFF_ID, id);
+  put32(buf + OFF_SEQ, slots);
+  put16(buf + OFF_CRC, blockCrc(buf, 0));
+  nextSeq = 0;
+  tailSeq = 0;
+  return write(first, buf);
+}
+
+/*
+ * Reads every slot once to find the newest entry of this ring: the read
+ * position saved with it is where the ring resumes.
+ */
+boolean SDRing::begin(Sd2Card *sd, uint32_t firstBlock, uint32_t blockCount)
+{
+  uint8_t *buf = SdVolume::cacheClear();
+  uint32_t slot, seq, newest = 0, tail = 0;
+  boolean found = false;
+
+  if(blockCount < 2)
+    return false;
+  card = sd;
+  first = firstBlock;
+  slots = blockCount - 1;
+  if(!card->readBlock(first, buf))
+  {
+    errors++;
+    return false;
+  }
+  if(get32(buf + OFF_MAGIC) != SD_RING_MAGIC || get16(buf + OFF_CRC) != blockCrc(buf, 0) ||
+     get32(buf + OFF_SEQ) != slots)
+  {
+    id = (get32(buf + OFF_MAGIC) == SD_RING_MAGIC) ? get32(buf + OFF_ID) : 0;
+    return format();
+  }
+  id = get32(buf + OFF_ID);
+
+  for(slot = 0; slot < slots; slot++)
+  {
+    if(!card->readBlock(first + 1 + slot, buf))
+    {
+      errors++;
+      return false;
+    }
+    if(get32(buf + OFF_MAGIC) != SD_RING_ENTRY_MAGIC || get32(buf + OFF_ID) != id ||
+       get16(buf + OFF_LEN) > SD_RING_PAYLOAD_MAX)
+      continue;
+    seq = get32(buf + OFF_SEQ);
+    if(seq % slots != slot || get16(buf + OFF_CRC) != blockCrc(buf, get16(buf + OFF_LEN)))
+      continue; //torn write
+    if(!found || seq > newest)
+    {
+      newest = seq;
+      tail = get32(buf + OFF_TAIL);
+      found = true;
+    }
+  }
+
+  nextSeq = found ? newest + 1 : 0;
+  tailSeq = tail;
+  if(nextSeq - tailSeq > slots)
+    tailSeq = nextSeq - slots;
+  return true;
+}
+
+/*
+ * Stores one entry with a single sector write. When the ring is full the
+ * oldest entry goes.
+ */
+boolean SDRing::append(const uint8_t *data, uint16_t len)
+{
+  uint8_t *buf;
+  uint32_t tail = tailSeq;
+
+  if(card == 0 || len == 0 || len > SD_RING_PAYLOAD_MAX)
+    return false;
+  if(nextSeq - tail >= slots)
+    tail++;
+  buf = SdVolume::cacheClear();
+  memcpy(buf + SD_RING_HEADER_SIZE, data, len);
+  memset(buf + SD_RING_HEADER_SIZE + len, 0, SD_RING_PAYLOAD_MAX - len);
+  if(!put(buf, len, tail))
+    return false;
+  if(tail != tailSeq)
+    overwrites++;
+  tailSeq = tail;
+  appends++;
+  return true;
+}
+
+/*
+ * Copies the oldest entry into dst and returns its length. Entries that
+ * fail their check or do not fit are skipped; a read error leaves the ring
+ * as it is and returns 0.
+ */
+uint16_t SDRing::peek(uint8_t *dst, uint16_t size)
+{
+  uint8_t *buf;
+  uint16_t len;
+
+  if(card == 0)
+    return 0;
+  buf = SdVolume::cacheClear();
+  for(; tailSeq != nextSeq; tailSeq++)
+  {
+    if(!card->readBlock(blockOf(tailSeq), buf))
+    {
+      errors++;
+      return 0;
+    }
+    len = get16(buf + OFF_LEN);
+    if(get32(buf + OFF_MAGIC) != SD_RING_ENTRY_MAGIC || get32(buf + OFF_ID) != id ||
+       get32(buf + OFF_SEQ) != tailSeq || len > SD_RING_PAYLOAD_MAX ||
+       get16(buf + OFF_CRC) != blockCrc(buf, len) || len > size)
+    {
+      errors++;
+      continue;
+    }
+    if(len == 0) //checkpoint
+      continue;
+    memcpy(dst, buf + SD_RING_HEADER_SIZE, len);
+    return len;
+  }
+  return 0;
+}
+
+/*
+ * Moves past the oldest entry. When that empties the ring a checkpoint
+ * entry records it, so a reset does not send everything again.
+ */
+boolean SDRing::pop()
+{
+  uint8_t *buf;
+
+  if(card == 0 || tailSeq == nextSeq)
+    return false;
+  tailSeq++;
+  if(tailSeq != nextSeq)
+    return true;
+  buf = SdVolume::cacheClear();
+  memset(buf + SD_RING_HEADER_SIZE, 0, SD_RING_PAYLOAD_MAX);
+  if(put(buf, 0, nextSeq + 1))
+    tailSeq = nextSeq;
+  return true;
+}
+
+uint32_t SDRing::count()
+{
+  return nextSeq - tailSeq;
+}
+
+uint32_t SDRing::capacity()
+{
+  return slots;
+}
+
+unsigned long SDRing::getAppendCount()
+{
+  return appends;
+}
+
+unsigned long SDRing::getOverwriteCount()
+{
+  return overwrites;
+}
+
+unsigned long SDRing::getErrorCount()
+{
+  return errors;
+}
@@ -0,0 +1,95 @@
+/*
+   This file is included as part of the CANOPNR distribution.
+   You are free to use this project as you see fit, provided credit is given to all
+   contributors (original and subsequent).
+
+   Copyright 2012  Jose Denrie Enriquez, Alex Bautista, Paloma Field, Sun-il Kim
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+  ------------------------------------------------------------------------------------------------------------
+
+  Store-and-forward log on the SD card for uploads the modem could not take.
+
+  Entries live in a fixed range of blocks, normally a contiguous file made
+  once with SdFile::createContiguous(), and are written with whole-sector
+  Sd2Card::writeBlock() calls: no FAT or directory update per entry, and
+  exactly one sector write per append. The 512-byte buffer is the SD
+  library's own block cache (SdVolume::cacheClear()), so the ring needs no
+  RAM of its own beyond a few counters.
+
+  The first block of the range holds the ring header; every other block is
+  one slot holding one entry:
+
+    off  size  field
+      0     4  SD_RING_MAGIC (header) / SD_RING_ENTRY_MAGIC (entry)
+      4     4  ring id, made up when the ring is formatted
+      8     4  header: slot count / entry: sequence number
+     12     4  entry: oldest undelivered sequence when it was written
+     16     2  entry: payload length, 0 for a checkpoint
+     18     2  CRC-16/CCITT of the bytes above and the payload
+     20     -  payload, up to SD_RING_PAYLOAD_MAX bytes
+
+  Slots are written in order and wrap around; when the ring is full the
+  oldest entry is overwritten. The read position is kept in RAM and saved
+  with the next append, or with a checkpoint entry when the ring runs empty,
+  so after a reset begin() finds the newest valid entry and at worst sends
+  again what was delivered since. A sector torn by a power loss fails its
+  CRC and is skipped; the ring id keeps entries of an older ring in the
+  same blocks from being taken for current ones. All fields little-endian.
+*/
+
+#ifndef CANOPNR_SDRing_h
+#define CANOPNR_SDRing_h
+
+#include "Arduino.h"
+#include <SD.h>
+
+#define SD_RING_MAGIC 0x474E5253UL        //"SRNG"
+#define SD_RING_ENTRY_MAGIC 0x544E5253UL  //"SRNT"
+#define SD_RING_HEADER_SIZE 20
+#define SD_RING_PAYLOAD_MAX (512 - SD_RING_HEADER_SIZE)
+
+class SDRing
+{
+  public:
+    SDRing();
+    //Finds the ring in the blocks, or formats them; false on an I/O error
+    boolean begin(Sd2Card *card, uint32_t firstBlock, uint32_t blockCount);
+    boolean append(const uint8_t *data, uint16_t len);
+    uint16_t peek(uint8_t *dst, uint16_t size);  //oldest entry, 0 if none
+    boolean pop();                               //the oldest entry was delivered
+    uint32_t count();
+    uint32_t capacity();
+
+    unsigned long getAppendCount();
+    unsigned long getOverwriteCount();
+    unsigned long getErrorCount();      //failed I/O and entries that failed their CRC
+
+  private:
+    Sd2Card *card;
+    uint32_t first;
+    uint32_t slots;
+    uint32_t id;
+    uint32_t nextSeq;    //sequence of the next append
+    uint32_t tailSeq;    //oldest undelivered sequence
+    unsigned long appends;
+    unsigned long overwrites;
+    unsigned long errors;
+    uint32_t blockOf(uint32_t seq);
+    boolean write(uint32_t block, uint8_t *buf);
+    boolean put(uint8_t *buf, uint16_t len, uint32_t tail);
+    boolean format();
+};
+
+#endif
@@ -0,0 +1,188 @@
+/*
+   This file is included as part of the CANOPNR distribution.
+   You are free to use this project as you see fit, provided credit is given to all
+   contributors (original and subsequent).
+
+   Copyright 2012  Jose Denrie Enriquez, Alex Bautista, Paloma Field, Sun-il Kim
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+  ------------------------------------------------------------------------------------------------------------
+
+  Declarative CAN signal decoding, DBC style: a signal is its message ID,
+  start bit, length, byte order, signedness and a scaling, and decodes to
+  an integer in fixed-point units. No float anywhere.
+
+  Start bits follow the DBC convention. Intel (little-endian): the LSB,
+  bit n being bit n%8 of byte n/8. Motorola (big-endian): the MSB, same
+  numbering, the signal running towards higher byte indices.
+
+  The value is raw * num / den + offset in units of 1/scale of the DBC
+  unit: a wheel speed with factor 0.01 km/h gets scale 100, num 1, den 1,
+  and comes out in 0.01 km/h. den is 1 whenever the factor is a decimal
+  fraction, so there is no division either.
+
+  Each signal is a CANSIGNAL type. Its byte range, shift and mask are
+  constants worked out at compile time, so value() compiles to a few
+  loads, shifts and at most one multiply:
+
+      typedef CANSIGNAL<0x513, 7, 16, CAN_MOTOROLA, false, 1, 1, 0, 100> SIG_WHEEL_SPEED0;
+      if(SIG_WHEEL_SPEED0::match(&msg))
+        speed = SIG_WHEEL_SPEED0::value(msg.data);
+
+  The same definitions as a table (SIGNALDEF) match and decode with
+  canSignalMatch() and canSignalValue(), for code that looks signals up
+  at run time. host/dbc2signals generates
+  both from a DBC file; see CANOPNR_VehicleSignals.h.
+*/
+
+#ifndef CANOPNR_Signals_h
+#define CANOPNR_Signals_h
+
+#include "CANOPNR_MCP2515.h"
+
+#define CAN_INTEL 1       //@1 in a DBC file
+#define CAN_MOTOROLA 0    //@0
+
+typedef struct
+{
+  const char *name;
+  unsigned long id;       //OR CAN_EXTENDED_ID for a 29-bit ID
+  byte start;
+  byte length;            //1-32 bits, within 4 consecutive bytes
+  byte order;             //CAN_INTEL or CAN_MOTOROLA
+  boolean isSigned;
+  long num;
+  long den;
+  long offset;
+  long scale;             //value units per DBC unit
+}  SIGNALDEF;
+
+//Bit position of the MSB counted from bit 7 of byte 0, as a byte stream reads
+constexpr byte canMotorolaMsb(byte start) { return (start / 8) * 8 + 7 - start % 8; }
+
+//The MSB (Motorola) or LSB (Intel) is in the first byte either way
+constexpr byte canFirstByte(byte start) { return start / 8; }
+
+constexpr byte canLastByte(byte start, byte length, byte order)
+{
+  return (order == CAN_MOTOROLA) ? (canMotorolaMsb(start) + length - 1) / 8 : (start + length - 1) / 8;
+}
+
+//Right shift that brings the LSB to bit 0 of the loaded word
+constexpr byte canShift(byte start, byte length, byte order)
+{
+  return (order == CAN_MOTOROLA) ? 7 - (canMotorolaMsb(start) + length - 1) % 8 : start % 8;
+}
+
+constexpr uint32_t canMask(byte length)
+{
+  return (length >= 32) ? 0xFFFFFFFFUL : (1UL << length) - 1;
+}
+
+//Bytes first..last as one word, in the signal's byte order
+inline uint32_t canLoad(const byte *data, byte first, byte last, byte order)
+{
+  uint32_t w = 0;
+  byte i;
+
+  if(order == CAN_MOTOROLA)
+  {
+    for(i = first; i <= last; i++)
+      w = (w << 8) | data[i];
+  }
+  else
+  {
+    for(i = last + 1; i-- > first; )
+      w = (w << 8) | data[i];
+  }
+  return w;
+}
+
+inline long canScale(uint32_t raw, byte length, boolean isSigned, long num, long den, long offset)
+{
+  int32_t v;
+
+  if(isSigned && length < 32 && ((raw >> (length - 1)) & 1))
+    v = (int32_t)(raw | ~canMask(length)); //sign-extend
+  else
+    v = (int32_t)raw;
+  if(num != 1)
+    v *= num;
+  if(den != 1)
+    v /= den;
+  return v + offset;
+}
+
+//The frame has this ID and type. A 29-bit ID arrives split into its top 11
+//bits (adrsValue) and low 18 (extendedAdrsValue)
+inline boolean canIdMatch(unsigned long id, const CANMSG *msg)
+{
+  if(id & CAN_EXTENDED_ID)
+    return msg->isExtendedAdrs &&
+           (((unsigned long)msg->adrsValue << 18) | msg->extendedAdrsValue) == (id & 0x1FFFFFFFUL);
+  return !msg->isExtendedAdrs && msg->adrsValue == id;
+}
+
+template <unsigned long ID, byte START, byte LENGTH, byte ORDER, boolean SIGNED, long NUM, long DEN, long OFFSET, long SCALE>
+struct CANSIGNAL
+{
+  static_assert(LENGTH >= 1 && LENGTH <= 32, "signal length must be 1-32 bits");
+  static_assert(canLastByte(START, LENGTH, ORDER) < 8, "signal runs past the 8th data byte");
+  static_assert(canLastByte(START, LENGTH, ORDER) - canFirstByte(START) < 4,
+                "signal spans more than 4 bytes");
+  static_assert(DEN > 0 && SCALE > 0, "den and scale must be positive");
+
+  static const unsigned long id = ID;
+  static const long scale = SCALE;
+
+  //The frame carries this signal: same ID and type, long enough
+  static boolean match(const CANMSG *msg)
+  {
+    if(msg->rtr || msg->dataLength <= canLastByte(START, LENGTH, ORDER))
+      return false;
+    return canIdMatch(ID, msg);
+  }
+
+  static uint32_t raw(const byte *data)
+  {
+    return (canLoad(data, canFirstByte(START), canLastByte(START, LENGTH, ORDER), ORDER) >>
+            canShift(START, LENGTH, ORDER)) & canMask(LENGTH);
+  }
+
+  static long value(const byte *data)
+  {
+    return canScale(raw(data), LENGTH, SIGNED, NUM, DEN, OFFSET);
+  }
+};
+
+//Run-time counterpart of CANSIGNAL::match()
+inline boolean canSignalMatch(const SIGNALDEF *sig, const CANMSG *msg)
+{
+  if(msg->rtr || msg->dataLength <= canLastByte(sig->start, sig->length, sig->order))
+    return false;
+  return canIdMatch(sig->id, msg);
+}
+
+//Run-time counterpart of CANSIGNAL::value()
+inline long canSignalValue(const SIGNALDEF *sig, const byte *data)
+{
+  uint32_t raw;
+
+  raw = (canLoad(data, canFirstByte(sig->start),
+                 canLastByte(sig->start, sig->length, sig->order), sig->order) >>
+         canShift(sig->start, sig->length, sig->order)) & canMask(sig->length);
+  return canScale(raw, sig->length, sig->isSigned, sig->num, sig->den, sig->offset);
+}
+
+#endif
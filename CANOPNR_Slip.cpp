@@ -0,0 +1,182 @@
+/*
+   This file is included as part of the CANOPNR distribution.
+   You are free to use this project as you see fit, provided credit is given to all
+   contributors (original and subsequent).
+
+   Copyright 2012  Jose Denrie Enriquez, Alex Bautista, Paloma Field, Sun-il Kim
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+  ------------------------------------------------------------------------------------------------------------
+
+  Wheel slip monitor, see CANOPNR_Slip.h.
+*/
+
+#include <string.h>
+#include "CANOPNR_Slip.h"
+
+void slipBegin(SLIPMONITOR *m, int16_t threshold, uint8_t refMask)
+{
+  memset(m, 0, sizeof(SLIPMONITOR));
+  m->threshold = threshold;
+  m->refMask = refMask & ((1 << SLIP_WHEELS) - 1);
+}
+
+void slipSetBrake(SLIPMONITOR *m, uint8_t brake)
+{
+  m->brake = brake;
+}
+
+static uint16_t reference(const SLIPMONITOR *m, const uint16_t *w)
+{
+  uint16_t s[SLIP_WHEELS], t;
+  uint32_t sum = 0;
+  uint8_t i, j, n = 0;
+
+  if(m->refMask != 0)
+  {
+    for(i = 0; i < SLIP_WHEELS; i++)
+    {
+      if((m->refMask >> i) & 1)
+      {
+        sum += w[i];
+        n++;
+      }
+    }
+    return sum / n;
+  }
+  memcpy(s, w, sizeof(s));
+  for(i = 1; i < SLIP_WHEELS; i++)
+    for(j = i; j > 0 && s[j - 1] > s[j]; j--)
+    {
+      t = s[j];
+      s[j] = s[j - 1];
+      s[j - 1] = t;
+    }
+  return ((uint32_t)s[1] + s[2]) / 2;
+}
+
+static int16_t magnitude(int16_t slip)
+{
+  return slip < 0 ? -slip : slip;
+}
+
+static void finish(SLIPMONITOR *m, SLIPTRACK *t, uint32_t stamp)
+{
+  t->open = false;
+  t->end = stamp;
+  m->events++;
+  if(m->doneCount >= SLIP_EVENT_QUEUE)
+  {
+    m->dropped++;
+    return;
+  }
+  m->done[m->doneCount++] = *t;
+}
+
+void slipAddWheels(SLIPMONITOR *m, const uint16_t *w, uint32_t stamp)
+{
+  uint16_t ref, top;
+  SLIPTRACK *t;
+  int16_t slip;
+  uint8_t i;
+
+  ref = reference(m, w);
+  m->speed = ref;
+  if(m->frames < 0xFFFF)
+    m->frames++;
+
+  for(i = 0; i < SLIP_WHEELS; i++)
+  {
+    t = &m->track[i];
+    top = (w[i] > ref) ? w[i] : ref;
+    if(top < SLIP_MIN_SPEED)
+    {
+      //Too slow for a meaningful ratio: a standstill ends any event
+      if(t->open)
+        finish(m, t, stamp);
+      continue;
+    }
+    slip = (int16_t)(((int32_t)w[i] - ref) * 1000 / top);
+    if(m->used[i] < 0xFFFF)
+    {
+      m->sum[i] += slip;
+      m->used[i]++;
+    }
+    if(magnitude(slip) > magnitude(m->peak[i]))
+      m->peak[i] = slip;
+
+    if(!t->open)
+    {
+      if(magnitude(slip) < m->threshold)
+        continue;
+      t->open = true;
+      t->wheel = i;
+      t->start = stamp;
+      t->peak = 0;
+    }
+    else if(magnitude(slip) < m->threshold / 2)
+    {
+      finish(m, t, stamp);
+      continue;
+    }
+    if(magnitude(slip) > magnitude(t->peak))
+    {
+      t->peak = slip;
+      t->speed = ref;
+      t->brake = m->brake;
+    }
+  }
+}
+
+uint8_t slipTakeEvents(SLIPMONITOR *m, SLIPEVENT *events, uint8_t max, uint32_t base)
+{
+  const SLIPTRACK *t;
+  int32_t start;
+  uint32_t duration;
+  uint8_t n, i;
+
+  n = (m->doneCount < max) ? m->doneCount : max;
+  for(i = 0; i < n; i++)
+  {
+    t = &m->done[i];
+    start = (int32_t)(t->start - base) / 1000;
+    duration = (t->end - t->start) / 1000;
+    events[i].start = (start < -32768) ? -32768 : (start > 32767) ? 32767 : start;
+    events[i].duration = (duration > 0xFFFF) ? 0xFFFF : duration;
+    events[i].wheel = t->wheel;
+    events[i].peak = t->peak;
+    events[i].speed = t->speed;
+    events[i].brake = t->brake;
+  }
+  m->doneCount -= n;
+  memmove(m->done, m->done + n, m->doneCount * sizeof(SLIPTRACK));
+  return n;
+}
+
+void slipTakeSummary(SLIPMONITOR *m, SLIPSUMMARY *summary)
+{
+  uint8_t i;
+
+  summary->frames = m->frames;
+  summary->speed = m->speed;
+  for(i = 0; i < SLIP_WHEELS; i++)
+  {
+    summary->mean[i] = m->used[i] ? m->sum[i] / m->used[i] : 0;
+    summary->peak[i] = m->peak[i];
+    m->sum[i] = 0;
+    m->used[i] = 0;
+    m->peak[i] = 0;
+  }
+  m->frames = 0;
+}
@@ -0,0 +1,120 @@
+/*
+   This file is included as part of the CANOPNR distribution.
+   You are free to use this project as you see fit, provided credit is given to all
+   contributors (original and subsequent).
+
+   Copyright 2012  Jose Denrie Enriquez, Alex Bautista, Paloma Field, Sun-il Kim
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+  ------------------------------------------------------------------------------------------------------------
+
+  Wheel slip from the 0x513 wheel speed frame, computed on the node so only
+  slip events and per-record aggregates are uploaded, not raw samples.
+
+  Wheel speeds come in 0.01 km/h, four per frame (the SIG_WHEEL_SPEED0-3
+  signals of 0x513, see CANOPNR_VehicleSignals.h), each frame with the time
+  the driver read it from the controller (CANMSG.timestamp), so events are
+  timed to the frame rather than to the loop() cycle. A wheel is its
+  index, 0-3.
+
+  The reference (vehicle) speed is the mean of the wheels in refMask, or
+  the median of all four when refMask is 0. Set refMask to the undriven
+  axle when it is known: with both driven wheels spinning the median sits
+  between them and the undriven pair. OBD PID 0x0D is not used, it has
+  1 km/h resolution and one reading per cycle.
+
+  Slip ratio, permille: (wheel - reference) * 1000 / max(wheel, reference),
+  positive when the wheel spins, negative when it locks. It is not computed
+  while both are below SLIP_MIN_SPEED. An event starts when a wheel's slip
+  magnitude reaches the threshold and ends when it falls below half of it.
+
+  Integer only and free of Arduino includes, like CANOPNR_Telemetry.
+*/
+
+#ifndef CANOPNR_Slip_h
+#define CANOPNR_Slip_h
+
+#include <stdint.h>
+
+#define SLIP_WHEELS 4
+#define SLIP_THRESHOLD 100      //default event threshold, permille
+#define SLIP_MIN_SPEED 500      //0.01 km/h
+#define SLIP_EVENT_QUEUE 8      //finished events held until slipTakeEvents()
+
+//A finished slip event as uploaded
+typedef struct
+{
+  int16_t start;        //ms after the base given to slipTakeEvents(), negative if earlier
+  uint16_t duration;    //ms
+  uint8_t wheel;        //0-3
+  int16_t peak;         //slip at the largest magnitude, permille
+  uint16_t speed;       //reference speed at the peak, 0.01 km/h
+  uint8_t brake;        //brake pressure at the peak (0x511 byte 4)
+}  SLIPEVENT;
+
+//Aggregates over the frames since the last slipTakeSummary()
+typedef struct
+{
+  uint16_t frames;                //0x513 frames seen
+  uint16_t speed;                 //last reference speed, 0.01 km/h
+  int16_t mean[SLIP_WHEELS];      //mean slip, permille
+  int16_t peak[SLIP_WHEELS];      //slip at the largest magnitude, permille
+}  SLIPSUMMARY;
+
+//An event while it is open, and once finished until it is taken
+typedef struct
+{
+  bool open;
+  uint8_t wheel;
+  uint32_t start;       //timestamp of the first frame at the threshold
+  uint32_t end;         //timestamp of the frame that ended it
+  int16_t peak;
+  uint16_t speed;
+  uint8_t brake;
+}  SLIPTRACK;
+
+typedef struct
+{
+  int16_t threshold;
+  uint8_t refMask;
+  uint8_t brake;                  //latest brake pressure
+  SLIPTRACK track[SLIP_WHEELS];
+  SLIPTRACK done[SLIP_EVENT_QUEUE];
+  uint8_t doneCount;
+  uint16_t frames;
+  uint16_t speed;
+  int32_t sum[SLIP_WHEELS];
+  uint16_t used[SLIP_WHEELS];     //frames with a slip ratio, per wheel
+  int16_t peak[SLIP_WHEELS];
+  uint32_t events;                //finished events, taken or not
+  uint32_t dropped;               //finished events lost to a full queue
+}  SLIPMONITOR;
+
+//refMask: bit n selects wheel n for the reference speed, 0 for the median
+void slipBegin(SLIPMONITOR *m, int16_t threshold, uint8_t refMask);
+
+//Brake pressure to attach to events from now on
+void slipSetBrake(SLIPMONITOR *m, uint8_t brake);
+
+//The four wheel speeds of one frame, 0.01 km/h, and the micros() it was received at
+void slipAddWheels(SLIPMONITOR *m, const uint16_t *wheels, uint32_t stamp);
+
+//Moves up to max finished events to events, oldest first, with start
+//relative to base (a micros() value). Returns how many were moved.
+uint8_t slipTakeEvents(SLIPMONITOR *m, SLIPEVENT *events, uint8_t max, uint32_t base);
+
+//Fills summary and starts the next aggregation period
+void slipTakeSummary(SLIPMONITOR *m, SLIPSUMMARY *summary);
+
+#endif
@@ -0,0 +1,173 @@
+/*
+   This file is included as part of the CANOPNR distribution.
+   You are free to use this project as you see fit, provided credit is given to all
+   contributors (original and subsequent).
+
+   Copyright 2012  Jose Denrie Enriquez, Alex Bautista, Paloma Field, Sun-il Kim
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+  ------------------------------------------------------------------------------------------------------------
+
+  Telemetry record encoder/decoder, see CANOPNR_Telemetry.h for the layout.
+  Fields are packed byte by byte, so the result does not depend on struct
+  padding or the host's byte order.
+*/
+
+#include <string.h>
+#include "CANOPNR_Telemetry.h"
+
+const uint8_t TELEMETRY_OBD_PIDS[TELEMETRY_OBD_COUNT] = {0x0C, 0x0D, 0x05, 0x2F, 0x1F, 0x0F, 0x10, 0x14};
+
+static uint8_t *put16(uint8_t *p, uint16_t val)
+{
+  p[0] = val;
+  p[1] = val >> 8;
+  return p + 2;
+}
+
+static uint8_t *put32(uint8_t *p, uint32_t val)
+{
+  p[0] = val;
+  p[1] = val >> 8;
+  p[2] = val >> 16;
+  p[3] = val >> 24;
+  return p + 4;
+}
+
+static uint16_t get16(const uint8_t *p)
+{
+  return p[0] | ((uint16_t)p[1] << 8);
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+  return p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+uint16_t telemetryEncode(const TELEMETRY *rec, uint8_t *buf, uint16_t size)
+{
+  uint8_t *p = buf;
+  uint8_t n, i;
+  uint16_t len;
+
+  n = rec->eventCount;
+  if(n > TELEMETRY_SLIP_EVENTS)
+    n = TELEMETRY_SLIP_EVENTS;
+  len = TELEMETRY_HEADER_SIZE + n * TELEMETRY_EVENT_SIZE;
+  if(len > size)
+    return 0;
+
+  *p++ = TELEMETRY_MAGIC;
+  *p++ = TELEMETRY_VERSION;
+  p = put16(p, rec->controllerId);
+  p = put16(p, rec->sequence);
+  p = put32(p, rec->timestamp);
+  p = put32(p, rec->present);
+  p = put32(p, rec->utc.seconds);
+  p = put32(p, rec->utc.micros);
+  p = put16(p, rec->clockRate);
+  p = put32(p, rec->gps.timeMs);
+  p = put16(p, rec->gps.days);
+  p = put32(p, rec->gps.lat);
+  p = put32(p, rec->gps.lon);
+  p = put16(p, rec->gps.speed);
+  p = put16(p, rec->gps.course);
+  *p++ = rec->accelerator;
+  *p++ = rec->csq;
+  for(i = 0; i < TELEMETRY_OBD_COUNT; i++)
+  {
+    *p++ = rec->obd[i][0];
+    *p++ = rec->obd[i][1];
+  }
+  for(i = 0; i < TELEMETRY_OBD_COUNT; i++)
+    p = put16(p, rec->obdTime[i]);
+  p = put16(p, rec->slip.frames);
+  p = put16(p, rec->slip.speed);
+  for(i = 0; i < SLIP_WHEELS; i++)
+    p = put16(p, rec->slip.mean[i]);
+  for(i = 0; i < SLIP_WHEELS; i++)
+    p = put16(p, rec->slip.peak[i]);
+  *p++ = rec->brake;
+  *p++ = n;
+  for(i = 0; i < n; i++)
+  {
+    p = put16(p, rec->events[i].start);
+    p = put16(p, rec->events[i].duration);
+    *p++ = rec->events[i].wheel;
+    p = put16(p, rec->events[i].peak);
+    p = put16(p, rec->events[i].speed);
+    *p++ = rec->events[i].brake;
+  }
+  return len;
+}
+
+uint16_t telemetryDecode(const uint8_t *buf, uint16_t len, TELEMETRY *rec)
+{
+  const uint8_t *p = buf;
+  uint16_t total;
+  uint8_t n, i;
+
+  if(len < TELEMETRY_HEADER_SIZE || buf[0] != TELEMETRY_MAGIC || buf[1] != TELEMETRY_VERSION)
+    return 0;
+  n = buf[TELEMETRY_HEADER_SIZE - 1];
+  if(n > TELEMETRY_SLIP_EVENTS)
+    return 0;
+  total = TELEMETRY_HEADER_SIZE + n * TELEMETRY_EVENT_SIZE;
+  if(len < total)
+    return 0;
+
+  memset(rec, 0, sizeof(TELEMETRY));
+  p += 2;
+  rec->controllerId = get16(p);     p += 2;
+  rec->sequence = get16(p);         p += 2;
+  rec->timestamp = get32(p);        p += 4;
+  rec->present = get32(p);          p += 4;
+  rec->utc.seconds = get32(p);      p += 4;
+  rec->utc.micros = get32(p);       p += 4;
+  rec->clockRate = get16(p);        p += 2;
+  rec->gps.timeMs = get32(p);       p += 4;
+  rec->gps.days = get16(p);         p += 2;
+  rec->gps.lat = get32(p);          p += 4;
+  rec->gps.lon = get32(p);          p += 4;
+  rec->gps.speed = get16(p);        p += 2;
+  rec->gps.course = get16(p);       p += 2;
+  rec->gps.valid = (rec->present >> TELEMETRY_HAS_GPS) & 1;
+  rec->accelerator = *p++;
+  rec->csq = *p++;
+  for(i = 0; i < TELEMETRY_OBD_COUNT; i++)
+  {
+    rec->obd[i][0] = *p++;
+    rec->obd[i][1] = *p++;
+  }
+  for(i = 0; i < TELEMETRY_OBD_COUNT; i++, p += 2)
+    rec->obdTime[i] = get16(p);
+  rec->slip.frames = get16(p);      p += 2;
+  rec->slip.speed = get16(p);       p += 2;
+  for(i = 0; i < SLIP_WHEELS; i++, p += 2)
+    rec->slip.mean[i] = get16(p);
+  for(i = 0; i < SLIP_WHEELS; i++, p += 2)
+    rec->slip.peak[i] = get16(p);
+  rec->brake = *p++;
+  rec->eventCount = *p++;
+  for(i = 0; i < n; i++)
+  {
+    rec->events[i].start = get16(p);      p += 2;
+    rec->events[i].duration = get16(p);   p += 2;
+    rec->events[i].wheel = *p++;
+    rec->events[i].peak = get16(p);       p += 2;
+    rec->events[i].speed = get16(p);      p += 2;
+    rec->events[i].brake = *p++;
+  }
+  return total;
+}
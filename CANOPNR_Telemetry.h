@@ -0,0 +1,129 @@
+/*
+   This file is included as part of the CANOPNR distribution.
+   You are free to use this project as you see fit, provided credit is given to all
+   contributors (original and subsequent).
+
+   Copyright 2012  Jose Denrie Enriquez, Alex Bautista, Paloma Field, Sun-il Kim
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+  ------------------------------------------------------------------------------------------------------------
+
+  Binary telemetry record, replacing the pipe-delimited ASCII upload.
+
+  Signals are sent as the raw bytes the vehicle put on the bus (OBD A/B,
+  brake and accelerator bytes); scaling happens on the server, so the node
+  does no sprintf or float work per sample. Wheel speeds are reduced to
+  slip on the node (CANOPNR_Slip.h): the record carries per-wheel
+  aggregates and the slip events that ended since the last record, not
+  raw 0x513 frames. All multi-byte fields are little-endian.
+
+  Version 3 layout:
+
+    off  size  field
+      0     1  TELEMETRY_MAGIC
+      1     1  TELEMETRY_VERSION
+      2     2  controller ID (signed)
+      4     2  sequence number
+      6     4  millis() when the sample started
+     10     4  presence bitmap, TELEMETRY_HAS_*
+     14     4  UTC at the record time, seconds since 2000-01-01
+     18     4  UTC at the record time, microseconds
+     22     2  local clock error, ppm, UTC minus micros() (signed)
+     24     4  GPS UTC time, ms since midnight
+     28     2  GPS UTC date, days since 2000-01-01
+     30     4  latitude, microdegrees
+     34     4  longitude, microdegrees
+     38     2  speed over ground, 0.01 knots
+     40     2  course, 0.01 degrees
+     42     1  accelerator (0x410 byte 4)
+     43     1  signal quality (AT+CSQ rssi, 99 = unknown)
+     44    16  OBD A,B for each of TELEMETRY_OBD_PIDS, in that order
+     60    16  OBD reply times, ms after the record time (signed), same order
+     76     2  0x513 frames seen since the last record
+     78     2  reference speed, 0.01 km/h
+     80     8  mean slip per wheel, permille, signed
+     88     8  peak slip per wheel, permille, signed
+     96     1  brake pressure (0x511 byte 4)
+     97     1  slip event count n (at most TELEMETRY_SLIP_EVENTS)
+     98  n*10  slip events: start, ms after the record time (2, signed),
+               duration ms (2), wheel (1), peak permille (2, signed),
+               reference speed (2), brake pressure (1)
+
+  The record time is the micros() at which the sample started. Its UTC
+  comes from the GPS-disciplined timebase (CANOPNR_Timebase.h) and is
+  there only with TELEMETRY_HAS_UTC. Slip event starts and OBD reply
+  times are micros() differences from it, stamped when the frame was
+  read in the RX interrupt; times (1 + ppm / 10^6) puts them on UTC too.
+  The GPS fix carries its own UTC time.
+
+  A record is self-delimiting: its length follows from the count byte.
+  Decoders must reject a version they do not know.
+*/
+
+#ifndef CANOPNR_Telemetry_h
+#define CANOPNR_Telemetry_h
+
+#include <stdint.h>
+#include "CANOPNR_GPS.h"
+#include "CANOPNR_Slip.h"
+#include "CANOPNR_Timebase.h"
+
+#define TELEMETRY_MAGIC 0xC7
+#define TELEMETRY_VERSION 3
+
+#define TELEMETRY_OBD_COUNT 8
+#define TELEMETRY_SLIP_EVENTS 6
+#define TELEMETRY_HEADER_SIZE 98
+#define TELEMETRY_EVENT_SIZE 10
+#define TELEMETRY_MAX_SIZE (TELEMETRY_HEADER_SIZE + TELEMETRY_SLIP_EVENTS * TELEMETRY_EVENT_SIZE)
+
+//Presence bitmap
+#define TELEMETRY_HAS_GPS 0            //fix valid
+#define TELEMETRY_HAS_ACCEL 1
+#define TELEMETRY_HAS_CSQ 2
+#define TELEMETRY_HAS_OBD(i) (3 + (i))             //OBD PID i answered
+#define TELEMETRY_HAS_BRAKE (3 + TELEMETRY_OBD_COUNT)
+#define TELEMETRY_HAS_UTC (4 + TELEMETRY_OBD_COUNT)   //utc and clockRate set
+#define TELEMETRY_UTC_PPS (5 + TELEMETRY_OBD_COUNT)   //timebase synced from PPS, not RMC
+
+//Mode 01 PIDs in record order: RPM, speed, coolant, fuel, run time, intake, MAF, O2
+extern const uint8_t TELEMETRY_OBD_PIDS[TELEMETRY_OBD_COUNT];
+
+typedef struct
+{
+  int16_t controllerId;
+  uint16_t sequence;
+  uint32_t timestamp;
+  uint32_t present;     //TELEMETRY_HAS_* bits
+  UTCTIME utc;          //UTC at the record time
+  int16_t clockRate;    //ppm, see timebasePpm()
+  GPSFIX gps;
+  uint8_t accelerator;
+  uint8_t csq;
+  uint8_t obd[TELEMETRY_OBD_COUNT][2];
+  int16_t obdTime[TELEMETRY_OBD_COUNT];   //ms after the record time
+  SLIPSUMMARY slip;
+  uint8_t brake;
+  uint8_t eventCount;
+  SLIPEVENT events[TELEMETRY_SLIP_EVENTS];
+}  TELEMETRY;
+
+//Returns the encoded length, or 0 if buf is too small
+uint16_t telemetryEncode(const TELEMETRY *rec, uint8_t *buf, uint16_t size);
+
+//Returns the bytes consumed, or 0 if buf does not start with a complete,
+//known-version record
+uint16_t telemetryDecode(const uint8_t *buf, uint16_t len, TELEMETRY *rec);
+
+#endif
@@ -0,0 +1,180 @@
+/*
+   This file is included as part of the CANOPNR distribution.
+   You are free to use this project as you see fit, provided credit is given to all
+   contributors (original and subsequent).
+
+   Copyright 2012  Jose Denrie Enriquez, Alex Bautista, Paloma Field, Sun-il Kim
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+  ------------------------------------------------------------------------------------------------------------
+
+  GPS-disciplined timebase, see CANOPNR_Timebase.h.
+*/
+
+#include "CANOPNR_Timebase.h"
+
+#define MICROS_PER_SECOND 1000000L
+#define MAX_SECONDS 2000L             //larger differences saturate int32_t microseconds
+#define RATE_LIMIT 335544L            //2 %, four times the worst resonator
+#define MIN_ELAPSED 500000L           //shorter intervals move the anchor only
+
+//t plus us microseconds, us may be negative
+static void addMicros(UTCTIME *t, int32_t us)
+{
+  int32_t m = (int32_t)t->micros + us % MICROS_PER_SECOND;
+
+  t->seconds += us / MICROS_PER_SECOND;
+  if(m < 0)
+  {
+    m += MICROS_PER_SECOND;
+    t->seconds--;
+  }
+  else if(m >= MICROS_PER_SECOND)
+  {
+    m -= MICROS_PER_SECOND;
+    t->seconds++;
+  }
+  t->micros = m;
+}
+
+//a - b in microseconds, saturated beyond MAX_SECONDS
+static int32_t difference(const UTCTIME *a, const UTCTIME *b)
+{
+  int32_t s = (int32_t)(a->seconds - b->seconds);
+
+  if(s > MAX_SECONDS)
+    return INT32_MAX;
+  if(s < -MAX_SECONDS)
+    return -INT32_MAX;
+  return s * MICROS_PER_SECOND + ((int32_t)a->micros - (int32_t)b->micros);
+}
+
+static void setAnchor(TIMEBASE *tb, uint32_t local, const UTCTIME *utc, uint8_t source)
+{
+  tb->local = local;
+  tb->utc = *utc;
+  tb->source = source;
+  tb->offset = 0;
+  tb->outliers = 0;
+  tb->syncs++;
+  tb->steps++;
+}
+
+void timebaseBegin(TIMEBASE *tb)
+{
+  tb->source = TIMEBASE_NONE;
+  tb->local = 0;
+  tb->utc.seconds = 0;
+  tb->utc.micros = 0;
+  tb->rate = 0;
+  tb->offset = 0;
+  tb->outliers = 0;
+  tb->syncs = 0;
+  tb->steps = 0;
+  tb->rejected = 0;
+}
+
+void timebaseSync(TIMEBASE *tb, uint32_t local, const UTCTIME *utc, uint8_t source)
+{
+  UTCTIME predicted;
+  int32_t elapsed, error, step;
+  uint8_t phase, freq;
+
+  //A measurement older than the anchor wraps to a large elapsed. A change
+  //of source would put the RMC latency error into the rate; the rate is
+  //kept and the anchor starts over.
+  elapsed = (int32_t)(local - tb->local);
+  if(tb->source == TIMEBASE_NONE || tb->source != source || (uint32_t)elapsed > TIMEBASE_HOLDOVER_US)
+  {
+    setAnchor(tb, local, utc, source);
+    return;
+  }
+
+  timebaseToUtc(tb, local, &predicted);
+  error = difference(utc, &predicted);
+  if(error > TIMEBASE_STEP_US || error < -TIMEBASE_STEP_US)
+  {
+    //Late sentences are late by different amounts; only outliers agreeing
+    //with the one before count towards a step
+    if(tb->outliers > 0 && error - tb->offset <= TIMEBASE_STEP_US && tb->offset - error <= TIMEBASE_STEP_US)
+      tb->outliers++;
+    else
+      tb->outliers = 1;
+    tb->offset = error;
+    if(tb->outliers < TIMEBASE_STEP_COUNT)
+    {
+      tb->rejected++;
+      return;
+    }
+    setAnchor(tb, local, utc, source);
+    return;
+  }
+
+  if(source == TIMEBASE_PPS)
+  {
+    phase = TIMEBASE_PPS_PHASE;
+    freq = TIMEBASE_PPS_FREQ;
+  }
+  else
+  {
+    phase = TIMEBASE_RMC_PHASE;
+    freq = TIMEBASE_RMC_FREQ;
+  }
+
+  if(elapsed >= MIN_ELAPSED)
+  {
+    step = (int32_t)(((int64_t)error << TIMEBASE_RATE_SHIFT) / elapsed) / (1L << freq);
+    tb->rate += step;
+    if(tb->rate > RATE_LIMIT)
+      tb->rate = RATE_LIMIT;
+    else if(tb->rate < -RATE_LIMIT)
+      tb->rate = -RATE_LIMIT;
+  }
+  addMicros(&predicted, error / (1L << phase));
+  tb->local = local;
+  tb->utc = predicted;
+  tb->offset = error;
+  tb->outliers = 0;
+  tb->syncs++;
+}
+
+bool timebaseValid(const TIMEBASE *tb, uint32_t now)
+{
+  return tb->source != TIMEBASE_NONE && now - tb->local <= TIMEBASE_HOLDOVER_US;
+}
+
+void timebaseToUtc(const TIMEBASE *tb, uint32_t local, UTCTIME *utc)
+{
+  int32_t elapsed = (int32_t)(local - tb->local);
+
+  *utc = tb->utc;
+  addMicros(utc, elapsed + (int32_t)(((int64_t)elapsed * tb->rate) >> TIMEBASE_RATE_SHIFT));
+}
+
+int16_t timebasePpm(const TIMEBASE *tb)
+{
+  int32_t ppm = (int32_t)(((int64_t)tb->rate * MICROS_PER_SECOND) >> TIMEBASE_RATE_SHIFT);
+
+  if(ppm > INT16_MAX)
+    return INT16_MAX;
+  if(ppm < INT16_MIN)
+    return INT16_MIN;
+  return ppm;
+}
+
+void timebaseFixTime(const GPSFIX *fix, UTCTIME *utc)
+{
+  utc->seconds = fix->days * 86400UL + fix->timeMs / 1000;
+  utc->micros = (fix->timeMs % 1000) * 1000UL;
+}
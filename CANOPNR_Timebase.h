@@ -0,0 +1,117 @@
+/*
+   This file is included as part of the CANOPNR distribution.
+   You are free to use this project as you see fit, provided credit is given to all
+   contributors (original and subsequent).
+
+   Copyright 2012  Jose Denrie Enriquez, Alex Bautista, Paloma Field, Sun-il Kim
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+  ------------------------------------------------------------------------------------------------------------
+
+  One timebase for every sample: micros() disciplined against GPS UTC, so
+  the stamp the RX interrupt puts on a CAN frame (CANMSG.timestamp), the
+  stamp of an OBD reply and the time of a GPS fix all convert to the same
+  UTC microseconds. Free of Arduino includes so the same code runs on a
+  host.
+
+  The timebase is an anchor, a micros() value and the UTC time it stood
+  for, plus the rate of the local clock against UTC. Each sync is a UTC
+  time and the micros() at which it happened: a PPS edge stamped in its
+  interrupt, or, without PPS, the arrival of the $xxRMC naming the second
+  less the receiver's output latency. The difference from what the
+  timebase predicted moves the anchor and the rate, a phase-locked loop
+  with proportional and integral gain. A PPS edge is good to a few
+  microseconds, about a hundred when the CAN interrupt holds its own off,
+  so the anchor takes a quarter of the error and the rate an eighth; an
+  RMC arrival jitters by milliseconds and is averaged over tens of
+  seconds. The rate takes out the resonator's error, up to 0.5 % (5 ms a
+  second) on an Uno, and its drift with temperature.
+
+  micros() wraps every 71.6 minutes. Stamps are converted through their
+  signed difference from the anchor, so a stamp up to 35 minutes either
+  side of the last sync converts correctly across a wrap.
+
+  A measurement more than TIMEBASE_STEP_US off the prediction is an
+  outlier (a sentence that waited in a buffer) and is dropped;
+  TIMEBASE_STEP_COUNT of them in a row that agree with each other mean
+  the time really moved and the anchor is set to the measurement. So is
+  the first sync, the first after more than TIMEBASE_HOLDOVER_US without
+  one, and the first from another source; the rate is kept.
+
+  UTC seconds count from 2000-01-01 00:00:00, without leap seconds, as
+  the GPS fix does.
+*/
+
+#ifndef CANOPNR_Timebase_h
+#define CANOPNR_Timebase_h
+
+#include <stdint.h>
+#include "CANOPNR_GPS.h"
+
+//Sync sources, also TIMEBASE.source
+#define TIMEBASE_NONE 0
+#define TIMEBASE_RMC 1
+#define TIMEBASE_PPS 2
+
+#define TIMEBASE_RATE_SHIFT 24               //TIMEBASE.rate is in units of 2^-24
+#define TIMEBASE_STEP_US 20000L              //larger errors are outliers
+#define TIMEBASE_STEP_COUNT 3                //outliers in a row that step the anchor
+#define TIMEBASE_HOLDOVER_US 1200000000UL    //20 minutes without a sync: time unknown
+
+//Loop gains as shifts: the anchor moves by error >> PHASE, the rate by
+//error / elapsed >> FREQ
+#define TIMEBASE_PPS_PHASE 2
+#define TIMEBASE_PPS_FREQ 3
+#define TIMEBASE_RMC_PHASE 3
+#define TIMEBASE_RMC_FREQ 6
+
+typedef struct
+{
+  uint32_t seconds;     //UTC seconds since 2000-01-01 00:00:00
+  uint32_t micros;      //0 to 999999
+}  UTCTIME;
+
+typedef struct
+{
+  uint8_t source;       //TIMEBASE_NONE before the first sync, else the source of the latest
+  uint32_t local;       //micros() at the anchor
+  UTCTIME utc;          //UTC at the anchor
+  int32_t rate;         //UTC minus local microseconds per local microsecond, 2^-24 units
+  int32_t offset;       //microseconds, measured minus predicted at the latest sync, outliers too
+  uint8_t outliers;     //agreeing outliers in a row
+  uint32_t syncs;       //measurements taken
+  uint32_t steps;       //anchor set outright: first sync, holdover ended, or time moved
+  uint32_t rejected;    //outliers dropped
+}  TIMEBASE;
+
+void timebaseBegin(TIMEBASE *tb);
+
+//local is the micros() at which UTC was utc, source one of TIMEBASE_RMC
+//and TIMEBASE_PPS
+void timebaseSync(TIMEBASE *tb, uint32_t local, const UTCTIME *utc, uint8_t source);
+
+//True if a sync happened and the last was less than TIMEBASE_HOLDOVER_US
+//before now (micros())
+bool timebaseValid(const TIMEBASE *tb, uint32_t now);
+
+//UTC of the micros() value local; meaningless unless timebaseValid()
+void timebaseToUtc(const TIMEBASE *tb, uint32_t local, UTCTIME *utc);
+
+//Local clock error in ppm, UTC minus local, saturated to int16_t
+int16_t timebasePpm(const TIMEBASE *tb);
+
+//UTC time of a fix (time of day and date)
+void timebaseFixTime(const GPSFIX *fix, UTCTIME *utc);
+
+#endif
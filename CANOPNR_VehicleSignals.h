@@ -0,0 +1,55 @@
+/*
+   This file is included as part of the CANOPNR distribution.
+   You are free to use this project as you see fit, provided credit is given to all
+   contributors (original and subsequent).
+
+   Copyright 2012  Jose Denrie Enriquez, Alex Bautista, Paloma Field, Sun-il Kim
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+  ------------------------------------------------------------------------------------------------------------
+
+  Generated by host/dbc2signals from host/canopnr.dbc: edit the DBC file and run it
+  again instead of editing this file. See CANOPNR_Signals.h.
+*/
+
+#ifndef CANOPNR_VehicleSignals_h
+#define CANOPNR_VehicleSignals_h
+
+#include "CANOPNR_Signals.h"
+
+//AcceleratorPedal in ACCELERATOR, raw units
+typedef CANSIGNAL<0x410, 32, 8, CAN_INTEL, false, 1, 1, 0, 1> SIG_ACCELERATOR_PEDAL;
+//BrakePressure in BRAKE_PRESSURE, raw units
+typedef CANSIGNAL<0x511, 32, 8, CAN_INTEL, false, 1, 1, 0, 1> SIG_BRAKE_PRESSURE;
+//WheelSpeed0 in ABSCAN, 1/100 km/h
+typedef CANSIGNAL<0x513, 7, 16, CAN_MOTOROLA, false, 1, 1, 0, 100> SIG_WHEEL_SPEED0;
+//WheelSpeed1 in ABSCAN, 1/100 km/h
+typedef CANSIGNAL<0x513, 23, 16, CAN_MOTOROLA, false, 1, 1, 0, 100> SIG_WHEEL_SPEED1;
+//WheelSpeed2 in ABSCAN, 1/100 km/h
+typedef CANSIGNAL<0x513, 39, 16, CAN_MOTOROLA, false, 1, 1, 0, 100> SIG_WHEEL_SPEED2;
+//WheelSpeed3 in ABSCAN, 1/100 km/h
+typedef CANSIGNAL<0x513, 55, 16, CAN_MOTOROLA, false, 1, 1, 0, 100> SIG_WHEEL_SPEED3;
+
+#define CAN_SIGNAL_COUNT 6
+
+constexpr SIGNALDEF CAN_SIGNALS[CAN_SIGNAL_COUNT] = {
+  {"AcceleratorPedal", 0x410UL, 32, 8, CAN_INTEL, false, 1, 1, 0, 1},
+  {"BrakePressure", 0x511UL, 32, 8, CAN_INTEL, false, 1, 1, 0, 1},
+  {"WheelSpeed0", 0x513UL, 7, 16, CAN_MOTOROLA, false, 1, 1, 0, 100},
+  {"WheelSpeed1", 0x513UL, 23, 16, CAN_MOTOROLA, false, 1, 1, 0, 100},
+  {"WheelSpeed2", 0x513UL, 39, 16, CAN_MOTOROLA, false, 1, 1, 0, 100},
+  {"WheelSpeed3", 0x513UL, 55, 16, CAN_MOTOROLA, false, 1, 1, 0, 100}
+};
+
+#endif
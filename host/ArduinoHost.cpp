@@ -0,0 +1,257 @@
+/*
+   This file is included as part of the CANOPNR distribution.
+   You are free to use this project as you see fit, provided credit is given to all
+   contributors (original and subsequent).
+
+   Copyright 2012  Jose Denrie Enriquez, Alex Bautista, Paloma Field, Sun-il Kim
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+  ------------------------------------------------------------------------------------------------------------
+
+  Host implementation of the Arduino.h/SPI.h stand-ins: a virtual microsecond
+  clock, chip-select routing to attached simulators and INT0/INT1 dispatch.
+  An attached ISR runs on the falling edge of a simulator's INT line whenever
+  interrupts are enabled and no SPI transaction has masked it, which mirrors
+  how the AVR latches the edge and runs the handler after the transfer.
+*/
+
+#include <vector>
+#include "Arduino.h"
+#include "SPI.h"
+#include "MCP2515Sim.h"
+
+SPIClass SPI;
+
+//Shorter than the 47 us of the shortest frame at 1 Mbit/s
+#define SIM_STEP_MICROS 10
+
+struct SimSlot
+{
+  MCP2515Sim *sim;
+  int csPin;
+  int intPin;
+  bool intWasLow;
+  bool pending;   //falling edge latched, handler not run yet
+};
+
+static std::vector<SimSlot> slots;
+static MCP2515Sim *selected = 0;
+static uint64_t clockMicros = 0;
+static unsigned int spiByteMicros = 1;  //8 MHz SCK plus per-byte overhead
+
+static void (*isrs[2])() = {0, 0};
+static bool usedBySPI[2] = {false, false};
+static bool maskedBySPI = false;
+static bool interruptsOn = true;
+static bool inISR = false;
+
+static void dispatchInterrupts()
+{
+  bool ran;
+  size_t i;
+
+  do
+  {
+    ran = false;
+    for(i = 0; i < slots.size(); i++)
+    {
+      SimSlot &s = slots[i];
+      int irq = digitalPinToInterrupt(s.intPin);
+      bool low;
+
+      if(irq < 0)
+        continue;
+      low = s.sim->intAsserted();
+      if(low && !s.intWasLow)
+        s.pending = true;
+      s.intWasLow = low;
+      if(!s.pending || isrs[irq] == 0 || !interruptsOn || inISR)
+        continue;
+      if(maskedBySPI && usedBySPI[irq])
+        continue;
+      s.pending = false;
+      inISR = true;
+      isrs[irq]();
+      inISR = false;
+      ran = true;
+    }
+  } while(ran);
+}
+
+void simAttach(MCP2515Sim *sim, int csPin, int intPin)
+{
+  SimSlot s;
+
+  s.sim = sim;
+  s.csPin = csPin;
+  s.intPin = intPin;
+  s.intWasLow = sim->intAsserted();
+  s.pending = false;
+  slots.push_back(s);
+}
+
+void simDetachAll()
+{
+  slots.clear();
+  selected = 0;
+  isrs[0] = isrs[1] = 0;
+  usedBySPI[0] = usedBySPI[1] = false;
+  maskedBySPI = false;
+  interruptsOn = true;
+}
+
+uint64_t simMicros()
+{
+  return clockMicros;
+}
+
+void simAdvance(uint64_t us)
+{
+  uint64_t end = clockMicros + us;
+  size_t i;
+
+  //Small steps so an ISR gets to run between frames during a long delay()
+  while(clockMicros < end)
+  {
+    clockMicros += (end - clockMicros > SIM_STEP_MICROS) ? SIM_STEP_MICROS : (end - clockMicros);
+    for(i = 0; i < slots.size(); i++)
+      slots[i].sim->advanceTo(clockMicros);
+    dispatchInterrupts();
+  }
+}
+
+void simSetSpiByteMicros(unsigned int us)
+{
+  spiByteMicros = us;
+}
+
+void pinMode(int pin, int mode)
+{
+  (void)pin;
+  (void)mode;
+}
+
+void digitalWrite(int pin, int val)
+{
+  size_t i;
+
+  for(i = 0; i < slots.size(); i++)
+  {
+    if(slots[i].csPin != pin)
+      continue;
+    slots[i].sim->select(val == LOW);
+    if(val == LOW)
+      selected = slots[i].sim;
+    else if(selected == slots[i].sim)
+      selected = 0;
+  }
+  if(val != LOW)
+    dispatchInterrupts();
+}
+
+int digitalRead(int pin)
+{
+  size_t i;
+
+  for(i = 0; i < slots.size(); i++)
+    if(slots[i].intPin == pin)
+      return slots[i].sim->intAsserted() ? LOW : HIGH;
+  return HIGH;
+}
+
+unsigned long millis()
+{
+  simAdvance(1);
+  return (unsigned long)(clockMicros / 1000);
+}
+
+unsigned long micros()
+{
+  simAdvance(1);
+  return (unsigned long)clockMicros;
+}
+
+void delay(unsigned long ms)
+{
+  simAdvance((uint64_t)ms * 1000);
+}
+
+void delayMicroseconds(unsigned int us)
+{
+  simAdvance(us);
+}
+
+int digitalPinToInterrupt(int pin)
+{
+  if(pin == 2)
+    return 0;
+  if(pin == 3)
+    return 1;
+  return -1;
+}
+
+void attachInterrupt(int irq, void (*isr)(), int mode)
+{
+  (void)mode;  //only FALLING is modelled
+  if(irq < 0 || irq > 1)
+    return;
+  isrs[irq] = isr;
+  dispatchInterrupts();
+}
+
+void detachInterrupt(int irq)
+{
+  if(irq < 0 || irq > 1)
+    return;
+  isrs[irq] = 0;
+}
+
+void noInterrupts()
+{
+  interruptsOn = false;
+}
+
+void interrupts()
+{
+  interruptsOn = true;
+  dispatchInterrupts();
+}
+
+byte SPIClass::transfer(byte data)
+{
+  byte out = 0xFF;
+
+  if(selected != 0)
+    out = selected->transfer(data);
+  simAdvance(spiByteMicros);
+  return out;
+}
+
+void SPIClass::beginTransaction(SPISettings settings)
+{
+  (void)settings;
+  maskedBySPI = true;
+}
+
+void SPIClass::endTransaction()
+{
+  maskedBySPI = false;
+  dispatchInterrupts();
+}
+
+void SPIClass::usingInterrupt(int irq)
+{
+  if(irq >= 0 && irq <= 1)
+    usedBySPI[irq] = true;
+}
@@ -0,0 +1,572 @@
+/*
+   This file is included as part of the CANOPNR distribution.
+   You are free to use this project as you see fit, provided credit is given to all
+   contributors (original and subsequent).
+
+   Copyright 2012  Jose Denrie Enriquez, Alex Bautista, Paloma Field, Sun-il Kim
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+  ------------------------------------------------------------------------------------------------------------
+
+  Register-level MCP2515 simulator, see MCP2515Sim.h.
+  Register and bit names follow MCP2515_defs.h.
+*/
+
+#include <string.h>
+#include "Arduino.h"
+#include "MCP2515Sim.h"
+#include "../MCP2515_defs.h"
+
+//OPMOD/REQOP values
+#define MODE_NORMAL 0
+#define MODE_SLEEP 1
+#define MODE_LOOPBACK 2
+#define MODE_LISTEN 3
+#define MODE_CONFIG 4
+
+//A node more than this far off the bus bitrate only sees error frames
+#define BITRATE_TOLERANCE 0.015
+
+static const uint8_t filterBase[6] = {RXF0SIDH, RXF1SIDH, RXF2SIDH, RXF3SIDH, RXF4SIDH, RXF5SIDH};
+
+enum
+{
+  ST_IDLE = -1, ST_CMD, ST_READ_ADDR, ST_WRITE_ADDR, ST_MOD_ADDR, ST_MOD_MASK, ST_MOD_DATA,
+  ST_READING, ST_WRITING, ST_READ_STATUS, ST_RX_STATUS, ST_DONE
+};
+
+MCP2515Sim::MCP2515Sim(unsigned long oscHz)
+  : osc(oscHz), busBitrate(500000), now(0), busFreeAt(0), txActive(-1),
+    cs(false), state(ST_IDLE), cmd(0), addr(0), bitMask(0), rxbRead(-1)
+{
+  memset(&stats, 0, sizeof(stats));
+  reset();
+}
+
+void MCP2515Sim::reset()
+{
+  memset(regs, 0, sizeof(regs));
+  regs[CANSTAT] = MODE_CONFIG << 5;
+  regs[CANCTRL] = (MODE_CONFIG << 5) | (1 << CLKEN) | (1 << CLKPRE1) | (1 << CLKPRE0);
+  txActive = -1;
+  busFreeAt = now;
+}
+
+uint8_t MCP2515Sim::reg(uint8_t a) const
+{
+  a &= 0x7F;
+  //CANSTAT and CANCTRL appear at the end of every 16-byte row
+  if((a & 0x0F) == 0x0E)
+    return regs[CANSTAT];
+  if((a & 0x0F) == 0x0F)
+    return regs[CANCTRL];
+  return regs[a];
+}
+
+unsigned long MCP2515Sim::programmedBitrate() const
+{
+  unsigned long brp = (regs[CNF1] & 0x3F) + 1;
+  unsigned long prseg = (regs[CNF2] & 0x07) + 1;
+  unsigned long ps1 = ((regs[CNF2] >> 3) & 0x07) + 1;
+  unsigned long ps2;
+
+  if(bitRead(regs[CNF2], BTLMODE))
+    ps2 = (regs[CNF3] & 0x07) + 1;
+  else
+    ps2 = (ps1 > 2) ? ps1 : 2;  //information processing time is 2 TQ
+  return osc / (2 * brp * (1 + prseg + ps1 + ps2));
+}
+
+unsigned int MCP2515Sim::frameBits(const SimFrame &frame)
+{
+  //SOF..EOF plus intermission, without stuff bits
+  unsigned int data = frame.rtr ? 0 : 8 * (frame.dlc > 8 ? 8 : frame.dlc);
+  return (frame.ext ? 67 : 47) + data;
+}
+
+bool MCP2515Sim::intAsserted() const
+{
+  return (regs[CANINTE] & regs[CANINTF]) != 0;
+}
+
+void MCP2515Sim::select(bool low)
+{
+  if(low)
+  {
+    cs = true;
+    state = ST_CMD;
+    rxbRead = -1;
+    stats.spiTransactions++;
+    return;
+  }
+  //READ_RX_BUFFER releases the buffer when CS rises
+  if(cs && rxbRead >= 0)
+    regs[CANINTF] &= ~(1 << (RX0IF + rxbRead));
+  rxbRead = -1;
+  cs = false;
+  state = ST_IDLE;
+}
+
+uint8_t MCP2515Sim::transfer(uint8_t in)
+{
+  uint8_t out = 0xFF;
+  int n;
+
+  if(!cs)
+    return out;
+  stats.spiBytes++;
+
+  switch(state)
+  {
+    case ST_CMD:
+      cmd = in;
+      state = ST_DONE;
+      if(in == SPI_RESET)
+        reset();
+      else if(in == SPI_READ)
+        state = ST_READ_ADDR;
+      else if(in == SPI_WRITE)
+        state = ST_WRITE_ADDR;
+      else if(in == SPI_BIT_MODIFY)
+        state = ST_MOD_ADDR;
+      else if(in == SPI_READ_STATUS)
+        state = ST_READ_STATUS;
+      else if(in == SPI_RX_STATUS)
+        state = ST_RX_STATUS;
+      else if((in & 0xF9) == SPI_READ_RX)
+      {
+        //0x90/0x92 RXB0 SIDH/D0, 0x94/0x96 RXB1 SIDH/D0
+        rxbRead = (in >> 2) & 1;
+        addr = RXB0SIDH + (rxbRead << 4) + ((in & 0x02) ? 5 : 0);
+        state = ST_READING;
+      }
+      else if((in & 0xF8) == SPI_WRITE_TX && (in & 0x07) <= 5)
+      {
+        //0x40..0x45: TXBn SIDH or D0 for n = 0..2
+        n = (in & 0x07) >> 1;
+        addr = TXB0SIDH + (n << 4) + ((in & 0x01) ? 5 : 0);
+        state = ST_WRITING;
+      }
+      else if((in & 0xF8) == SPI_RTS)
+      {
+        for(n = 0; n < 3; n++)
+          if(in & (1 << n))
+            modifyReg(TXB0CTRL + (n << 4), 1 << TXREQ, 1 << TXREQ);
+      }
+      break;
+
+    case ST_READ_ADDR:
+      addr = in & 0x7F;
+      state = ST_READING;
+      break;
+
+    case ST_WRITE_ADDR:
+      addr = in & 0x7F;
+      state = ST_WRITING;
+      break;
+
+    case ST_MOD_ADDR:
+      addr = in & 0x7F;
+      state = ST_MOD_MASK;
+      break;
+
+    case ST_MOD_MASK:
+      bitMask = in;
+      state = ST_MOD_DATA;
+      break;
+
+    case ST_MOD_DATA:
+      modifyReg(addr, bitMask, in);
+      state = ST_DONE;
+      break;
+
+    case ST_READING:
+      out = reg(addr);
+      addr = (addr + 1) & 0x7F;
+      break;
+
+    case ST_WRITING:
+      writeReg(addr, in);
+      addr = (addr + 1) & 0x7F;
+      break;
+
+    case ST_READ_STATUS:
+      out = 0;
+      out |= bitRead(regs[CANINTF], RX0IF) << 0;
+      out |= bitRead(regs[CANINTF], RX1IF) << 1;
+      out |= bitRead(regs[TXB0CTRL], TXREQ) << 2;
+      out |= bitRead(regs[CANINTF], TX0IF) << 3;
+      out |= bitRead(regs[TXB1CTRL], TXREQ) << 4;
+      out |= bitRead(regs[CANINTF], TX1IF) << 5;
+      out |= bitRead(regs[TXB2CTRL], TXREQ) << 6;
+      out |= bitRead(regs[CANINTF], TX2IF) << 7;
+      break;
+
+    case ST_RX_STATUS:
+    {
+      uint8_t base;
+      out = (bitRead(regs[CANINTF], RX1IF) << 7) | (bitRead(regs[CANINTF], RX0IF) << 6);
+      if(out != 0)
+      {
+        base = bitRead(regs[CANINTF], RX0IF) ? RXB0CTRL : RXB1CTRL;
+        out |= bitRead(regs[base + 2], IDE) << 4;
+        out |= bitRead(regs[base], RXRTR) << 3;
+        out |= (base == RXB0CTRL) ? (regs[base] & 0x01) : (regs[base] & 0x07);
+      }
+      break;
+    }
+
+    default:
+      break;
+  }
+  return out;
+}
+
+void MCP2515Sim::writeReg(uint8_t a, uint8_t val)
+{
+  uint8_t old;
+  int n;
+
+  a &= 0x7F;
+  if((a & 0x0F) == 0x0E)
+    return;  //CANSTAT is read-only
+  if((a & 0x0F) == 0x0F)
+  {
+    regs[CANCTRL] = val;
+    if(bitRead(val, ABAT))
+    {
+      for(n = 0; n < 3; n++)
+      {
+        uint8_t c = TXB0CTRL + (n << 4);
+        if(bitRead(regs[c], TXREQ) && n != txActive)
+          regs[c] = (regs[c] & ~(1 << TXREQ)) | (1 << ABTF);
+      }
+    }
+    requestMode(val >> 5);
+    return;
+  }
+
+  //Filters, masks and CNF1-3 only take writes in configuration mode
+  if((a <= RXF2EID0 || (a >= RXF3SIDH && a <= RXF5EID0) || (a >= RXM0SIDH && a <= CNF1)) && mode() != MODE_CONFIG)
+    return;
+
+  switch(a)
+  {
+    case TEC:
+    case REC:
+      return;
+
+    case EFLG:
+      //Only RX0OVR/RX1OVR can be written, and only cleared
+      regs[EFLG] &= (val | 0x3F);
+      return;
+
+    case TXB0CTRL:
+    case TXB1CTRL:
+    case TXB2CTRL:
+      n = (a - TXB0CTRL) >> 4;
+      old = regs[a];
+      regs[a] = (old & 0x70) | (val & ((1 << TXREQ) | (1 << TXP1) | (1 << TXP0)));
+      if(bitRead(old, TXREQ) && !bitRead(val, TXREQ) && n != txActive)
+        regs[a] |= (1 << ABTF);
+      if(!bitRead(old, TXREQ) && bitRead(val, TXREQ))
+        regs[a] &= ~((1 << ABTF) | (1 << MLOA) | (1 << TXERR));
+      startTransmit();
+      return;
+
+    case RXB0CTRL:
+      regs[a] = (regs[a] & 0x0B) | (val & ((1 << RXM1) | (1 << RXM0) | (1 << BUKT)));
+      return;
+
+    case RXB1CTRL:
+      regs[a] = (regs[a] & 0x0F) | (val & ((1 << RXM1) | (1 << RXM0)));
+      return;
+
+    default:
+      regs[a] = val;
+      return;
+  }
+}
+
+void MCP2515Sim::modifyReg(uint8_t a, uint8_t mask, uint8_t val)
+{
+  a &= 0x7F;
+  //Registers without bit-modify support take the whole byte
+  switch(a)
+  {
+    case BFPCTRL: case TXRTSCTRL: case CNF3: case CNF2: case CNF1:
+    case CANINTE: case CANINTF: case EFLG:
+    case TXB0CTRL: case TXB1CTRL: case TXB2CTRL: case RXB0CTRL: case RXB1CTRL:
+      break;
+    default:
+      if((a & 0x0F) != 0x0F)
+        mask = 0xFF;
+      break;
+  }
+  writeReg(a, (reg(a) & ~mask) | (val & mask));
+}
+
+void MCP2515Sim::requestMode(uint8_t m)
+{
+  m &= 0x07;
+  if(m > MODE_CONFIG)
+    m = MODE_CONFIG;
+  regs[CANSTAT] = (regs[CANSTAT] & 0x1F) | (m << 5);
+  startTransmit();
+}
+
+bool MCP2515Sim::filterMatch(const SimFrame &f, int rxb) const
+{
+  uint8_t m[4], id[4];
+  uint8_t maskBase = (rxb == 0) ? RXM0SIDH : RXM1SIDH;
+  int first = (rxb == 0) ? 0 : 2;
+  int last = (rxb == 0) ? 1 : 5;
+  uint16_t sid;
+  uint32_t eid;
+  int i, k;
+
+  for(k = 0; k < 4; k++)
+    m[k] = regs[maskBase + k];
+  if(f.ext)
+  {
+    sid = (f.id >> 18) & 0x7FF;
+    eid = f.id & 0x3FFFF;
+    id[0] = sid >> 3;
+    id[1] = ((sid & 0x07) << 5) | ((eid >> 16) & 0x03);
+    id[2] = eid >> 8;
+    id[3] = eid;
+  }
+  else
+  {
+    //Standard frames match the EID bytes against data bytes 0 and 1
+    sid = f.id & 0x7FF;
+    id[0] = sid >> 3;
+    id[1] = (sid & 0x07) << 5;
+    id[2] = (f.dlc > 0 && !f.rtr) ? f.data[0] : 0;
+    id[3] = (f.dlc > 1 && !f.rtr) ? f.data[1] : 0;
+    m[1] &= 0xE0;
+  }
+
+  for(i = first; i <= last; i++)
+  {
+    const uint8_t *flt = &regs[filterBase[i]];
+    if(bitRead(flt[1], EXIDE) != (f.ext ? 1 : 0))
+      continue;
+    if(((id[0] ^ flt[0]) & m[0]) == 0 && ((id[1] ^ flt[1]) & m[1] & 0xE3) == 0 &&
+       ((id[2] ^ flt[2]) & m[2]) == 0 && ((id[3] ^ flt[3]) & m[3]) == 0)
+      return true;
+  }
+  return false;
+}
+
+void MCP2515Sim::storeRx(int rxb, const SimFrame &f, int filhit)
+{
+  uint8_t base = RXB0CTRL + (rxb << 4);
+  uint16_t sid;
+  uint32_t eid;
+  uint8_t dlc = f.dlc & 0x0F;
+  int i;
+
+  if(f.ext)
+  {
+    sid = (f.id >> 18) & 0x7FF;
+    eid = f.id & 0x3FFFF;
+    regs[base + 1] = sid >> 3;
+    regs[base + 2] = ((sid & 0x07) << 5) | (1 << IDE) | ((eid >> 16) & 0x03);
+    regs[base + 3] = eid >> 8;
+    regs[base + 4] = eid;
+    regs[base + 5] = dlc | (f.rtr ? (1 << RTR) : 0);
+  }
+  else
+  {
+    sid = f.id & 0x7FF;
+    regs[base + 1] = sid >> 3;
+    regs[base + 2] = ((sid & 0x07) << 5) | (f.rtr ? (1 << SRR) : 0);
+    regs[base + 3] = 0;
+    regs[base + 4] = 0;
+    regs[base + 5] = dlc;
+  }
+  for(i = 0; i < 8; i++)
+    regs[base + 6 + i] = (i < dlc && !f.rtr) ? f.data[i] : 0;
+
+  if(rxb == 0)
+    regs[base] = (regs[base] & 0x64) | (f.rtr ? (1 << RXRTR) : 0) | (filhit & 0x01);
+  else
+    regs[base] = (regs[base] & 0x60) | (f.rtr ? (1 << RXRTR) : 0) | (filhit & 0x07);
+  setIntFlag(RX0IF + rxb);
+  stats.framesAccepted++;
+}
+
+static bool bitrateMatches(unsigned long a, unsigned long b)
+{
+  double d = (double)a - (double)b;
+  if(d < 0)
+    d = -d;
+  return d <= BITRATE_TOLERANCE * (double)b;
+}
+
+void MCP2515Sim::receive(const SimFrame &f)
+{
+  uint8_t m = mode();
+  bool any0, any1;
+
+  stats.framesOnBus++;
+  if(m == MODE_CONFIG)
+    return;
+  if(m == MODE_SLEEP)
+  {
+    //Bus activity wakes the controller into listen-only mode; the frame is lost
+    if(bitRead(regs[CANINTE], WAKIE))
+    {
+      setIntFlag(WAKIF);
+      regs[CANSTAT] = (regs[CANSTAT] & 0x1F) | (MODE_LISTEN << 5);
+    }
+    return;
+  }
+  any0 = ((regs[RXB0CTRL] >> 5) & 0x03) == 0x03;
+  any1 = ((regs[RXB1CTRL] >> 5) & 0x03) == 0x03;
+  if(m != MODE_LOOPBACK && !bitrateMatches(programmedBitrate(), busBitrate))
+  {
+    setIntFlag(MERRF);
+    if(m != MODE_LISTEN && regs[REC] < 255)
+      regs[REC]++;
+    stats.framesErrored++;
+    //RXM = 11 keeps frames with errors too; what lands in the buffer is garbage
+    if(!any0 && !any1)
+      return;
+  }
+  if(any0 || filterMatch(f, 0))
+  {
+    if(!bitRead(regs[CANINTF], RX0IF))
+      storeRx(0, f, 0);
+    else if(bitRead(regs[RXB0CTRL], BUKT) && !bitRead(regs[CANINTF], RX1IF))
+      storeRx(1, f, 0);
+    else
+    {
+      regs[EFLG] |= bitRead(regs[RXB0CTRL], BUKT) ? (1 << RX1OVR) : (1 << RX0OVR);
+      setIntFlag(ERRIF);
+      stats.framesOverflowed++;
+    }
+  }
+  else if(any1 || filterMatch(f, 1))
+  {
+    if(!bitRead(regs[CANINTF], RX1IF))
+      storeRx(1, f, 2);
+    else
+    {
+      regs[EFLG] |= (1 << RX1OVR);
+      setIntFlag(ERRIF);
+      stats.framesOverflowed++;
+    }
+  }
+  else
+    stats.framesFiltered++;
+}
+
+void MCP2515Sim::schedule(const SimFrame &frame, uint64_t atMicros)
+{
+  scheduled.insert(std::make_pair(atMicros, frame));
+}
+
+void MCP2515Sim::startTransmit()
+{
+  int n, best = -1, bestPri = -1;
+  uint8_t m = mode();
+  SimFrame f;
+
+  if(txActive >= 0 || (m != MODE_NORMAL && m != MODE_LOOPBACK))
+    return;
+  //Highest TXP wins; on a tie the higher buffer number goes first
+  for(n = 0; n < 3; n++)
+  {
+    uint8_t c = regs[TXB0CTRL + (n << 4)];
+    if(bitRead(c, TXREQ) && (int)(c & 0x03) >= bestPri)
+    {
+      best = n;
+      bestPri = c & 0x03;
+    }
+  }
+  if(best < 0)
+    return;
+  f.rtr = bitRead(regs[TXB0DLC + (best << 4)], RTR);
+  f.dlc = regs[TXB0DLC + (best << 4)] & 0x0F;
+  f.ext = bitRead(regs[TXB0SIDL + (best << 4)], EXIDE);
+  txActive = best;
+  if(busFreeAt < now)
+    busFreeAt = now;
+  busFreeAt += (uint64_t)frameBits(f) * 1000000ULL / programmedBitrate();
+}
+
+void MCP2515Sim::advanceTo(uint64_t t)
+{
+  SimFrame f;
+  uint8_t base, ctrl;
+  int n, i;
+
+  while(true)
+  {
+    bool haveRx = !scheduled.empty() && scheduled.begin()->first <= t;
+    bool haveTx = txActive >= 0 && busFreeAt <= t;
+
+    if(!haveRx && !haveTx)
+      break;
+    if(haveTx && (!haveRx || busFreeAt <= scheduled.begin()->first))
+    {
+      now = busFreeAt;
+      n = txActive;
+      txActive = -1;
+      ctrl = TXB0CTRL + (n << 4);
+      base = TXB0SIDH + (n << 4);
+      if(mode() != MODE_LOOPBACK && !bitrateMatches(programmedBitrate(), busBitrate))
+      {
+        //Nobody acknowledges: error frame, retry while TXREQ stays set
+        regs[ctrl] |= (1 << TXERR);
+        setIntFlag(MERRF);
+        if(regs[TEC] <= 247)
+          regs[TEC] += 8;
+        if(!bitRead(regs[ctrl], TXREQ))
+          regs[ctrl] |= (1 << ABTF);
+        startTransmit();
+        continue;
+      }
+      f.ext = bitRead(regs[base + 1], EXIDE);
+      if(f.ext)
+        f.id = ((uint32_t)((regs[base] << 3) | (regs[base + 1] >> 5)) << 18) |
+               ((uint32_t)(regs[base + 1] & 0x03) << 16) | (regs[base + 2] << 8) | regs[base + 3];
+      else
+        f.id = (regs[base] << 3) | (regs[base + 1] >> 5);
+      f.rtr = bitRead(regs[base + 4], RTR);
+      f.dlc = regs[base + 4] & 0x0F;
+      for(i = 0; i < 8; i++)
+        f.data[i] = regs[base + 5 + i];
+      regs[ctrl] &= ~(1 << TXREQ);
+      setIntFlag(TX0IF + n);
+      stats.framesSent++;
+      if(mode() == MODE_LOOPBACK)
+        receive(f);
+      else if(onTransmit)
+        onTransmit(f, now);
+      startTransmit();
+    }
+    else
+    {
+      now = scheduled.begin()->first;
+      f = scheduled.begin()->second;
+      scheduled.erase(scheduled.begin());
+      receive(f);
+    }
+  }
+  now = t;
+  startTransmit();
+}
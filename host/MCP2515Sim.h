@@ -0,0 +1,133 @@
+/*
+   This file is included as part of the CANOPNR distribution.
+   You are free to use this project as you see fit, provided credit is given to all
+   contributors (original and subsequent).
+
+   Copyright 2012  Jose Denrie Enriquez, Alex Bautista, Paloma Field, Sun-il Kim
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+  ------------------------------------------------------------------------------------------------------------
+
+  Register-level MCP2515 simulator for running CANOPNR_MCP2515.cpp on a PC.
+
+  Modelled: the register file with CANSTAT/CANCTRL mirrors and config-mode
+  write protection, every SPI command (RESET, READ, WRITE, BIT_MODIFY,
+  READ_RX_BUFFER, LOAD_TX_BUFFER, RTS, READ_STATUS, RX_STATUS), acceptance
+  masks/filters, RXB0->RXB1 rollover and RXnOVR, TX arbitration by TXP, the
+  operating modes, the INT line and bit timing from CNF1-3. A frame sent at a
+  bitrate other than the one programmed raises MERRF; it is received as well
+  only by a buffer set to RXM = 11, which keeps frames with errors.
+
+  Build the driver for the host by putting host/ first on the include path:
+
+      g++ -std=c++11 -Ihost -I. host/ArduinoHost.cpp host/MCP2515Sim.cpp \
+          CANOPNR_MCP2515.cpp CANOPNR_OBD.cpp your_program.cpp
+
+  then attach a simulator to the driver's chip-select (and INT) pin with
+  simAttach() before calling initCAN().
+*/
+
+#ifndef CANOPNR_MCP2515SIM_H
+#define CANOPNR_MCP2515SIM_H
+
+#include <stdint.h>
+#include <functional>
+#include <map>
+#include <vector>
+
+struct SimFrame
+{
+  uint32_t id;        //11-bit or 29-bit identifier
+  bool ext;
+  bool rtr;
+  uint8_t dlc;
+  uint8_t data[8];
+};
+
+struct SimStats
+{
+  unsigned long spiTransactions;  //chip-select assertions
+  unsigned long spiBytes;
+  unsigned long framesOnBus;      //frames offered to the controller
+  unsigned long framesAccepted;   //stored in RXB0 or RXB1
+  unsigned long framesFiltered;   //rejected by the acceptance filters
+  unsigned long framesOverflowed; //lost because both RX buffers were full
+  unsigned long framesErrored;    //bitrate mismatch, MERRF raised
+  unsigned long framesSent;       //left a TX buffer
+};
+
+class MCP2515Sim
+{
+  public:
+    explicit MCP2515Sim(unsigned long oscHz = 16000000UL);
+
+    void reset();
+
+    //SPI side, driven by the host SPI/GPIO shims
+    void select(bool low);
+    uint8_t transfer(uint8_t in);
+    bool intAsserted() const;   //INT is active low: true means the pin reads LOW
+
+    //Bus side
+    void setBusBitrate(unsigned long bps) { busBitrate = bps; }
+    unsigned long getBusBitrate() const { return busBitrate; }
+    unsigned long programmedBitrate() const;  //from CNF1-3 and the oscillator
+    void receive(const SimFrame &frame);       //a frame completes on the bus now
+    void schedule(const SimFrame &frame, uint64_t atMicros);
+    void advanceTo(uint64_t nowMicros);        //deliver due frames, finish transmissions
+    size_t pendingFrames() const { return scheduled.size(); }
+
+    //Called for each frame the controller puts on the bus
+    std::function<void(const SimFrame &, uint64_t)> onTransmit;
+
+    uint8_t reg(uint8_t addr) const;
+    uint8_t mode() const { return regs[0x0E] >> 5; }
+    static unsigned int frameBits(const SimFrame &frame);
+
+    SimStats stats;
+
+  private:
+    uint8_t regs[128];
+    unsigned long osc;
+    unsigned long busBitrate;
+    uint64_t now;
+    uint64_t busFreeAt;   //end of the frame currently being transmitted
+    int txActive;         //buffer on the bus, or -1
+    std::multimap<uint64_t, SimFrame> scheduled;
+
+    //SPI command decoding
+    bool cs;
+    int state;
+    uint8_t cmd;
+    uint8_t addr;
+    uint8_t bitMask;
+    int rxbRead;          //RX buffer read by READ_RX_BUFFER, cleared on CS high
+
+    void writeReg(uint8_t a, uint8_t val);
+    void modifyReg(uint8_t a, uint8_t mask, uint8_t val);
+    void requestMode(uint8_t m);
+    bool filterMatch(const SimFrame &f, int rxb) const;
+    void storeRx(int rxb, const SimFrame &f, int filhit);
+    void startTransmit();
+    void setIntFlag(uint8_t bit) { regs[0x2C] |= (1 << bit); }
+};
+
+//Host glue (ArduinoHost.cpp)
+void simAttach(MCP2515Sim *sim, int csPin, int intPin);
+void simDetachAll();
+uint64_t simMicros();
+void simAdvance(uint64_t us);
+void simSetSpiByteMicros(unsigned int us);
+
+#endif
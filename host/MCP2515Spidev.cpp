@@ -0,0 +1,158 @@
+/*
+   This file is included as part of the CANOPNR distribution.
+   You are free to use this project as you see fit, provided credit is given to all
+   contributors (original and subsequent).
+
+   Copyright 2012  Jose Denrie Enriquez, Alex Bautista, Paloma Field, Sun-il Kim
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+  ------------------------------------------------------------------------------------------------------------
+
+  Linux spidev binding for the MCP2515 driver (see CANOPNR_HAL.h). Build the
+  driver for a Linux SPI gateway with:
+
+      g++ -std=c++11 -DCANOPNR_SPIDEV -I. host/MCP2515Spidev.cpp \
+          CANOPNR_MCP2515.cpp CANOPNR_OBD.cpp your_program.cpp
+
+  MCP2515 commands stream data while CS is held, and the driver reads each
+  reply byte before it decides what to send next, so a transaction is many
+  one-byte transfers. spidev raises its own chip select at the end of every
+  SPI_IOC_MESSAGE, so CS is a GPIO line instead: select() drives it low,
+  deselect() high, and spidev is opened with SPI_NO_CS. The csPin given to
+  MCP2515 is the line offset on CANOPNR_SPIDEV_GPIOCHIP, so several
+  controllers share one spidev node. Wire each MCP2515's CS to its GPIO.
+  If the SPI controller can't turn its chip select off, that pin keeps
+  toggling per byte, which is harmless when nothing is wired to it.
+*/
+
+#if defined(CANOPNR_SPIDEV)
+
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+#include <linux/spi/spidev.h>
+#include "CANOPNR_HAL.h"
+
+void MCP2515SPI::begin()
+{
+  struct gpiohandle_request req;
+  char path[32];
+  unsigned char mode = SPI_MODE_0 | SPI_NO_CS, bits = 8;
+  unsigned int speed = MCP2515_SPI_CLOCK;
+  int chip;
+
+  if(fd >= 0)
+    return;
+
+  //CS first, high, so the controller never sees a stray select
+  if(csFd < 0)
+  {
+    chip = open(CANOPNR_SPIDEV_GPIOCHIP, O_RDWR);
+    if(chip < 0)
+    {
+      perror(CANOPNR_SPIDEV_GPIOCHIP);
+      return;
+    }
+    memset(&req, 0, sizeof(req));
+    req.lineoffsets[0] = cs;
+    req.lines = 1;
+    req.flags = GPIOHANDLE_REQUEST_OUTPUT;
+    req.default_values[0] = 1;
+    strncpy(req.consumer_label, "canopnr-cs", sizeof(req.consumer_label) - 1);
+    if(ioctl(chip, GPIO_GET_LINEHANDLE_IOCTL, &req) < 0)
+    {
+      perror("CS line");
+      close(chip);
+      return;
+    }
+    close(chip);
+    csFd = req.fd;
+  }
+
+  snprintf(path, sizeof(path), "/dev/spidev%d.%d", CANOPNR_SPIDEV_BUS, CANOPNR_SPIDEV_DEVICE);
+  fd = open(path, O_RDWR);
+  if(fd < 0)
+  {
+    perror(path);
+    return;
+  }
+  if(ioctl(fd, SPI_IOC_WR_MODE, &mode) < 0)
+  {
+    mode = SPI_MODE_0;
+    ioctl(fd, SPI_IOC_WR_MODE, &mode);
+  }
+  ioctl(fd, SPI_IOC_WR_BITS_PER_WORD, &bits);
+  ioctl(fd, SPI_IOC_WR_MAX_SPEED_HZ, &speed);
+}
+
+void MCP2515SPI::setCS(byte level)
+{
+  struct gpiohandle_data data;
+
+  if(csFd < 0)
+    return;
+  memset(&data, 0, sizeof(data));
+  data.values[0] = level;
+  ioctl(csFd, GPIOHANDLE_SET_LINE_VALUES_IOCTL, &data);
+}
+
+byte MCP2515SPI::transfer(byte val)
+{
+  struct spi_ioc_transfer xfer;
+  byte in = 0xFF;
+
+  if(fd < 0)
+    return in;
+  memset(&xfer, 0, sizeof(xfer));
+  xfer.tx_buf = (unsigned long)&val;
+  xfer.rx_buf = (unsigned long)&in;
+  xfer.len = 1;
+  xfer.speed_hz = MCP2515_SPI_CLOCK;
+  xfer.bits_per_word = 8;
+  ioctl(fd, SPI_IOC_MESSAGE(1), &xfer);
+  return in;
+}
+
+static unsigned long long monotonicMicros()
+{
+  static unsigned long long start = 0;
+  struct timespec ts;
+  unsigned long long now;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  now = (unsigned long long)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+  if(start == 0)
+    start = now;
+  return now - start;
+}
+
+unsigned long halMillis()
+{
+  return (unsigned long)(monotonicMicros() / 1000);
+}
+
+unsigned long halMicros()
+{
+  return (unsigned long)monotonicMicros();
+}
+
+void halDelay(unsigned long ms)
+{
+  usleep(ms * 1000);
+}
+
+#endif
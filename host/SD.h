@@ -0,0 +1,204 @@
+/*
+   This file is included as part of the CANOPNR distribution.
+   You are free to use this project as you see fit, provided credit is given to all
+   contributors (original and subsequent).
+
+   Copyright 2012  Jose Denrie Enriquez, Alex Bautista, Paloma Field, Sun-il Kim
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+  ------------------------------------------------------------------------------------------------------------
+
+  Host stand-in for the raw block side of the Arduino SD library: Sd2Card
+  backed by an image file, and the SdVolume block cache. No FAT: code under
+  test is given a block range directly.
+
+  Each block read or write advances the virtual clock by a typical SPI SD
+  card figure, inside an SPI transaction, so interrupts registered with
+  SPI.usingInterrupt() (the MCP2515's) are held off meanwhile as on the
+  board. writeStart()/writeData()/writeStop() stream consecutive blocks
+  with one command, at a lower cost per block; setStreaming(false) charges
+  writeData() a full single-block write instead, for comparison.
+  failAfter() simulates a power loss: the given number of writes still go
+  through, the next one is torn (only its first half reaches the image) or
+  lost, and every access fails until open() is called again, as after a
+  reset.
+
+      Sd2Card card;
+      card.open("ring.img", 4096);
+      ring.begin(&card, 0, 4096);
+*/
+
+#ifndef CANOPNR_HOST_SD_H
+#define CANOPNR_HOST_SD_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "Arduino.h"
+#include "MCP2515Sim.h"
+#include "SPI.h"
+
+#define SD_READ_MICROS 1200     //CMD17 plus 512 bytes at 4 MHz SCK
+#define SD_WRITE_MICROS 2500    //CMD24, 512 bytes and the card's busy time
+#define SD_STREAM_MICROS 1100   //one block of a CMD25 multi-block write
+#define SD_START_MICROS 2000    //ACMD23 pre-erase and CMD25
+#define SD_STOP_MICROS 2000     //stop token and busy
+
+class Sd2Card
+{
+  public:
+    Sd2Card() : reads(0), writes(0), fp(0), blocks(0), writesLeft(-1), torn(false), dead(false), streaming(true), streamBlock(0), streamLeft(0) {}
+    ~Sd2Card() { close(); }
+
+    //Host only: opens the image, creating it or growing it to blockCount
+    bool open(const char *path, uint32_t blockCount)
+    {
+      static const uint8_t blank[512] = {0};
+      long size;
+
+      close();
+      fp = fopen(path, "r+b");
+      if(fp == 0)
+        fp = fopen(path, "w+b");
+      if(fp == 0)
+        return false;
+      fseek(fp, 0, SEEK_END);
+      size = ftell(fp);
+      for(blocks = size / 512; blocks < blockCount; blocks++)
+        fwrite(blank, 1, 512, fp);
+      fflush(fp);
+      writesLeft = -1;
+      dead = false;
+      return true;
+    }
+
+    void close()
+    {
+      if(fp != 0)
+        fclose(fp);
+      fp = 0;
+    }
+
+    void failAfter(long n, bool tornWrite)
+    {
+      writesLeft = n;
+      torn = tornWrite;
+    }
+
+    //Host only: false makes writeData() cost as much as writeBlock()
+    void setStreaming(bool on) { streaming = on; }
+
+    uint8_t init(uint8_t sckRateID, uint8_t chipSelectPin) { (void)sckRateID; (void)chipSelectPin; return fp != 0; }
+    uint32_t cardSize() { return blocks; }
+
+    uint8_t readBlock(uint32_t block, uint8_t *dst)
+    {
+      busy(SD_READ_MICROS);
+      if(fp == 0 || dead || block >= blocks)
+        return 0;
+      fseek(fp, (long)block * 512, SEEK_SET);
+      if(fread(dst, 1, 512, fp) != 512)
+        return 0;
+      reads++;
+      return 1;
+    }
+
+    uint8_t writeBlock(uint32_t block, const uint8_t *src)
+    {
+      busy(SD_WRITE_MICROS);
+      return store(block, src);
+    }
+
+    uint8_t writeStart(uint32_t block, uint32_t eraseCount)
+    {
+      busy(SD_START_MICROS);
+      if(fp == 0 || dead || block + eraseCount > blocks)
+        return 0;
+      streamBlock = block;
+      streamLeft = eraseCount;
+      return 1;
+    }
+
+    uint8_t writeData(const uint8_t *src)
+    {
+      busy(streaming ? SD_STREAM_MICROS : SD_WRITE_MICROS);
+      if(streamLeft == 0 || !store(streamBlock, src))
+        return 0;
+      streamBlock++;
+      streamLeft--;
+      return 1;
+    }
+
+    uint8_t writeStop()
+    {
+      busy(SD_STOP_MICROS);
+      streamLeft = 0;
+      return fp != 0 && !dead;
+    }
+
+    unsigned long reads;
+    unsigned long writes;
+
+  private:
+    FILE *fp;
+    uint32_t blocks;
+    long writesLeft;
+    bool torn;
+    bool dead;
+    bool streaming;
+    uint32_t streamBlock;
+    uint32_t streamLeft;
+
+    void busy(unsigned long us)
+    {
+      SPI.beginTransaction(SPISettings(4000000, MSBFIRST, SPI_MODE0));
+      simAdvance(us);
+      SPI.endTransaction();
+    }
+
+    uint8_t store(uint32_t block, const uint8_t *src)
+    {
+      if(fp == 0 || dead || block >= blocks)
+        return 0;
+      fseek(fp, (long)block * 512, SEEK_SET);
+      if(writesLeft == 0)
+      {
+        if(torn)
+          fwrite(src, 1, 256, fp);
+        fflush(fp);
+        dead = true;
+        return 0;
+      }
+      if(writesLeft > 0)
+        writesLeft--;
+      if(fwrite(src, 1, 512, fp) != 512)
+        return 0;
+      fflush(fp);
+      writes++;
+      return 1;
+    }
+};
+
+class SdVolume
+{
+  public:
+    //The library's single 512-byte block cache, handed out for raw block I/O
+    static uint8_t *cacheClear()
+    {
+      static uint8_t cache[512];
+      return cache;
+    }
+};
+
+#endif
@@ -0,0 +1,339 @@
+/*
+   This file is included as part of the CANOPNR distribution.
+   You are free to use this project as you see fit, provided credit is given to all
+   contributors (original and subsequent).
+
+   Copyright 2012  Jose Denrie Enriquez, Alex Bautista, Paloma Field, Sun-il Kim
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+  ------------------------------------------------------------------------------------------------------------
+
+  SIM900 modem stand-in, see SIM900Sim.h. Default latencies are typical of
+  a SIM900 on a 2G network; change them per command with setDelay().
+*/
+
+#include <stdlib.h>
+#include <algorithm>
+#include "SIM900Sim.h"
+#include "MCP2515Sim.h"
+
+#define SIM900_COMMAND_MS 30     //plain AT commands
+#define SIM900_CONNECT_MS 1800   //CIPSTART to CONNECT OK
+#define SIM900_SEND_MS 700       //payload to SEND OK (server TCP ack)
+#define SIM900_ACCEPT_MS 5       //payload to DATA ACCEPT
+#define SIM900_CLOSE_MS 250
+#define SIM900_SHUT_MS 400
+
+static bool startsWith(const std::string &s, const char *prefix)
+{
+  return s.compare(0, strlen(prefix), prefix) == 0;
+}
+
+SIM900Sim::SIM900Sim(unsigned long baud)
+  : byteMicros(10000000UL / baud), powered(true), echo(true), quickSend(false), csq(17),
+    ipState(IP_INITIAL), connectedAt(0), dataLeft(0), skipLF(false), outFree(0)
+{
+  memset(&stats, 0, sizeof(stats));
+}
+
+void SIM900Sim::setDelay(const char *command, unsigned long ms)
+{
+  delays[command] = ms;
+}
+
+void SIM900Sim::inject(const char *command, const char *text, unsigned times)
+{
+  Injection inj;
+
+  inj.command = command;
+  inj.reply = text;
+  inj.times = times;
+  injections.push_back(inj);
+}
+
+void SIM900Sim::dropAt(uint64_t atMicros, bool pdp)
+{
+  Drop d;
+
+  d.at = atMicros;
+  d.pdp = pdp;
+  drops.push_back(d);
+}
+
+bool SIM900Sim::connected()
+{
+  tick();
+  return ipState == IP_CONNECTED;
+}
+
+//Applies the state changes that are due: connects completing, network drops
+void SIM900Sim::tick()
+{
+  uint64_t now = simMicros();
+  size_t i;
+
+  if(ipState == IP_CONNECTING && now >= connectedAt)
+  {
+    ipState = IP_CONNECTED;
+    stats.sessions++;
+  }
+  for(i = 0; i < drops.size(); )
+  {
+    if(drops[i].at > now)
+    {
+      i++;
+      continue;
+    }
+    if(ipState == IP_CONNECTED || ipState == IP_CONNECTING)
+    {
+      stats.closes++;
+      reply(drops[i].pdp ? "+PDP: DEACT" : "CLOSED", 0);
+    }
+    if(drops[i].pdp)
+      ipState = IP_PDP_DEACT;
+    else if(ipState != IP_PDP_DEACT)
+      ipState = IP_INITIAL;
+    drops.erase(drops.begin() + i);
+  }
+  while(!pending.empty() && pending.begin()->first <= now)
+  {
+    uint64_t t = std::max(pending.begin()->first, outFree);
+    const std::string &text = pending.begin()->second;
+
+    for(i = 0; i < text.size(); i++)
+    {
+      t += byteMicros;
+      out.push_back(std::make_pair(t, (uint8_t)text[i]));
+    }
+    outFree = t;
+    pending.erase(pending.begin());
+  }
+}
+
+//A reply is ready after its latency; replies then go out one after the
+//other at the baud rate, in the order they became ready
+void SIM900Sim::emitRaw(const std::string &s, unsigned long delayMs)
+{
+  pending.insert(std::make_pair(simMicros() + (uint64_t)delayMs * 1000, s));
+}
+
+//Verbose result format: every line is framed by CR LF on both sides
+void SIM900Sim::reply(const std::string &lines, unsigned long delayMs)
+{
+  std::string framed;
+  size_t start = 0, end;
+
+  do
+  {
+    end = lines.find('\n', start);
+    framed += "\r\n" + lines.substr(start, end == std::string::npos ? std::string::npos : end - start) + "\r\n";
+    start = end + 1;
+  } while(end != std::string::npos);
+  emitRaw(framed, delayMs);
+}
+
+unsigned long SIM900Sim::delayFor(const std::string &command, unsigned long dflt)
+{
+  std::map<std::string, unsigned long>::const_iterator it;
+  size_t best = 0;
+
+  for(it = delays.begin(); it != delays.end(); ++it)
+  {
+    if(startsWith(command, it->first.c_str()) && it->first.size() >= best)
+    {
+      best = it->first.size();
+      dflt = it->second;
+    }
+  }
+  return dflt;
+}
+
+int SIM900Sim::available()
+{
+  uint64_t now = simMicros();
+  int n = 0;
+  size_t i;
+
+  tick();
+  for(i = 0; i < out.size() && out[i].first <= now; i++)
+    n++;
+  return n;
+}
+
+int SIM900Sim::read()
+{
+  uint8_t b;
+
+  if(available() == 0)
+    return -1;
+  b = out.front().second;
+  out.pop_front();
+  return b;
+}
+
+int SIM900Sim::peek()
+{
+  if(available() == 0)
+    return -1;
+  return out.front().second;
+}
+
+size_t SIM900Sim::write(uint8_t b)
+{
+  simAdvance(byteMicros);
+  tick();
+  if(!powered)
+    return 1;
+
+  if(skipLF)
+  {
+    skipLF = false;
+    if(b == '\n')
+      return 1;
+  }
+  if(dataLeft > 0)
+  {
+    if(echo)
+      emitRaw(std::string(1, (char)b), 0);
+    payload.push_back(b);
+    if(--dataLeft == 0)
+      finishPayload();
+    return 1;
+  }
+  if(b == '\r')
+  {
+    handleCommand();
+    cmd.clear();
+  }
+  else if(b != '\n')
+    cmd += (char)b;
+  return 1;
+}
+
+void SIM900Sim::finishPayload()
+{
+  if(ipState != IP_CONNECTED)
+  {
+    stats.errors++;
+    reply("SEND FAIL", SIM900_ACCEPT_MS);
+  }
+  else
+  {
+    server.insert(server.end(), payload.begin(), payload.end());
+    stats.sends++;
+    if(quickSend)
+      reply("DATA ACCEPT:" + std::to_string(payload.size()), SIM900_ACCEPT_MS);
+    else
+      reply("SEND OK", delayFor("AT+CIPSEND", SIM900_SEND_MS));
+  }
+  payload.clear();
+}
+
+void SIM900Sim::handleCommand()
+{
+  unsigned long ms = delayFor(cmd, SIM900_COMMAND_MS);
+  size_t i;
+
+  if(cmd.empty())
+    return;
+  stats.commands++;
+  if(echo)
+    emitRaw(cmd + "\r", 0);
+
+  for(i = 0; i < injections.size(); i++)
+  {
+    if(injections[i].times == 0 || !startsWith(cmd, injections[i].command.c_str()))
+      continue;
+    injections[i].times--;
+    stats.errors++;
+    reply(injections[i].reply, ms);
+    return;
+  }
+
+  if(cmd == "AT")
+    reply("OK", ms);
+  else if(cmd == "ATE0" || cmd == "ATE1")
+  {
+    echo = (cmd == "ATE1");
+    reply("OK", ms);
+  }
+  else if(startsWith(cmd, "AT+CIPQSEND="))
+  {
+    quickSend = (cmd[12] == '1');
+    reply("OK", ms);
+  }
+  else if(startsWith(cmd, "AT+CIPMUX=") || startsWith(cmd, "AT+CIPMODE=") ||
+          startsWith(cmd, "AT+CGDCONT=") || startsWith(cmd, "AT+CSTT="))
+    reply("OK", ms);
+  else if(cmd == "AT+CSQ")
+    reply("+CSQ: " + std::to_string(csq) + ",0\nOK", ms);
+  else if(cmd == "AT+CIPSHUT")
+  {
+    if(ipState == IP_CONNECTED || ipState == IP_CONNECTING)
+      stats.closes++;
+    ipState = IP_INITIAL;
+    reply("SHUT OK", delayFor(cmd, SIM900_SHUT_MS));
+  }
+  else if(startsWith(cmd, "AT+CIPCLOSE"))
+  {
+    if(ipState == IP_CONNECTED || ipState == IP_CONNECTING)
+    {
+      stats.closes++;
+      ipState = IP_INITIAL;
+      reply("CLOSE OK", delayFor(cmd, SIM900_CLOSE_MS));
+    }
+    else
+    {
+      stats.errors++;
+      reply("ERROR", ms);
+    }
+  }
+  else if(startsWith(cmd, "AT+CIPSTART="))
+  {
+    if(ipState == IP_CONNECTED || ipState == IP_CONNECTING)
+      reply("ALREADY CONNECT", ms);
+    else if(ipState == IP_PDP_DEACT)
+    {
+      stats.errors++;
+      reply("ERROR", ms);
+    }
+    else
+    {
+      ms = delayFor(cmd, SIM900_CONNECT_MS);
+      ipState = IP_CONNECTING;
+      connectedAt = simMicros() + (uint64_t)ms * 1000;
+      reply("OK", SIM900_COMMAND_MS);
+      reply("CONNECT OK", ms);
+    }
+  }
+  else if(startsWith(cmd, "AT+CIPSEND="))
+  {
+    if(ipState != IP_CONNECTED)
+    {
+      stats.errors++;
+      reply("ERROR", ms);
+    }
+    else
+    {
+      dataLeft = atoi(cmd.c_str() + 11);
+      skipLF = true;
+      emitRaw("\r\n> ", ms);
+    }
+  }
+  else
+  {
+    stats.errors++;
+    reply("ERROR", ms);
+  }
+}
@@ -0,0 +1,124 @@
+/*
+   This file is included as part of the CANOPNR distribution.
+   You are free to use this project as you see fit, provided credit is given to all
+   contributors (original and subsequent).
+
+   Copyright 2012  Jose Denrie Enriquez, Alex Bautista, Paloma Field, Sun-il Kim
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+  ------------------------------------------------------------------------------------------------------------
+
+  Scriptable SIM900 stand-in for the modem serial port (cell in the sketch).
+
+  It parses the AT commands the sketch and CANOPNR_GPRS use and answers on
+  the virtual clock of ArduinoHost.cpp: replies come after a per-command
+  latency and then one byte per character time at the configured baud rate,
+  and every byte written to it costs a character time, as SoftwareSerial's
+  blocking write does. Modelled: echo (ATE0/ATE1, data is echoed too), the
+  IP state (initial, connecting, connected, PDP deactivated), CIPSEND with
+  its "> " prompt, SEND OK or DATA ACCEPT (AT+CIPQSEND), CIPCLOSE/CIPSHUT and
+  +CSQ. Bytes sent while connected are appended to server.
+
+  Scripting: setDelay() changes a command's latency, inject() replaces the
+  next replies to a command (the state is left as it was), dropAt() closes
+  the session from the network side at a given time.
+
+      SIM900Sim modem;
+      modem.inject("AT+CIPSTART", "OK\nCONNECT FAIL");
+      modem.dropAt(simMicros() + 60000000ULL);
+      GPRSLink gprs(modem, 9);
+*/
+
+#ifndef CANOPNR_SIM900SIM_H
+#define CANOPNR_SIM900SIM_H
+
+#include <stdint.h>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+#include "Arduino.h"
+
+struct SIM900Stats
+{
+  unsigned long commands;
+  unsigned long sessions;   //CONNECT OK given
+  unsigned long sends;      //CIPSEND payloads taken while connected
+  unsigned long closes;     //sessions ended by CIPCLOSE, CIPSHUT or the network
+  unsigned long errors;     //ERROR, FAIL and injected replies
+};
+
+class SIM900Sim : public Stream
+{
+  public:
+    explicit SIM900Sim(unsigned long baud = 19200);
+
+    //Stream side, the node's serial port
+    int available();
+    int read();
+    int peek();
+    size_t write(uint8_t b);
+    using Print::write;
+
+    //Script
+    void setDelay(const char *command, unsigned long ms);
+    void inject(const char *command, const char *reply, unsigned times = 1);
+    void dropAt(uint64_t atMicros, bool pdp = false);
+    void setPowered(bool on) { powered = on; }
+    void setCsq(int rssi) { csq = rssi; }
+    bool connected();
+
+    std::vector<uint8_t> server;   //payload bytes that reached the server, in order
+    SIM900Stats stats;
+
+  private:
+    struct Injection
+    {
+      std::string command;
+      std::string reply;
+      unsigned times;
+    };
+    struct Drop
+    {
+      uint64_t at;
+      bool pdp;
+    };
+
+    unsigned long byteMicros;
+    bool powered;
+    bool echo;
+    bool quickSend;
+    int csq;
+    enum { IP_INITIAL, IP_CONNECTING, IP_CONNECTED, IP_PDP_DEACT } ipState;
+    uint64_t connectedAt;
+    std::string cmd;
+    unsigned dataLeft;            //payload bytes still expected after "> "
+    bool skipLF;                  //LF of the CR LF that ended AT+CIPSEND
+    std::vector<uint8_t> payload;
+    std::multimap<uint64_t, std::string> pending;   //replies by the time they are ready
+    std::deque<std::pair<uint64_t, uint8_t> > out;  //reply bytes on the wire
+    uint64_t outFree;             //when the last byte on the wire is through
+    std::map<std::string, unsigned long> delays;
+    std::vector<Injection> injections;
+    std::vector<Drop> drops;
+
+    void tick();
+    void emitRaw(const std::string &s, unsigned long delayMs);
+    void reply(const std::string &lines, unsigned long delayMs);
+    unsigned long delayFor(const std::string &command, unsigned long dflt);
+    void handleCommand();
+    void finishPayload();
+};
+
+#endif
@@ -0,0 +1,67 @@
+/*
+   This file is included as part of the CANOPNR distribution.
+   You are free to use this project as you see fit, provided credit is given to all
+   contributors (original and subsequent).
+
+   Copyright 2012  Jose Denrie Enriquez, Alex Bautista, Paloma Field, Sun-il Kim
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+  ------------------------------------------------------------------------------------------------------------
+
+  Host stand-in for the Arduino SPI library. Bytes go to whichever simulated
+  device currently has its chip select low; beginTransaction() masks the
+  interrupts registered with usingInterrupt() just like the AVR library.
+*/
+
+#ifndef CANOPNR_HOST_SPI_H
+#define CANOPNR_HOST_SPI_H
+
+#include "Arduino.h"
+
+#define SPI_HAS_TRANSACTION 1
+
+#define LSBFIRST 0
+#define MSBFIRST 1
+#define SPI_MODE0 0x00
+#define SPI_MODE1 0x04
+#define SPI_MODE2 0x08
+#define SPI_MODE3 0x0C
+#define SPI_CLOCK_DIV2 0x04
+#define SPI_HALF_SPEED 1
+
+class SPISettings
+{
+  public:
+    SPISettings() : clock(4000000) {}
+    SPISettings(unsigned long clk, byte bitOrder, byte dataMode) : clock(clk) { (void)bitOrder; (void)dataMode; }
+    unsigned long clock;
+};
+
+class SPIClass
+{
+  public:
+    void begin() {}
+    void end() {}
+    byte transfer(byte data);
+    void beginTransaction(SPISettings settings);
+    void endTransaction();
+    void usingInterrupt(int irq);
+    void setClockDivider(byte div) { (void)div; }
+    void setDataMode(byte mode) { (void)mode; }
+    void setBitOrder(byte order) { (void)order; }
+};
+
+extern SPIClass SPI;
+
+#endif
@@ -0,0 +1,81 @@
+/*
+   This file is included as part of the CANOPNR distribution.
+   You are free to use this project as you see fit, provided credit is given to all
+   contributors (original and subsequent).
+
+   Copyright 2012  Jose Denrie Enriquez, Alex Bautista, Paloma Field, Sun-il Kim
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+  ------------------------------------------------------------------------------------------------------------
+
+  Host stand-in for the Arduino Print/Stream classes, enough for code that
+  talks to a serial port (SoftwareSerial on the board). println() ends lines
+  with "\r\n" like the Arduino core.
+*/
+
+#ifndef CANOPNR_HOST_STREAM_H
+#define CANOPNR_HOST_STREAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+class Print
+{
+  public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t b) = 0;
+    virtual size_t write(const uint8_t *buf, size_t len)
+    {
+      size_t i;
+
+      for(i = 0; i < len; i++)
+        write(buf[i]);
+      return len;
+    }
+    size_t write(const char *s) { return write((const uint8_t *)s, strlen(s)); }
+
+    size_t print(const char *s) { return write(s); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(long n, int base = 10) { return printNumber(n < 0, n < 0 ? -(unsigned long)n : n, base); }
+    size_t print(unsigned long n, int base = 10) { return printNumber(false, n, base); }
+    size_t print(int n, int base = 10) { return print((long)n, base); }
+    size_t print(unsigned int n, int base = 10) { return print((unsigned long)n, base); }
+    size_t print(unsigned char n, int base = 10) { return print((unsigned long)n, base); }
+
+    size_t println() { return write("\r\n"); }
+    template <typename T> size_t println(T val) { size_t n = print(val); return n + println(); }
+    template <typename T> size_t println(T val, int base) { size_t n = print(val, base); return n + println(); }
+
+  private:
+    size_t printNumber(bool negative, unsigned long n, int base)
+    {
+      char tmp[34];
+
+      snprintf(tmp, sizeof(tmp), base == 16 ? "%s%lX" : "%s%lu", negative ? "-" : "", n);
+      return write(tmp);
+    }
+};
+
+class Stream : public Print
+{
+  public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+    virtual void flush() {}
+};
+
+#endif
@@ -0,0 +1,136 @@
+/*
+   This file is included as part of the CANOPNR distribution.
+   You are free to use this project as you see fit, provided credit is given to all
+   contributors (original and subsequent).
+
+   Copyright 2012  Jose Denrie Enriquez, Alex Bautista, Paloma Field, Sun-il Kim
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+  ------------------------------------------------------------------------------------------------------------
+
+  Benchmark for MCP2515::detectBaud() on a simulated controller, with the
+  sketch's candidate rates (HSCAN_BAUDS in CANOPNR.ino) and dwell time.
+
+      g++ -std=c++11 -O2 -Ihost -I. host/ArduinoHost.cpp host/MCP2515Sim.cpp \
+          CANOPNR_MCP2515.cpp CANOPNR_OBD.cpp host/bench_autobaud.cpp -o bench_autobaud
+      ./bench_autobaud [-f fps] [-d dwell_ms] [-L label]
+
+  The bus runs at each CAN_BAUD_ rate in turn, then at 33.3 kbit/s, which
+  is not a candidate, and then is quiet. It carries fps frames a second
+  (default 100) starting at a random phase. The controller starts the
+  way startHSCAN() brings it up. Reported per bus: the rate found, how
+  long detection took against the count * dwell bound, frames the
+  controller put on the bus (must be 0), and MERRF errors seen while
+  probing. One JSON line per bus rate; the exit status is 1 if a rate
+  was missed or misread, or anything was transmitted.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include "Arduino.h"
+#include "MCP2515Sim.h"
+#include "CANOPNR_MCP2515.h"
+#include "CANOPNR_BitTiming.h"
+
+#define CS_PIN 10
+#define INT_PIN 2
+#define CAN_BAUD_NONE 0 //bus at a rate no candidate matches
+#define UNLISTED_BITRATE 33333UL
+
+//As in CANOPNR.ino
+static const int bauds[] = {CAN_BAUD_500K, CAN_BAUD_250K, CAN_BAUD_125K, CAN_BAUD_1000K, CAN_BAUD_100K, CAN_BAUD_83K3, CAN_BAUD_50K};
+#define BAUD_COUNT (sizeof(bauds) / sizeof(bauds[0]))
+
+static std::string label;
+static unsigned long fps = 100, dwellMillis = 250;
+
+//bitrate 0 is a quiet bus
+static bool run(unsigned long bitrate, int expect, const char *name)
+{
+  MCP2515Sim sim(MCP2515_OSC_HZ);
+  MCP2515 can(CS_PIN);
+  unsigned long transmitted = 0, n, count;
+  uint64_t start, t, gap, elapsed;
+  SimFrame f;
+  int found;
+  bool ok;
+
+  simDetachAll();
+  sim.setBusBitrate(bitrate ? bitrate : 500000UL);
+  sim.onTransmit = [&](const SimFrame &, uint64_t) { transmitted++; };
+  simAttach(&sim, CS_PIN, INT_PIN);
+  if(!can.initCAN(bauds[0]))
+    return false;
+
+  memset(&f, 0, sizeof(f));
+  f.id = 0x123;
+  f.dlc = 8;
+  start = simMicros();
+  if(bitrate != 0)
+  {
+    gap = 1000000ULL / fps;
+    count = (unsigned long)((BAUD_COUNT * dwellMillis + 1000) * fps / 1000);
+    for(n = 0, t = start + rand() % gap; n < count; n++, t += gap)
+      sim.schedule(f, t);
+  }
+  found = can.detectBaud(bauds, BAUD_COUNT, dwellMillis);
+  elapsed = simMicros() - start;
+  transmitted += sim.stats.framesSent;
+  simDetachAll();
+
+  ok = found == expect && transmitted == 0;
+  printf("{\"label\":\"%s\",\"bus\":\"%s\",\"fps\":%lu,\"dwell_ms\":%lu,\"found\":%lu,\"detect_ms\":%.1f,"
+         "\"bound_ms\":%lu,\"errors_seen\":%lu,\"transmitted\":%lu,\"ok\":%s}\n",
+         label.c_str(), name, fps, dwellMillis, canBaudRate(found), elapsed / 1000.0,
+         (unsigned long)(BAUD_COUNT * dwellMillis), sim.stats.framesErrored, transmitted, ok ? "true" : "false");
+  return ok;
+}
+
+int main(int argc, char **argv)
+{
+  bool failed = false;
+  char name[16];
+  int a, c;
+
+  for(a = 1; a + 1 < argc; a += 2)
+  {
+    std::string opt = argv[a];
+    if(opt == "-f")
+      fps = strtoul(argv[a + 1], 0, 10);
+    else if(opt == "-d")
+      dwellMillis = strtoul(argv[a + 1], 0, 10);
+    else if(opt == "-L")
+      label = argv[a + 1];
+    else
+      break;
+  }
+  if(a < argc || fps == 0 || dwellMillis == 0)
+  {
+    fprintf(stderr, "usage: bench_autobaud [-f fps] [-d dwell_ms] [-L label]\n");
+    return 2;
+  }
+
+  srand(1);
+  for(c = 1; c < CAN_BAUD_COUNT; c++)
+  {
+    snprintf(name, sizeof(name), "%lu", canBaudRate(c));
+    //CAN_BAUD_10K is not a candidate: expect nothing rather than a wrong rate
+    failed |= !run(canBaudRate(c), (c == CAN_BAUD_10K) ? CAN_BAUD_NONE : c, name);
+  }
+  failed |= !run(UNLISTED_BITRATE, CAN_BAUD_NONE, "33333");
+  failed |= !run(0, CAN_BAUD_NONE, "quiet");
+  return failed ? 1 : 0;
+}
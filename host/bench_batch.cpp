@@ -0,0 +1,324 @@
+/*
+   This file is included as part of the CANOPNR distribution.
+   You are free to use this project as you see fit, provided credit is given to all
+   contributors (original and subsequent).
+
+   Copyright 2012  Jose Denrie Enriquez, Alex Bautista, Paloma Field, Sun-il Kim
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+  ------------------------------------------------------------------------------------------------------------
+
+  Batch compression benchmark (CANOPNR_Batch.h).
+
+      g++ -std=c++11 -O2 -I. CANOPNR_Telemetry.cpp CANOPNR_GPS.cpp CANOPNR_Batch.cpp \
+          CANOPNR_Slip.cpp host/bench_batch.cpp -o bench_batch
+      ./bench_batch [-r records.bin] [-n records_per_batch] [-b buffer_bytes] [-c cycles] [-L label]
+
+  -r takes a recorded trace: concatenated version 3 records as the server
+  received them (see host/telemetry_dump.cpp). Without it a synthetic drive
+  of -c cycles is generated: warm-up, city stop-and-go and a highway leg,
+  with 0x513 at 50 Hz run through the slip monitor (CANOPNR_Slip.h), a
+  wheel locking under some city stops and a wheel spinning now and then
+  on the highway.
+
+  Every batch is decoded again and compared with the input records.
+  One JSON line reports bytes per record for the old ASCII upload, the
+  single binary record and the batch, the compression ratios, uploads
+  (handshakes) saved and encode/decode time per record on this machine.
+  The old ASCII upload is estimated with ten raw 0x513 samples per record
+  at the reference speed, as the sketch sent them before slip was
+  computed on the node.
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include "CANOPNR_Batch.h"
+
+#define LEGACY_WHEEL_SAMPLES 10   //0x513 samples per record in the ASCII upload
+
+//ms between requests for each OBD PID, as the sketch polls them
+static const uint16_t obdPeriods[TELEMETRY_OBD_COUNT] = {100, 200, 10000, 10000, 1000, 5000, 200, 500};
+
+static std::vector<TELEMETRY> trace;
+
+static uint64_t nowNanos()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static bool loadTrace(const char *path)
+{
+  FILE *f = fopen(path, "rb");
+  std::vector<uint8_t> data;
+  uint8_t chunk[512];
+  size_t n, pos = 0;
+  uint16_t used;
+  TELEMETRY rec;
+
+  if(f == 0)
+    return false;
+  while((n = fread(chunk, 1, sizeof(chunk), f)) > 0)
+    data.insert(data.end(), chunk, chunk + n);
+  fclose(f);
+
+  while(pos < data.size())
+  {
+    n = data.size() - pos;
+    used = telemetryDecode(&data[pos], n > 0xFFFF ? 0xFFFF : n, &rec);
+    if(used == 0)
+    {
+      pos++;
+      continue;
+    }
+    trace.push_back(rec);
+    pos += used;
+  }
+  return !trace.empty();
+}
+
+//Speed profile in km/h for cycle i: 20 idle cycles, city, then highway
+static double profileSpeed(unsigned i)
+{
+  if(i < 20)
+    return 0;
+  if(i < 220)
+    return 25 + 25 * sin((i - 20) / 9.0) + ((i / 40) % 2 ? 0 : 5);
+  return 95 + 8 * sin(i / 23.0);
+}
+
+static void buildSynthetic(unsigned cycles)
+{
+  TELEMETRY r;
+  SLIPMONITOR slip;
+  double speed, lat = 61.2181, lon = -149.9003, factor;
+  uint32_t t = 5000, start, us, base;
+  unsigned i, k, w, frames;
+  uint16_t wheels[4];
+  uint8_t brake;
+
+  srand(12);
+  slipBegin(&slip, SLIP_THRESHOLD, 0);
+  for(i = 0; i < cycles; i++)
+  {
+    memset(&r, 0, sizeof(r));
+    speed = profileSpeed(i);
+    start = t;
+    base = start * 1000;
+    t += 2900 + rand() % 200;   //one loop(): GPS, collection, OBD, CSQ
+    lon += speed / 3600.0 * (t / 1000.0 - (t - 3000) / 1000.0) / 53.6;
+
+    r.controllerId = 17;
+    r.sequence = i;
+    r.timestamp = start;
+    r.gps.valid = true;
+    r.gps.timeMs = 43200000UL + t;
+    r.gps.days = 9786;
+    r.gps.lat = (int32_t)(lat * 1e6);
+    r.gps.lon = (int32_t)(lon * 1e6);
+    r.gps.speed = (uint16_t)(speed / 1.852 * 100);
+    r.gps.course = 9000 + rand() % 50;
+    r.accelerator = (uint8_t)(speed > 0 ? 20 + speed / 3 + rand() % 6 : 0);
+    r.csq = 17 + (i / 50) % 3;
+    r.present = (1UL << TELEMETRY_HAS_GPS) | (1UL << TELEMETRY_HAS_ACCEL) | (1UL << TELEMETRY_HAS_CSQ) |
+                (1UL << TELEMETRY_HAS_UTC);
+    r.utc.seconds = r.gps.days * 86400UL + (43200000UL + start) / 1000;
+    r.utc.micros = (start % 1000) * 1000 + rand() % 1000;
+    r.clockRate = -2990 - rand() % 20;
+
+    //RPM, speed, coolant, fuel, run time, intake, MAF, O2 as raw A,B
+    unsigned rpm4 = (unsigned)((800 + speed * 28 + rand() % 40) * 4);
+    unsigned maf = (unsigned)((2.5 + speed * 0.12) * 100);
+    r.obd[0][0] = rpm4 >> 8;  r.obd[0][1] = rpm4;
+    r.obd[1][0] = (uint8_t)speed;
+    r.obd[2][0] = (uint8_t)(40 + (i < 120 ? i * 60 / 120 : 60 + rand() % 2) + 20);
+    r.obd[3][0] = (uint8_t)(200 - i / 40);
+    r.obd[4][0] = (t / 1000) >> 8;  r.obd[4][1] = t / 1000;
+    r.obd[5][0] = 55 + (i / 100);
+    r.obd[6][0] = maf >> 8;  r.obd[6][1] = maf;
+    r.obd[7][0] = 90 + rand() % 40;  r.obd[7][1] = 128;
+    for(k = 0; k < TELEMETRY_OBD_COUNT; k++)
+    {
+      r.present |= 1UL << TELEMETRY_HAS_OBD(k);
+      r.obdTime[k] = (int16_t)((t - start) - rand() % obdPeriods[k]);   //latest reply, polled at its own rate
+    }
+
+    //0x513 every 20 ms over the cycle, 0.01 km/h per bit with a little
+    //noise per wheel. Some city stops lock a rear wheel for 300 ms, and
+    //every 97th highway cycle spins a front wheel for 200 ms.
+    brake = (speed < 30 && (i % 7) == 0) ? 40 + rand() % 30 : 0;
+    slipSetBrake(&slip, brake);
+    frames = (t - start) / 20;
+    for(k = 0; k < frames; k++)
+    {
+      us = base + k * 20000;
+      for(w = 0; w < 4; w++)
+      {
+        factor = 1.0;
+        if(brake > 0 && speed > 8 && w == 2 && k >= 40 && k < 55)
+          factor = 0.6;
+        else if(i >= 220 && (i % 97) == 0 && w == 0 && k >= 60 && k < 70)
+          factor = 1.15;
+        wheels[w] = (uint16_t)(speed * 100 * factor + (speed > 0 ? rand() % 30 : 0));
+      }
+      slipAddWheels(&slip, wheels, us);
+    }
+    slipTakeSummary(&slip, &r.slip);
+    r.eventCount = slipTakeEvents(&slip, r.events, TELEMETRY_SLIP_EVENTS, base);
+    r.brake = brake;
+    r.present |= 1UL << TELEMETRY_HAS_BRAKE;
+    trace.push_back(r);
+  }
+}
+
+//Length of the pipe-delimited record the sketch used to upload
+static size_t asciiLength(const TELEMETRY *r)
+{
+  char tmp[96];
+  size_t len;
+  unsigned k, j;
+
+  //ID, $GPRMC as received (typical 9600-baud receiver output), accelerator
+  len = snprintf(tmp, sizeof(tmp), "%d", r->controllerId);
+  len += 68 + 1;
+  len += snprintf(tmp, sizeof(tmp), "%u|", r->accelerator);
+  for(k = 0; k < LEGACY_WHEEL_SAMPLES; k++)
+  {
+    for(j = 0; j < 8; j++)
+      len += snprintf(tmp, sizeof(tmp), "%X", (j & 1) ? r->slip.speed & 0xFF : r->slip.speed >> 8) + (j < 7 ? 1 : 0);
+    len += snprintf(tmp, sizeof(tmp), "*%u", r->brake);
+    if(k < LEGACY_WHEEL_SAMPLES - 1)
+      len++;
+  }
+  len += 1;
+  //Decimal PIDs, then "|<csq>,<ber>"
+  len += snprintf(tmp, sizeof(tmp), "%u|%u|%u|%u|%u|%u|%u|%u",
+                  ((r->obd[0][0] << 8) | r->obd[0][1]) / 4, r->obd[1][0], r->obd[2][0] - 40,
+                  r->obd[3][0] * 100 / 255, (r->obd[4][0] << 8) | r->obd[4][1], r->obd[5][0] - 40,
+                  ((r->obd[6][0] << 8) | r->obd[6][1]) / 100, 0);
+  len += snprintf(tmp, sizeof(tmp), "|%u,0", r->csq);
+  return len;
+}
+
+static bool sameRecord(const TELEMETRY *a, const TELEMETRY *b)
+{
+  uint8_t x[TELEMETRY_MAX_SIZE], y[TELEMETRY_MAX_SIZE];
+  uint16_t lx, ly;
+
+  //Compare on the wire format so padding bytes do not matter
+  lx = telemetryEncode(a, x, sizeof(x));
+  ly = telemetryEncode(b, y, sizeof(y));
+  return lx == ly && memcmp(x, y, lx) == 0;
+}
+
+int main(int argc, char **argv)
+{
+  const char *replay = 0;
+  std::string label;
+  unsigned perBatch = 6, bufSize = 384, cycles = 600;
+  std::vector<uint8_t> buf;
+  std::vector<TELEMETRY> decoded(255);
+  TELEMETRYBATCH batch;
+  uint8_t one[TELEMETRY_MAX_SIZE], count;
+  size_t i, start, asciiBytes = 0, recordBytes = 0, batchBytes = 0, batches = 0, events = 0;
+  uint64_t encodeNs = 0, decodeNs = 0, t0;
+  bool ok = true;
+  int a;
+
+  for(a = 1; a + 1 < argc; a += 2)
+  {
+    if(strcmp(argv[a], "-r") == 0)
+      replay = argv[a + 1];
+    else if(strcmp(argv[a], "-n") == 0)
+      perBatch = strtoul(argv[a + 1], 0, 10);
+    else if(strcmp(argv[a], "-b") == 0)
+      bufSize = strtoul(argv[a + 1], 0, 10);
+    else if(strcmp(argv[a], "-c") == 0)
+      cycles = strtoul(argv[a + 1], 0, 10);
+    else if(strcmp(argv[a], "-L") == 0)
+      label = argv[a + 1];
+  }
+  if(a != argc || perBatch < 1 || perBatch > 255 || bufSize < TELEMETRY_BATCH_RECORD_MAX)
+  {
+    fprintf(stderr, "usage: bench_batch [-r records.bin] [-n 1-255] [-b >=%d] [-c cycles] [-L label]\n",
+            TELEMETRY_BATCH_RECORD_MAX);
+    return 2;
+  }
+  if(replay != 0)
+  {
+    if(!loadTrace(replay))
+    {
+      fprintf(stderr, "no records in %s\n", replay);
+      return 1;
+    }
+  }
+  else
+    buildSynthetic(cycles);
+
+  buf.resize(bufSize);
+  for(i = 0; i < trace.size(); i++)
+  {
+    asciiBytes += asciiLength(&trace[i]);
+    recordBytes += telemetryEncode(&trace[i], one, sizeof(one));
+    events += trace[i].eventCount;
+  }
+
+  //Fill a batch until it holds perBatch records or the next one does not
+  //fit, as the sketch does, then decode and check it
+  i = 0;
+  while(i < trace.size())
+  {
+    start = i;
+    telemetryBatchBegin(&batch, &buf[0], bufSize);
+    t0 = nowNanos();
+    while(i < trace.size() && batch.count < perBatch && telemetryBatchAdd(&batch, &trace[i]))
+      i++;
+    encodeNs += nowNanos() - t0;
+    batchBytes += batch.len;
+    batches++;
+
+    t0 = nowNanos();
+    if(telemetryBatchDecode(&buf[0], batch.len, &decoded[0], decoded.size(), &count) != batch.len)
+      ok = false;
+    decodeNs += nowNanos() - t0;
+    if(!ok || count != i - start)
+    {
+      ok = false;
+      break;
+    }
+    for(size_t k = 0; k < count; k++)
+      if(!sameRecord(&decoded[k], &trace[start + k]))
+        ok = false;
+  }
+
+  printf("{\"label\":\"%s\",\"trace\":\"%s\",\"records\":%lu,\"per_batch\":%u,\"buffer\":%u,"
+         "\"batches\":%lu,\"roundtrip\":%s,\"slip_events\":%lu,"
+         "\"ascii_bytes_per_record\":%.1f,\"binary_bytes_per_record\":%.1f,\"batch_bytes_per_record\":%.1f,"
+         "\"ratio_vs_binary\":%.2f,\"ratio_vs_ascii\":%.2f,\"uploads_saved\":%lu,"
+         "\"encode_ns_per_record\":%.0f,\"decode_ns_per_record\":%.0f}\n",
+         label.c_str(), replay ? replay : "synthetic", (unsigned long)trace.size(), perBatch, bufSize,
+         (unsigned long)batches, ok ? "true" : "false", (unsigned long)events,
+         (double)asciiBytes / trace.size(), (double)recordBytes / trace.size(), (double)batchBytes / trace.size(),
+         (double)recordBytes / batchBytes, (double)asciiBytes / batchBytes,
+         (unsigned long)(trace.size() - batches),
+         (double)encodeNs / trace.size(), (double)decodeNs / trace.size());
+  return ok ? 0 : 1;
+}
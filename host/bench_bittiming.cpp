@@ -0,0 +1,175 @@
+/*
+   This file is included as part of the CANOPNR distribution.
+   You are free to use this project as you see fit, provided credit is given to all
+   contributors (original and subsequent).
+
+   Copyright 2012  Jose Denrie Enriquez, Alex Bautista, Paloma Field, Sun-il Kim
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+  ------------------------------------------------------------------------------------------------------------
+
+  Checks the bit timing solver (CANOPNR_BitTiming.h) for every CAN_BAUD_
+  rate and a range of MCP2515 crystals.
+
+      g++ -std=c++11 -O2 -Ihost -I. host/ArduinoHost.cpp host/MCP2515Sim.cpp \
+          CANOPNR_MCP2515.cpp CANOPNR_OBD.cpp host/bench_bittiming.cpp -o bench_bittiming
+      ./bench_bittiming [-L label]
+
+  For each crystal and rate the CNF1-3 values are decoded again and held
+  to the controller's limits: BRP 1-64, PropSeg and PS1 1-8, PS2 2-8,
+  PropSeg + PS1 >= PS2, SJW 1-4 and below PS2. The bitrate error is
+  compared with the best any BRP and quanta count can do, found by trying
+  them all, so a rate the solver refuses or misses is caught. For the
+  crystal the driver is built for (MCP2515_OSC_HZ), initCAN() programs a
+  simulated controller, which must read back the same registers and
+  receive a frame sent at the rate without raising MERRF.
+
+  One JSON line per crystal and rate; the exit status is 1 if any check
+  failed. Rebuild with -DMCP2515_OSC_HZ=8000000UL for the 8 MHz boards.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include "Arduino.h"
+#include "MCP2515Sim.h"
+#include "CANOPNR_MCP2515.h"
+#include "CANOPNR_BitTiming.h"
+#include "MCP2515_defs.h"
+
+#define CS_PIN 10
+#define INT_PIN 2
+
+static const unsigned long oscillators[] = {8000000UL, 10000000UL, 16000000UL, 20000000UL};
+
+static std::string label;
+
+//Smallest bitrate error any BRP and quanta count give, in ppm
+static unsigned long bestPpm(unsigned long osc, unsigned long rate)
+{
+  unsigned long best = 0xFFFFFFFFUL, brp, ppm;
+  byte n;
+
+  for(n = 5; n <= 25; n++)
+  {
+    for(brp = 1; brp <= 64; brp++)
+    {
+      ppm = canRatePpm(osc, rate, brp, n);
+      if(ppm < best)
+        best = ppm;
+    }
+  }
+  return best;
+}
+
+//The frame lands in a receive buffer of a controller set up by initCAN()
+static bool simulate(int baudConst, unsigned long timing, bool *regsMatch)
+{
+  MCP2515Sim sim(MCP2515_OSC_HZ);
+  MCP2515 can(CS_PIN);
+  SimFrame f;
+  CANMSG m;
+  bool got;
+
+  simDetachAll();
+  sim.setBusBitrate(canBaudRate(baudConst));
+  simAttach(&sim, CS_PIN, INT_PIN);
+  *regsMatch = false;
+  if(!can.initCAN(baudConst))
+    return false;
+  *regsMatch = sim.reg(CNF1) == ((timing >> 16) & 0xFF) && sim.reg(CNF2) == ((timing >> 8) & 0xFF) &&
+               sim.reg(CNF3) == (timing & 0xFF);
+  if(!can.setCANReceiveonlyMode())
+    return false;
+
+  memset(&f, 0, sizeof(f));
+  f.id = 0x123;
+  f.dlc = 8;
+  sim.schedule(f, simMicros() + 5000);
+  delayMicroseconds(20000);
+  got = can.SNIFF_ALL(&m);
+  simDetachAll();
+  return got && m.adrsValue == 0x123 && sim.stats.framesErrored == 0;
+}
+
+int main(int argc, char **argv)
+{
+  unsigned long osc, rate, timing, brp, prop, ps1, ps2, sjw, n, ppm, best, actual, sp;
+  bool supported, limits, ok, sim, simRegs, failed = false;
+  unsigned int i;
+  int a, c;
+
+  for(a = 1; a + 1 < argc && strcmp(argv[a], "-L") == 0; a += 2)
+    label = argv[a + 1];
+  if(a < argc)
+  {
+    fprintf(stderr, "usage: bench_bittiming [-L label]\n");
+    return 2;
+  }
+
+  for(i = 0; i < sizeof(oscillators) / sizeof(oscillators[0]); i++)
+  {
+    osc = oscillators[i];
+    for(c = 1; c < CAN_BAUD_COUNT; c++)
+    {
+      rate = canBaudRate(c);
+      timing = canBitTiming(osc, rate);
+      best = bestPpm(osc, rate);
+      supported = timing != 0;
+
+      brp = ((timing >> 16) & 0x3F) + 1;
+      sjw = ((timing >> 22) & 0x03) + 1;
+      prop = ((timing >> 8) & 0x07) + 1;
+      ps1 = ((timing >> 11) & 0x07) + 1;
+      ps2 = (timing & 0x07) + 1;
+      n = 1 + prop + ps1 + ps2;
+      actual = osc / (2 * brp * n);
+      ppm = canRatePpm(osc, rate, brp, n);
+      sp = 1000 * (1 + prop + ps1) / n;
+
+      if(supported)
+      {
+        limits = (timing & 0x8000) != 0 && ps2 >= 2 && prop + ps1 >= ps2 && sjw < ps2 && n >= 5 && n <= 25;
+        ok = limits && ppm <= CAN_TIMING_TOLERANCE_PPM && ppm == best;
+      }
+      else
+      {
+        limits = true;
+        ok = best > CAN_TIMING_TOLERANCE_PPM;
+      }
+      sim = simRegs = true;
+      if(osc == MCP2515_OSC_HZ)
+      {
+        sim = simulate(c, timing, &simRegs);
+        if(!supported)
+          sim = !sim; //initCAN() must refuse it
+        ok = ok && sim && (simRegs || !supported);
+      }
+      failed = failed || !ok;
+
+      printf("{\"label\":\"%s\",\"osc_hz\":%lu,\"bitrate\":%lu,\"supported\":%s,", label.c_str(), osc, rate,
+             supported ? "true" : "false");
+      if(supported)
+        printf("\"cnf\":[\"0x%02lX\",\"0x%02lX\",\"0x%02lX\"],\"brp\":%lu,\"quanta\":%lu,\"prop\":%lu,\"ps1\":%lu,"
+               "\"ps2\":%lu,\"sjw\":%lu,\"actual\":%lu,\"error_ppm\":%lu,\"sample_point\":%.1f,",
+               (timing >> 16) & 0xFF, (timing >> 8) & 0xFF, timing & 0xFF, brp, n, prop, ps1, ps2, sjw, actual, ppm,
+               sp / 10.0);
+      printf("\"best_ppm\":%lu,", best);
+      if(osc == MCP2515_OSC_HZ)
+        printf("\"sim\":%s,", sim ? "true" : "false");
+      printf("\"ok\":%s}\n", ok ? "true" : "false");
+    }
+  }
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,267 @@
+/*
+   This file is included as part of the CANOPNR distribution.
+   You are free to use this project as you see fit, provided credit is given to all
+   contributors (original and subsequent).
+
+   Copyright 2012  Jose Denrie Enriquez, Alex Bautista, Paloma Field, Sun-il Kim
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+  ------------------------------------------------------------------------------------------------------------
+
+  Sustained-rate benchmark for the raw frame capture (CANOPNR_Capture) on
+  the simulated MCP2515 and a file-backed SD card (host/SD.h).
+
+      g++ -std=c++11 -O2 -Ihost -I. host/ArduinoHost.cpp host/MCP2515Sim.cpp \
+          CANOPNR_MCP2515.cpp CANOPNR_OBD.cpp CANOPNR_Capture.cpp host/bench_capture.cpp -o bench_capture
+      ./bench_capture [-r fps] [-t ms] [-m stream|block] [-f image] [-L label]
+
+  Eight-byte standard frames arrive at a steady rate (at most back to back
+  at 500 kbit/s) while loop() does what capture mode in the sketch does:
+  take a frame from the receive ring into the log, and write a waiting
+  sector only when the ring is empty. Without -r a range of rates is run;
+  -m block charges every sector a single-block write instead of a block of
+  a multi-block write. One JSON object is printed per run.
+
+  The image is decoded afterwards and every frame matched to the time it
+  completed on the bus by the sequence number in its last two bytes, so a
+  lost frame is counted where it was lost: in the controller (both RX
+  buffers full while an SD transfer held the interrupt off), in the
+  receive ring, or in the log (no sector buffer free). stamp_error_us is
+  how late the recorded time (read from the controller in the RX
+  interrupt) is.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "Arduino.h"
+#include "MCP2515Sim.h"
+#include "SD.h"
+#include "CANOPNR_MCP2515.h"
+#include "CANOPNR_Capture.h"
+
+#define CS_PIN 10
+#define INT_PIN 2
+#define BUS_BITRATE 500000UL
+#define CAPTURE_ID 0x123
+#define LOOP_MICROS 20      //loop() overhead besides the ring and the log
+#define IMAGE_BLOCKS 4096
+
+struct RunResult
+{
+  unsigned long offered, captured, rxOverflow, ringDropped, logDropped;
+  unsigned long sectors, bytes;
+  uint64_t stampErrorSum, stampErrorMax;
+};
+
+static std::string label, image = "capture.img";
+static unsigned long durationMillis = 2000;
+static bool streaming = true;
+
+static uint32_t le32(const uint8_t *p)
+{
+  return p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+//Offers frames at 'fps' and returns the end of the last one; arrivals[n]
+//is when frame n completed on the bus
+static uint64_t scheduleTraffic(MCP2515Sim &sim, unsigned long fps, std::vector<uint64_t> &arrivals)
+{
+  uint64_t start = simMicros() + 1000, t, gap, frameTime;
+  unsigned long n, count = (unsigned long)((uint64_t)fps * durationMillis / 1000);
+  SimFrame f;
+
+  memset(&f, 0, sizeof(f));
+  f.id = CAPTURE_ID;
+  f.dlc = 8;
+  frameTime = ((uint64_t)MCP2515Sim::frameBits(f) * 1000000ULL + BUS_BITRATE - 1) / BUS_BITRATE;
+  gap = 1000000ULL / fps;
+  if(gap < frameTime)
+    gap = frameTime;
+  arrivals.clear();
+  for(n = 0, t = start; n < count; n++, t += gap)
+  {
+    f.data[0] = n >> 24;
+    f.data[1] = n >> 16;
+    f.data[6] = n >> 8;
+    f.data[7] = n;
+    sim.schedule(f, t + frameTime);
+    arrivals.push_back(t + frameTime);
+  }
+  return t;
+}
+
+//Walks the sectors of the session just written, as capture_dump does
+static void decode(Sd2Card &card, const std::vector<uint64_t> &arrivals, RunResult &r)
+{
+  uint8_t sector[CAPTURE_SECTOR_SIZE];
+  uint32_t session = 0, block, base, delta, stamp;
+  unsigned long seq;
+  uint64_t err;
+  uint16_t pos;
+  CANMSG m;
+
+  for(block = 0; block < IMAGE_BLOCKS && card.readBlock(block, sector); block++)
+  {
+    if((sector[0] | (sector[1] << 8)) != CAPTURE_MAGIC)
+      break;
+    if(block == 0)
+      session = le32(sector + 4);
+    if(le32(sector + 4) != session || le32(sector + 8) != block)
+      break;
+    r.sectors++;
+    r.bytes += (sector[2] | (sector[3] << 8)) - CAPTURE_HEADER_SIZE;
+    base = le32(sector + 12);
+    stamp = base;
+    pos = 0;
+    while(captureReadFrame(sector, &pos, &m, &delta))
+    {
+      stamp += delta;
+      seq = ((unsigned long)m.data[0] << 24) | ((unsigned long)m.data[1] << 16) |
+            ((unsigned long)m.data[6] << 8) | m.data[7];
+      if(seq >= arrivals.size())
+        continue;
+      //micros() is the low 32 bits of the virtual clock
+      err = (uint32_t)(stamp - (uint32_t)arrivals[seq]);
+      r.stampErrorSum += err;
+      if(err > r.stampErrorMax)
+        r.stampErrorMax = err;
+      r.captured++;
+    }
+  }
+}
+
+static bool run(unsigned long fps, RunResult &r)
+{
+  static MCP2515Sim *sim = 0;
+  std::vector<uint64_t> arrivals;
+  MCP2515 can;
+  Sd2Card card;
+  CaptureLog log;
+  unsigned long ringDrops;
+  uint64_t end;
+  CANMSG m;
+
+  memset(&r, 0, sizeof(r));
+  simDetachAll();
+  delete sim;
+  sim = new MCP2515Sim();
+  sim->setBusBitrate(BUS_BITRATE);
+  simAttach(sim, CS_PIN, INT_PIN);
+
+  remove(image.c_str());
+  if(!card.open(image.c_str(), IMAGE_BLOCKS))
+    return false;
+  card.setStreaming(streaming);
+  if(!can.initCAN(CAN_BAUD_500K) || !can.setCANNormalMode() || !can.enableRxInterrupt(INT_PIN))
+    return false;
+  if(!log.begin(&card, 0, IMAGE_BLOCKS))
+    return false;
+  ringDrops = can.getRxDropCount();
+  memset(&sim->stats, 0, sizeof(sim->stats));
+
+  end = scheduleTraffic(*sim, fps, arrivals) + 20000;
+  while(simMicros() < end)
+  {
+    if(can.SNIFF_ALL(&m))
+      log.add(&m, m.timestamp);
+    else if(log.pending())
+      log.service();
+    delayMicroseconds(LOOP_MICROS);
+  }
+  while(can.SNIFF_ALL(&m))
+    log.add(&m, m.timestamp);
+  log.end();
+  can.disableRxInterrupt(INT_PIN);
+
+  r.offered = arrivals.size();
+  r.rxOverflow = sim->stats.framesOverflowed;
+  r.ringDropped = can.getRxDropCount() - ringDrops;
+  r.logDropped = log.getDropCount();
+  decode(card, arrivals, r);
+  card.close();
+  return true;
+}
+
+static void printResult(unsigned long fps, const RunResult &r)
+{
+  unsigned long lost = r.offered - r.captured;
+
+  printf("{\"label\":\"%s\",\"mode\":\"%s\",\"fps\":%lu,\"duration_ms\":%lu,"
+         "\"offered\":%lu,\"captured\":%lu,\"lost\":%lu,"
+         "\"lost_rxovr\":%lu,\"lost_ring\":%lu,\"lost_log\":%lu,"
+         "\"sectors\":%lu,\"bytes_per_frame\":%.2f,"
+         "\"stamp_error_us\":{\"avg\":%.1f,\"max\":%lu},\"sustained\":%s}\n",
+         label.c_str(), streaming ? "stream" : "block", fps, durationMillis,
+         r.offered, r.captured, lost,
+         r.rxOverflow, r.ringDropped, r.logDropped,
+         r.sectors, r.captured ? (double)r.bytes / r.captured : 0.0,
+         r.captured ? (double)r.stampErrorSum / r.captured : 0.0,
+         (unsigned long)r.stampErrorMax, lost == 0 ? "true" : "false");
+}
+
+static void usage()
+{
+  fprintf(stderr, "usage: bench_capture [-r fps] [-t ms] [-m stream|block] [-f image] [-L label]\n");
+}
+
+int main(int argc, char **argv)
+{
+  static const unsigned long defaultRates[] = {500, 1000, 2000, 3000, 3600};
+  std::vector<unsigned long> rates;
+  RunResult r;
+  size_t i;
+  int a;
+
+  for(a = 1; a < argc; a++)
+  {
+    std::string opt = argv[a];
+    if(a + 1 >= argc)
+    {
+      usage();
+      return 2;
+    }
+    const char *val = argv[++a];
+    if(opt == "-r")
+      rates.push_back(strtoul(val, 0, 10));
+    else if(opt == "-t")
+      durationMillis = strtoul(val, 0, 10);
+    else if(opt == "-m" && (strcmp(val, "stream") == 0 || strcmp(val, "block") == 0))
+      streaming = strcmp(val, "stream") == 0;
+    else if(opt == "-f")
+      image = val;
+    else if(opt == "-L")
+      label = val;
+    else
+    {
+      usage();
+      return 2;
+    }
+  }
+  if(rates.empty())
+    rates.assign(defaultRates, defaultRates + sizeof(defaultRates) / sizeof(defaultRates[0]));
+
+  for(i = 0; i < rates.size(); i++)
+  {
+    if(rates[i] == 0 || !run(rates[i], r))
+    {
+      fprintf(stderr, "%lu fps: setup failed\n", rates[i]);
+      return 1;
+    }
+    printResult(rates[i], r);
+  }
+  return 0;
+}
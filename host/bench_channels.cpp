@@ -0,0 +1,245 @@
+/*
+   This file is included as part of the CANOPNR distribution.
+   You are free to use this project as you see fit, provided credit is given to all
+   contributors (original and subsequent).
+
+   Copyright 2012  Jose Denrie Enriquez, Alex Bautista, Paloma Field, Sun-il Kim
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+  ------------------------------------------------------------------------------------------------------------
+
+  Two-bus benchmark for CANChannels (CANOPNR_MCP2515.h) on two simulated
+  MCP2515s sharing the SPI bus: HS-CAN at 500 kbit/s on CS 10 / INT 2 and
+  MS-CAN at 125 kbit/s on CS 6 / INT 3, as the sketch wires them.
+
+      g++ -std=c++11 -O2 -Ihost -I. host/ArduinoHost.cpp host/MCP2515Sim.cpp \
+          CANOPNR_MCP2515.cpp CANOPNR_OBD.cpp host/bench_channels.cpp -o bench_channels
+      ./bench_channels [-h hs_fps] [-m ms_fps] [-w work_us] [-t ms] [-L label]
+
+  Each bus carries eight-byte frames at a steady rate (defaults 2000 and
+  400 a second) and loop() spends work_us (default 150) on every frame it
+  takes. Two ways of reading are compared:
+
+    drain      empty HS-CAN, then empty MS-CAN, as a sketch written for
+               one bus and extended by a second loop would do
+    channels   CANChannels::receive(), oldest frame on either bus first
+
+  Frames carry a sequence number, so each one is matched to the time it
+  completed on the bus. Per bus: frames offered and delivered, lost in
+  the controller or in the receive ring, and how long delivered frames
+  waited. out_of_order counts frames handed over with an earlier stamp
+  than the one before, which a capture log would have to reorder. One
+  JSON line per mode.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "Arduino.h"
+#include "MCP2515Sim.h"
+#include "CANOPNR_MCP2515.h"
+
+#define HS_CS_PIN 10
+#define HS_INT_PIN 2
+#define MS_CS_PIN 6
+#define MS_INT_PIN 3
+#define HS_BITRATE 500000UL
+#define MS_BITRATE 125000UL
+#define HS_ID 0x123
+#define MS_ID 0x2A0
+
+enum { MODE_DRAIN, MODE_CHANNELS };
+
+struct BusResult
+{
+  unsigned long offered, delivered, rxOverflow, ringDropped;
+  uint64_t waitSum, waitMax;
+};
+
+static std::string label;
+static unsigned long hsFps = 2000, msFps = 400, workMicros = 150, durationMillis = 2000;
+
+static void scheduleTraffic(MCP2515Sim &sim, uint32_t id, unsigned long bitrate, unsigned long fps,
+                            uint64_t start, std::vector<uint64_t> &arrivals)
+{
+  uint64_t t, gap, frameTime;
+  unsigned long n, count = (unsigned long)((uint64_t)fps * durationMillis / 1000);
+  SimFrame f;
+
+  memset(&f, 0, sizeof(f));
+  f.id = id;
+  f.dlc = 8;
+  frameTime = ((uint64_t)MCP2515Sim::frameBits(f) * 1000000ULL + bitrate - 1) / bitrate;
+  gap = 1000000ULL / fps;
+  if(gap < frameTime)
+    gap = frameTime;
+  arrivals.clear();
+  for(n = 0, t = start; n < count; n++, t += gap)
+  {
+    f.data[6] = n >> 8;
+    f.data[7] = n;
+    sim.schedule(f, t + frameTime);
+    arrivals.push_back(t + frameTime);
+  }
+}
+
+static void account(BusResult &r, const std::vector<uint64_t> &arrivals, const CANMSG &m)
+{
+  unsigned long seq = ((unsigned long)m.data[6] << 8) | m.data[7];
+  uint64_t wait;
+
+  if(seq >= arrivals.size())
+    return;
+  wait = simMicros() - arrivals[seq];
+  r.waitSum += wait;
+  if(wait > r.waitMax)
+    r.waitMax = wait;
+  r.delivered++;
+}
+
+static bool run(int mode, BusResult *r, unsigned long *outOfOrder)
+{
+  static MCP2515Sim *hsSim = 0, *msSim = 0;
+  std::vector<uint64_t> arrivals[2];
+  MCP2515 hs(HS_CS_PIN), ms(MS_CS_PIN);
+  CANChannels buses;
+  unsigned long drops[2];
+  uint32_t last = 0;
+  bool first = true, got;
+  uint64_t end;
+  byte bus;
+  CANMSG m;
+
+  memset(r, 0, 2 * sizeof(BusResult));
+  *outOfOrder = 0;
+  simDetachAll();
+  delete hsSim;
+  delete msSim;
+  hsSim = new MCP2515Sim();
+  msSim = new MCP2515Sim();
+  hsSim->setBusBitrate(HS_BITRATE);
+  msSim->setBusBitrate(MS_BITRATE);
+  simAttach(hsSim, HS_CS_PIN, HS_INT_PIN);
+  simAttach(msSim, MS_CS_PIN, MS_INT_PIN);
+
+  if(!hs.initCAN(CAN_BAUD_500K) || !hs.setCANNormalMode() || !hs.enableRxInterrupt(HS_INT_PIN))
+    return false;
+  if(!ms.initCAN(CAN_BAUD_125K) || !ms.setCANReceiveonlyMode() || !ms.enableRxInterrupt(MS_INT_PIN))
+    return false;
+  buses.add(&hs);
+  buses.add(&ms);
+  drops[0] = hs.getRxDropCount();
+  drops[1] = ms.getRxDropCount();
+  memset(&hsSim->stats, 0, sizeof(hsSim->stats));
+  memset(&msSim->stats, 0, sizeof(msSim->stats));
+
+  scheduleTraffic(*hsSim, HS_ID, HS_BITRATE, hsFps, simMicros() + 1000, arrivals[0]);
+  scheduleTraffic(*msSim, MS_ID, MS_BITRATE, msFps, simMicros() + 1300, arrivals[1]);
+  end = simMicros() + 1000 + durationMillis * 1000ULL + 50000;
+  while(simMicros() < end)
+  {
+    if(mode == MODE_CHANNELS)
+      got = buses.receive(&m, &bus);
+    else
+    {
+      //Whatever HS-CAN has first; MS-CAN only once it is empty
+      bus = 0;
+      got = hs.SNIFF_ALL(&m);
+      if(!got)
+      {
+        bus = 1;
+        got = ms.SNIFF_ALL(&m);
+      }
+    }
+    if(!got)
+    {
+      delayMicroseconds(20);
+      continue;
+    }
+    if(!first && (long)(m.timestamp - last) < 0)
+      (*outOfOrder)++;
+    else
+      last = m.timestamp;
+    first = false;
+    account(r[bus], arrivals[bus], m);
+    delayMicroseconds(workMicros);
+  }
+  hs.disableRxInterrupt(HS_INT_PIN);
+  ms.disableRxInterrupt(MS_INT_PIN);
+
+  r[0].offered = arrivals[0].size();
+  r[1].offered = arrivals[1].size();
+  r[0].rxOverflow = hsSim->stats.framesOverflowed;
+  r[1].rxOverflow = msSim->stats.framesOverflowed;
+  r[0].ringDropped = hs.getRxDropCount() - drops[0];
+  r[1].ringDropped = ms.getRxDropCount() - drops[1];
+  return true;
+}
+
+static void printBus(const char *name, const BusResult &r, bool comma)
+{
+  printf("\"%s\":{\"offered\":%lu,\"delivered\":%lu,\"lost_rxovr\":%lu,\"lost_ring\":%lu,"
+         "\"wait_us\":{\"avg\":%.0f,\"max\":%lu}}%s",
+         name, r.offered, r.delivered, r.rxOverflow, r.ringDropped,
+         r.delivered ? (double)r.waitSum / r.delivered : 0.0, (unsigned long)r.waitMax, comma ? "," : "");
+}
+
+int main(int argc, char **argv)
+{
+  BusResult r[2];
+  unsigned long outOfOrder;
+  int a, mode;
+
+  for(a = 1; a < argc; a++)
+  {
+    std::string opt = argv[a];
+    if(a + 1 >= argc)
+      break;
+    const char *val = argv[++a];
+    if(opt == "-h")
+      hsFps = strtoul(val, 0, 10);
+    else if(opt == "-m")
+      msFps = strtoul(val, 0, 10);
+    else if(opt == "-w")
+      workMicros = strtoul(val, 0, 10);
+    else if(opt == "-t")
+      durationMillis = strtoul(val, 0, 10);
+    else if(opt == "-L")
+      label = val;
+    else
+      break;
+  }
+  if(a < argc || hsFps == 0 || msFps == 0)
+  {
+    fprintf(stderr, "usage: bench_channels [-h hs_fps] [-m ms_fps] [-w work_us] [-t ms] [-L label]\n");
+    return 2;
+  }
+
+  for(mode = MODE_DRAIN; mode <= MODE_CHANNELS; mode++)
+  {
+    if(!run(mode, r, &outOfOrder))
+    {
+      fprintf(stderr, "controller setup failed\n");
+      return 1;
+    }
+    printf("{\"label\":\"%s\",\"mode\":\"%s\",\"hs_fps\":%lu,\"ms_fps\":%lu,\"work_us\":%lu,\"duration_ms\":%lu,",
+           label.c_str(), mode == MODE_CHANNELS ? "channels" : "drain", hsFps, msFps, workMicros, durationMillis);
+    printBus("hs", r[0], true);
+    printBus("ms", r[1], true);
+    printf("\"out_of_order\":%lu}\n", outOfOrder);
+  }
+  return 0;
+}
@@ -0,0 +1,518 @@
+/*
+   This file is included as part of the CANOPNR distribution.
+   You are free to use this project as you see fit, provided credit is given to all
+   contributors (original and subsequent).
+
+   Copyright 2012  Jose Denrie Enriquez, Alex Bautista, Paloma Field, Sun-il Kim
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+  ------------------------------------------------------------------------------------------------------------
+
+  Frame-loss benchmark: replays a traffic profile into the simulated MCP2515
+  and measures what the receive API hands to the application.
+
+      g++ -std=c++11 -O2 -Ihost -I. host/ArduinoHost.cpp host/MCP2515Sim.cpp \
+          CANOPNR_MCP2515.cpp CANOPNR_OBD.cpp host/bench_frameloss.cpp -o bench_frameloss
+      ./bench_frameloss [-m sniff|receive|getmsg|interrupt] [-w work_us]
+                        [-p vehicle|heavy] [-r candump.log] [-t ms] [-n] [-L label]
+
+  Without -m/-w every mode is run at several amounts of per-iteration
+  application work. -n leaves the acceptance filters open (the old
+  behaviour), -r replays a candump log (\"(sec.usec) can0 513#0102...\")
+  instead of the synthetic profile. One JSON object is printed per run so
+  the output of two versions can be diffed or loaded side by side.
+
+  Frames are serialized on the bus with ID arbitration, and the last two
+  data bytes carry a sequence number so each delivered frame is matched to
+  its arrival time. Latency runs from end of frame to the API returning it.
+  SPI bytes/transactions per frame include every empty poll, so they show
+  what a receive strategy costs the bus, not just what a frame read costs.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+#include "Arduino.h"
+#include "MCP2515Sim.h"
+#include "CANOPNR_MCP2515.h"
+
+#define CS_PIN 10
+#define INT_PIN 2
+#define BUS_BITRATE 500000UL
+#define DRAIN_MICROS 20000
+#define LOOP_MICROS 1       //loop() overhead; a ring pop alone takes no SPI time
+
+enum { MODE_SNIFF, MODE_RECEIVE, MODE_GETMSG, MODE_INTERRUPT, MODE_COUNT };
+static const char *modeNames[MODE_COUNT] = {"sniff", "receive", "getmsg", "interrupt"};
+
+//Periodic sender in a synthetic profile
+struct Source
+{
+  uint32_t id;
+  unsigned long periodMicros;
+  unsigned long offsetMicros;
+  uint8_t dlc;
+};
+
+//A frame ready to send at 'ready'; the bus decides when it actually goes
+struct BusFrame
+{
+  uint64_t ready;
+  SimFrame frame;
+};
+
+//A frame that completed on the bus, waiting to be matched to a delivery
+struct Arrival
+{
+  uint64_t at;
+  SimFrame frame;
+};
+
+struct RunConfig
+{
+  int mode;
+  unsigned long workMicros;
+  bool filters;
+};
+
+struct RunResult
+{
+  unsigned long onBus, filtered, accepted, delivered, unmatched;
+  unsigned long rxOverflow, rxOverflowSeen, ringDropped, discarded;
+  unsigned long spiBytes, spiTransactions;
+  uint64_t latencySum, latencyMax;
+};
+
+//Signals the sketch collects: accelerator, brake pressure, wheel speed
+static const uint32_t wantedIds[] = {ACCELERATOR, BRAKE_PRESSURE, ABSCAN};
+static const unsigned long filterIds[] = {ABSCAN, BRAKE_PRESSURE, ACCELERATOR, PID_REPLY};
+#define WANTED_COUNT (sizeof(wantedIds) / sizeof(wantedIds[0]))
+
+static std::string profileName = "vehicle";
+static std::string label;
+static unsigned long durationMillis = 1000;
+static std::vector<BusFrame> traffic;     //relative to the start of a run
+static std::map<uint32_t, std::deque<Arrival> > inFlight;
+
+static void addSources(const Source *src, size_t n, unsigned long durationMicros)
+{
+  size_t i;
+  unsigned long t;
+  BusFrame b;
+
+  for(i = 0; i < n; i++)
+  {
+    for(t = src[i].offsetMicros; t < durationMicros; t += src[i].periodMicros)
+    {
+      memset(&b, 0, sizeof(b));
+      b.ready = t;
+      b.frame.id = src[i].id;
+      b.frame.dlc = src[i].dlc;
+      traffic.push_back(b);
+    }
+  }
+}
+
+//0x410/0x511/0x513 at their vehicle rates over a gateway-style background
+//of 24 IDs, plus a back-to-back burst of eight frames every 100 ms
+static void buildSynthetic(bool heavy)
+{
+  const Source wanted[] = {
+    {ABSCAN, 5000, 0, 8},
+    {BRAKE_PRESSURE, 10000, 1300, 8},
+    {ACCELERATOR, 10000, 2700, 8},
+  };
+  std::vector<Source> bg;
+  unsigned long d = durationMillis * 1000UL;
+  unsigned long t, k;
+  BusFrame b;
+  Source s;
+
+  traffic.clear();
+  addSources(wanted, sizeof(wanted) / sizeof(wanted[0]), d);
+
+  for(k = 0; k < 24; k++)
+  {
+    s.id = 0x0A0 + k * 0x40;
+    if(s.id == ABSCAN || s.id == BRAKE_PRESSURE || s.id == ACCELERATOR)
+      s.id++;
+    s.periodMicros = (heavy ? 10000 : 20000) + (k % 4) * 5000;
+    s.offsetMicros = (k * 733) % s.periodMicros;
+    s.dlc = 4 + (k % 5);
+    bg.push_back(s);
+  }
+  addSources(&bg[0], bg.size(), d);
+
+  for(t = 50000; t < d; t += 100000)
+  {
+    for(k = 0; k < (heavy ? 16UL : 8UL); k++)
+    {
+      memset(&b, 0, sizeof(b));
+      b.ready = t;
+      b.frame.id = 0x600 + k;
+      b.frame.dlc = 8;
+      traffic.push_back(b);
+    }
+  }
+}
+
+static bool loadCandump(const char *path)
+{
+  FILE *f = fopen(path, "r");
+  char line[128], iface[32], body[64];
+  unsigned long sec, usec;
+  uint64_t first = 0, ts;
+  bool haveFirst = false;
+  BusFrame b;
+  char *hash;
+  size_t len, i;
+
+  if(f == 0)
+    return false;
+  traffic.clear();
+  while(fgets(line, sizeof(line), f) != 0)
+  {
+    if(sscanf(line, " (%lu.%lu) %31s %63s", &sec, &usec, iface, body) != 4)
+      continue;
+    hash = strchr(body, '#');
+    if(hash == 0)
+      continue;
+    *hash = 0;
+    memset(&b, 0, sizeof(b));
+    b.frame.id = strtoul(body, 0, 16);
+    b.frame.ext = strlen(body) > 3;
+    if(hash[1] == 'R')
+    {
+      b.frame.rtr = true;
+    }
+    else
+    {
+      len = strlen(hash + 1) / 2;
+      b.frame.dlc = len > 8 ? 8 : len;
+      for(i = 0; i < b.frame.dlc; i++)
+      {
+        char hex[3] = {hash[1 + 2 * i], hash[2 + 2 * i], 0};
+        b.frame.data[i] = strtoul(hex, 0, 16);
+      }
+    }
+    ts = (uint64_t)sec * 1000000ULL + usec;
+    if(!haveFirst)
+    {
+      first = ts;
+      haveFirst = true;
+    }
+    b.ready = ts - first;
+    traffic.push_back(b);
+  }
+  fclose(f);
+  return !traffic.empty();
+}
+
+static bool readyBefore(const BusFrame &a, const BusFrame &b)
+{
+  return a.ready < b.ready;
+}
+
+//Arbitration key: lower IDs win, a standard frame beats an extended one
+//with the same base ID
+static uint32_t arbitrationKey(const SimFrame &f)
+{
+  if(f.ext)
+    return ((f.id >> 18) << 19) | (1UL << 18) | (f.id & 0x3FFFF);
+  return f.id << 19;
+}
+
+//Replays 'traffic' into the simulator starting at 'start' and returns the
+//end of the last frame. Each frame goes out when the bus is idle and it
+//wins arbitration against everything else that is ready.
+static uint64_t scheduleTraffic(MCP2515Sim &sim, uint64_t start)
+{
+  std::multimap<uint32_t, size_t> ready;
+  std::multimap<uint32_t, size_t>::iterator win;
+  uint64_t busFree = 0;
+  size_t next = 0, seq = 0;
+  SimFrame f;
+
+  std::stable_sort(traffic.begin(), traffic.end(), readyBefore);
+  inFlight.clear();
+  while(next < traffic.size() || !ready.empty())
+  {
+    if(ready.empty() && traffic[next].ready > busFree)
+      busFree = traffic[next].ready;
+    while(next < traffic.size() && traffic[next].ready <= busFree)
+    {
+      ready.insert(std::make_pair(arbitrationKey(traffic[next].frame), next));
+      next++;
+    }
+    win = ready.begin();
+    f = traffic[win->second].frame;
+    ready.erase(win);
+
+    if(!f.rtr && f.dlc >= 2)
+    {
+      f.data[f.dlc - 2] = seq >> 8;
+      f.data[f.dlc - 1] = seq;
+    }
+    seq++;
+    busFree += (uint64_t)MCP2515Sim::frameBits(f) * 1000000ULL / BUS_BITRATE;
+    sim.schedule(f, start + busFree);
+
+    Arrival a;
+    a.at = start + busFree;
+    a.frame = f;
+    inFlight[f.id].push_back(a);
+  }
+  return start + busFree;
+}
+
+static bool sameFrame(const SimFrame &f, const CANMSG &m)
+{
+  uint32_t id = m.isExtendedAdrs ? m.extendedAdrsValue : m.adrsValue;
+
+  if(f.id != id || f.ext != (bool)m.isExtendedAdrs || f.dlc != m.dataLength)
+    return false;
+  return f.rtr || memcmp(f.data, m.data, f.dlc) == 0;
+}
+
+//Frames of the same ID are delivered in bus order, so anything in front of
+//the match was lost on the way
+static void matchDelivery(const CANMSG &m, RunResult &r)
+{
+  uint32_t id = m.isExtendedAdrs ? m.extendedAdrsValue : m.adrsValue;
+  std::deque<Arrival> &q = inFlight[id];
+  uint64_t now = simMicros(), lat;
+  size_t i;
+
+  for(i = 0; i < q.size(); i++)
+  {
+    if(!sameFrame(q[i].frame, m))
+      continue;
+    lat = now - q[i].at;
+    r.latencySum += lat;
+    if(lat > r.latencyMax)
+      r.latencyMax = lat;
+    r.delivered++;
+    q.erase(q.begin(), q.begin() + i + 1);
+    return;
+  }
+  r.unmatched++;
+}
+
+static void appStep(MCP2515 &can, int mode, RunResult &r, byte &next)
+{
+  CANMSG m;
+
+  switch(mode)
+  {
+    case MODE_SNIFF:
+    case MODE_INTERRUPT:
+      if(can.SNIFF_ALL(&m))
+        matchDelivery(m, r);
+      break;
+    case MODE_RECEIVE:
+      if(can.receiveCANMessage(&m, 1))
+        matchDelivery(m, r);
+      break;
+    case MODE_GETMSG:
+      //The original loop(): wait for each signal in turn
+      m.adrsValue = 0;
+      if(can.getMSG(&m, 10, wantedIds[next]))
+        matchDelivery(m, r);
+      next = (next + 1) % WANTED_COUNT;
+      break;
+  }
+}
+
+static bool run(const RunConfig &cfg, RunResult &r)
+{
+  static MCP2515Sim *sim = 0;
+  MCP2515 can;
+  uint64_t end;
+  unsigned long ovf0, ovf1, ringDrops;
+  byte next = 0;
+  CANMSG m;
+
+  memset(&r, 0, sizeof(r));
+  simDetachAll();
+  delete sim;
+  sim = new MCP2515Sim();
+  sim->setBusBitrate(BUS_BITRATE);
+  simAttach(sim, CS_PIN, INT_PIN);
+
+  if(!can.initCAN(CAN_BAUD_500K))
+    return false;
+  if(cfg.filters)
+  {
+    if(!can.setAcceptanceFilters(filterIds, sizeof(filterIds) / sizeof(filterIds[0])))
+      return false;
+  }
+  if(!can.setCANNormalMode())
+    return false;
+  while(can.SNIFF_ALL(&m))
+    ;
+  if(cfg.mode == MODE_INTERRUPT && !can.enableRxInterrupt(INT_PIN))
+    return false;
+
+  ovf0 = can.getRxOverflowCount(0);
+  ovf1 = can.getRxOverflowCount(1);
+  ringDrops = can.getRxDropCount();
+  memset(&sim->stats, 0, sizeof(sim->stats));
+
+  end = scheduleTraffic(*sim, simMicros() + 1000) + DRAIN_MICROS;
+  while(simMicros() < end)
+  {
+    appStep(can, cfg.mode, r, next);
+    delayMicroseconds(cfg.workMicros + LOOP_MICROS);
+  }
+
+  r.onBus = sim->stats.framesOnBus;
+  r.filtered = sim->stats.framesFiltered;
+  r.accepted = sim->stats.framesAccepted;
+  r.spiBytes = sim->stats.spiBytes;
+  r.spiTransactions = sim->stats.spiTransactions;
+  //Both the controller's count and the driver's EFLG count are kept: the
+  //driver only sees an overflow when it looks at EFLG in time
+  r.rxOverflow = sim->stats.framesOverflowed;
+  r.rxOverflowSeen = can.getRxOverflowCount(0) - ovf0 + can.getRxOverflowCount(1) - ovf1;
+  r.ringDropped = can.getRxDropCount() - ringDrops;
+  r.discarded = r.accepted - r.delivered - r.ringDropped;
+  can.disableRxInterrupt(INT_PIN);
+  return true;
+}
+
+static void printResult(const RunConfig &cfg, const RunResult &r)
+{
+  printf("{\"label\":\"%s\",\"profile\":\"%s\",\"mode\":\"%s\",\"filters\":%s,"
+         "\"work_us\":%lu,\"duration_ms\":%lu,"
+         "\"frames_on_bus\":%lu,\"filtered\":%lu,\"accepted\":%lu,"
+         "\"delivered\":%lu,\"dropped_rxovr\":%lu,\"rxovr_seen\":%lu,\"dropped_ring\":%lu,"
+         "\"discarded\":%lu,\"unmatched\":%lu,"
+         "\"spi_bytes_per_frame\":%.2f,\"spi_transactions_per_frame\":%.2f,"
+         "\"latency_us\":{\"avg\":%.1f,\"max\":%lu}}\n",
+         label.c_str(), profileName.c_str(), modeNames[cfg.mode], cfg.filters ? "true" : "false",
+         cfg.workMicros, durationMillis,
+         r.onBus, r.filtered, r.accepted,
+         r.delivered, r.rxOverflow, r.rxOverflowSeen, r.ringDropped,
+         r.discarded, r.unmatched,
+         r.delivered ? (double)r.spiBytes / r.delivered : 0.0,
+         r.delivered ? (double)r.spiTransactions / r.delivered : 0.0,
+         r.delivered ? (double)r.latencySum / r.delivered : 0.0,
+         (unsigned long)r.latencyMax);
+}
+
+static void usage()
+{
+  fprintf(stderr, "usage: bench_frameloss [-m sniff|receive|getmsg|interrupt] [-w work_us]\n"
+                  "                       [-p vehicle|heavy] [-r candump.log] [-t ms] [-n] [-L label]\n");
+}
+
+int main(int argc, char **argv)
+{
+  static const unsigned long defaultWork[] = {0, 500, 2000};
+  std::vector<int> modes;
+  std::vector<unsigned long> works;
+  const char *replay = 0;
+  bool filters = true;
+  RunConfig cfg;
+  RunResult r;
+  size_t i, j;
+  int a, k;
+
+  for(a = 1; a < argc; a++)
+  {
+    std::string opt = argv[a];
+    if(opt == "-n")
+    {
+      filters = false;
+      continue;
+    }
+    if(a + 1 >= argc)
+    {
+      usage();
+      return 2;
+    }
+    const char *val = argv[++a];
+    if(opt == "-m")
+    {
+      for(k = 0; k < MODE_COUNT; k++)
+        if(strcmp(val, modeNames[k]) == 0)
+          modes.push_back(k);
+      if(modes.empty())
+      {
+        usage();
+        return 2;
+      }
+    }
+    else if(opt == "-w")
+      works.push_back(strtoul(val, 0, 10));
+    else if(opt == "-p")
+      profileName = val;
+    else if(opt == "-r")
+      replay = val;
+    else if(opt == "-t")
+      durationMillis = strtoul(val, 0, 10);
+    else if(opt == "-L")
+      label = val;
+    else
+    {
+      usage();
+      return 2;
+    }
+  }
+
+  if(replay != 0)
+  {
+    if(!loadCandump(replay))
+    {
+      fprintf(stderr, "cannot read %s\n", replay);
+      return 1;
+    }
+    profileName = replay;
+    durationMillis = traffic.back().ready / 1000 + 1;
+  }
+  else if(profileName == "vehicle" || profileName == "heavy")
+    buildSynthetic(profileName == "heavy");
+  else
+  {
+    usage();
+    return 2;
+  }
+
+  if(modes.empty())
+    for(k = 0; k < MODE_COUNT; k++)
+      modes.push_back(k);
+  if(works.empty())
+    works.assign(defaultWork, defaultWork + sizeof(defaultWork) / sizeof(defaultWork[0]));
+
+  for(i = 0; i < modes.size(); i++)
+  {
+    for(j = 0; j < works.size(); j++)
+    {
+      cfg.mode = modes[i];
+      cfg.workMicros = works[j];
+      cfg.filters = filters;
+      if(!run(cfg, r))
+      {
+        fprintf(stderr, "%s: controller setup failed\n", modeNames[cfg.mode]);
+        return 1;
+      }
+      printResult(cfg, r);
+    }
+  }
+  return 0;
+}
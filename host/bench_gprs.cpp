@@ -0,0 +1,402 @@
+/*
+   This file is included as part of the CANOPNR distribution.
+   You are free to use this project as you see fit, provided credit is given to all
+   contributors (original and subsequent).
+
+   Copyright 2012  Jose Denrie Enriquez, Alex Bautista, Paloma Field, Sun-il Kim
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+  ------------------------------------------------------------------------------------------------------------
+
+  Uplink benchmark on the simulated SIM900 (host/SIM900Sim.h).
+
+      g++ -std=c++11 -O2 -Ihost -I. host/ArduinoHost.cpp host/MCP2515Sim.cpp \
+          host/SIM900Sim.cpp CANOPNR_AT.cpp CANOPNR_GPRS.cpp host/bench_gprs.cpp -o bench_gprs
+      ./bench_gprs [-m legacy|persistent] [-n uploads] [-s bytes] [-c connect_ms]
+                   [-d drop_every] [-e error_every] [-L label]
+
+  Each loop() cycle spends CYCLE_MS sampling (GPS, CAN collection, OBD) in
+  STEP_MS pieces and then has one payload ready for upload.
+
+  legacy is the modem handling loop() had before CANOPNR_GPRS: CIPSTART,
+  CIPSEND and CIPCLOSE at the end of every cycle, waiting on byte counts
+  polled every 100 ms and fixed delays, while nothing is sampled. -c sets
+  the time from CIPSTART to CONNECT OK; the legacy code sends CIPSEND 400 ms
+  after CIPSTART and gives up after five ERRORs, so it only copes with fast
+  connects. A failed upload is retried with the same payload next cycle.
+
+  persistent is GPRSLink on a session kept open, serviced between the
+  sampling steps as the sketch does; payloads wait their turn while one is
+  in flight and a FAILED send is started again.
+
+  -d closes the session from the network side at the start of every Nth
+  cycle, -e answers the next CIPSEND after every Nth cycle start with ERROR.
+
+  Each payload is unique, so afterwards the server stream is searched for
+  every one of them. One JSON line per mode reports the loop() cycle time,
+  the longest stretch spent in modem code (no CAN or GPS reads meanwhile),
+  the time from a payload being ready to the modem accepting it, the modem
+  commands, TCP sessions and any payload that never arrived.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <deque>
+#include <string>
+#include <vector>
+#include "Arduino.h"
+#include "MCP2515Sim.h"
+#include "SIM900Sim.h"
+#include "CANOPNR_GPRS.h"
+
+#define SERVER "AT+CIPSTART=\"TCP\",\"203.0.113.7\",\"5000\""
+#define APN "web.gci"
+#define CYCLE_MS 3000   //sampling part of loop(): GPS, CAN collection, OBD
+#define STEP_MS 50      //sampling between two calls into the uplink
+#define POWER_PIN 9
+
+enum { MODE_LEGACY, MODE_PERSISTENT, MODE_COUNT };
+static const char *modeNames[MODE_COUNT] = {"legacy", "persistent"};
+
+static std::string label;
+static unsigned long uploads = 100, payloadSize = 250, connectMillis = 900, dropEvery = 0, errorEvery = 0;
+
+//The old sketch's helpers, with cell and tempbuffS
+static char tempbuff[128];
+static size_t tempLen;
+
+static void drain(SIM900Sim &cell)
+{
+  while(cell.available() != 0)
+  {
+    int c = cell.read();
+    if(tempLen < sizeof(tempbuff) - 1)
+      tempbuff[tempLen++] = c;
+  }
+  tempbuff[tempLen] = '\0';
+}
+
+static bool sawError()
+{
+  return strstr(tempbuff, "ERROR") != NULL || strstr(tempbuff, "FAIL") != NULL;
+}
+
+static char cell_wait_for_bytes(SIM900Sim &cell, char no_of_bytes, int timeout)
+{
+  while(cell.available() < no_of_bytes)
+  {
+    delay(100);
+    timeout -= 1;
+    if(timeout == 0)
+      return 0;
+  }
+  return 1;
+}
+
+//Connect, send and close as loop() did; false where it went back to loop_start
+static bool legacyUpload(SIM900Sim &cell, const std::vector<uint8_t> &data)
+{
+  int timeo1 = 0, timeo2 = 0, timeo3 = 0;
+
+  tempLen = 0;
+start_check:
+  cell.println(SERVER);
+  if(cell_wait_for_bytes(cell, 12, 100) == 0)
+  {
+    cell.println("AT+CIPSHUT");
+    delay(100);
+    return false;
+  }
+  drain(cell);
+  if(sawError())
+  {
+    timeo1++;
+    tempLen = 0;
+    cell.println("AT+CIPSHUT");
+    cell_wait_for_bytes(cell, 4, 100);
+    if(timeo1 > 4)
+      return false;
+    goto start_check;
+  }
+  tempLen = 0;
+  delay(400);
+send_check:
+  cell.print("AT+CIPSEND=");
+  cell.println((unsigned long)data.size());
+  if(cell_wait_for_bytes(cell, 5, 100) == 0)
+  {
+    cell.println("AT+CIPSHUT");
+    delay(100);
+    return false;
+  }
+  drain(cell);
+  if(sawError())
+  {
+    tempLen = 0;
+    timeo2++;
+    if(timeo2 > 4)
+    {
+      cell.println("AT+CIPSHUT");
+      delay(100);
+      return false;
+    }
+    goto send_check;
+  }
+  tempLen = 0;
+  delay(15);
+  cell.write(&data[0], data.size());
+end_check:
+  if(cell_wait_for_bytes(cell, 20, 255) == 0)
+  {
+    cell.println("AT+CIPSHUT");
+    cell_wait_for_bytes(cell, 4, 100);
+    return false;
+  }
+  drain(cell);
+  if(sawError())
+  {
+    tempLen = 0;
+    timeo3++;
+    if(timeo3 > 4)
+    {
+      cell.println("AT+CIPSHUT");
+      delay(100);
+      return false;
+    }
+    goto end_check;
+  }
+  cell.println("AT+CIPCLOSE=0");
+  cell_wait_for_bytes(cell, 7, 100);
+  return true;
+}
+
+//A payload and when it was ready
+struct Upload
+{
+  std::vector<uint8_t> data;
+  uint64_t readyAt;
+};
+
+struct Totals
+{
+  unsigned long attempts;
+  unsigned long failed;
+  unsigned long delivered;
+  uint64_t blindMicros;     //longest single stretch inside modem code
+  uint64_t deliveryMicros;  //summed over delivered payloads
+  size_t backlog;           //most payloads waiting at once
+};
+
+static std::deque<Upload> waiting;
+static std::vector<std::vector<uint8_t> > sent;
+static Totals totals;
+
+static void delivered(const Upload &u)
+{
+  sent.push_back(u.data);
+  totals.delivered++;
+  totals.deliveryMicros += simMicros() - u.readyAt;
+}
+
+//The sketch's uplink() step: one call into the link between sampling steps
+static void persistentStep(GPRSLink &gprs, bool &busy)
+{
+  uint64_t t0 = simMicros();
+
+  gprs.service();
+  if(busy)
+  {
+    if(gprs.sendState() == GPRS_SEND_DONE)
+    {
+      delivered(waiting.front());
+      waiting.pop_front();
+      busy = false;
+    }
+    else if(gprs.sendState() == GPRS_SEND_FAILED)
+    {
+      totals.failed++;
+      busy = false;
+    }
+  }
+  if(!busy && !waiting.empty())
+  {
+    totals.attempts++;
+    gprs.send(&waiting.front().data[0], waiting.front().data.size());
+    busy = true;
+  }
+  totals.blindMicros = std::max(totals.blindMicros, simMicros() - t0);
+}
+
+static void run(int mode)
+{
+  SIM900Sim cell;
+  GPRSLink gprs(cell, POWER_PIN);
+  Upload u;
+  unsigned long cycles, made = 0, lost = 0, commands0, i, j;
+  uint64_t t0, cycleStart, cycleMicros = 0, worstCycle = 0;
+  bool busy = false;
+
+  waiting.clear();
+  sent.clear();
+  memset(&totals, 0, sizeof(totals));
+  cell.setDelay("AT+CIPSTART", connectMillis);
+  if(mode == MODE_PERSISTENT)
+  {
+    gprs.setServer(SERVER);
+    gprs.begin(APN);
+    while(!gprs.ready())
+    {
+      gprs.service();
+      if(gprs.getPowerCount() != 0)
+      {
+        fprintf(stderr, "modem setup failed\n");
+        exit(1);
+      }
+    }
+  }
+  commands0 = cell.stats.commands;
+
+  for(cycles = 0; (made < uploads || !waiting.empty() || busy) && cycles < 3 * uploads; cycles++)
+  {
+    cycleStart = simMicros();
+    if(dropEvery != 0 && (cycles + 1) % dropEvery == 0)
+      cell.dropAt(simMicros());
+    if(errorEvery != 0 && (cycles + 1) % errorEvery == 0)
+      cell.inject("AT+CIPSEND", "ERROR");
+
+    while(simMicros() - cycleStart < CYCLE_MS * 1000ULL)
+    {
+      delay(STEP_MS);
+      if(mode == MODE_PERSISTENT)
+        persistentStep(gprs, busy);
+    }
+
+    if(made < uploads)
+    {
+      u.data.resize(payloadSize);
+      for(j = 0; j < payloadSize; j++)
+        u.data[j] = (uint8_t)(made * 131 + j * 7 + (j >> 8));
+      u.data[0] = made;
+      u.data[1] = made >> 8;
+      u.readyAt = simMicros();
+      waiting.push_back(u);
+      made++;
+    }
+    totals.backlog = std::max(totals.backlog, waiting.size());
+
+    if(mode == MODE_LEGACY && !waiting.empty())
+    {
+      totals.attempts++;
+      t0 = simMicros();
+      if(legacyUpload(cell, waiting.front().data))
+      {
+        delivered(waiting.front());
+        waiting.pop_front();
+      }
+      else
+        totals.failed++;
+      totals.blindMicros = std::max(totals.blindMicros, simMicros() - t0);
+    }
+    else if(mode == MODE_PERSISTENT)
+      persistentStep(gprs, busy);
+
+    t0 = simMicros() - cycleStart;
+    cycleMicros += t0;
+    worstCycle = std::max(worstCycle, t0);
+  }
+
+  for(i = 0; i < sent.size(); i++)
+    if(std::search(cell.server.begin(), cell.server.end(), sent[i].begin(), sent[i].end()) == cell.server.end())
+      lost++;
+
+  printf("{\"label\":\"%s\",\"mode\":\"%s\",\"uploads\":%lu,\"bytes\":%lu,\"connect_ms\":%lu,"
+         "\"drop_every\":%lu,\"error_every\":%lu,"
+         "\"attempts\":%lu,\"failed\":%lu,\"undelivered\":%lu,\"lost\":%lu,"
+         "\"cycle_ms\":%.1f,\"cycle_ms_max\":%.1f,\"blind_ms_max\":%.1f,\"delivery_ms\":%.1f,"
+         "\"backlog_max\":%lu,\"commands_per_upload\":%.2f,"
+         "\"sessions\":%lu,\"dropped\":%lu,\"resets\":%lu,\"server_bytes\":%lu}\n",
+         label.c_str(), modeNames[mode], totals.delivered, payloadSize, connectMillis, dropEvery, errorEvery,
+         totals.attempts, totals.failed, made - totals.delivered, lost,
+         cycles ? cycleMicros / 1000.0 / cycles : 0.0, worstCycle / 1000.0, totals.blindMicros / 1000.0,
+         totals.delivered ? totals.deliveryMicros / 1000.0 / totals.delivered : 0.0,
+         (unsigned long)totals.backlog,
+         totals.delivered ? (double)(cell.stats.commands - commands0) / totals.delivered : 0.0,
+         cell.stats.sessions, mode == MODE_PERSISTENT ? gprs.getDropCount() : 0UL,
+         mode == MODE_PERSISTENT ? gprs.getResetCount() : 0UL, (unsigned long)cell.server.size());
+}
+
+static void usage()
+{
+  fprintf(stderr, "usage: bench_gprs [-m legacy|persistent] [-n uploads] [-s bytes] [-c connect_ms]\n"
+                  "                  [-d drop_every] [-e error_every] [-L label]\n");
+}
+
+int main(int argc, char **argv)
+{
+  std::vector<int> modes;
+  int a, k;
+
+  for(a = 1; a < argc; a++)
+  {
+    std::string opt = argv[a];
+    if(a + 1 >= argc)
+    {
+      usage();
+      return 2;
+    }
+    const char *val = argv[++a];
+    if(opt == "-m")
+    {
+      for(k = 0; k < MODE_COUNT; k++)
+        if(strcmp(val, modeNames[k]) == 0)
+          modes.push_back(k);
+      if(modes.empty())
+      {
+        usage();
+        return 2;
+      }
+    }
+    else if(opt == "-n")
+      uploads = strtoul(val, 0, 10);
+    else if(opt == "-s")
+      payloadSize = strtoul(val, 0, 10);
+    else if(opt == "-c")
+      connectMillis = strtoul(val, 0, 10);
+    else if(opt == "-d")
+      dropEvery = strtoul(val, 0, 10);
+    else if(opt == "-e")
+      errorEvery = strtoul(val, 0, 10);
+    else if(opt == "-L")
+      label = val;
+    else
+    {
+      usage();
+      return 2;
+    }
+  }
+  if(payloadSize < 2 || payloadSize > 1460)
+  {
+    usage();
+    return 2;
+  }
+
+  if(modes.empty())
+    for(k = 0; k < MODE_COUNT; k++)
+      modes.push_back(k);
+  for(k = 0; k < (int)modes.size(); k++)
+    run(modes[k]);
+  return 0;
+}
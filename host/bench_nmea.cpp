@@ -0,0 +1,259 @@
+/*
+   This file is included as part of the CANOPNR distribution.
+   You are free to use this project as you see fit, provided credit is given to all
+   contributors (original and subsequent).
+
+   Copyright 2012  Jose Denrie Enriquez, Alex Bautista, Paloma Field, Sun-il Kim
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+  ------------------------------------------------------------------------------------------------------------
+
+  NMEA parser check and benchmark (CANOPNR_GPS.h).
+
+      g++ -std=c++11 -O2 -I. CANOPNR_GPS.cpp host/bench_nmea.cpp -o bench_nmea
+      ./bench_nmea [-r recorded.nmea] [-s seconds] [-d drop_ppm] [-L label]
+
+  -r feeds a recorded receiver stream (the raw bytes, e.g. captured with
+  "cat /dev/ttyUSB0") and reports what was parsed. Without it a synthetic
+  drive is generated: one second of RMC, GGA, GSA, three GSV and VTG at a
+  time, about 480 bytes, as a typical 4800 baud receiver sends them. Every
+  fix the parser hands back is compared with the one the sentence was
+  generated from.
+
+  -d drops bytes at random, drop_ppm per million, the way SoftwareSerial
+  loses them when its buffer is not read in time. A damaged RMC or GGA
+  sentence should then be rejected, not parsed into the fix. Two equal
+  bytes lost from the fractional digits of one sentence get past the XOR
+  checksum and the format checks; "wrong" counts those, which only
+  happens at loss rates far above a receiver read in time.
+
+  Then the stream is fed byte by byte until at least 10^7 bytes have gone
+  through, and the mean cost per byte and per sentence is reported for
+  this machine. One JSON line per run; exit status 1 on a wrong fix from
+  an undamaged stream.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include "CANOPNR_GPS.h"
+
+static uint64_t nowNanos()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static std::vector<char> stream;
+static std::vector<GPSFIX> truth;      //by second of the synthetic drive
+static uint32_t startMs = 12 * 3600000UL + 34 * 60000UL + 56000UL;
+
+//Appends "$<body>*hh\r\n"
+static void sentence(const char *body)
+{
+  uint8_t sum = 0;
+  const char *p;
+  char tail[8];
+
+  for(p = body; *p != '\0'; p++)
+    sum ^= *p;
+  snprintf(tail, sizeof(tail), "*%02X\r\n", sum);
+  stream.push_back('$');
+  stream.insert(stream.end(), body, body + strlen(body));
+  stream.insert(stream.end(), tail, tail + strlen(tail));
+}
+
+//Microdegrees as NMEA "ddmm.mmmmm"
+static void coordinate(char *out, size_t size, int32_t micro, int degDigits)
+{
+  uint32_t a = micro < 0 ? -micro : micro;
+  uint64_t min100k = ((uint64_t)(a % 1000000) * 60 * 100000 + 500000) / 1000000;
+
+  snprintf(out, size, "%0*u%02u.%05u", degDigits, a / 1000000,
+           (unsigned)(min100k / 100000), (unsigned)(min100k % 100000));
+}
+
+static void buildSynthetic(unsigned seconds)
+{
+  double lat = 61.2181, lon = -149.9003, speed, course = 30;
+  char body[128], la[20], lo[20], hms[16];
+  GPSFIX f;
+  uint32_t t;
+  unsigned i, s;
+
+  srand(21);
+  for(i = 0; i < seconds; i++)
+  {
+    memset(&f, 0, sizeof(f));
+    speed = i < 10 ? 0 : 30 + 20 * sin(i / 40.0);         //knots
+    course = fmod(course + (rand() % 7 - 3) + 360, 360);
+    lat += speed * 0.514 * cos(course * M_PI / 180) / 111320.0;
+    lon += speed * 0.514 * sin(course * M_PI / 180) / (111320.0 * cos(lat * M_PI / 180));
+    t = startMs + i * 1000;
+    f.valid = i >= 3;                 //a few seconds without a fix first
+    f.timeMs = t % 86400000UL;
+    f.days = 9786;                    //171026, 2026-10-17; the drive stays before midnight
+    f.lat = (int32_t)floor(lat * 1e6);
+    f.lon = (int32_t)floor(lon * 1e6);
+    f.speed = f.valid ? (uint16_t)(speed * 100) : 0;
+    f.course = f.valid ? (uint16_t)(course * 100) : 0;
+    f.quality = f.valid ? 1 : 0;
+    f.satellites = f.valid ? 7 + rand() % 4 : 0;
+    f.hdop = f.valid ? 80 + rand() % 60 : 9999;
+    f.altitude = 3500 + (int32_t)(i % 50) * 10 - 250;
+    truth.push_back(f);
+
+    coordinate(la, sizeof(la), f.lat, 2);
+    coordinate(lo, sizeof(lo), f.lon, 3);
+    snprintf(hms, sizeof(hms), "%02u%02u%02u.00", f.timeMs / 3600000, f.timeMs / 60000 % 60, f.timeMs / 1000 % 60);
+    snprintf(body, sizeof(body), "GPRMC,%s,%c,%s,%c,%s,%c,%u.%02u,%u.%02u,171026,,,%c", hms, f.valid ? 'A' : 'V',
+             la, f.lat < 0 ? 'S' : 'N', lo, f.lon < 0 ? 'W' : 'E', f.speed / 100, f.speed % 100,
+             f.course / 100, f.course % 100, f.valid ? 'A' : 'N');
+    sentence(body);
+    snprintf(body, sizeof(body), "GPGGA,%s,%s,%c,%s,%c,%u,%02u,%u.%02u,%s%d.%02d,M,3.1,M,,", hms,
+             la, f.lat < 0 ? 'S' : 'N', lo, f.lon < 0 ? 'W' : 'E', f.quality, f.satellites,
+             f.hdop / 100, f.hdop % 100, f.altitude < 0 ? "-" : "", abs(f.altitude) / 100, abs(f.altitude) % 100);
+    sentence(body);
+    sentence("GPGSA,A,3,04,05,09,12,24,25,29,31,,,,,1.8,1.0,1.5");
+    for(s = 1; s <= 3; s++)
+    {
+      snprintf(body, sizeof(body), "GPGSV,3,%u,11,%02u,41,312,42,%02u,26,045,38,%02u,63,210,45,%02u,12,120,", s,
+               s * 3, s * 3 + 1, s * 3 + 2, s * 3 + 20);
+      sentence(body);
+    }
+    snprintf(body, sizeof(body), "GPVTG,%u.%02u,T,,M,%u.%02u,N,%u.%u,K,A", f.course / 100, f.course % 100,
+             f.speed / 100, f.speed % 100, f.speed * 1852 / 100000, f.speed * 1852 / 10000 % 10);
+    sentence(body);
+  }
+}
+
+static bool loadStream(const char *path)
+{
+  FILE *f = fopen(path, "rb");
+  char chunk[512];
+  size_t n;
+
+  if(f == 0)
+    return false;
+  while((n = fread(chunk, 1, sizeof(chunk), f)) > 0)
+    stream.insert(stream.end(), chunk, chunk + n);
+  fclose(f);
+  return !stream.empty();
+}
+
+//Fields sentence type 'type' carries, compared with the generated fix
+static bool sameFix(uint8_t type, const GPSFIX *a, const GPSFIX *b)
+{
+  if(a->timeMs != b->timeMs || labs((long)a->lat - b->lat) > 1 || labs((long)a->lon - b->lon) > 1)
+    return false;
+  if(type == NMEA_RMC)
+    return a->valid == b->valid && a->days == b->days && a->speed == b->speed && a->course == b->course;
+  return a->quality == b->quality && a->satellites == b->satellites && a->hdop == b->hdop &&
+         a->altitude == b->altitude;
+}
+
+int main(int argc, char **argv)
+{
+  const char *replay = 0;
+  std::string label;
+  std::vector<char> fed;
+  unsigned seconds = 600, dropPpm = 0, rmc = 0, gga = 0, wrong = 0, passes, k;
+  NMEAPARSER p;
+  size_t i, dropped = 0;
+  uint64_t t0, ns, bytes;
+  uint8_t type;
+  uint32_t sec;
+  int a;
+
+  for(a = 1; a + 1 < argc; a += 2)
+  {
+    if(strcmp(argv[a], "-r") == 0)
+      replay = argv[a + 1];
+    else if(strcmp(argv[a], "-s") == 0)
+      seconds = strtoul(argv[a + 1], 0, 10);
+    else if(strcmp(argv[a], "-d") == 0)
+      dropPpm = strtoul(argv[a + 1], 0, 10);
+    else if(strcmp(argv[a], "-L") == 0)
+      label = argv[a + 1];
+  }
+  if(a != argc || seconds == 0 || seconds > 40000)
+  {
+    fprintf(stderr, "usage: bench_nmea [-r recorded.nmea] [-s 1-40000] [-d drop_ppm] [-L label]\n");
+    return 2;
+  }
+  if(replay != 0)
+  {
+    if(!loadStream(replay))
+    {
+      fprintf(stderr, "nothing in %s\n", replay);
+      return 1;
+    }
+  }
+  else
+    buildSynthetic(seconds);
+
+  //What the parser actually receives
+  srand(2021);
+  for(i = 0; i < stream.size(); i++)
+  {
+    if(dropPpm > 0 && (unsigned)(rand() % 1000000) < dropPpm)
+      dropped++;
+    else
+      fed.push_back(stream[i]);
+  }
+
+  nmeaBegin(&p);
+  for(i = 0; i < fed.size(); i++)
+  {
+    type = nmeaFeed(&p, fed[i]);
+    if(type == NMEA_NONE)
+      continue;
+    if(type == NMEA_RMC)
+      rmc++;
+    else
+      gga++;
+    if(replay == 0)
+    {
+      sec = (p.fix.timeMs + 86400000UL - startMs % 86400000UL) % 86400000UL / 1000;
+      if(sec >= truth.size() || !sameFix(type, &p.fix, &truth[sec]))
+      {
+        if(wrong++ == 0)
+          fprintf(stderr, "wrong %s fix at byte %zu\n", type == NMEA_RMC ? "RMC" : "GGA", i);
+      }
+    }
+  }
+
+  //Cost: the same bytes again, enough of them to time
+  passes = 10000000 / fed.size() + 1;
+  nmeaBegin(&p);
+  t0 = nowNanos();
+  for(k = 0; k < passes; k++)
+    for(i = 0; i < fed.size(); i++)
+      nmeaFeed(&p, fed[i]);
+  ns = nowNanos() - t0;
+  bytes = (uint64_t)passes * fed.size();
+
+  printf("{\"label\":\"%s\",\"source\":\"%s\",\"bytes\":%zu,\"dropped_bytes\":%zu,\"rmc\":%u,\"gga\":%u,"
+         "\"rejected\":%lu,\"wrong\":%u,\"ns_per_byte\":%.2f,\"ns_per_sentence\":%.1f}\n",
+         label.c_str(), replay ? replay : "synthetic", fed.size(), dropped, rmc, gga,
+         (unsigned long)(p.errors / passes), wrong, (double)ns / bytes,
+         p.sentences ? (double)ns / p.sentences : 0.0);
+  return (wrong && dropped == 0) ? 1 : 0;
+}
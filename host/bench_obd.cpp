@@ -0,0 +1,342 @@
+/*
+   This file is included as part of the CANOPNR distribution.
+   You are free to use this project as you see fit, provided credit is given to all
+   contributors (original and subsequent).
+
+   Copyright 2012  Jose Denrie Enriquez, Alex Bautista, Paloma Field, Sun-il Kim
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+  ------------------------------------------------------------------------------------------------------------
+
+  Mode 01 PID decoder check and benchmark (CANOPNR_OBD.h).
+
+      g++ -std=c++11 -O2 -I. CANOPNR_OBD.cpp host/bench_obd.cpp -o bench_obd
+      ./bench_obd [-n decodes_per_pid] [-L label]
+
+  Every PID in the table is decoded for all 65536 values of A,B and of C,D
+  (the other two bytes random) and compared with the formulas on
+  http://en.wikipedia.org/wiki/OBD-II_PIDs, evaluated in double below. A
+  value passes when it is within half of its last decimal of the formula
+  (bit-encoded PIDs must be exact). A PID the formulas know but the table
+  lacks, or the other way round, is an error.
+
+  Then each PID is decoded -n times and the cost per decode is reported,
+  next to the float and sprintf() path MCP2515::formatOBD() used for the
+  PIDs it knew. Times are for this machine; on the AVR both are much
+  slower, the float path most of all (soft-float, vfprintf).
+
+  One JSON line per PID, then a summary line. Exit status 1 on any
+  mismatch.
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include "CANOPNR_OBD.h"
+
+static uint64_t nowNanos()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+//The Wikipedia formulas, one entry per value. Returns false for a PID it
+//does not cover. Bit-encoded PIDs give their bytes as one integer.
+static bool reference(uint8_t pid, const uint8_t *d, std::vector<double> *out)
+{
+  double A = d[0], B = d[1], C = d[2], D = d[3];
+  double AB = 256 * A + B, CD = 256 * C + D;
+
+  out->clear();
+  switch(pid)
+  {
+    case 0x00: case 0x01: case 0x20: case 0x40: case 0x41: case 0x60:
+    case 0x80: case 0xA0: case 0xC0:
+      out->push_back(AB * 65536 + CD);
+      break;
+    case 0x02: case 0x03:
+      out->push_back(AB);
+      break;
+    case 0x12: case 0x13: case 0x1C: case 0x1D: case 0x1E: case 0x30:
+    case 0x51: case 0x5F:
+    case 0x0B: case 0x0D: case 0x33:
+      out->push_back(A);
+      break;
+    case 0x04: case 0x11: case 0x2C: case 0x2E: case 0x2F: case 0x45:
+    case 0x47: case 0x48: case 0x49: case 0x4A: case 0x4B: case 0x4C:
+    case 0x52: case 0x5A: case 0x5B:
+      out->push_back(A * 100 / 255);
+      break;
+    case 0x05: case 0x0F: case 0x46: case 0x5C:
+      out->push_back(A - 40);
+      break;
+    case 0x06: case 0x07: case 0x08: case 0x09: case 0x2D:
+      out->push_back(A * 100 / 128 - 100);
+      break;
+    case 0x0A:
+      out->push_back(3 * A);
+      break;
+    case 0x0C:
+      out->push_back(AB / 4);
+      break;
+    case 0x0E:
+      out->push_back(A / 2 - 64);
+      break;
+    case 0x10:
+      out->push_back(AB / 100);
+      break;
+    case 0x14: case 0x15: case 0x16: case 0x17:
+    case 0x18: case 0x19: case 0x1A: case 0x1B:
+      out->push_back(A / 200);
+      out->push_back(B * 100 / 128 - 100);
+      break;
+    case 0x1F: case 0x21: case 0x31: case 0x4D: case 0x4E: case 0x63:
+      out->push_back(AB);
+      break;
+    case 0x22:
+      out->push_back(0.079 * AB);
+      break;
+    case 0x23: case 0x59:
+      out->push_back(10 * AB);
+      break;
+    case 0x24: case 0x25: case 0x26: case 0x27:
+    case 0x28: case 0x29: case 0x2A: case 0x2B:
+      out->push_back(2.0 / 65536 * AB);
+      out->push_back(8.0 / 65536 * CD);
+      break;
+    case 0x32:
+      out->push_back((AB >= 32768 ? AB - 65536 : AB) / 4);
+      break;
+    case 0x34: case 0x35: case 0x36: case 0x37:
+    case 0x38: case 0x39: case 0x3A: case 0x3B:
+      out->push_back(2.0 / 65536 * AB);
+      out->push_back(CD / 256 - 128);
+      break;
+    case 0x3C: case 0x3D: case 0x3E: case 0x3F:
+      out->push_back(AB / 10 - 40);
+      break;
+    case 0x42:
+      out->push_back(AB / 1000);
+      break;
+    case 0x43:
+      out->push_back(AB * 100 / 255);
+      break;
+    case 0x44:
+      out->push_back(2.0 / 65536 * AB);
+      break;
+    case 0x4F:
+      out->push_back(A);
+      out->push_back(B);
+      out->push_back(C);
+      out->push_back(D * 10);
+      break;
+    case 0x50:
+      out->push_back(A * 10);
+      break;
+    case 0x53:
+      out->push_back(AB / 200);
+      break;
+    case 0x54:
+      out->push_back(AB - 32767);
+      break;
+    case 0x55: case 0x56: case 0x57: case 0x58:
+      out->push_back(A * 100 / 128 - 100);
+      out->push_back(B * 100 / 128 - 100);
+      break;
+    case 0x5D:
+      out->push_back(AB / 128 - 210);
+      break;
+    case 0x5E:
+      out->push_back(AB / 20);
+      break;
+    case 0x61: case 0x62:
+      out->push_back(A - 125);
+      break;
+    case 0xA6:
+      //OBDVALUE is signed 32-bit: the decoder saturates, see CANOPNR_OBD.h
+      out->push_back(fmin(AB * 65536 + CD, INT32_MAX) / 10);
+      break;
+    default:
+      return false;
+  }
+  return true;
+}
+
+//MCP2515::formatOBD() before the table decoder, for the cost comparison
+static bool legacyFormat(unsigned char pid, const uint8_t *data, char *buffer)
+{
+  float engine_data;
+
+  buffer[0] = '\0';
+  switch(pid)
+  {
+    case 0x05: engine_data = data[0] - 40; break;
+    case 0x0C: engine_data = ((data[0] * 256) + data[1]) / 4; break;
+    case 0x2F: engine_data = ((100 * data[0]) / 255); break;
+    case 0x0D: engine_data = data[0]; break;
+    case 0x1F: engine_data = ((data[0] * 256) + data[1]); break;
+    case 0x0F: engine_data = (data[0] - 40); break;
+    case 0x10: engine_data = ((data[0] * 256) + data[1]) / 100; break;
+    case 0x14: engine_data = data[0] * 0.005; break;
+    case 0x11: engine_data = (data[0] * 100) / 255; break;
+    default: return false;
+  }
+  sprintf(buffer, "%d", (int)engine_data);
+  return true;
+}
+
+typedef struct
+{
+  unsigned checked, bad;
+  double maxErr;        //largest |decoded - formula| in units of the last decimal
+}  CHECK;
+
+static void checkOne(uint8_t pid, const uint8_t *data, CHECK *c)
+{
+  OBDVALUE v[OBD_MAX_FIELDS];
+  std::vector<double> ref;
+  uint8_t n, i;
+  double got, err, unit;
+
+  n = obdDecode(pid, data, 4, v, OBD_MAX_FIELDS);
+  reference(pid, data, &ref);
+  c->checked++;
+  if(n != ref.size())
+  {
+    c->bad++;
+    return;
+  }
+  for(i = 0; i < n; i++)
+  {
+    unit = pow(10, -v[i].decimals);
+    got = (v[i].unit == OBD_UNIT_BITS) ? (double)(uint32_t)v[i].value : v[i].value * unit;
+    err = fabs(got - ref[i]) / unit;
+    if(err > c->maxErr)
+      c->maxErr = err;
+    if(v[i].unit == OBD_UNIT_BITS ? err != 0 : err > 0.5 + 1e-6)
+    {
+      if(c->bad++ == 0)
+        fprintf(stderr, "pid %02X field %u data %02X %02X %02X %02X: got %.6f want %.6f\n",
+                pid, i, data[0], data[1], data[2], data[3], got, ref[i]);
+    }
+  }
+}
+
+int main(int argc, char **argv)
+{
+  std::string label;
+  unsigned iterations = 200000, pid, i, pids = 0, failed = 0;
+  std::vector<double> ref;
+  std::vector<uint8_t> inputs(4 * 256);
+  OBDVALUE v[OBD_MAX_FIELDS];
+  uint8_t data[4];
+  char text[16];
+  uint64_t t0, ns, legacyNs;
+  double decodeSum = 0, legacySum = 0;
+  unsigned legacyPids = 0;
+  volatile int32_t sink = 0;
+  CHECK c;
+  bool known, inTable;
+  int a;
+
+  for(a = 1; a + 1 < argc; a += 2)
+  {
+    if(strcmp(argv[a], "-n") == 0)
+      iterations = strtoul(argv[a + 1], 0, 10);
+    else if(strcmp(argv[a], "-L") == 0)
+      label = argv[a + 1];
+  }
+  if(a != argc || iterations == 0)
+  {
+    fprintf(stderr, "usage: bench_obd [-n decodes_per_pid] [-L label]\n");
+    return 2;
+  }
+
+  srand(19);
+  for(i = 0; i < inputs.size(); i++)
+    inputs[i] = rand();
+
+  for(pid = 0; pid < 256; pid++)
+  {
+    data[0] = data[1] = data[2] = data[3] = 0;
+    known = reference(pid, data, &ref);
+    inTable = obdFieldCount(pid) > 0;
+    if(!known && !inTable)
+      continue;
+    pids++;
+
+    memset(&c, 0, sizeof(c));
+    if(known != inTable)
+      c.bad++;
+    else
+    {
+      //Every A,B with C,D random, then every C,D with A,B random
+      for(i = 0; i < 65536; i++)
+      {
+        data[0] = i >> 8;  data[1] = i;  data[2] = rand();  data[3] = rand();
+        checkOne(pid, data, &c);
+        data[0] = rand();  data[1] = rand();  data[2] = i >> 8;  data[3] = i;
+        checkOne(pid, data, &c);
+      }
+    }
+
+    ns = 0;
+    if(inTable)
+    {
+      t0 = nowNanos();
+      for(i = 0; i < iterations; i++)
+      {
+        obdDecode(pid, &inputs[(i & 255) * 4], 4, v, OBD_MAX_FIELDS);
+        sink += v[0].value;
+      }
+      ns = nowNanos() - t0;
+      decodeSum += (double)ns / iterations;
+    }
+    legacyNs = 0;
+    if(legacyFormat(pid, data, text))
+    {
+      t0 = nowNanos();
+      for(i = 0; i < iterations; i++)
+      {
+        legacyFormat(pid, &inputs[(i & 255) * 4], text);
+        sink += text[0];
+      }
+      legacyNs = nowNanos() - t0;
+      legacySum += (double)legacyNs / iterations;
+      legacyPids++;
+    }
+
+    if(c.bad)
+      failed++;
+    printf("{\"label\":\"%s\",\"pid\":\"%02X\",\"fields\":%u,\"reply_bytes\":%u,\"checked\":%u,\"bad\":%u,"
+           "\"max_err_lsb\":%.3f,\"decode_ns\":%.1f",
+           label.c_str(), pid, obdFieldCount(pid), obdReplyLength(pid), c.checked, c.bad, c.maxErr,
+           (double)ns / iterations);
+    if(legacyNs)
+      printf(",\"legacy_ns\":%.1f", (double)legacyNs / iterations);
+    printf("}\n");
+  }
+
+  printf("{\"label\":\"%s\",\"pids\":%u,\"failed\":%u,\"mean_decode_ns\":%.1f,\"legacy_pids\":%u,"
+         "\"mean_legacy_ns\":%.1f}\n",
+         label.c_str(), pids, failed, decodeSum / pids, legacyPids,
+         legacyPids ? legacySum / legacyPids : 0.0);
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,319 @@
+/*
+   This file is included as part of the CANOPNR distribution.
+   You are free to use this project as you see fit, provided credit is given to all
+   contributors (original and subsequent).
+
+   Copyright 2012  Jose Denrie Enriquez, Alex Bautista, Paloma Field, Sun-il Kim
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+  ------------------------------------------------------------------------------------------------------------
+
+  OBD polling benchmark: the fixed eight-PID round trip per loop() cycle
+  (MCP2515::queryOBDBatch) against the per-PID scheduler (OBDSCHEDULER,
+  CANOPNR_OBD.h), on the simulated MCP2515 with a simulated ECU.
+
+      g++ -std=c++11 -O2 -Ihost -I. host/ArduinoHost.cpp host/MCP2515Sim.cpp \
+          CANOPNR_MCP2515.cpp CANOPNR_OBD.cpp CANOPNR_Telemetry.cpp host/bench_obdsched.cpp -o bench_obdsched
+      ./bench_obdsched [-m batch|sched] [-s all|partial] [-t ms] [-L label]
+
+  The ECU answers mode 01 requests for the PIDs it supports after
+  ECU_REPLY_MICROS, including the supported-PID bitmaps, and ignores the
+  rest. -s partial (the default) leaves fuel level (0x2F) and O2 sensor
+  (0x14) unsupported, as on many cars. 0x513 runs at 200 Hz throughout.
+
+  The application drains the receive ring every APP_STEP_MICROS. It closes
+  a record every CYCLE_MS, the way loop() does. In batch mode each record
+  first waits for queryOBDBatch(), which discards every other frame it
+  reads. In sched mode the scheduler is polled on every drain, as
+  drainCAN() does, with the periods the sketch uses.
+
+  One JSON line per run reports, for each mode:
+  - requests sent, and how many went unanswered;
+  - the time the application spent blocked in OBD calls per record;
+  - 0x513 frames lost;
+  - per PID, the replies per second and the mean age of the value at
+    record time.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include "Arduino.h"
+#include "MCP2515Sim.h"
+#include "CANOPNR_MCP2515.h"
+#include "CANOPNR_Telemetry.h"
+
+#define CS_PIN 10
+#define INT_PIN 2
+#define BUS_BITRATE 500000UL
+#define ECU_REPLY_MICROS 4000
+#define ABS_PERIOD_MICROS 5000
+#define APP_STEP_MICROS 1000
+#define CYCLE_MS 3000
+#define OBD_COUNT TELEMETRY_OBD_COUNT
+
+enum { MODE_BATCH, MODE_SCHED, MODE_COUNT };
+static const char *modeNames[MODE_COUNT] = {"batch", "sched"};
+
+//The sketch's periods, in TELEMETRY_OBD_PIDS order
+static const uint16_t periods[OBD_COUNT] = {100, 200, 10000, 10000, 1000, 5000, 200, 500};
+
+static MCP2515Sim *sim = 0;
+static bool ecuSupports[256];
+static unsigned long ecuRequests, ecuIgnored;
+
+struct RunResult
+{
+  unsigned long requests, unanswered, records;
+  unsigned long absSent, absSeen;
+  uint64_t blockedMicros;
+  unsigned long replies[OBD_COUNT], fresh[OBD_COUNT];
+  uint64_t ageMillis[OBD_COUNT];
+};
+
+static void ecuSupport(bool all)
+{
+  //A plausible engine ECU: the common PIDs of 0x01-0x40 plus a few above
+  static const uint8_t pids[] = {0x01, 0x03, 0x04, 0x05, 0x06, 0x07, 0x0B, 0x0C, 0x0D, 0x0E,
+                                 0x0F, 0x10, 0x11, 0x13, 0x14, 0x15, 0x1C, 0x1F, 0x21, 0x2F,
+                                 0x30, 0x31, 0x33, 0x42, 0x46, 0x49};
+  size_t i;
+
+  memset(ecuSupports, 0, sizeof(ecuSupports));
+  for(i = 0; i < sizeof(pids); i++)
+    ecuSupports[pids[i]] = true;
+  if(!all)
+    ecuSupports[0x2F] = ecuSupports[0x14] = false;
+  //Each bitmap up to the one listing a supported PID is answered
+  for(i = 0xFF; i > 0; i--)
+    if(ecuSupports[i])
+      ecuSupports[(i - 1) & 0xE0] = true;
+}
+
+static void ecuReply(const SimFrame &req, uint64_t at)
+{
+  SimFrame f;
+  uint8_t pid = req.data[2], i;
+
+  if(req.ext || req.id != OBD_REQUEST || req.data[1] != 0x01)
+    return;
+  ecuRequests++;
+  if(!ecuSupports[pid])
+  {
+    ecuIgnored++;
+    return;
+  }
+  memset(&f, 0, sizeof(f));
+  f.id = PID_REPLY;
+  f.dlc = 8;
+  f.data[1] = 0x41;
+  f.data[2] = pid;
+  if((pid & 0x1F) == 0)
+  {
+    for(i = 0; i < 32; i++)
+      if(pid + 1 + i < 0x100 && ecuSupports[pid + 1 + i])
+        f.data[3 + i / 8] |= 0x80 >> (i % 8);
+    f.data[0] = 6;
+  }
+  else
+  {
+    f.data[0] = 2 + obdReplyLength(pid);
+    for(i = 3; i < 8; i++)
+      f.data[i] = (uint8_t)(at >> (i * 3));
+  }
+  sim->schedule(f, at + ECU_REPLY_MICROS);
+}
+
+static void scheduleAbs(uint64_t from, uint64_t to, RunResult &r)
+{
+  SimFrame f;
+  uint64_t t;
+
+  memset(&f, 0, sizeof(f));
+  f.id = ABSCAN;
+  f.dlc = 8;
+  for(t = from; t < to; t += ABS_PERIOD_MICROS)
+  {
+    sim->schedule(f, t);
+    r.absSent++;
+  }
+}
+
+static bool run(int mode, unsigned long durationMillis, RunResult &r)
+{
+  static const unsigned long filterIds[] = {ABSCAN, BRAKE_PRESSURE, ACCELERATOR, PID_REPLY};
+  OBDREPLY obd[OBD_COUNT];
+  OBDSCHEDULER sched;
+  MCP2515 can;
+  CANMSG m;
+  uint64_t start, end, nextRecord, t0;
+  byte len, pid;
+  int8_t index;
+  int i;
+
+  memset(&r, 0, sizeof(r));
+  ecuRequests = ecuIgnored = 0;
+  simDetachAll();
+  delete sim;
+  sim = new MCP2515Sim();
+  sim->setBusBitrate(BUS_BITRATE);
+  sim->onTransmit = ecuReply;
+  simAttach(sim, CS_PIN, INT_PIN);
+  if(!can.initCAN(CAN_BAUD_500K) ||
+     !can.setAcceptanceFilters(filterIds, sizeof(filterIds) / sizeof(filterIds[0])) ||
+     !can.setCANNormalMode() || !can.enableRxInterrupt(INT_PIN))
+    return false;
+
+  for(i = 0; i < OBD_COUNT; i++)
+    obd[i].pid = TELEMETRY_OBD_PIDS[i];
+  obdSchedBegin(&sched);
+  for(i = 0; i < OBD_COUNT; i++)
+    obdSchedAdd(&sched, TELEMETRY_OBD_PIDS[i], periods[i]);
+
+  start = simMicros();
+  end = start + (uint64_t)durationMillis * 1000;
+  scheduleAbs(start, end, r);
+  nextRecord = start + CYCLE_MS * 1000ULL;
+  if(mode == MODE_BATCH)
+    nextRecord = start;
+
+  while(simMicros() < end)
+  {
+    while(can.SNIFF_ALL(&m))
+    {
+      if(m.adrsValue == ABSCAN)
+        r.absSeen++;
+      else if(mode == MODE_SCHED && (len = MCP2515::getOBDReply(&m)) > 0)
+      {
+        index = obdSchedReply(&sched, m.data[2], &m.data[3], len, millis());
+        if(index >= 0)
+          r.replies[index]++;
+      }
+    }
+    if(mode == MODE_SCHED && obdSchedNext(&sched, millis(), &pid))
+    {
+      t0 = simMicros();
+      if(!can.requestOBD(pid))
+        obdSchedUnsent(&sched);
+      r.blockedMicros += simMicros() - t0;
+    }
+
+    if(simMicros() >= nextRecord)
+    {
+      if(mode == MODE_BATCH)
+      {
+        t0 = simMicros();
+        can.queryOBDBatch(obd, OBD_COUNT, 300);
+        r.blockedMicros += simMicros() - t0;
+        for(i = 0; i < OBD_COUNT; i++)
+        {
+          if(obd[i].valid)
+          {
+            r.replies[i]++;
+            r.fresh[i]++;
+            //the reply arrived during the call: count it half way through
+            r.ageMillis[i] += (simMicros() - t0) / 2000;
+          }
+        }
+      }
+      else
+      {
+        for(i = 0; i < OBD_COUNT; i++)
+        {
+          if(obdSchedFresh(&sched, i, millis(), 1000))
+          {
+            r.fresh[i]++;
+            r.ageMillis[i] += millis() - sched.pids[i].updated;
+          }
+        }
+      }
+      r.records++;
+      nextRecord += CYCLE_MS * 1000ULL;
+    }
+    delayMicroseconds(APP_STEP_MICROS);
+  }
+  delay(20);
+  while(can.SNIFF_ALL(&m))
+    if(m.adrsValue == ABSCAN)
+      r.absSeen++;
+  can.disableRxInterrupt(INT_PIN);
+
+  r.requests = ecuRequests;
+  r.unanswered = ecuIgnored;
+  return true;
+}
+
+static void printResult(const std::string &label, int mode, bool all, unsigned long durationMillis,
+                        const RunResult &r)
+{
+  int i;
+
+  printf("{\"label\":\"%s\",\"mode\":\"%s\",\"ecu\":\"%s\",\"duration_ms\":%lu,\"records\":%lu,"
+         "\"requests\":%lu,\"unanswered\":%lu,\"blocked_ms_per_record\":%.1f,"
+         "\"abs_sent\":%lu,\"abs_lost\":%lu,\"pids\":{",
+         label.c_str(), modeNames[mode], all ? "all" : "partial", durationMillis, r.records,
+         r.requests, r.unanswered, r.records ? r.blockedMicros / 1000.0 / r.records : 0.0,
+         r.absSent, r.absSent - r.absSeen);
+  for(i = 0; i < OBD_COUNT; i++)
+  {
+    printf("%s\"%02X\":{\"hz\":%.2f,\"fresh\":%lu,\"age_ms\":%.0f}", i ? "," : "",
+           TELEMETRY_OBD_PIDS[i], r.replies[i] * 1000.0 / durationMillis, r.fresh[i],
+           r.fresh[i] ? (double)r.ageMillis[i] / r.fresh[i] : 0.0);
+  }
+  printf("}}\n");
+}
+
+int main(int argc, char **argv)
+{
+  std::string label;
+  unsigned long durationMillis = 60000;
+  int mode = -1, m, a;
+  bool all = false;
+  RunResult r;
+
+  for(a = 1; a + 1 < argc; a += 2)
+  {
+    if(strcmp(argv[a], "-m") == 0)
+    {
+      for(m = 0; m < MODE_COUNT && strcmp(argv[a + 1], modeNames[m]) != 0; m++)
+        ;
+      mode = m;
+    }
+    else if(strcmp(argv[a], "-s") == 0)
+      all = strcmp(argv[a + 1], "all") == 0;
+    else if(strcmp(argv[a], "-t") == 0)
+      durationMillis = strtoul(argv[a + 1], 0, 10);
+    else if(strcmp(argv[a], "-L") == 0)
+      label = argv[a + 1];
+  }
+  if(a != argc || mode == MODE_COUNT || durationMillis == 0)
+  {
+    fprintf(stderr, "usage: bench_obdsched [-m batch|sched] [-s all|partial] [-t ms] [-L label]\n");
+    return 2;
+  }
+
+  ecuSupport(all);
+  for(m = 0; m < MODE_COUNT; m++)
+  {
+    if(mode >= 0 && m != mode)
+      continue;
+    if(!run(m, durationMillis, r))
+    {
+      fprintf(stderr, "driver setup failed\n");
+      return 1;
+    }
+    printResult(label, m, all, durationMillis, r);
+  }
+  return 0;
+}
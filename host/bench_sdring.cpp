@@ -0,0 +1,221 @@
+/*
+   This file is included as part of the CANOPNR distribution.
+   You are free to use this project as you see fit, provided credit is given to all
+   contributors (original and subsequent).
+
+   Copyright 2012  Jose Denrie Enriquez, Alex Bautista, Paloma Field, Sun-il Kim
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+  ------------------------------------------------------------------------------------------------------------
+
+  Store-and-forward benchmark for CANOPNR_SDRing on a file-backed card
+  (host/SD.h).
+
+      g++ -std=c++11 -O2 -Ihost -I. host/ArduinoHost.cpp host/MCP2515Sim.cpp \
+          CANOPNR_SDRing.cpp host/bench_sdring.cpp -o bench_sdring
+      ./bench_sdring [-n cycles] [-s bytes] [-b blocks] [-p period] [-o offline]
+                     [-r drain] [-x crash_every] [-t] [-f image] [-L label]
+
+  Every cycle makes one payload of -s bytes (an upload batch). For the first
+  -o cycles of every -p the uplink is down and payloads go to the ring; while
+  it is up the ring is drained oldest first, -r entries per cycle, before
+  new payloads are sent directly. -b sets the ring size in blocks, header
+  block included, so a long enough outage wraps and overwrites the oldest
+  entries. -x cuts the power every Nth cycle after 0-2 more sector writes,
+  tearing the last one with -t; the ring is then mounted again from the
+  image, as after a reset. The image file is started afresh.
+
+  Payloads carry their number, so the server side counts what arrived,
+  twice or not at all. Without power losses missing equals overwritten:
+  nothing goes except what a full ring drops. After a power loss the ring
+  resumes from the read position saved with its newest entry, so entries
+  drained since then come again (duplicates) and, if the ring is full, may
+  be counted as overwritten a second time; cut counts the appends the
+  power loss interrupted.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "Arduino.h"
+#include "MCP2515Sim.h"
+#include "SD.h"
+#include "CANOPNR_SDRing.h"
+
+static std::string label, image = "sdring.img";
+static unsigned long cycles = 5000, payloadSize = 384, blocks = 257, period = 200, offline = 150,
+                     drainRate = 5, crashEvery = 0;
+static bool tornWrites = false;
+
+static void makePayload(std::vector<uint8_t> &p, uint32_t n)
+{
+  size_t i;
+
+  for(i = 0; i < p.size(); i++)
+    p[i] = (uint8_t)(n * 29 + i * 13);
+  memcpy(&p[0], &n, 4);
+}
+
+int main(int argc, char **argv)
+{
+  Sd2Card card;
+  SDRing *ring = new SDRing;
+  std::vector<uint8_t> payload, got(SD_RING_PAYLOAD_MAX);
+  std::vector<unsigned> arrived;
+  unsigned long c, k, produced = 0, direct = 0, drained = 0, corrupt = 0, cut = 0, crashes = 0,
+                duplicates = 0, missing = 0, overwritten = 0, errors = 0, writes0;
+  uint64_t t0, appendMicros = 0, mountMicros = 0, worstMount = 0;
+  uint16_t len;
+  uint32_t n;
+  bool online;
+  int a;
+
+  for(a = 1; a + 1 < argc || (a < argc && strcmp(argv[a], "-t") == 0); a++)
+  {
+    std::string opt = argv[a];
+    if(opt == "-t")
+    {
+      tornWrites = true;
+      continue;
+    }
+    const char *val = argv[++a];
+    if(opt == "-n")
+      cycles = strtoul(val, 0, 10);
+    else if(opt == "-s")
+      payloadSize = strtoul(val, 0, 10);
+    else if(opt == "-b")
+      blocks = strtoul(val, 0, 10);
+    else if(opt == "-p")
+      period = strtoul(val, 0, 10);
+    else if(opt == "-o")
+      offline = strtoul(val, 0, 10);
+    else if(opt == "-r")
+      drainRate = strtoul(val, 0, 10);
+    else if(opt == "-x")
+      crashEvery = strtoul(val, 0, 10);
+    else if(opt == "-f")
+      image = val;
+    else if(opt == "-L")
+      label = val;
+    else
+      a = argc;
+  }
+  if(a != argc || payloadSize < 4 || payloadSize > SD_RING_PAYLOAD_MAX || blocks < 2 || period == 0)
+  {
+    fprintf(stderr, "usage: bench_sdring [-n cycles] [-s bytes] [-b blocks] [-p period] [-o offline]\n"
+                    "                    [-r drain] [-x crash_every] [-t] [-f image] [-L label]\n");
+    return 2;
+  }
+
+  remove(image.c_str());
+  if(!card.open(image.c_str(), blocks) || !ring->begin(&card, 0, blocks))
+  {
+    fprintf(stderr, "cannot set up %s\n", image.c_str());
+    return 1;
+  }
+  payload.resize(payloadSize);
+  arrived.assign(cycles, 0);
+  srand(1);
+
+  for(c = 0; c < cycles + blocks; c++)
+  {
+    online = (c % period) >= offline || c >= cycles; //after the last payload, drain it all
+    if(crashEvery != 0 && c < cycles && c % crashEvery == crashEvery - 1)
+      card.failAfter(rand() % 3, tornWrites);
+
+    if(online)
+    {
+      for(k = 0; k < drainRate && ring->count() > 0; k++)
+      {
+        len = ring->peek(&got[0], got.size());
+        if(len == 0)
+          break;
+        memcpy(&n, &got[0], 4);
+        makePayload(payload, n);
+        if(len != payloadSize || n >= cycles || memcmp(&got[0], &payload[0], len) != 0)
+          corrupt++;
+        else
+          arrived[n]++;
+        drained++;
+        ring->pop();
+      }
+    }
+    if(c < cycles)
+    {
+      makePayload(payload, produced);
+      if(online && ring->count() == 0)
+      {
+        arrived[produced]++;
+        direct++;
+      }
+      else
+      {
+        t0 = simMicros();
+        if(!ring->append(&payload[0], payload.size()))
+          cut++;
+        appendMicros += simMicros() - t0;
+      }
+      produced++;
+    }
+
+    if(crashEvery != 0 && c < cycles && c % crashEvery == crashEvery - 1)
+    {
+      //power comes back: whatever the RAM held is gone, the card is read again
+      crashes++;
+      overwritten += ring->getOverwriteCount();
+      errors += ring->getErrorCount();
+      delete ring;
+      ring = new SDRing;
+      card.open(image.c_str(), blocks);
+      t0 = simMicros();
+      if(!ring->begin(&card, 0, blocks))
+      {
+        fprintf(stderr, "remount failed at cycle %lu\n", c);
+        return 1;
+      }
+      t0 = simMicros() - t0;
+      mountMicros += t0;
+      worstMount = std::max(worstMount, t0);
+    }
+  }
+  overwritten += ring->getOverwriteCount();
+  errors += ring->getErrorCount();
+  writes0 = card.writes;
+
+  for(n = 0; n < produced; n++)
+  {
+    if(arrived[n] > 1)
+      duplicates += arrived[n] - 1;
+    if(arrived[n] == 0)
+      missing++;
+  }
+
+  printf("{\"label\":\"%s\",\"cycles\":%lu,\"bytes\":%lu,\"slots\":%lu,\"period\":%lu,\"offline\":%lu,"
+         "\"drain\":%lu,\"crash_every\":%lu,\"torn\":%s,"
+         "\"produced\":%lu,\"direct\":%lu,\"stored\":%lu,\"drained\":%lu,\"duplicates\":%lu,"
+         "\"overwritten\":%lu,\"cut\":%lu,\"missing\":%lu,\"corrupt\":%lu,\"errors\":%lu,"
+         "\"crashes\":%lu,\"append_ms\":%.2f,\"mount_ms\":%.1f,\"mount_ms_max\":%.1f,\"sector_writes\":%lu}\n",
+         label.c_str(), cycles, payloadSize, blocks - 1, period, offline, drainRate, crashEvery,
+         tornWrites ? "true" : "false",
+         produced, direct, produced - direct - cut, drained, duplicates,
+         overwritten, cut, missing, corrupt, errors,
+         crashes, (produced - direct) ? appendMicros / 1000.0 / (produced - direct) : 0.0,
+         crashes ? mountMicros / 1000.0 / crashes : 0.0, worstMount / 1000.0, writes0);
+  delete ring;
+  remove(image.c_str());
+  return 0;
+}
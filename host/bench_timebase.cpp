@@ -0,0 +1,263 @@
+/*
+   This file is included as part of the CANOPNR distribution.
+   You are free to use this project as you see fit, provided credit is given to all
+   contributors (original and subsequent).
+
+   Copyright 2012  Jose Denrie Enriquez, Alex Bautista, Paloma Field, Sun-il Kim
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+  ------------------------------------------------------------------------------------------------------------
+
+  Timebase check and benchmark (CANOPNR_Timebase.h).
+
+      g++ -std=c++11 -O2 -I. CANOPNR_GPS.cpp CANOPNR_Timebase.cpp host/bench_timebase.cpp -o bench_timebase
+      ./bench_timebase [-p] [-s seconds] [-d drift_ppm] [-w wander_ppm] [-j jitter_us] [-o outlier_ppm] [-L label]
+
+  Simulates an Uno's micros() against true UTC: a resonator drift_ppm fast
+  (default 3000) with a temperature wander of wander_ppm (default 300)
+  over a 20 minute period, 4 us resolution, and micros() starting just
+  short of its wrap so a run of the default three hours crosses it twice.
+
+  Without -p the timebase is synced from RMC arrivals as pollGPS() times
+  them: the receiver's latency (GPS_RMC_LATENCY_US in the sketch, assumed
+  calibrated) varies by jitter_us (default 3000), the '$' is timed to
+  within one character at 4800 baud, one sentence in a hundred is lost
+  and outlier_ppm per million (default 5000) arrive 50-200 ms late. With
+  -p it is synced from a PPS edge, stamped after an interrupt latency of
+  up to 10 us, or up to 110 us in one edge of ten while the CAN interrupt
+  runs.
+
+  Twenty random instants a second are converted with timebaseToUtc() and
+  compared with the truth after a two-minute warm-up. settle_s is the
+  last second in which an error went over 2 ms (RMC) or 100 us (PPS).
+  The naive error is that of the sketch before the timebase: an RMC's
+  time taken for the moment its line was read, with micros() differences
+  from there. One JSON line per run; exit status 1 if the error after
+  warm-up goes over 5 ms (RMC) or 200 us (PPS).
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "CANOPNR_Timebase.h"
+
+#define RMC_LATENCY_US 150000.0       //receiver's delay from the second to the RMC '$'
+#define CHAR_US (10000000.0 / 4800)   //one character at 4800 baud
+#define RMC_CHARS 70                  //an RMC line, read whole by the old sketch
+#define WANDER_PERIOD_S 1200.0
+#define WARMUP_S 120
+#define SAMPLES 20                    //conversions checked per second
+
+static volatile uint32_t sink;
+static double driftPpm = 3000, wanderPpm = 300;
+static const double localStart = 4294000000.0;   //micros() 16 s before its wrap
+static const double utcStart = 9786 * 86400.0 + 12 * 3600 + 34 * 60 + 56.3;   //seconds, at T = 0
+
+static uint64_t nowNanos()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static double uniform(double lo, double hi)
+{
+  return lo + (hi - lo) * (rand() / (RAND_MAX + 1.0));
+}
+
+//Unwrapped local clock at true time t (microseconds since the start)
+static double localAt(double t)
+{
+  double w = 2 * M_PI / (WANDER_PERIOD_S * 1e6);
+
+  return localStart + t + driftPpm * 1e-6 * t - wanderPpm * 1e-6 * (cos(w * t) - 1) / w;
+}
+
+//micros() as the Uno returns it: 4 us steps, wrapped
+static uint32_t microsAt(double t)
+{
+  uint64_t l = (uint64_t)floor(localAt(t));
+
+  return (uint32_t)(l & ~3ULL);
+}
+
+static void utcAt(double t, UTCTIME *utc)
+{
+  double s = utcStart + t / 1e6;
+
+  utc->seconds = (uint32_t)floor(s);
+  utc->micros = (uint32_t)floor((s - floor(s)) * 1e6);
+  if(utc->micros > 999999)
+    utc->micros = 999999;
+}
+
+static double diffMicros(const UTCTIME *a, const UTCTIME *b)
+{
+  return ((double)a->seconds - (double)b->seconds) * 1e6 + ((double)a->micros - (double)b->micros);
+}
+
+typedef struct
+{
+  std::vector<double> err;
+  double sumAbs, max;
+}  ERRSTATS;
+
+static void addError(ERRSTATS *s, double e)
+{
+  e = fabs(e);
+  s->err.push_back(e);
+  s->sumAbs += e;
+  if(e > s->max)
+    s->max = e;
+}
+
+static double p99(ERRSTATS *s)
+{
+  size_t k;
+
+  if(s->err.empty())
+    return 0;
+  k = s->err.size() * 99 / 100;
+  std::nth_element(s->err.begin(), s->err.begin() + k, s->err.end());
+  return s->err[k];
+}
+
+int main(int argc, char **argv)
+{
+  TIMEBASE tb;
+  UTCTIME utc, est, naiveUtc;
+  ERRSTATS tbErr, naiveErr;
+  std::string label = "default";
+  bool pps = false, haveNaive = false;
+  unsigned seconds = 3 * 3600, n, k, settle = 0;
+  double jitterUs = 3000, outlierPpm = 5000, limit, settleLimit;
+  double tSecond, tArrive, tRead, t, e, worst;
+  uint32_t local, naiveLocal = 0;
+  uint64_t start, conversions = 0;
+  int i;
+
+  for(i = 1; i < argc; i++)
+  {
+    if(strcmp(argv[i], "-p") == 0)
+      pps = true;
+    else if(strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+      seconds = atoi(argv[++i]);
+    else if(strcmp(argv[i], "-d") == 0 && i + 1 < argc)
+      driftPpm = atof(argv[++i]);
+    else if(strcmp(argv[i], "-w") == 0 && i + 1 < argc)
+      wanderPpm = atof(argv[++i]);
+    else if(strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+      jitterUs = atof(argv[++i]);
+    else if(strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+      outlierPpm = atof(argv[++i]);
+    else if(strcmp(argv[i], "-L") == 0 && i + 1 < argc)
+      label = argv[++i];
+    else
+    {
+      fprintf(stderr, "usage: %s [-p] [-s seconds] [-d drift_ppm] [-w wander_ppm] [-j jitter_us] [-o outlier_ppm] [-L label]\n", argv[0]);
+      return 2;
+    }
+  }
+  limit = pps ? 200 : 5000;
+  settleLimit = pps ? 100 : 2000;
+
+  srand(22);
+  tbErr.sumAbs = tbErr.max = 0;
+  naiveErr.sumAbs = naiveErr.max = 0;
+  timebaseBegin(&tb);
+  for(n = 1; n <= seconds; n++)
+  {
+    //true time of the start of UTC second n
+    tSecond = (n - (utcStart - floor(utcStart))) * 1e6;
+    utcAt(tSecond, &utc);
+    utc.micros = 0;
+
+    if(rand() % 100 != 0)
+    {
+      tArrive = tSecond + RMC_LATENCY_US + uniform(-jitterUs / 2, jitterUs / 2);
+      if(uniform(0, 1e6) < outlierPpm)
+        tArrive += uniform(50000, 200000);
+      if(pps)
+      {
+        t = tSecond + (rand() % 10 == 0 ? uniform(0, 110) : uniform(0, 10));
+        timebaseSync(&tb, microsAt(t), &utc, TIMEBASE_PPS);
+      }
+      else
+      {
+        //pollGPS() reads the '$' up to a character after its stop bit and
+        //backs off by one character; the calibrated latency takes in the
+        //half character that leaves on average
+        local = microsAt(tArrive + CHAR_US + uniform(0, CHAR_US)) - (uint32_t)CHAR_US -
+                (uint32_t)(RMC_LATENCY_US + CHAR_US / 2);
+        timebaseSync(&tb, local, &utc, TIMEBASE_RMC);
+      }
+      //the old sketch: the fix time belonged to the moment readline() returned
+      tRead = tArrive + RMC_CHARS * CHAR_US + uniform(0, 20000);
+      naiveLocal = microsAt(tRead);
+      naiveUtc = utc;
+      haveNaive = true;
+    }
+
+    worst = 0;
+    for(k = 0; k < SAMPLES; k++)
+    {
+      t = tSecond + uniform(0, 1e6);
+      local = microsAt(t);
+      utcAt(t, &utc);
+      timebaseToUtc(&tb, local, &est);
+      e = diffMicros(&est, &utc);
+      if(fabs(e) > worst)
+        worst = fabs(e);
+      if(n > WARMUP_S)
+      {
+        addError(&tbErr, e);
+        if(haveNaive)
+        {
+          est = naiveUtc;
+          e = diffMicros(&est, &utc) + (double)(int32_t)(local - naiveLocal);
+          addError(&naiveErr, e);
+        }
+      }
+    }
+    if(worst > settleLimit)
+      settle = n;
+  }
+
+  //conversion cost on this machine
+  start = nowNanos();
+  for(local = 0; conversions < 10000000; conversions++, local += 997)
+  {
+    timebaseToUtc(&tb, local, &est);
+    sink += est.micros;
+  }
+  t = (double)(nowNanos() - start) / conversions;
+
+  printf("{\"label\":\"%s\",\"source\":\"%s\",\"seconds\":%u,\"drift_ppm\":%.0f,\"wander_ppm\":%.0f,"
+         "\"err_us\":{\"mean\":%.1f,\"p99\":%.1f,\"max\":%.1f},\"settle_s\":%u,"
+         "\"ppm\":{\"estimated\":%d,\"true\":%.0f},\"syncs\":%lu,\"steps\":%lu,\"rejected\":%lu,"
+         "\"naive_err_us\":{\"mean\":%.0f,\"p99\":%.0f,\"max\":%.0f},\"convert_ns\":%.1f}\n",
+         label.c_str(), pps ? "pps" : "rmc", seconds, driftPpm, wanderPpm,
+         tbErr.err.empty() ? 0 : tbErr.sumAbs / tbErr.err.size(), p99(&tbErr), tbErr.max, settle,
+         timebasePpm(&tb), 0.0 - (driftPpm + wanderPpm * sin(2 * M_PI * seconds / WANDER_PERIOD_S)),
+         (unsigned long)tb.syncs, (unsigned long)tb.steps, (unsigned long)tb.rejected,
+         naiveErr.err.empty() ? 0 : naiveErr.sumAbs / naiveErr.err.size(), p99(&naiveErr), naiveErr.max,
+         t);
+  return tbErr.max > limit ? 1 : 0;
+}
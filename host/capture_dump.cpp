@@ -0,0 +1,168 @@
+/*
+   This file is included as part of the CANOPNR distribution.
+   You are free to use this project as you see fit, provided credit is given to all
+   contributors (original and subsequent).
+
+   Copyright 2012  Jose Denrie Enriquez, Alex Bautista, Paloma Field, Sun-il Kim
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+  ------------------------------------------------------------------------------------------------------------
+
+  Converts a raw frame capture (CANOPNR_Capture.h) to text: candump log
+  lines or a Vector ASC trace. Reads CAPTURE.BIN copied off the card, or a
+  host SD image with -b giving the first block of the capture.
+
+      g++ -std=c++11 -O2 -Ihost -I. host/ArduinoHost.cpp host/MCP2515Sim.cpp \
+          CANOPNR_Capture.cpp host/capture_dump.cpp -o capture_dump
+      ./capture_dump [-f candump|asc] [-i can0,can1] [-b first_block] CAPTURE.BIN > drive.log
+
+  Each channel (bus) of the capture gets the candump interface named at its
+  place in the -i list, can<n> past the end of it, and ASC channel n + 1.
+  Times are relative to the first frame: candump "(sec.usec)" and ASC
+  seconds both start at 0. Decoding stops at the first sector of another
+  session or out of sequence, which is where the capture ended. A summary
+  goes to stderr.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "CANOPNR_Capture.h"
+
+enum { FORMAT_CANDUMP, FORMAT_ASC };
+
+static void printFrame(int format, const char *iface, byte channel, uint64_t t, const CANMSG *m)
+{
+  unsigned long id = m->isExtendedAdrs ? m->extendedAdrsValue : m->adrsValue;
+  byte i;
+
+  if(format == FORMAT_CANDUMP)
+  {
+    printf("(%lu.%06lu) %s ", (unsigned long)(t / 1000000), (unsigned long)(t % 1000000), iface);
+    printf(m->isExtendedAdrs ? "%08lX#" : "%03lX#", id);
+    if(m->rtr)
+      printf("R");
+    else
+      for(i = 0; i < m->dataLength; i++)
+        printf("%02X", m->data[i]);
+    printf("\n");
+    return;
+  }
+
+  char idText[16];
+  snprintf(idText, sizeof(idText), m->isExtendedAdrs ? "%lXx" : "%lX", id);
+  printf("%11.6f %u  %-15s Rx   %s %u", t / 1e6, channel + 1, idText, m->rtr ? "r" : "d", m->dataLength);
+  if(!m->rtr)
+    for(i = 0; i < m->dataLength; i++)
+      printf(" %02X", m->data[i]);
+  printf("\n");
+}
+
+static uint32_t le32(const uint8_t *p)
+{
+  return p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+int main(int argc, char **argv)
+{
+  std::vector<std::string> ifaces;
+  std::string names = "can0", name;
+  char fallback[16];
+  size_t start, comma;
+  byte channel;
+  const char *path = 0;
+  unsigned long firstBlock = 0, frames = 0, sectors = 0;
+  uint8_t sector[CAPTURE_SECTOR_SIZE];
+  uint32_t session = 0, base, prevBase = 0, delta;
+  uint64_t t = 0, sectorTime = 0;
+  uint16_t pos;
+  int format = FORMAT_CANDUMP, a;
+  CANMSG m;
+  FILE *f;
+
+  for(a = 1; a < argc; a++)
+  {
+    std::string opt = argv[a];
+    if(a + 1 < argc && opt == "-f")
+      format = (strcmp(argv[++a], "asc") == 0) ? FORMAT_ASC : FORMAT_CANDUMP;
+    else if(a + 1 < argc && opt == "-i")
+      names = argv[++a];
+    else if(a + 1 < argc && opt == "-b")
+      firstBlock = strtoul(argv[++a], 0, 10);
+    else if(path == 0 && opt[0] != '-')
+      path = argv[a];
+    else
+      path = 0, a = argc;
+  }
+  if(path == 0)
+  {
+    fprintf(stderr, "usage: capture_dump [-f candump|asc] [-i can0,can1] [-b first_block] CAPTURE.BIN\n");
+    return 2;
+  }
+  if((f = fopen(path, "rb")) == 0)
+  {
+    perror(path);
+    return 1;
+  }
+  for(start = 0; start <= names.size(); start = comma + 1)
+  {
+    comma = names.find(',', start);
+    if(comma == std::string::npos)
+      comma = names.size();
+    ifaces.push_back(names.substr(start, comma - start));
+  }
+  fseek(f, (long)firstBlock * CAPTURE_SECTOR_SIZE, SEEK_SET);
+
+  if(format == FORMAT_ASC)
+    printf("date Thu Jan 1 00:00:00.000 1970\nbase hex  timestamps absolute\nno internal events logged\n"
+           "Begin Triggerblock\n");
+  while(fread(sector, 1, sizeof(sector), f) == sizeof(sector))
+  {
+    if((sector[0] | (sector[1] << 8)) != CAPTURE_MAGIC)
+      break;
+    if(sectors == 0)
+      session = le32(sector + 4);
+    if(le32(sector + 4) != session || le32(sector + 8) != sectors)
+      break;
+    base = le32(sector + 12);
+    //micros() wraps every 71 minutes; sectors are never that far apart
+    if(sectors > 0)
+      sectorTime += (uint32_t)(base - prevBase);
+    prevBase = base;
+    t = sectorTime;
+    pos = 0;
+    while(captureReadFrame(sector, &pos, &m, &delta, &channel))
+    {
+      t += delta;
+      if(channel < ifaces.size())
+        name = ifaces[channel];
+      else
+      {
+        snprintf(fallback, sizeof(fallback), "can%u", channel);
+        name = fallback;
+      }
+      printFrame(format, name.c_str(), channel, t, &m);
+      frames++;
+    }
+    sectors++;
+  }
+  if(format == FORMAT_ASC)
+    printf("End TriggerBlock\n");
+  fclose(f);
+  fprintf(stderr, "session %lu: %lu sectors, %lu frames, %.3f s\n",
+          (unsigned long)session, sectors, frames, t / 1e6);
+  return 0;
+}
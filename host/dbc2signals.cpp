@@ -0,0 +1,254 @@
+/*
+   This file is included as part of the CANOPNR distribution.
+   You are free to use this project as you see fit, provided credit is given to all
+   contributors (original and subsequent).
+
+   Copyright 2012  Jose Denrie Enriquez, Alex Bautista, Paloma Field, Sun-il Kim
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+  ------------------------------------------------------------------------------------------------------------
+
+  Generates CANSIGNAL types and a SIGNALDEF table (CANOPNR_Signals.h) from
+  a DBC file, so signals are added by editing the DBC, not the code.
+
+      g++ -std=c++11 -O2 host/dbc2signals.cpp -o dbc2signals
+      ./dbc2signals host/canopnr.dbc > CANOPNR_VehicleSignals.h
+
+  Each signal gets the smallest power of ten scale (up to 10^6) that makes
+  its factor and offset whole numbers, so the value is an integer in units
+  of 1/scale of the DBC unit and needs no division. The scale is lowered
+  when raw * factor could overflow 32 bits; that, and a factor that is not
+  a decimal fraction, are reported on stderr as a loss of precision.
+  Multiplexed signals are skipped with a warning.
+*/
+
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <set>
+#include <string>
+#include <vector>
+
+#define EXTENDED_FLAG 0x80000000UL   //bit 31 of a DBC message ID, CAN_EXTENDED_ID
+
+struct Signal
+{
+  std::string name, message, unit;
+  unsigned long id;
+  int start, length;
+  bool intel, isSigned;
+  double factor, offset;
+  long num, offsetUnits, scale;
+};
+
+static const char *license =
+  "/*\n"
+  "   This file is included as part of the CANOPNR distribution.\n"
+  "   You are free to use this project as you see fit, provided credit is given to all\n"
+  "   contributors (original and subsequent).\n"
+  "\n"
+  "   Copyright 2012  Jose Denrie Enriquez, Alex Bautista, Paloma Field, Sun-il Kim\n"
+  "\n"
+  "   Licensed under the Apache License, Version 2.0 (the \"License\");\n"
+  "   you may not use this file except in compliance with the License.\n"
+  "   You may obtain a copy of the License at\n"
+  "\n"
+  "       http://www.apache.org/licenses/LICENSE-2.0\n"
+  "\n"
+  "   Unless required by applicable law or agreed to in writing, software\n"
+  "   distributed under the License is distributed on an \"AS IS\" BASIS,\n"
+  "   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.\n"
+  "   See the License for the specific language governing permissions and\n"
+  "   limitations under the License.\n"
+  "\n"
+  "  ------------------------------------------------------------------------------------------------------------\n";
+
+//AcceleratorPedal -> ACCELERATOR_PEDAL, wheel_speed0 -> WHEEL_SPEED0
+static std::string macroName(const std::string &name)
+{
+  std::string out;
+  size_t i;
+
+  for(i = 0; i < name.size(); i++)
+  {
+    if(i > 0 && isupper((unsigned char)name[i]) && islower((unsigned char)name[i - 1]))
+      out += '_';
+    out += isalnum((unsigned char)name[i]) ? (char)toupper((unsigned char)name[i]) : '_';
+  }
+  return out;
+}
+
+static bool whole(double v)
+{
+  return fabs(v - floor(v + 0.5)) < 1e-9 * (fabs(v) > 1 ? fabs(v) : 1);
+}
+
+//Picks scale, num and offset for the signal; false if it cannot be
+//represented at all
+static bool fixScale(Signal &s)
+{
+  double rawMax = s.isSigned ? ldexp(1.0, s.length - 1) : ldexp(1.0, s.length) - 1;
+  long scale;
+  bool exact = false;
+
+  for(scale = 1; scale <= 1000000; scale *= 10)
+  {
+    if(whole(s.factor * scale) && whole(s.offset * scale))
+    {
+      exact = true;
+      break;
+    }
+  }
+  if(!exact)
+    scale = 1000000;
+  while(scale > 1 && fabs(rawMax * s.factor * scale) + fabs(s.offset * scale) > 2147483647.0)
+  {
+    scale /= 10;
+    exact = false;
+  }
+  s.scale = scale;
+  s.num = (long)floor(s.factor * scale + 0.5);
+  s.offsetUnits = (long)floor(s.offset * scale + 0.5);
+  if(s.num == 0 || fabs(rawMax * s.num) + fabs((double)s.offsetUnits) > 2147483647.0)
+  {
+    fprintf(stderr, "%s: factor %g does not fit 32-bit fixed point, skipped\n", s.name.c_str(), s.factor);
+    return false;
+  }
+  if(!exact)
+    fprintf(stderr, "%s: factor %g offset %g rounded to %ld/%ld, %ld/%ld\n", s.name.c_str(),
+            s.factor, s.offset, s.num, scale, s.offsetUnits, scale);
+  return true;
+}
+
+static bool validLayout(const Signal &s)
+{
+  int first = s.start / 8, last;
+
+  if(s.length < 1 || s.length > 32)
+    return false;
+  if(s.intel)
+    last = (s.start + s.length - 1) / 8;
+  else
+    last = ((s.start / 8) * 8 + 7 - s.start % 8 + s.length - 1) / 8;
+  return last < 8 && last - first < 4;
+}
+
+int main(int argc, char **argv)
+{
+  std::vector<Signal> signals;
+  std::set<std::string> names;
+  std::string message;
+  unsigned long id = 0;
+  char line[512], name[128], mux[16], unit[64];
+  char order, sign;
+  FILE *f;
+  size_t i;
+
+  if(argc != 2)
+  {
+    fprintf(stderr, "usage: dbc2signals file.dbc > CANOPNR_VehicleSignals.h\n");
+    return 2;
+  }
+  if((f = fopen(argv[1], "r")) == 0)
+  {
+    perror(argv[1]);
+    return 1;
+  }
+  while(fgets(line, sizeof(line), f) != 0)
+  {
+    Signal s;
+    const char *p = line;
+    char *colon;
+
+    while(*p == ' ' || *p == '\t')
+      p++;
+    if(strncmp(p, "BO_ ", 4) == 0)
+    {
+      if(sscanf(p, "BO_ %lu %127[^:]:", &id, name) == 2)
+        message = name;
+      continue;
+    }
+    if(strncmp(p, "SG_ ", 4) != 0 || (colon = strchr((char *)p, ':')) == 0)
+      continue;
+    mux[0] = 0;
+    if(sscanf(p, "SG_ %127s %15[^:]", name, mux) < 1)
+      continue;
+    if(mux[0] == 'M' || mux[0] == 'm')
+    {
+      fprintf(stderr, "%s: multiplexed, skipped\n", name);
+      continue;
+    }
+    unit[0] = 0;
+    if(sscanf(colon + 1, " %d|%d@%c%c (%lf,%lf) [%*[^]]] \"%63[^\"]\"",
+              &s.start, &s.length, &order, &sign, &s.factor, &s.offset, unit) < 6)
+    {
+      fprintf(stderr, "%s: cannot parse, skipped\n", name);
+      continue;
+    }
+    s.name = name;
+    s.message = message;
+    s.unit = unit;
+    s.id = id;
+    s.intel = (order == '1');
+    s.isSigned = (sign == '-');
+    if(!validLayout(s))
+    {
+      fprintf(stderr, "%s: not within 4 bytes of an 8-byte frame, skipped\n", name);
+      continue;
+    }
+    if(!names.insert(macroName(s.name)).second)
+    {
+      fprintf(stderr, "%s: duplicate name, skipped\n", name);
+      continue;
+    }
+    if(fixScale(s))
+      signals.push_back(s);
+  }
+  fclose(f);
+
+  printf("%s\n  Generated by host/dbc2signals from %s: edit the DBC file and run it\n"
+         "  again instead of editing this file. See CANOPNR_Signals.h.\n*/\n\n"
+         "#ifndef CANOPNR_VehicleSignals_h\n#define CANOPNR_VehicleSignals_h\n\n"
+         "#include \"CANOPNR_Signals.h\"\n\n", license, argv[1]);
+  for(i = 0; i < signals.size(); i++)
+  {
+    const Signal &s = signals[i];
+    std::string ident = s.id & EXTENDED_FLAG ? "0x%08lXUL | CAN_EXTENDED_ID" : "0x%03lX";
+    char idText[40];
+
+    snprintf(idText, sizeof(idText), ident.c_str(), s.id & ~EXTENDED_FLAG);
+    printf("//%s in %s, ", s.name.c_str(), s.message.c_str());
+    if(s.scale == 1)
+      printf("%s\n", s.unit.empty() ? "raw units" : s.unit.c_str());
+    else
+      printf("1/%ld %s\n", s.scale, s.unit.empty() ? "unit" : s.unit.c_str());
+    printf("typedef CANSIGNAL<%s, %d, %d, %s, %s, %ld, 1, %ld, %ld> SIG_%s;\n",
+           idText, s.start, s.length, s.intel ? "CAN_INTEL" : "CAN_MOTOROLA",
+           s.isSigned ? "true" : "false", s.num, s.offsetUnits, s.scale, macroName(s.name).c_str());
+  }
+  printf("\n#define CAN_SIGNAL_COUNT %lu\n\nconstexpr SIGNALDEF CAN_SIGNALS[CAN_SIGNAL_COUNT] = {\n",
+         (unsigned long)signals.size());
+  for(i = 0; i < signals.size(); i++)
+  {
+    const Signal &s = signals[i];
+
+    printf("  {\"%s\", 0x%lXUL, %d, %d, %s, %s, %ld, 1, %ld, %ld}%s\n", s.name.c_str(),
+           s.id, s.start, s.length, s.intel ? "CAN_INTEL" : "CAN_MOTOROLA",
+           s.isSigned ? "true" : "false", s.num, s.offsetUnits, s.scale, i + 1 < signals.size() ? "," : "");
+  }
+  printf("};\n\n#endif\n");
+  return signals.empty() ? 1 : 0;
+}
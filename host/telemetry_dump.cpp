@@ -0,0 +1,148 @@
+/*
+   This file is included as part of the CANOPNR distribution.
+   You are free to use this project as you see fit, provided credit is given to all
+   contributors (original and subsequent).
+
+   Copyright 2012  Jose Denrie Enriquez, Alex Bautista, Paloma Field, Sun-il Kim
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+  ------------------------------------------------------------------------------------------------------------
+
+  Server-side decoder for the binary telemetry records (CANOPNR_Telemetry.h)
+  and record batches (CANOPNR_Batch.h). Reads a TCP capture of concatenated
+  records and batches from a file or stdin and prints one JSON object per
+  record. Bytes that do not start a valid record or batch are skipped one
+  at a time, so a stream can be picked up mid-record.
+
+      g++ -std=c++11 -I. CANOPNR_Telemetry.cpp CANOPNR_GPS.cpp CANOPNR_Batch.cpp \
+          host/telemetry_dump.cpp -o telemetry_dump
+      ./telemetry_dump capture.bin
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include "CANOPNR_Batch.h"
+
+//ISO 8601 for UTC seconds since 2000-01-01 (civil-from-days, 400-year eras)
+static void printUtc(const UTCTIME *t)
+{
+  uint32_t days = t->seconds / 86400 + 730425, secs = t->seconds % 86400;   //days from 0000-03-01
+  uint32_t era = days / 146097, doe = days % 146097;
+  uint32_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  uint32_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  uint32_t mp = (5 * doy + 2) / 153, d = doy - (153 * mp + 2) / 5 + 1;
+  uint32_t m = mp < 10 ? mp + 3 : mp - 9, y = yoe + era * 400 + (m <= 2);
+
+  printf("\"%04u-%02u-%02uT%02u:%02u:%02u.%06uZ\"", (unsigned)y, (unsigned)m, (unsigned)d,
+         (unsigned)(secs / 3600), (unsigned)(secs / 60 % 60), (unsigned)(secs % 60), (unsigned)t->micros);
+}
+
+static void printRecord(const TELEMETRY *r)
+{
+  uint8_t i;
+
+  printf("{\"controller\":%d,\"seq\":%u,\"ms\":%lu,\"present\":%lu,",
+         r->controllerId, r->sequence, (unsigned long)r->timestamp, (unsigned long)r->present);
+  printf("\"utc\":");
+  if((r->present >> TELEMETRY_HAS_UTC) & 1)
+  {
+    printUtc(&r->utc);
+    printf(",\"clock_ppm\":%d,\"time_source\":\"%s\",", r->clockRate,
+           ((r->present >> TELEMETRY_UTC_PPS) & 1) ? "pps" : "rmc");
+  }
+  else
+    printf("null,");
+  printf("\"gps\":{\"valid\":%s,\"time_ms\":%lu,\"days\":%u,\"lat\":%.6f,\"lon\":%.6f,\"knots\":%.2f,\"course\":%.2f},",
+         r->gps.valid ? "true" : "false", (unsigned long)r->gps.timeMs, r->gps.days,
+         r->gps.lat / 1e6, r->gps.lon / 1e6, r->gps.speed / 100.0, r->gps.course / 100.0);
+  printf("\"accel\":%u,\"csq\":%u,\"obd\":{", r->accelerator, r->csq);
+  for(i = 0; i < TELEMETRY_OBD_COUNT; i++)
+  {
+    printf("%s\"%02X\":", i ? "," : "", TELEMETRY_OBD_PIDS[i]);
+    if((r->present >> TELEMETRY_HAS_OBD(i)) & 1)
+      printf("[%u,%u]", r->obd[i][0], r->obd[i][1]);
+    else
+      printf("null");
+  }
+  printf("},\"obd_ms\":[");
+  for(i = 0; i < TELEMETRY_OBD_COUNT; i++)
+  {
+    if((r->present >> TELEMETRY_HAS_OBD(i)) & 1)
+      printf("%s%d", i ? "," : "", r->obdTime[i]);
+    else
+      printf("%snull", i ? "," : "");
+  }
+  printf("],\"slip\":{\"frames\":%u,\"kmh\":%.2f,\"mean\":[", r->slip.frames, r->slip.speed / 100.0);
+  for(i = 0; i < SLIP_WHEELS; i++)
+    printf("%s%.3f", i ? "," : "", r->slip.mean[i] / 1000.0);
+  printf("],\"peak\":[");
+  for(i = 0; i < SLIP_WHEELS; i++)
+    printf("%s%.3f", i ? "," : "", r->slip.peak[i] / 1000.0);
+  printf("]},\"brake\":");
+  if((r->present >> TELEMETRY_HAS_BRAKE) & 1)
+    printf("%u", r->brake);
+  else
+    printf("null");
+  printf(",\"events\":[");
+  for(i = 0; i < r->eventCount; i++)
+  {
+    const SLIPEVENT *e = &r->events[i];
+    printf("%s{\"start_ms\":%d,\"duration_ms\":%u,\"wheel\":%u,\"peak\":%.3f,\"kmh\":%.2f,\"brake\":%u}",
+           i ? "," : "", e->start, e->duration, e->wheel, e->peak / 1000.0, e->speed / 100.0, e->brake);
+  }
+  printf("]}\n");
+}
+
+int main(int argc, char **argv)
+{
+  std::vector<uint8_t> data;
+  FILE *f = stdin;
+  std::vector<TELEMETRY> recs(255);
+  uint8_t chunk[512], count, i;
+  size_t n, pos = 0, skipped = 0;
+  uint16_t used;
+
+  if(argc > 1 && (f = fopen(argv[1], "rb")) == 0)
+  {
+    perror(argv[1]);
+    return 1;
+  }
+  while((n = fread(chunk, 1, sizeof(chunk), f)) > 0)
+    data.insert(data.end(), chunk, chunk + n);
+
+  while(pos < data.size())
+  {
+    n = data.size() - pos;
+    if(n > 0xFFFF)
+      n = 0xFFFF;
+    count = 0;
+    if(data[pos] == TELEMETRY_BATCH_MAGIC)
+      used = telemetryBatchDecode(&data[pos], n, &recs[0], recs.size(), &count);
+    else if((used = telemetryDecode(&data[pos], n, &recs[0])) != 0)
+      count = 1;
+    if(used == 0)
+    {
+      pos++;
+      skipped++;
+      continue;
+    }
+    for(i = 0; i < count; i++)
+      printRecord(&recs[i]);
+    pos += used;
+  }
+  if(skipped)
+    fprintf(stderr, "%lu bytes skipped\n", (unsigned long)skipped);
+  return 0;
+}
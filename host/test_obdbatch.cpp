@@ -0,0 +1,198 @@
+/*
+   This file is included as part of the CANOPNR distribution.
+   You are free to use this project as you see fit, provided credit is given to all
+   contributors (original and subsequent).
+
+   Copyright 2012  Jose Denrie Enriquez, Alex Bautista, Paloma Field, Sun-il Kim
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+  ------------------------------------------------------------------------------------------------------------
+
+  Test of MCP2515::queryOBDBatch against a simulated ECU on the simulated
+  MCP2515. The ECU answers each PID after its own delay, so replies come
+  back in a different order from the requests, never answers 0x2F, and
+  answers three PIDs only after OBD_REPLY_TIMEOUT, when the batch has
+  already given up on them.
+
+      make -C host check
+
+  Checks that every PID the ECU answers comes back with its data, the
+  unanswered one is left invalid, each PID is requested once, no more than
+  OBD_PIPELINE_DEPTH requests are ever in flight (a late reply must not
+  free another request's slot), and the batch ends once nothing is left in
+  flight rather than at its timeout. Runs polled and with the RX
+  interrupt. Prints one line per failed check; the exit status is 1 if any.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include "Arduino.h"
+#include "MCP2515Sim.h"
+#include "CANOPNR_MCP2515.h"
+#include "CANOPNR_OBD.h"
+
+#define CS_PIN 10
+#define INT_PIN 2
+#define BATCH_TIMEOUT 1000
+#define NEVER 0
+
+//In request order; the reply delay in ms, NEVER for a PID the ECU ignores
+static const struct { uint8_t pid; unsigned int delay; } ecuPids[] = {
+  {0x2F, NEVER},
+  {0x04, OBD_REPLY_TIMEOUT + 30},
+  {0x05, OBD_REPLY_TIMEOUT + 30},
+  {0x0B, OBD_REPLY_TIMEOUT + 30},
+  {0x0C, 40},
+  {0x0D, 35},
+  {0x0F, 30},
+  {0x10, 25},
+  {0x11, 20},
+  {0x46, 15},
+  {0x06, 10},
+  {0x07, 5},
+};
+#define PID_COUNT (sizeof(ecuPids) / sizeof(ecuPids[0]))
+
+struct Request
+{
+  uint8_t pid;
+  uint64_t done;             //the earliest the node can let it go
+};
+
+static MCP2515Sim *sim = 0;
+static std::vector<Request> requests;
+static unsigned int maxInFlight;
+static unsigned int failures = 0;
+
+static void check(bool ok, const char *mode, const char *what, unsigned long got, unsigned long want)
+{
+  if(ok)
+    return;
+  printf("FAIL %s: %s is 0x%lX, expected 0x%lX\n", mode, what, got, want);
+  failures++;
+}
+
+static uint8_t ecuData(uint8_t pid, int i)
+{
+  return (uint8_t)(pid * 7 + i);
+}
+
+static void ecuReply(const SimFrame &req, uint64_t at)
+{
+  Request r;
+  SimFrame f;
+  unsigned int i, j, inFlight = 1;
+
+  if(req.ext || req.id != OBD_REQUEST || req.data[1] != 0x01)
+    return;
+  r.pid = req.data[2];
+  //The node frees a slot when it reads the reply or OBD_REPLY_TIMEOUT after
+  //queueing the request; the margin covers the time on the bus
+  r.done = at + (OBD_REPLY_TIMEOUT - 2) * 1000ULL;
+  for(i = 0; i < PID_COUNT; i++)
+  {
+    if(ecuPids[i].pid != r.pid || ecuPids[i].delay == NEVER)
+      continue;
+    memset(&f, 0, sizeof(f));
+    f.id = PID_REPLY;
+    f.dlc = 8;
+    f.data[0] = 2 + obdReplyLength(r.pid);
+    f.data[1] = 0x41;
+    f.data[2] = r.pid;
+    for(j = 0; j < 5; j++)
+      f.data[3 + j] = ecuData(r.pid, j);
+    sim->schedule(f, at + ecuPids[i].delay * 1000ULL);
+    if(at + ecuPids[i].delay * 1000ULL < r.done)
+      r.done = at + ecuPids[i].delay * 1000ULL;
+    break;
+  }
+  for(i = 0; i < requests.size(); i++)
+    if(requests[i].done > at)
+      inFlight++;
+  if(inFlight > maxInFlight)
+    maxInFlight = inFlight;
+  requests.push_back(r);
+}
+
+static void run(bool interrupt)
+{
+  const char *mode = interrupt ? "interrupt" : "polled";
+  OBDREPLY replies[PID_COUNT];
+  MCP2515 can(CS_PIN);
+  unsigned long start, elapsed;
+  unsigned int i, j, times, length;
+  byte answered;
+
+  simDetachAll();
+  delete sim;
+  sim = new MCP2515Sim();
+  sim->onTransmit = ecuReply;
+  simAttach(sim, CS_PIN, INT_PIN);
+  requests.clear();
+  maxInFlight = 0;
+  if(!can.initCAN(CAN_BAUD_500K) || !can.setCANNormalMode() ||
+     (interrupt && !can.enableRxInterrupt(INT_PIN)))
+  {
+    printf("FAIL %s: controller setup\n", mode);
+    failures++;
+    return;
+  }
+
+  for(i = 0; i < PID_COUNT; i++)
+    replies[i].pid = ecuPids[i].pid;
+  start = millis();
+  answered = can.queryOBDBatch(replies, PID_COUNT, BATCH_TIMEOUT);
+  elapsed = millis() - start;
+
+  check(answered == PID_COUNT - 1, mode, "answered", answered, PID_COUNT - 1);
+  for(i = 0; i < PID_COUNT; i++)
+  {
+    if(ecuPids[i].delay == NEVER)
+    {
+      check(!replies[i].valid, mode, "valid for the PID the ECU ignores", replies[i].valid, 0);
+      continue;
+    }
+    check(replies[i].valid, mode, "valid", ecuPids[i].pid, 1);
+    if(!replies[i].valid)
+      continue;
+    length = obdReplyLength(ecuPids[i].pid);
+    if(length > 4)
+      length = 4;
+    check(replies[i].replyId == PID_REPLY, mode, "reply ID", replies[i].replyId, PID_REPLY);
+    check(replies[i].length == length, mode, "reply length", replies[i].length, length);
+    for(j = 0; j < replies[i].length; j++)
+      check(replies[i].data[j] == ecuData(ecuPids[i].pid, j), mode, "reply data", replies[i].data[j], ecuData(ecuPids[i].pid, j));
+  }
+  for(i = 0; i < PID_COUNT; i++)
+  {
+    times = 0;
+    for(j = 0; j < requests.size(); j++)
+      if(requests[j].pid == ecuPids[i].pid)
+        times++;
+    check(times == 1, mode, "requests for one PID", times, 1);
+  }
+  check(maxInFlight <= OBD_PIPELINE_DEPTH, mode, "requests in flight", maxInFlight, OBD_PIPELINE_DEPTH);
+  check(elapsed < 2 * OBD_REPLY_TIMEOUT, mode, "batch time (ms)", elapsed, 2 * OBD_REPLY_TIMEOUT);
+  if(interrupt)
+    can.disableRxInterrupt(INT_PIN);
+}
+
+int main()
+{
+  run(false);
+  run(true);
+  printf("test_obdbatch: %u PIDs, %u failures\n", (unsigned int)PID_COUNT, failures);
+  return failures ? 1 : 0;
+}
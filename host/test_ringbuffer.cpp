@@ -0,0 +1,160 @@
+/*
+   This file is included as part of the CANOPNR distribution.
+   You are free to use this project as you see fit, provided credit is given to all
+   contributors (original and subsequent).
+
+   Copyright 2012  Jose Denrie Enriquez, Alex Bautista, Paloma Field, Sun-il Kim
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+  ------------------------------------------------------------------------------------------------------------
+
+  Stress test of RingBuffer (CANOPNR_RingBuffer.h) with a producer thread
+  standing in for the RX interrupt and the main thread as loop(). On the
+  host the indices are std::atomic with acquire/release ordering, the
+  only build where the single-producer/single-consumer handoff can be
+  exercised concurrently.
+
+      make -C host check
+      ./build/test_ringbuffer [-n frames]
+
+  The producer pushes CANMSGs whose every field is derived from a
+  sequence number and counts the pushes refused as full. The consumer
+  checks each frame whole and in order. A producer that retries must get
+  every frame through; one that drops a frame when the ring is full, as
+  the ISR does, must leave exactly as many gaps as pushes refused. Either
+  way the overflow counter must equal the refused pushes. Rings of 2, 8
+  (CAN_RX_RING_SIZE) and 255 slots. Prints one line per
+  case; the exit status is 1 if any failed.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <thread>
+#include "CANOPNR_MCP2515.h"
+#include "CANOPNR_RingBuffer.h"
+
+static unsigned long frameCount = 2000000;
+
+static void fill(CANMSG *m, unsigned long seq)
+{
+  int i;
+
+  memset(m, 0, sizeof(*m));
+  m->adrsValue = seq & 0x7FF;
+  m->isExtendedAdrs = (seq & 1) != 0;
+  m->extendedAdrsValue = (seq * 2654435761UL) & 0x3FFFF;
+  m->rtr = (seq & 2) != 0;
+  m->dataLength = seq % 9;
+  for(i = 0; i < 8; i++)
+    m->data[i] = (byte)((seq >> (3 * i)) ^ (0x5A + i));
+  m->timestamp = ~seq;
+}
+
+//Recovers the sequence number, or returns false if any field disagrees
+static bool decode(const CANMSG *m, unsigned long *seq)
+{
+  CANMSG want;
+
+  *seq = ~m->timestamp;
+  fill(&want, *seq);
+  return memcmp(&want, m, sizeof(want)) == 0;
+}
+
+template <unsigned char SIZE>
+static bool run(bool retry)
+{
+  RingBuffer<CANMSG, SIZE> ring;
+  std::atomic<bool> done(false);
+  unsigned long refused = 0, received = 0, skipped = 0, torn = 0, misordered = 0, expect = 0, seq;
+  bool ok;
+  CANMSG m;
+
+  std::thread producer([&]() {
+    unsigned long n = 0;
+    CANMSG p;
+
+    while(n < frameCount)
+    {
+      fill(&p, n);
+      if(ring.push(p))
+        n++;
+      else
+      {
+        refused++;
+        if(!retry)
+          n++; //dropped, as the ISR drops a frame when the ring is full
+        std::this_thread::yield(); //lets the consumer run on a single core
+      }
+    }
+    done.store(true, std::memory_order_release);
+  });
+
+  //Checking done before pop() so nothing pushed before it was set is missed
+  for(;;)
+  {
+    bool finished = done.load(std::memory_order_acquire);
+    if(!ring.pop(&m))
+    {
+      if(finished)
+        break;
+      std::this_thread::yield();
+      continue;
+    }
+    received++;
+    if(!decode(&m, &seq))
+    {
+      torn++;
+      continue;
+    }
+    if(seq < expect)
+      misordered++;
+    else
+      skipped += seq - expect;
+    expect = seq + 1;
+  }
+  producer.join();
+  skipped += frameCount - expect; //dropped after the last one received
+
+  ok = torn == 0 && misordered == 0 && ring.getOverflowCount() == refused &&
+       (retry ? received == frameCount && skipped == 0 : received + refused == frameCount && skipped == refused);
+  printf("{\"slots\":%u,\"producer\":\"%s\",\"frames\":%lu,\"received\":%lu,\"overflows\":%lu,\"refused\":%lu,"
+         "\"skipped\":%lu,\"torn\":%lu,\"misordered\":%lu,\"ok\":%s}\n",
+         (unsigned int)SIZE, retry ? "retry" : "drop", frameCount, received, ring.getOverflowCount(), refused,
+         skipped, torn, misordered, ok ? "true" : "false");
+  return ok;
+}
+
+int main(int argc, char **argv)
+{
+  bool ok = true;
+  int r;
+
+  if(argc == 3 && strcmp(argv[1], "-n") == 0)
+    frameCount = strtoul(argv[2], 0, 10);
+  else if(argc != 1)
+  {
+    fprintf(stderr, "usage: test_ringbuffer [-n frames]\n");
+    return 2;
+  }
+
+  for(r = 0; r < 2; r++)
+  {
+    ok = run<2>(r != 0) && ok;
+    ok = run<CAN_RX_RING_SIZE>(r != 0) && ok;
+    ok = run<255>(r != 0) && ok;
+  }
+  return ok ? 0 : 1;
+}
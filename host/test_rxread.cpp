@@ -0,0 +1,132 @@
+/*
+   This file is included as part of the CANOPNR distribution.
+   You are free to use this project as you see fit, provided credit is given to all
+   contributors (original and subsequent).
+
+   Copyright 2012  Jose Denrie Enriquez, Alex Bautista, Paloma Field, Sun-il Kim
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+  ------------------------------------------------------------------------------------------------------------
+
+  Test of the receive path on the simulated MCP2515: each frame is read
+  with one READ_RX_BUFFER transaction, which also clears its RXnIF, and
+  the ID, DLC, RTR and data come out as sent. The frames cover standard
+  and extended IDs, including EID8 values of 0x80 and above.
+
+      make -C host check
+
+  Polled (SNIFF_ALL without the RX interrupt), a received frame costs the
+  RX_STATUS that finds it plus the read, and an empty poll one RX_STATUS.
+  With the interrupt, the ISR adds the RX_STATUS that finds both buffers
+  empty. Prints one line per failed check; the exit status is 1 if any.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "Arduino.h"
+#include "MCP2515Sim.h"
+#include "CANOPNR_MCP2515.h"
+#include "MCP2515_defs.h"
+
+#define CS_PIN 10
+#define INT_PIN 2
+
+static const SimFrame frames[] = {
+  {0x123, false, false, 8, {1, 2, 3, 4, 5, 6, 7, 8}},
+  {0x7FF, false, false, 0, {0}},
+  {0x7E8, false, true, 0, {0}},
+  {0x18FEF100, true, false, 8, {0xFF, 0xFE, 0x80, 0x7F, 0, 1, 2, 3}},
+  {0x1FFFFFFF, true, false, 3, {0xAA, 0x55, 0xC3}},
+  {0x0CF00400, true, false, 8, {0x10, 0x20, 0x30, 0x40, 0x50, 0x60, 0x70, 0x80}},
+  {0x00008000, true, true, 0, {0}},
+};
+#define FRAME_COUNT (sizeof(frames) / sizeof(frames[0]))
+
+static unsigned int failures = 0;
+
+static void check(bool ok, const char *what, unsigned int frame, unsigned long got, unsigned long want)
+{
+  if(ok)
+    return;
+  printf("FAIL frame %u: %s is 0x%lX, expected 0x%lX\n", frame, what, got, want);
+  failures++;
+}
+
+static void checkFrame(unsigned int i, const CANMSG &m)
+{
+  const SimFrame &f = frames[i];
+  unsigned long id;
+
+  id = m.isExtendedAdrs ? ((unsigned long)m.adrsValue << 18) | m.extendedAdrsValue : m.adrsValue;
+  check(m.isExtendedAdrs == f.ext, "IDE", i, m.isExtendedAdrs, f.ext);
+  check(id == f.id, "ID", i, id, f.id);
+  check(m.rtr == f.rtr, "RTR", i, m.rtr, f.rtr);
+  check(m.dataLength == f.dlc, "DLC", i, m.dataLength, f.dlc);
+  check(memcmp(m.data, f.data, f.dlc) == 0, "data", i, m.data[0], f.data[0]);
+}
+
+int main()
+{
+  MCP2515Sim sim;
+  MCP2515 can(CS_PIN);
+  unsigned long before;
+  unsigned int i;
+  CANMSG m;
+  bool got;
+
+  simAttach(&sim, CS_PIN, INT_PIN);
+  if(!can.initCAN(CAN_BAUD_500K) || !can.setCANNormalMode())
+  {
+    printf("FAIL controller setup\n");
+    return 1;
+  }
+
+  //Polled
+  for(i = 0; i < FRAME_COUNT; i++)
+  {
+    sim.schedule(frames[i], simMicros() + 100);
+    delayMicroseconds(500);
+    before = sim.stats.spiTransactions;
+    got = can.SNIFF_ALL(&m);
+    check(got, "received", i, got, 1);
+    check(sim.stats.spiTransactions - before == 2, "SPI transactions", i, sim.stats.spiTransactions - before, 2);
+    check((sim.reg(CANINTF) & ((1 << RX0IF) | (1 << RX1IF))) == 0, "RXnIF after the read", i, sim.reg(CANINTF), 0);
+    if(got)
+      checkFrame(i, m);
+    before = sim.stats.spiTransactions;
+    got = can.SNIFF_ALL(&m);
+    check(!got, "empty poll received", i, got, 0);
+    check(sim.stats.spiTransactions - before == 1, "empty poll SPI transactions", i, sim.stats.spiTransactions - before, 1);
+  }
+
+  //The ISR reads each frame as it arrives
+  can.enableRxInterrupt(INT_PIN);
+  for(i = 0; i < FRAME_COUNT; i++)
+  {
+    before = sim.stats.spiTransactions;
+    sim.schedule(frames[i], simMicros() + 100);
+    delayMicroseconds(500);
+    check(sim.stats.spiTransactions - before == 3, "ISR SPI transactions", i, sim.stats.spiTransactions - before, 3);
+    before = sim.stats.spiTransactions;
+    got = can.SNIFF_ALL(&m);
+    check(got, "received from the ring", i, got, 1);
+    check(sim.stats.spiTransactions == before, "SPI transactions reading the ring", i, sim.stats.spiTransactions - before, 0);
+    if(got)
+      checkFrame(i, m);
+  }
+  can.disableRxInterrupt(INT_PIN);
+
+  printf("test_rxread: %u frames, %u failures\n", (unsigned int)FRAME_COUNT, failures);
+  return failures ? 1 : 0;
+}
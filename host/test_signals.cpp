@@ -0,0 +1,272 @@
+/*
+   This file is included as part of the CANOPNR distribution.
+   You are free to use this project as you see fit, provided credit is given to all
+   contributors (original and subsequent).
+
+   Copyright 2012  Jose Denrie Enriquez, Alex Bautista, Paloma Field, Sun-il Kim
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+  ------------------------------------------------------------------------------------------------------------
+
+  Test of the signal decoders (CANOPNR_Signals.h) against a reference
+  decoder that follows the DBC definition one bit at a time: Intel signals
+  take bits start, start + 1, ... from the LSB up; Motorola signals take
+  bits from start down to bit 0 of each byte, then bit 7 of the next byte.
+
+      make -C host check
+
+  canSignalValue() is checked for every start bit, length and byte order
+  that fits in 4 bytes of an 8-byte frame, signed and unsigned, on random
+  frames. The CANSIGNAL types of CANOPNR_VehicleSignals.h and a few written
+  here, one on a 29-bit ID the way dbc2signals emits it, are checked for
+  value() and match() against the reference and against their SIGNALDEF,
+  on standard, extended, short and remote frames. Prints one line per
+  failed check; the exit status is 1 if any.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "CANOPNR_VehicleSignals.h"
+
+#define FRAMES_PER_LAYOUT 64
+#define FRAMES_PER_TYPE 2000
+
+static unsigned int failures = 0;
+static unsigned long checks = 0;
+static uint32_t seed = 1;
+
+static uint32_t nextRandom()
+{
+  seed = seed * 1664525UL + 1013904223UL;
+  return seed;
+}
+
+static void check(bool ok, const char *sig, const char *what, long got, long want)
+{
+  checks++;
+  if(ok)
+    return;
+  printf("FAIL %s: %s is %ld, expected %ld\n", sig, what, got, want);
+  failures++;
+}
+
+static int frameBit(const byte *data, int pos)
+{
+  return (data[pos / 8] >> (pos % 8)) & 1;
+}
+
+//Reference: the bit positions of the signal, MSB first
+static int refBits(const SIGNALDEF *sig, int *bits)
+{
+  int i, pos;
+
+  if(sig->order == CAN_INTEL)
+  {
+    for(i = 0; i < sig->length; i++)
+      bits[sig->length - 1 - i] = sig->start + i;
+  }
+  else
+  {
+    pos = sig->start;
+    for(i = 0; i < sig->length; i++)
+    {
+      bits[i] = pos;
+      pos = (pos % 8 == 0) ? pos + 15 : pos - 1;
+    }
+  }
+  for(i = 0; i < sig->length; i++)
+    if(bits[i] < 0 || bits[i] > 63)
+      return -1;
+  return 0;
+}
+
+static long long refValue(const SIGNALDEF *sig, const byte *data)
+{
+  int bits[64];
+  long long v;
+  unsigned long long raw = 0;
+  int i;
+
+  refBits(sig, bits);
+  for(i = 0; i < sig->length; i++)
+    raw = (raw << 1) | frameBit(data, bits[i]);
+  v = (long long)raw;
+  if(sig->isSigned && ((raw >> (sig->length - 1)) & 1))
+    v -= 1LL << sig->length;
+  return v * sig->num / sig->den + sig->offset;
+}
+
+static bool refMatch(const SIGNALDEF *sig, const CANMSG *msg, unsigned long id)
+{
+  int bits[64], i;
+
+  if(msg->rtr)
+    return false;
+  if((sig->id & CAN_EXTENDED_ID) != (msg->isExtendedAdrs ? CAN_EXTENDED_ID : 0))
+    return false;
+  if((sig->id & ~CAN_EXTENDED_ID) != id)
+    return false;
+  refBits(sig, bits);
+  for(i = 0; i < sig->length; i++)
+    if(bits[i] / 8 >= msg->dataLength)
+      return false;
+  return true;
+}
+
+//A 29-bit ID is read from the controller as 11 + 18 bits
+static void makeFrame(CANMSG *msg, unsigned long id, bool ext, bool rtr, byte dlc)
+{
+  byte i;
+
+  memset(msg, 0, sizeof(*msg));
+  msg->isExtendedAdrs = ext;
+  msg->adrsValue = ext ? id >> 18 : id;
+  msg->extendedAdrsValue = ext ? id & 0x3FFFF : 0;
+  msg->rtr = rtr;
+  msg->dataLength = dlc;
+  for(i = 0; i < 8; i++)
+    msg->data[i] = nextRandom() >> 24;
+}
+
+//Every layout the decoders accept, unscaled, so the raw bits are compared
+static void checkLayouts(unsigned long *layouts)
+{
+  SIGNALDEF sig;
+  byte data[8];
+  int start, length, order, sign, f, i;
+  char name[48];
+  long got;
+
+  memset(&sig, 0, sizeof(sig));
+  sig.num = sig.den = sig.scale = 1;
+  for(order = 0; order < 2; order++)
+    for(start = 0; start < 64; start++)
+      for(length = 1; length <= 32; length++)
+        for(sign = 0; sign < 2; sign++)
+        {
+          sig.start = start;
+          sig.length = length;
+          sig.order = order ? CAN_INTEL : CAN_MOTOROLA;
+          sig.isSigned = sign;
+          if(canLastByte(start, length, sig.order) > 7 ||
+             canLastByte(start, length, sig.order) - canFirstByte(start) >= 4)
+            continue;
+          (*layouts)++;
+          snprintf(name, sizeof(name), "%s start %d length %d %s", order ? "Intel" : "Motorola",
+                   start, length, sign ? "signed" : "unsigned");
+          for(f = 0; f < FRAMES_PER_LAYOUT; f++)
+          {
+            for(i = 0; i < 8; i++)
+              data[i] = nextRandom() >> 24;
+            got = canSignalValue(&sig, data);
+            //Values are 32-bit: an unsigned 32-bit signal wraps in a long on AVR
+            check((int32_t)got == (int32_t)refValue(&sig, data), name, "canSignalValue", got, (long)refValue(&sig, data));
+          }
+        }
+}
+
+template <typename SIG>
+static void checkType(const SIGNALDEF *def, const CANMSG *frames, const unsigned long *ids, int count)
+{
+  CANMSG msg;
+  unsigned long id;
+  int f;
+
+  check(SIG::id == def->id, def->name, "type ID", SIG::id, def->id);
+  check(SIG::scale == def->scale, def->name, "type scale", SIG::scale, def->scale);
+  for(f = 0; f < count; f++)
+  {
+    check(SIG::match(&frames[f]) == refMatch(def, &frames[f], ids[f]), def->name, "match()",
+          SIG::match(&frames[f]), refMatch(def, &frames[f], ids[f]));
+    check(canSignalMatch(def, &frames[f]) == SIG::match(&frames[f]), def->name, "canSignalMatch",
+          canSignalMatch(def, &frames[f]), SIG::match(&frames[f]));
+  }
+  id = def->id & ~CAN_EXTENDED_ID;
+  for(f = 0; f < FRAMES_PER_TYPE; f++)
+  {
+    makeFrame(&msg, id, (def->id & CAN_EXTENDED_ID) != 0, false, 8);
+    check(SIG::match(&msg), def->name, "match() on its own frame", 0, 1);
+    check(SIG::value(msg.data) == refValue(def, msg.data), def->name, "value()", SIG::value(msg.data), (long)refValue(def, msg.data));
+    check(canSignalValue(def, msg.data) == SIG::value(msg.data), def->name, "canSignalValue", canSignalValue(def, msg.data), SIG::value(msg.data));
+  }
+}
+
+//Written the way dbc2signals writes a 29-bit ID: the type ORs in
+//CAN_EXTENDED_ID, the table has bit 31 set as in the DBC file
+typedef CANSIGNAL<0x18FEF100UL | CAN_EXTENDED_ID, 52, 12, CAN_INTEL, true, 5, 1, -40, 10> SIG_EXT_INTEL;
+typedef CANSIGNAL<0x0CF00400UL | CAN_EXTENDED_ID, 7, 32, CAN_MOTOROLA, true, 1, 1, 0, 1> SIG_EXT_MOTOROLA32;
+typedef CANSIGNAL<0x7E8, 63, 1, CAN_INTEL, false, 1, 1, 0, 1> SIG_TOP_BIT;
+typedef CANSIGNAL<0x7E8, 2, 11, CAN_MOTOROLA, true, 1, 3, 100, 3> SIG_THIRDS;
+static const SIGNALDEF extraDefs[] = {
+  {"EXT_INTEL", 0x98FEF100UL, 52, 12, CAN_INTEL, true, 5, 1, -40, 10},
+  {"EXT_MOTOROLA32", 0x8CF00400UL, 7, 32, CAN_MOTOROLA, true, 1, 1, 0, 1},
+  {"TOP_BIT", 0x7E8UL, 63, 1, CAN_INTEL, false, 1, 1, 0, 1},
+  {"THIRDS", 0x7E8UL, 2, 11, CAN_MOTOROLA, true, 1, 3, 100, 3},
+};
+
+int main()
+{
+  //ID, extended, RTR, DLC
+  static const struct { unsigned long id; bool ext, rtr; byte dlc; } shapes[] = {
+    {0x18FEF100UL, true, false, 8},
+    {0x18FEF100UL, true, false, 7},
+    {0x18FEF100UL, true, true, 8},
+    {0x00FEF100UL, true, false, 8},    //same low 18 bits, other top 11
+    {0x18FEF101UL, true, false, 8},
+    {0x18FEF100UL >> 18, false, false, 8},
+    {0x0CF00400UL, true, false, 8},
+    {0x0CF00400UL, true, false, 4},
+    {0x513, false, false, 8},
+    {0x513, false, false, 7},
+    {0x513, false, true, 8},
+    {0x513UL << 18, true, false, 8},   //top 11 bits are 0x513
+    {0x513, true, false, 8},
+    {0x410, false, false, 5},
+    {0x410, false, false, 4},
+    {0x511, false, false, 8},
+    {0x7E8, false, false, 8},
+    {0x7E8, false, false, 7},
+    {0x7E8, false, false, 2},
+  };
+  const int count = sizeof(shapes) / sizeof(shapes[0]);
+  CANMSG frames[sizeof(shapes) / sizeof(shapes[0])];
+  unsigned long ids[sizeof(shapes) / sizeof(shapes[0])];
+  unsigned long layouts = 0;
+  int i;
+
+  for(i = 0; i < count; i++)
+  {
+    makeFrame(&frames[i], shapes[i].id, shapes[i].ext, shapes[i].rtr, shapes[i].dlc);
+    ids[i] = shapes[i].id;
+  }
+
+  checkLayouts(&layouts);
+
+  checkType<SIG_ACCELERATOR_PEDAL>(&CAN_SIGNALS[0], frames, ids, count);
+  checkType<SIG_BRAKE_PRESSURE>(&CAN_SIGNALS[1], frames, ids, count);
+  checkType<SIG_WHEEL_SPEED0>(&CAN_SIGNALS[2], frames, ids, count);
+  checkType<SIG_WHEEL_SPEED1>(&CAN_SIGNALS[3], frames, ids, count);
+  checkType<SIG_WHEEL_SPEED2>(&CAN_SIGNALS[4], frames, ids, count);
+  checkType<SIG_WHEEL_SPEED3>(&CAN_SIGNALS[5], frames, ids, count);
+  checkType<SIG_EXT_INTEL>(&extraDefs[0], frames, ids, count);
+  checkType<SIG_EXT_MOTOROLA32>(&extraDefs[1], frames, ids, count);
+  checkType<SIG_TOP_BIT>(&extraDefs[2], frames, ids, count);
+  checkType<SIG_THIRDS>(&extraDefs[3], frames, ids, count);
+
+  //A J1939-style 29-bit ID reaches its signal
+  check(SIG_EXT_INTEL::match(&frames[0]), "EXT_INTEL", "match() on 0x18FEF100", 0, 1);
+
+  printf("test_signals: %lu layouts, %lu checks, %u failures\n", layouts, checks, failures);
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,301 @@
+/*
+   This file is included as part of the CANOPNR distribution.
+   You are free to use this project as you see fit, provided credit is given to all
+   contributors (original and subsequent).
+
+   Copyright 2012  Jose Denrie Enriquez, Alex Bautista, Paloma Field, Sun-il Kim
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+  ------------------------------------------------------------------------------------------------------------
+
+  Round-trip test of the telemetry record (CANOPNR_Telemetry.h): records
+  encoded with telemetryEncode() come back field for field from
+  telemetryDecode(), with the length and byte offsets the layout table
+  gives.
+
+      make -C host check
+
+  The records are all zeros, every field at its largest value, every
+  signed field at its most negative, and pseudo-random ones with 0 to
+  TELEMETRY_SLIP_EVENTS slip events. Also checks the limits:
+  - more events than fit are cut to TELEMETRY_SLIP_EVENTS;
+  - a buffer one byte short is refused;
+  - a truncated record, an event count above the limit, a wrong magic
+    and any other version byte are all rejected.
+  Prints one line per failed check; the exit status is 1 if any.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "CANOPNR_Telemetry.h"
+
+#define RANDOM_RECORDS 10000
+
+static unsigned int failures = 0;
+static uint32_t seed = 1;
+
+static void check(bool ok, const char *what, unsigned long record, unsigned long got, unsigned long want)
+{
+  if(ok)
+    return;
+  printf("FAIL record %lu: %s is 0x%lX, expected 0x%lX\n", record, what, got, want);
+  failures++;
+}
+
+static uint32_t nextRandom()
+{
+  seed = seed * 1664525UL + 1013904223UL;
+  return seed;
+}
+
+static void fill(TELEMETRY *rec, uint8_t byteVal, uint16_t signed16, uint32_t signed32)
+{
+  uint8_t i;
+
+  memset(rec, 0, sizeof(*rec));
+  rec->controllerId = (int16_t)signed16;
+  rec->sequence = byteVal * 0x0101;
+  rec->timestamp = byteVal * 0x01010101UL;
+  rec->present = byteVal * 0x01010101UL;
+  rec->utc.seconds = byteVal * 0x01010101UL;
+  rec->utc.micros = byteVal * 0x01010101UL;
+  rec->clockRate = (int16_t)signed16;
+  rec->gps.timeMs = byteVal * 0x01010101UL;
+  rec->gps.days = byteVal * 0x0101;
+  rec->gps.lat = (int32_t)signed32;
+  rec->gps.lon = (int32_t)signed32;
+  rec->gps.speed = byteVal * 0x0101;
+  rec->gps.course = byteVal * 0x0101;
+  rec->accelerator = byteVal;
+  rec->csq = byteVal;
+  for(i = 0; i < TELEMETRY_OBD_COUNT; i++)
+  {
+    rec->obd[i][0] = rec->obd[i][1] = byteVal;
+    rec->obdTime[i] = (int16_t)signed16;
+  }
+  rec->slip.frames = byteVal * 0x0101;
+  rec->slip.speed = byteVal * 0x0101;
+  for(i = 0; i < SLIP_WHEELS; i++)
+    rec->slip.mean[i] = rec->slip.peak[i] = (int16_t)signed16;
+  rec->brake = byteVal;
+  rec->eventCount = TELEMETRY_SLIP_EVENTS;
+  for(i = 0; i < TELEMETRY_SLIP_EVENTS; i++)
+  {
+    rec->events[i].start = (int16_t)signed16;
+    rec->events[i].duration = byteVal * 0x0101;
+    rec->events[i].wheel = byteVal;
+    rec->events[i].peak = (int16_t)signed16;
+    rec->events[i].speed = byteVal * 0x0101;
+    rec->events[i].brake = byteVal;
+  }
+}
+
+static void randomFill(TELEMETRY *rec)
+{
+  uint8_t i;
+
+  memset(rec, 0, sizeof(*rec));
+  rec->controllerId = (int16_t)nextRandom();
+  rec->sequence = nextRandom();
+  rec->timestamp = nextRandom();
+  rec->present = nextRandom();
+  rec->utc.seconds = nextRandom();
+  rec->utc.micros = nextRandom() % 1000000;
+  rec->clockRate = (int16_t)nextRandom();
+  rec->gps.timeMs = nextRandom();
+  rec->gps.days = nextRandom();
+  rec->gps.lat = (int32_t)nextRandom();
+  rec->gps.lon = (int32_t)nextRandom();
+  rec->gps.speed = nextRandom();
+  rec->gps.course = nextRandom();
+  rec->accelerator = nextRandom();
+  rec->csq = nextRandom();
+  for(i = 0; i < TELEMETRY_OBD_COUNT; i++)
+  {
+    rec->obd[i][0] = nextRandom();
+    rec->obd[i][1] = nextRandom();
+    rec->obdTime[i] = (int16_t)nextRandom();
+  }
+  rec->slip.frames = nextRandom();
+  rec->slip.speed = nextRandom();
+  for(i = 0; i < SLIP_WHEELS; i++)
+  {
+    rec->slip.mean[i] = (int16_t)nextRandom();
+    rec->slip.peak[i] = (int16_t)nextRandom();
+  }
+  rec->brake = nextRandom();
+  rec->eventCount = (nextRandom() >> 8) % (TELEMETRY_SLIP_EVENTS + 1);
+  for(i = 0; i < rec->eventCount; i++)
+  {
+    rec->events[i].start = (int16_t)nextRandom();
+    rec->events[i].duration = nextRandom();
+    rec->events[i].wheel = nextRandom() % SLIP_WHEELS;
+    rec->events[i].peak = (int16_t)nextRandom();
+    rec->events[i].speed = nextRandom();
+    rec->events[i].brake = nextRandom();
+  }
+}
+
+//The fields a record carries; the rest of GPSFIX is not sent
+static void compare(unsigned long r, const TELEMETRY *in, const TELEMETRY *out)
+{
+  uint8_t i;
+
+  check(out->controllerId == in->controllerId, "controller ID", r, out->controllerId, in->controllerId);
+  check(out->sequence == in->sequence, "sequence", r, out->sequence, in->sequence);
+  check(out->timestamp == in->timestamp, "timestamp", r, out->timestamp, in->timestamp);
+  check(out->present == in->present, "presence bitmap", r, out->present, in->present);
+  check(out->utc.seconds == in->utc.seconds, "UTC seconds", r, out->utc.seconds, in->utc.seconds);
+  check(out->utc.micros == in->utc.micros, "UTC microseconds", r, out->utc.micros, in->utc.micros);
+  check(out->clockRate == in->clockRate, "clock rate", r, out->clockRate, in->clockRate);
+  check(out->gps.valid == ((in->present >> TELEMETRY_HAS_GPS) & 1), "GPS valid", r, out->gps.valid, (in->present >> TELEMETRY_HAS_GPS) & 1);
+  check(out->gps.timeMs == in->gps.timeMs, "GPS time", r, out->gps.timeMs, in->gps.timeMs);
+  check(out->gps.days == in->gps.days, "GPS date", r, out->gps.days, in->gps.days);
+  check(out->gps.lat == in->gps.lat, "latitude", r, out->gps.lat, in->gps.lat);
+  check(out->gps.lon == in->gps.lon, "longitude", r, out->gps.lon, in->gps.lon);
+  check(out->gps.speed == in->gps.speed, "GPS speed", r, out->gps.speed, in->gps.speed);
+  check(out->gps.course == in->gps.course, "GPS course", r, out->gps.course, in->gps.course);
+  check(out->accelerator == in->accelerator, "accelerator", r, out->accelerator, in->accelerator);
+  check(out->csq == in->csq, "signal quality", r, out->csq, in->csq);
+  for(i = 0; i < TELEMETRY_OBD_COUNT; i++)
+  {
+    check(out->obd[i][0] == in->obd[i][0] && out->obd[i][1] == in->obd[i][1], "OBD A,B", r, i, i);
+    check(out->obdTime[i] == in->obdTime[i], "OBD reply time", r, out->obdTime[i], in->obdTime[i]);
+  }
+  check(out->slip.frames == in->slip.frames, "0x513 frames", r, out->slip.frames, in->slip.frames);
+  check(out->slip.speed == in->slip.speed, "reference speed", r, out->slip.speed, in->slip.speed);
+  for(i = 0; i < SLIP_WHEELS; i++)
+  {
+    check(out->slip.mean[i] == in->slip.mean[i], "mean slip", r, out->slip.mean[i], in->slip.mean[i]);
+    check(out->slip.peak[i] == in->slip.peak[i], "peak slip", r, out->slip.peak[i], in->slip.peak[i]);
+  }
+  check(out->brake == in->brake, "brake", r, out->brake, in->brake);
+  check(out->eventCount == in->eventCount, "event count", r, out->eventCount, in->eventCount);
+  for(i = 0; i < in->eventCount && i < TELEMETRY_SLIP_EVENTS; i++)
+  {
+    check(out->events[i].start == in->events[i].start, "event start", r, out->events[i].start, in->events[i].start);
+    check(out->events[i].duration == in->events[i].duration, "event duration", r, out->events[i].duration, in->events[i].duration);
+    check(out->events[i].wheel == in->events[i].wheel, "event wheel", r, out->events[i].wheel, in->events[i].wheel);
+    check(out->events[i].peak == in->events[i].peak, "event peak", r, out->events[i].peak, in->events[i].peak);
+    check(out->events[i].speed == in->events[i].speed, "event speed", r, out->events[i].speed, in->events[i].speed);
+    check(out->events[i].brake == in->events[i].brake, "event brake", r, out->events[i].brake, in->events[i].brake);
+  }
+}
+
+static void roundTrip(unsigned long r, const TELEMETRY *in)
+{
+  uint8_t buf[TELEMETRY_MAX_SIZE];
+  TELEMETRY out;
+  uint16_t len, want, used;
+
+  want = TELEMETRY_HEADER_SIZE + in->eventCount * TELEMETRY_EVENT_SIZE;
+  len = telemetryEncode(in, buf, sizeof(buf));
+  check(len == want, "encoded length", r, len, want);
+  if(len != want)
+    return;
+  check(buf[0] == TELEMETRY_MAGIC, "magic byte", r, buf[0], TELEMETRY_MAGIC);
+  check(buf[1] == TELEMETRY_VERSION, "version byte", r, buf[1], TELEMETRY_VERSION);
+  check(buf[TELEMETRY_HEADER_SIZE - 1] == in->eventCount, "count byte", r, buf[TELEMETRY_HEADER_SIZE - 1], in->eventCount);
+  used = telemetryDecode(buf, len, &out);
+  check(used == len, "decoded length", r, used, len);
+  if(used == len)
+    compare(r, in, &out);
+}
+
+int main()
+{
+  uint8_t buf[TELEMETRY_MAX_SIZE + 1];
+  TELEMETRY in, out;
+  unsigned long r = 0;
+  uint16_t len;
+  unsigned int v;
+
+  //Limits
+  fill(&in, 0, 0, 0);
+  in.eventCount = 0;
+  roundTrip(r++, &in);
+  fill(&in, 0xFF, 0x7FFF, 0x7FFFFFFFUL);
+  roundTrip(r++, &in);
+  fill(&in, 0xFF, 0xFFFF, 0xFFFFFFFFUL);
+  roundTrip(r++, &in);
+  fill(&in, 0x80, 0x8000, 0x80000000UL);
+  roundTrip(r++, &in);
+  for(; r < RANDOM_RECORDS; r++)
+  {
+    randomFill(&in);
+    roundTrip(r, &in);
+  }
+
+  //Byte offsets from the layout table, little-endian
+  fill(&in, 0, 0, 0);
+  in.controllerId = 0x0201;
+  in.timestamp = 0x06050403UL;
+  in.gps.lat = 0x24232221L;
+  in.obd[0][0] = 0xA0;
+  in.obdTime[0] = 0x0B0A;
+  in.slip.frames = 0x4D4C;
+  in.brake = 0x60;
+  in.eventCount = 1;
+  in.events[0].start = 0x7170;
+  len = telemetryEncode(&in, buf, sizeof(buf));
+  check(buf[2] == 0x01 && buf[3] == 0x02, "controller ID at 2", r, buf[2], 0x01);
+  check(buf[6] == 0x03 && buf[9] == 0x06, "timestamp at 6", r, buf[6], 0x03);
+  check(buf[30] == 0x21 && buf[33] == 0x24, "latitude at 30", r, buf[30], 0x21);
+  check(buf[44] == 0xA0, "OBD A at 44", r, buf[44], 0xA0);
+  check(buf[60] == 0x0A && buf[61] == 0x0B, "OBD reply time at 60", r, buf[60], 0x0A);
+  check(buf[76] == 0x4C && buf[77] == 0x4D, "0x513 frames at 76", r, buf[76], 0x4C);
+  check(buf[96] == 0x60, "brake at 96", r, buf[96], 0x60);
+  check(buf[98] == 0x70 && buf[99] == 0x71, "first event at 98", r, buf[98], 0x70);
+  r++;
+
+  //More events than the record holds are cut, not overrun
+  fill(&in, 0x5A, 0x1234, 0x12345678UL);
+  in.eventCount = TELEMETRY_SLIP_EVENTS + 3;
+  len = telemetryEncode(&in, buf, sizeof(buf));
+  check(len == TELEMETRY_MAX_SIZE, "length with too many events", r, len, TELEMETRY_MAX_SIZE);
+  check(buf[TELEMETRY_HEADER_SIZE - 1] == TELEMETRY_SLIP_EVENTS, "count byte with too many events", r, buf[TELEMETRY_HEADER_SIZE - 1], TELEMETRY_SLIP_EVENTS);
+  check(telemetryDecode(buf, len, &out) == len && out.eventCount == TELEMETRY_SLIP_EVENTS, "decoded event count", r, out.eventCount, TELEMETRY_SLIP_EVENTS);
+  r++;
+
+  //Buffers and records that are too short
+  in.eventCount = 2;
+  len = TELEMETRY_HEADER_SIZE + 2 * TELEMETRY_EVENT_SIZE;
+  check(telemetryEncode(&in, buf, len - 1) == 0, "encode into a short buffer", r, 1, 0);
+  check(telemetryEncode(&in, buf, len) == len, "encode into an exact buffer", r, 0, len);
+  check(telemetryDecode(buf, len - 1, &out) == 0, "decode of a truncated record", r, 1, 0);
+  check(telemetryDecode(buf, TELEMETRY_HEADER_SIZE - 1, &out) == 0, "decode of a truncated header", r, 1, 0);
+  check(telemetryDecode(buf, len + 1, &out) == len, "decode with a byte to spare", r, 0, len);
+
+  //An event count no encoder writes
+  buf[TELEMETRY_HEADER_SIZE - 1] = TELEMETRY_SLIP_EVENTS + 1;
+  check(telemetryDecode(buf, sizeof(buf), &out) == 0, "decode with too many events", r, 1, 0);
+  buf[TELEMETRY_HEADER_SIZE - 1] = 2;
+
+  //Only this version, and only after the magic
+  for(v = 0; v < 0x100; v++)
+  {
+    buf[1] = v;
+    if(v == TELEMETRY_VERSION)
+      check(telemetryDecode(buf, len, &out) == len, "decode of the current version", r, v, TELEMETRY_VERSION);
+    else if(telemetryDecode(buf, len, &out) != 0)
+      check(false, "decode of another version", r, v, TELEMETRY_VERSION);
+  }
+  buf[1] = TELEMETRY_VERSION;
+  buf[0] = TELEMETRY_MAGIC ^ 0xFF;
+  check(telemetryDecode(buf, len, &out) == 0, "decode with a wrong magic", r, buf[0], TELEMETRY_MAGIC);
+  r++;
+
+  printf("test_telemetry: %lu records, %u failures\n", r, failures);
+  return failures ? 1 : 0;
+}
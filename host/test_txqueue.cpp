@@ -0,0 +1,139 @@
+/*
+   This file is included as part of the CANOPNR distribution.
+   You are free to use this project as you see fit, provided credit is given to all
+   contributors (original and subsequent).
+
+   Copyright 2012  Jose Denrie Enriquez, Alex Bautista, Paloma Field, Sun-il Kim
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+  ------------------------------------------------------------------------------------------------------------
+
+  Test of the transmit queue on the simulated MCP2515: frames that find all
+  three TX buffers busy wait in MCP2515's software queue in priority order,
+  first come first served within a priority, and serviceTX() hands them to
+  the controller highest priority first. A full queue refuses the frame,
+  and CANChannels::serviceTX() costs no SPI traffic while nothing waits.
+
+      make -C host check
+
+  The three buffers are held busy by running the bus at a bitrate the
+  controller isn't set to, so nothing is acknowledged, and released by
+  putting the bus back. Prints one line per failed check; the exit status
+  is 1 if any.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include "Arduino.h"
+#include "MCP2515Sim.h"
+#include "CANOPNR_MCP2515.h"
+
+#define CS_PIN 10
+#define INT_PIN 2
+#define FILLER_ID 0x100
+
+//Queued in this order; they should reach the bus as 0x201, 0x203, 0x202, 0x200
+static const struct { unsigned short id; byte priority; } queued[] = {
+  {0x200, 0},
+  {0x201, 3},
+  {0x202, 2},
+  {0x203, 3},
+};
+#define QUEUED_COUNT (sizeof(queued) / sizeof(queued[0]))
+static const unsigned short expected[QUEUED_COUNT] = {0x201, 0x203, 0x202, 0x200};
+
+static std::vector<unsigned short> sent;
+static unsigned int failures = 0;
+
+static void check(bool ok, const char *what, unsigned long got, unsigned long want)
+{
+  if(ok)
+    return;
+  printf("FAIL %s is 0x%lX, expected 0x%lX\n", what, got, want);
+  failures++;
+}
+
+static void onTransmit(const SimFrame &f, uint64_t)
+{
+  if(f.id != FILLER_ID)
+    sent.push_back((unsigned short)f.id);
+}
+
+static void frame(CANMSG *msg, unsigned short id)
+{
+  memset(msg, 0, sizeof(*msg));
+  msg->adrsValue = id;
+  msg->dataLength = 1;
+  msg->data[0] = (byte)id;
+}
+
+int main()
+{
+  MCP2515Sim sim;
+  MCP2515 can(CS_PIN);
+  CANChannels buses;
+  unsigned long before;
+  unsigned int i;
+  CANMSG msg;
+  bool ok;
+
+  sim.onTransmit = onTransmit;
+  simAttach(&sim, CS_PIN, INT_PIN);
+  if(!can.initCAN(CAN_BAUD_500K) || !can.setCANNormalMode() || buses.add(&can) < 0)
+  {
+    printf("FAIL controller setup\n");
+    return 1;
+  }
+
+  before = sim.stats.spiTransactions;
+  buses.serviceTX();
+  check(sim.stats.spiTransactions == before, "SPI transactions for an empty queue", sim.stats.spiTransactions - before, 0);
+
+  //Nobody on the bus acknowledges, so the fillers keep every buffer busy
+  sim.setBusBitrate(250000);
+  frame(&msg, FILLER_ID);
+  for(i = 0; i < 3; i++)
+    check(can.queueCANMessage(&msg, 0), "filler loaded", 0, 1);
+  check(can.txPending() == 0, "frames queued after the fillers", can.txPending(), 0);
+
+  for(i = 0; i < QUEUED_COUNT; i++)
+  {
+    frame(&msg, queued[i].id);
+    ok = can.queueCANMessage(&msg, queued[i].priority);
+    check(ok, "frame queued", queued[i].id, 1);
+  }
+  frame(&msg, 0x2FF);
+  check(!can.queueCANMessage(&msg, 3), "frame queued on a full queue", 1, 0);
+  check(can.txPending() == QUEUED_COUNT, "frames queued", can.txPending(), QUEUED_COUNT);
+
+  sim.setBusBitrate(500000);
+  for(i = 0; i < 1000 && (can.txPending() > 0 || sent.size() < QUEUED_COUNT); i++)
+  {
+    buses.serviceTX();
+    delayMicroseconds(50);
+  }
+  delay(5);
+
+  check(sent.size() == QUEUED_COUNT, "frames sent", sent.size(), QUEUED_COUNT);
+  for(i = 0; i < QUEUED_COUNT && i < sent.size(); i++)
+    check(sent[i] == expected[i], "frame sent in this place", sent[i], expected[i]);
+
+  before = sim.stats.spiTransactions;
+  buses.serviceTX();
+  check(sim.stats.spiTransactions == before, "SPI transactions for an empty queue", sim.stats.spiTransactions - before, 0);
+
+  printf("test_txqueue: %u frames, %u failures\n", (unsigned int)QUEUED_COUNT, failures);
+  return failures ? 1 : 0;
+}